@@ -29,6 +29,7 @@
 #include "sim_elf.h"
 #include "sim_gdb.h"
 #include "sim_vcd_file.h"
+#include "sim_mailbox.h"
 
 #if __APPLE__
 #include <GLUT/glut.h>
@@ -48,6 +49,16 @@ avr_t * avr = NULL;
 avr_vcd_t vcd_file;
 ac_input_t ac_input;
 hd44780_t hd44780;
+/*
+ * The keys are handled on the GLUT thread, the AVR runs on its own; what
+ * they do to the AVR goes through its mailbox, as these IRQs
+ */
+enum {
+	KEY_QUIT = 0,
+	KEY_VCD,	// 1 to start, 0 to stop
+	KEY_COUNT
+};
+avr_irq_t * keys;
 
 int color = 0;
 uint32_t colors[][4] = {
@@ -70,16 +81,34 @@ void keyCB(
 {
 	switch (key) {
 		case 'q':
-			avr_vcd_stop(&vcd_file);
-			exit(0);
+			avr_mailbox_post(avr, keys + KEY_QUIT, 1, 0);
 			break;
 		case 'r':
-			printf("Starting VCD trace; press 's' to stop\n");
-			avr_vcd_start(&vcd_file);
+			avr_mailbox_post(avr, keys + KEY_VCD, 1, 0);
 			break;
 		case 's':
-			printf("Stopping VCD trace\n");
+			avr_mailbox_post(avr, keys + KEY_VCD, 0, 0);
+			break;
+	}
+}
+
+// the keys, back on the AVR thread
+void key_hook(
+		struct avr_irq_t * irq, uint32_t value, void * param)
+{
+	switch (irq->irq) {
+		case KEY_QUIT:
 			avr_vcd_stop(&vcd_file);
+			exit(0);
+			break;
+		case KEY_VCD:
+			if (value) {
+				printf("Starting VCD trace; press 's' to stop\n");
+				avr_vcd_start(&vcd_file);
+			} else {
+				printf("Stopping VCD trace\n");
+				avr_vcd_stop(&vcd_file);
+			}
 			break;
 	}
 }
@@ -189,6 +218,11 @@ main(
 			hd44780.irq + IRQ_HD44780_RW);
 
 
+	static const char * key_names[KEY_COUNT] = { "key.quit", "key.vcd" };
+	keys = avr_alloc_irq(&avr->irq_pool, 0, KEY_COUNT, key_names);
+	for (int i = 0; i < KEY_COUNT; i++)
+		avr_irq_register_notify(keys + i, key_hook, NULL);
+
 	avr_vcd_init(avr, "gtkwave_output.vcd", &vcd_file, 10 /* usec */);
 	avr_vcd_add_signal(&vcd_file,
 			avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), IOPORT_IRQ_PIN_ALL),
@@ -34,12 +34,22 @@
 #include "sim_elf.h"
 #include "sim_gdb.h"
 #include "sim_vcd_file.h"
+#include "sim_mailbox.h"
 
 #include "button.h"
 
 button_t button;
-int do_button_press = 0;
 avr_t * avr = NULL;
+/*
+ * The keys are handled on the GLUT thread, the AVR runs on its own; what
+ * they do to the AVR goes through its mailbox, as these IRQs
+ */
+enum {
+	KEY_BUTTON = 0,
+	KEY_VCD,	// 1 to start, 0 to stop
+	KEY_COUNT
+};
+avr_irq_t * keys;
 avr_vcd_t vcd_file;
 uint8_t	pin_state = 0;	// current port B
 
@@ -97,15 +107,33 @@ void keyCB(unsigned char key, int x, int y)	/* called on key press */
 			exit(0);
 			break;
 		case ' ':
-			do_button_press++; // pass the message to the AVR thread
+			avr_mailbox_post(avr, keys + KEY_BUTTON, 1, 0);
 			break;
 		case 'r':
-			printf("Starting VCD trace\n");
-			avr_vcd_start(&vcd_file);
+			avr_mailbox_post(avr, keys + KEY_VCD, 1, 0);
 			break;
 		case 's':
-			printf("Stopping VCD trace\n");
-			avr_vcd_stop(&vcd_file);
+			avr_mailbox_post(avr, keys + KEY_VCD, 0, 0);
+			break;
+	}
+}
+
+// the keys, back on the AVR thread
+void key_hook(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+	switch (irq->irq) {
+		case KEY_BUTTON:
+			printf("Button pressed\n");
+			button_press(&button, 1000000);
+			break;
+		case KEY_VCD:
+			if (value) {
+				printf("Starting VCD trace\n");
+				avr_vcd_start(&vcd_file);
+			} else {
+				printf("Stopping VCD trace\n");
+				avr_vcd_stop(&vcd_file);
+			}
 			break;
 	}
 }
@@ -125,16 +153,8 @@ void timerCB(int i)
 
 static void * avr_run_thread(void * oaram)
 {
-	int b_press = do_button_press;
-	
-	while (1) {
+	while (1)
 		avr_run(avr);
-		if (do_button_press != b_press) {
-			b_press = do_button_press;
-			printf("Button pressed\n");
-			button_press(&button, 1000000);
-		}
-	}
 	return NULL;
 }
 
@@ -161,6 +181,10 @@ int main(int argc, char *argv[])
 
 	// initialize our 'peripheral'
 	button_init(avr, &button, "button");
+	static const char * key_names[KEY_COUNT] = { "key.button", "key.vcd" };
+	keys = avr_alloc_irq(&avr->irq_pool, 0, KEY_COUNT, key_names);
+	for (int i = 0; i < KEY_COUNT; i++)
+		avr_irq_register_notify(keys + i, key_hook, NULL);
 	// "connect" the output irw of the button to the port pin of the AVR
 	avr_connect_irq(
 		button.irq + IRQ_BUTTON_OUT,
@@ -19,7 +19,6 @@
 	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <sys/mman.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -43,69 +42,24 @@ avr_t * avr = NULL;
 avr_vcd_t vcd_file;
 
 
-struct avr_flash {
-	char avr_flash_path[1024];
-	int avr_flash_fd;
-};
-
-// avr special flash initalization
-// here: open and map a file to enable a persistent storage for the flash memory
-void avr_special_init( avr_t* avr, void *data)
-{
-	struct avr_flash *flash_data = (struct avr_flash *)data;
-	//puts(" --=== INIT CALLED ===--");
-	// release flash memory if allocated
-	if(avr->flash) free(avr->flash);
-	// open the file
-	flash_data->avr_flash_fd = open(flash_data->avr_flash_path,
-            O_RDWR|O_CREAT, 0644);
-	if (flash_data->avr_flash_fd < 0) {
-		perror(flash_data->avr_flash_path);
-		exit(1);
-	}
-	// resize and map the file the file
-	(void)ftruncate(flash_data->avr_flash_fd, avr->flashend + 1);
-	avr->flash = (uint8_t*)mmap(NULL, avr->flashend + 1, // 32k is multiple of 4096
-            PROT_READ|PROT_WRITE, MAP_SHARED, flash_data->avr_flash_fd, 0);
-	if (!avr->flash) {
-		fprintf(stderr, "unable to map memory\n");
-		perror(flash_data->avr_flash_path);
-		exit(1);
-	}
-}
-
-// avr special flash deinitalization
-// here: cleanup the persistent storage
-void avr_special_deinit( avr_t* avr, void *data)
-{
-	struct avr_flash *flash_data = (struct avr_flash *)data;
-	//puts(" --=== DEINIT CALLED ===--");
-	// unmap and close the file
-	munmap( avr->flash, avr->flashend + 1);
-	close(flash_data->avr_flash_fd);
-	// signal that cleanup is done
-	avr->flash = NULL;
-}
-
 int main(int argc, char *argv[])
 {
 //		elf_firmware_t f;
 	const char * pwd = dirname(argv[0]);
-	struct avr_flash flash_data;
 
 	avr = avr_make_mcu_by_name("at90usb162");
 	if (!avr) {
 		fprintf(stderr, "%s: Error creating the AVR core\n", argv[0]);
 		exit(1);
 	}
-	strcpy(flash_data->avr_flash_path,  "simusb_flash.bin");
-	flash_data->avr_flash_fd = 0;
-	// register our own functions
-	avr->special_init = avr_special_init;
-	avr->special_deinit = avr_special_deinit;
-	avr->special_data = &flash_data;
+	// open and map a file to enable a persistent storage for the flash memory
+	avr->flash_file = "simusb_flash.bin";
 	//avr->reset = NULL;
 	avr_init(avr);
+	if (!avr->flash_map) {
+		fprintf(stderr, "%s: Unable to map %s\n", argv[0], avr->flash_file);
+		exit(1);
+	}
 	avr->frequency = 8000000;
 
 	// this trick creates a file that contains /and keep/ the flash
@@ -0,0 +1,475 @@
+/*
+	io_hub.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include "io_hub.h"
+#include "sim_time.h"
+#include "sim_mailbox.h"
+
+DEFINE_FIFO(uint8_t, io_hub_fifo);
+
+static struct {
+	pthread_once_t	once;
+	pthread_mutex_t	lock;		// the list, and the 'ready' calls
+	pthread_t		thread;
+	int				wake[2];	// the same eventfd twice, or a pipe
+#ifdef __linux__
+	int				ep;
+#endif
+	io_hub_fd_t *	fds;
+} hub = { .once = PTHREAD_ONCE_INIT, .wake = { -1, -1 } };
+
+static void
+io_hub_wake(void)
+{
+	uint64_t one = 1;
+#ifdef __linux__
+	ssize_t r = write(hub.wake[1], &one, sizeof(one));
+#else
+	ssize_t r = write(hub.wake[1], &one, 1);
+#endif
+	(void)r;
+}
+
+static int
+io_hub_watched(
+		io_hub_fd_t * h)
+{
+	for (io_hub_fd_t * w = hub.fds; w; w = w->next)
+		if (w == h)
+			return 1;
+	return 0;
+}
+
+/*
+ * Calls the ones that were kicked, with the lock held. 'ready' can unwatch
+ * anything, so it starts over after each of them; it shouldn't kick itself.
+ */
+static void
+io_hub_kicks(void)
+{
+	uint64_t c;
+	while (read(hub.wake[0], &c, sizeof(c)) > 0)
+		;
+	io_hub_fd_t * h = hub.fds;
+	while (h) {
+		if (h->kicked) {
+			__sync_lock_release(&h->kicked);
+			h->ready(h, IO_HUB_KICK);
+			h = hub.fds;
+		} else
+			h = h->next;
+	}
+}
+
+#ifdef __linux__
+static uint32_t
+io_hub_events(
+		uint32_t want)
+{
+	return (want & IO_HUB_READ ? EPOLLIN : 0) |
+			(want & IO_HUB_WRITE ? EPOLLOUT : 0);
+}
+
+static void *
+io_hub_thread(
+		void * param)
+{
+	struct epoll_event ev[32];
+
+	while (1) {
+		int n = epoll_wait(hub.ep, ev, 32, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(__func__);
+			break;
+		}
+		int kicks = 0;
+		pthread_mutex_lock(&hub.lock);
+		for (int i = 0; i < n; i++) {
+			io_hub_fd_t * h = ev[i].data.ptr;
+			if (!h) {
+				kicks++;
+				continue;
+			}
+			// it might have been unwatched since
+			if (!io_hub_watched(h))
+				continue;
+			uint32_t what = 0;
+			if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				what |= IO_HUB_READ;
+			if (ev[i].events & EPOLLOUT)
+				what |= IO_HUB_WRITE;
+			h->ready(h, what);
+		}
+		if (kicks)
+			io_hub_kicks();
+		pthread_mutex_unlock(&hub.lock);
+	}
+	return NULL;
+}
+#else
+/*
+ * No epoll, the list of descriptors is made again every time; the pipe
+ * tells it changed, as well as about the kicks.
+ */
+static void *
+io_hub_thread(
+		void * param)
+{
+	while (1) {
+		pthread_mutex_lock(&hub.lock);
+		int count = 1;
+		for (io_hub_fd_t * h = hub.fds; h; h = h->next)
+			count++;
+		struct pollfd pfd[count];
+		io_hub_fd_t * hfd[count];
+		pfd[0] = (struct pollfd) { .fd = hub.wake[0], .events = POLLIN };
+		count = 1;
+		for (io_hub_fd_t * h = hub.fds; h; h = h->next, count++) {
+			hfd[count] = h;
+			pfd[count] = (struct pollfd) { .fd = h->fd,
+				.events = (h->want & IO_HUB_READ ? POLLIN : 0) |
+							(h->want & IO_HUB_WRITE ? POLLOUT : 0) };
+		}
+		pthread_mutex_unlock(&hub.lock);
+
+		int n = poll(pfd, count, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(__func__);
+			break;
+		}
+		pthread_mutex_lock(&hub.lock);
+		for (int i = 1; i < count; i++) {
+			if (!pfd[i].revents || !io_hub_watched(hfd[i]))
+				continue;
+			uint32_t what = 0;
+			if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+				what |= IO_HUB_READ;
+			if (pfd[i].revents & POLLOUT)
+				what |= IO_HUB_WRITE;
+			hfd[i]->ready(hfd[i], what);
+		}
+		if (pfd[0].revents)
+			io_hub_kicks();
+		pthread_mutex_unlock(&hub.lock);
+	}
+	return NULL;
+}
+#endif
+
+static void
+io_hub_start(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	// so 'ready' can watch and unwatch
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&hub.lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+#ifdef __linux__
+	hub.ep = epoll_create1(EPOLL_CLOEXEC);
+	if (hub.ep < 0) {
+		fprintf(stderr, "%s: Can't create epoll: %s\n", __func__, strerror(errno));
+		return;
+	}
+	int e = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (e < 0) {
+		fprintf(stderr, "%s: Can't create eventfd: %s\n", __func__, strerror(errno));
+		return;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(hub.ep, EPOLL_CTL_ADD, e, &ev);
+	hub.wake[0] = hub.wake[1] = e;
+#else
+	int w[2];
+	if (pipe(w)) {
+		fprintf(stderr, "%s: Can't create pipe: %s\n", __func__, strerror(errno));
+		return;
+	}
+	for (int i = 0; i < 2; i++)
+		fcntl(w[i], F_SETFL, fcntl(w[i], F_GETFL) | O_NONBLOCK);
+	hub.wake[0] = w[0];
+	hub.wake[1] = w[1];
+#endif
+	// signals are for the simulator's thread
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_create(&hub.thread, NULL, io_hub_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+int
+io_hub_watch(
+		io_hub_fd_t * h)
+{
+	pthread_once(&hub.once, io_hub_start);
+	if (hub.wake[0] < 0)
+		return -1;
+
+	int res = 0;
+	pthread_mutex_lock(&hub.lock);
+	h->kicked = 0;
+	h->next = hub.fds;
+	hub.fds = h;
+#ifdef __linux__
+	struct epoll_event ev = { .events = io_hub_events(h->want), .data.ptr = h };
+	res = epoll_ctl(hub.ep, EPOLL_CTL_ADD, h->fd, &ev);
+	if (res) {
+		fprintf(stderr, "%s: Can't watch %d: %s\n", __func__, h->fd, strerror(errno));
+		hub.fds = h->next;
+	}
+#else
+	io_hub_wake();
+#endif
+	pthread_mutex_unlock(&hub.lock);
+	return res;
+}
+
+void
+io_hub_unwatch(
+		io_hub_fd_t * h)
+{
+	pthread_once(&hub.once, io_hub_start);
+
+	pthread_mutex_lock(&hub.lock);
+	for (io_hub_fd_t ** w = &hub.fds; *w; w = &(*w)->next)
+		if (*w == h) {
+			*w = h->next;
+#ifdef __linux__
+			epoll_ctl(hub.ep, EPOLL_CTL_DEL, h->fd, NULL);
+#else
+			io_hub_wake();
+#endif
+			break;
+		}
+	pthread_mutex_unlock(&hub.lock);
+}
+
+void
+io_hub_want(
+		io_hub_fd_t * h,
+		uint32_t want)
+{
+	if (h->want == want)
+		return;
+	h->want = want;
+#ifdef __linux__
+	struct epoll_event ev = { .events = io_hub_events(want), .data.ptr = h };
+	epoll_ctl(hub.ep, EPOLL_CTL_MOD, h->fd, &ev);
+#else
+	io_hub_wake();
+#endif
+}
+
+void
+io_hub_kick(
+		io_hub_fd_t * h)
+{
+	// only the first one since the hub got to it costs a syscall
+	if (__sync_lock_test_and_set(&h->kicked, 1))
+		return;
+	io_hub_wake();
+}
+
+void
+io_hub_uart_wake(
+		io_hub_uart_t * u)
+{
+	// if the mailbox is full, its overflow IRQ starts the poll timer
+	avr_mailbox_post(u->avr, u->irq, 1, 0);
+}
+
+/*
+ * The AVR side of the UART bridges, everything from here on runs on the
+ * simulator thread.
+ */
+static void
+io_hub_uart_queue(
+		io_hub_uart_t * u);
+
+// the UART is done with 'pos' bytes of 'rx', maybe all of them
+static void
+io_hub_uart_done(
+		avr_uart_buffer_t * b)
+{
+	io_hub_uart_t * u = (io_hub_uart_t*)b->param;
+
+	if (u->received && b->pos)
+		u->received(u, b->data, b->pos);
+	io_hub_fifo_read_offset(&u->rx, b->pos);
+	u->busy = 0;
+	// there is room for the hub to read some more
+	io_hub_kick(u->hub);
+	io_hub_uart_queue(u);
+}
+
+// queues as much of 'rx' as is in one piece
+static void
+io_hub_uart_queue(
+		io_hub_uart_t * u)
+{
+	if (u->busy)
+		return;
+	uint16_t read = u->rx.read;
+	uint16_t size = io_hub_fifo_get_read_size(&u->rx);
+	if (read + size > io_hub_fifo_fifo_size)
+		size = io_hub_fifo_fifo_size - read;	// the rest comes next
+	if (!size)
+		return;
+	u->queued = (avr_uart_buffer_t) {
+		.data = u->rx.buffer + read,
+		.size = size,
+		.done = io_hub_uart_done,
+		.param = u,
+	};
+	u->busy = 1;
+	if (avr_ioctl(u->avr, AVR_IOCTL_UART_QUEUE(u->name), &u->queued))
+		u->busy = 0;
+}
+
+// how often it looks for what the hub read, when a post was lost
+static avr_cycle_count_t
+io_hub_uart_period(
+		io_hub_uart_t * u)
+{
+	avr_cycle_count_t c = avr_usec_to_cycles(u->avr, 100);
+	return c ? c : 1;
+}
+
+static avr_cycle_count_t
+io_hub_uart_poll(
+		struct avr_t * avr,
+		avr_cycle_count_t when,
+		void * param)
+{
+	io_hub_uart_t * u = (io_hub_uart_t*)param;
+
+	io_hub_uart_queue(u);
+	// the posts work again by the time it's all taken
+	return io_hub_fifo_isempty(&u->rx) ? 0 : when + io_hub_uart_period(u);
+}
+
+// the mailbox refused some posts, maybe ours
+static void
+io_hub_uart_overflow_hook(
+		struct avr_irq_t * irq,
+		uint32_t value,
+		void * param)
+{
+	io_hub_uart_t * u = (io_hub_uart_t*)param;
+
+	if (!avr_cycle_timer_status(u->avr, io_hub_uart_poll, u))
+		avr_cycle_timer_register(u->avr, 1, io_hub_uart_poll, u);
+}
+
+// the UART fifo is empty
+static void
+io_hub_uart_xon_hook(
+		struct avr_irq_t * irq,
+		uint32_t value,
+		void * param)
+{
+	io_hub_uart_queue((io_hub_uart_t*)param);
+}
+
+// posted by io_hub_uart_wake()
+static void
+io_hub_uart_rx_hook(
+		struct avr_irq_t * irq,
+		uint32_t value,
+		void * param)
+{
+	io_hub_uart_queue((io_hub_uart_t*)param);
+}
+
+static void
+io_hub_uart_flush(
+		avr_uart_drain_t * d,
+		uint32_t len)
+{
+	io_hub_uart_t * u = (io_hub_uart_t*)d->param;
+
+	// what doesn't fit is lost, like on a wire nobody listens to
+	for (uint32_t i = 0; i < len; i++)
+		if (!io_hub_fifo_write(&u->tx, d->buf[i]))
+			break;
+	if (u->sent)
+		u->sent(u, d->buf, len);
+	io_hub_kick(u->hub);
+}
+
+void
+io_hub_uart_connect(
+		io_hub_uart_t * u,
+		struct avr_t * avr,
+		char name,
+		io_hub_fd_t * hub)
+{
+	u->avr = avr;
+	u->name = name;
+	u->hub = hub;
+
+	// disable the stdio dump, as we are sending binary there
+	uint32_t f = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS(name), &f);
+	f &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS(name), &f);
+
+	// a batch goes when full, or when its first byte is 100us old
+	u->drain = (avr_uart_drain_t) {
+		.buf = u->batch,
+		.size = sizeof(u->batch),
+		.latency = io_hub_uart_period(u),
+		.flush = io_hub_uart_flush,
+		.param = u,
+	};
+	avr_ioctl(avr, AVR_IOCTL_UART_DRAIN(name), &u->drain);
+
+	avr_irq_t * xon = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ(name), UART_IRQ_OUT_XON);
+	if (xon)
+		avr_irq_register_notify(xon, io_hub_uart_xon_hook, u);
+	static const char * irq_name[] = { "1>hub.rx" };
+	u->irq = avr_alloc_irq(&avr->irq_pool, 0, 1, irq_name);
+	avr_irq_register_notify(u->irq, io_hub_uart_rx_hook, u);
+	avr_irq_register_notify(avr_mailbox_overflow_getirq(avr),
+			io_hub_uart_overflow_hook, u);
+	io_hub_uart_queue(u);
+}
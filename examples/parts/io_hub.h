@@ -0,0 +1,113 @@
+/*
+	io_hub.h
+
+	One thread per process that waits on the file descriptors of all the
+	parts (ptys, sockets) of all the simulated AVRs, instead of a thread
+	polling each of them.
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __IO_HUB_H__
+#define __IO_HUB_H__
+
+#include "sim_avr.h"
+#include "avr_uart.h"
+#include "fifo_declare.h"
+
+enum {
+	IO_HUB_READ		= (1 << 0),
+	IO_HUB_WRITE	= (1 << 1),
+	IO_HUB_KICK		= (1 << 2),	// io_hub_kick() was called
+};
+
+/*
+ * A file descriptor the hub waits on, for the IO_HUB_READ/WRITE in 'want'.
+ * 'ready' is called on the hub thread, with what happened; it can change
+ * 'want' with io_hub_want(), or stop watching altogether.
+ */
+typedef struct io_hub_fd_t {
+	int			fd;
+	uint32_t	want;
+	void (*ready)(struct io_hub_fd_t * h, uint32_t what);
+	void *		param;
+
+	int			kicked;
+	struct io_hub_fd_t * next;
+} io_hub_fd_t;
+
+// the hub thread is started by the first one
+int
+io_hub_watch(
+		io_hub_fd_t * h);
+void
+io_hub_unwatch(
+		io_hub_fd_t * h);
+// from the hub thread, 'ready' usually
+void
+io_hub_want(
+		io_hub_fd_t * h,
+		uint32_t want);
+// from any thread: calls 'ready' with IO_HUB_KICK on the hub thread, soon
+void
+io_hub_kick(
+		io_hub_fd_t * h);
+
+DECLARE_FIFO(uint8_t, io_hub_fifo, 1024);
+
+/*
+ * The AVR side of a UART bridge. What the UART sends is gathered in
+ * batches into 'tx', what the hub thread puts in 'rx' is queued to the UART
+ * in bulk, as soon as the hub posts to the AVR's mailbox (see
+ * sim_mailbox.h). If the mailbox was full, 'rx' is polled every 100us
+ * until it is empty. Either way, 'hub' is kicked so it can write 'tx' out,
+ * or read more into 'rx'. Nothing else runs on the simulator thread, and
+ * these are the only two things both threads touch.
+ */
+typedef struct io_hub_uart_t {
+	struct avr_t *	avr;
+	char			name;		// of the UART
+	io_hub_fd_t *	hub;
+	io_hub_fifo_t	rx;			// to the AVR
+	io_hub_fifo_t	tx;			// from the AVR
+
+	// optional, on the simulator thread, bytes the UART took or sent
+	void (*received)(struct io_hub_uart_t * u, const uint8_t * b, uint32_t len);
+	void (*sent)(struct io_hub_uart_t * u, const uint8_t * b, uint32_t len);
+	void *			param;
+
+	avr_uart_buffer_t	queued;		// the part of 'rx' the UART is taking
+	int				busy;		// 'queued' is
+	avr_irq_t *		irq;		// posted to the mailbox when 'rx' has more
+	avr_uart_drain_t	drain;
+	uint8_t			batch[64];
+} io_hub_uart_t;
+
+void
+io_hub_uart_connect(
+		io_hub_uart_t * u,
+		struct avr_t * avr,
+		char name,
+		io_hub_fd_t * hub);
+// from the hub thread, once it put bytes in 'rx': the UART takes them next
+void
+io_hub_uart_wake(
+		io_hub_uart_t * u);
+
+#endif /* __IO_HUB_H__ */
@@ -21,12 +21,11 @@
 
 #include "sim_network.h"
 #include <stdlib.h>
-#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
-#include <signal.h>
+#include <fcntl.h>
 #ifdef __APPLE__
 #include <util.h>
 #else
@@ -37,7 +36,7 @@
 #include "avr_uart.h"
 #include "sim_hex.h"
 
-DEFINE_FIFO(uint8_t,uart_pty_fifo);
+DEFINE_FIFO(uint8_t, io_hub_fifo);
 
 //#define TRACE(_w) _w
 #ifndef TRACE
@@ -45,163 +44,80 @@ DEFINE_FIFO(uint8_t,uart_pty_fifo);
 #endif
 
 /*
- * called when a byte is send via the uart on the AVR
+ * Called on the simulator thread with what the AVR received or sent, the
+ * tap shows both
  */
 static void
-uart_pty_in_hook(
-		struct avr_irq_t * irq,
-		uint32_t value,
-		void * param)
+uart_pty_tap(
+		io_hub_uart_t * u,
+		const uint8_t * b,
+		uint32_t len)
 {
-	uart_pty_t * p = (uart_pty_t*)param;
-	TRACE(printf("uart_pty_in_hook %02x\n", value);)
-	uart_pty_fifo_write(&p->pty.in, value);
+	uart_pty_t * p = (uart_pty_t*)u->param;
 
-	if (p->tap.s) {
-		if (p->tap.crlf && value == '\n')
-			uart_pty_fifo_write(&p->tap.in, '\r');
-		uart_pty_fifo_write(&p->tap.in, value);
-	}
-}
-
-// try to empty our fifo, the uart_pty_xoff_hook() will be called when
-// other side is full
-static void
-uart_pty_flush_incoming(
-		uart_pty_t * p)
-{
-	while (p->xon && !uart_pty_fifo_isempty(&p->pty.out)) {
-		TRACE(int r = p->pty.out.read;)
-		uint8_t byte = uart_pty_fifo_read(&p->pty.out);
-		TRACE(printf("uart_pty_flush_incoming send r %03d:%02x\n", r, byte);)
-		avr_raise_irq(p->irq + IRQ_UART_PTY_BYTE_OUT, byte);
-
-		if (p->tap.s) {
-			if (p->tap.crlf && byte == '\n')
-				uart_pty_fifo_write(&p->tap.in, '\r');
-			uart_pty_fifo_write(&p->tap.in, byte);
-		}
-	}
-	if (p->tap.s) {
-		while (p->xon && !uart_pty_fifo_isempty(&p->tap.out)) {
-			uint8_t byte = uart_pty_fifo_read(&p->tap.out);
-			if (p->tap.crlf && byte == '\r') {
-				uart_pty_fifo_write(&p->tap.in, '\n');
-			}
-			if (byte == '\n')
-				continue;
-			uart_pty_fifo_write(&p->tap.in, byte);
-			avr_raise_irq(p->irq + IRQ_UART_PTY_BYTE_OUT, byte);
-		}
+	for (uint32_t i = 0; i < len; i++) {
+		if (p->tap.crlf && b[i] == '\n')
+			io_hub_fifo_write(&p->tap.in, '\r');
+		io_hub_fifo_write(&p->tap.in, b[i]);
 	}
+	io_hub_kick(&p->tap.hub);
 }
 
 /*
- * Called when the uart has room in it's input buffer. This is called repeateadly
- * if necessary, while the xoff is called only when the uart fifo is FULL
+ * Called on the hub thread, when the pty (or the tap) has something to
+ * read or room to write, or when the bridge has news: the AVR sent
+ * something, or took some of what was read
  */
 static void
-uart_pty_xon_hook(
-		struct avr_irq_t * irq,
-		uint32_t value,
-		void * param)
+uart_pty_ready(
+		io_hub_fd_t * h,
+		uint32_t what)
 {
-	uart_pty_t * p = (uart_pty_t*)param;
-	TRACE(if (!p->xon) printf("uart_pty_xon_hook\n");)
-	p->xon = 1;
-	uart_pty_flush_incoming(p);
-}
-
-/*
- * Called when the uart ran out of room in it's input buffer
- */
-static void
-uart_pty_xoff_hook(
-		struct avr_irq_t * irq,
-		uint32_t value,
-		void * param)
-{
-	uart_pty_t * p = (uart_pty_t*)param;
-	TRACE(if (p->xon) printf("uart_pty_xoff_hook\n");)
-	p->xon = 0;
-}
-
-static void *
-uart_pty_thread(
-		void * param)
-{
-	uart_pty_t * p = (uart_pty_t*)param;
-
-	while (1) {
-		fd_set read_set, write_set;
-		int max = 0;
-		FD_ZERO(&read_set);
-		FD_ZERO(&write_set);
-
-		for (int ti = 0; ti < 2; ti++) if (p->port[ti].s) {
-			// read more only if buffer was flushed
-			if (p->port[ti].buffer_len == p->port[ti].buffer_done) {
-				FD_SET(p->port[ti].s, &read_set);
-				max = p->port[ti].s > max ? p->port[ti].s : max;
-			}
-			if (!uart_pty_fifo_isempty(&p->port[ti].in)) {
-				FD_SET(p->port[ti].s, &write_set);
-				max = p->port[ti].s > max ? p->port[ti].s : max;
-			}
-		}
-
-		struct timeval timo = { 0, 500 };	// short, but not too short interval
-		int ret = select(max+1, &read_set, &write_set, NULL, &timo);
-
-		if (!ret)
+	uart_pty_t * p = (uart_pty_t*)h->param;
+	uart_pty_port_t * port = h == &p->tap.hub ? &p->tap : &p->pty;
+	io_hub_fifo_t * out = port->tap ? &port->in : &p->uart.tx;
+
+	// read more only if buffer was flushed
+	if ((what & IO_HUB_READ) && port->buffer_done == port->buffer_len) {
+		ssize_t r = read(port->s, port->buffer, sizeof(port->buffer));
+		port->buffer_len = r > 0 ? r : 0;
+		port->buffer_done = 0;
+		TRACE(if (!port->tap) hdump("pty recv", port->buffer, r);)
+	}
+	// write them in the bridge's fifo, as far as there is room
+	int got = 0;
+	while (port->buffer_done < port->buffer_len &&
+			!io_hub_fifo_isfull(&p->uart.rx)) {
+		uint8_t b = port->buffer[port->buffer_done++];
+		if (port->tap && b == '\n')
 			continue;
-		if (ret < 0)
+		io_hub_fifo_write(&p->uart.rx, b);
+		got++;
+	}
+	if (got)
+		io_hub_uart_wake(&p->uart);
+	// the tap might be waiting for room too
+	if (!port->tap && p->tap.s && p->tap.buffer_done < p->tap.buffer_len)
+		io_hub_kick(&p->tap.hub);
+
+	while (!io_hub_fifo_isempty(out)) {
+		uint8_t buffer[512];
+		uint16_t len = io_hub_fifo_get_read_size(out);
+		if (len > sizeof(buffer))
+			len = sizeof(buffer);
+		for (uint16_t i = 0; i < len; i++)
+			buffer[i] = io_hub_fifo_read_at(out, i);
+		ssize_t r = write(port->s, buffer, len);
+		TRACE(if (!port->tap) hdump("pty send", buffer, r);)
+		if (r <= 0)
 			break;
-
-		for (int ti = 0; ti < 2; ti++) if (p->port[ti].s) {
-			if (FD_ISSET(p->port[ti].s, &read_set)) {
-				ssize_t r = read(p->port[ti].s, p->port[ti].buffer,
-									sizeof(p->port[ti].buffer)-1);
-				p->port[ti].buffer_len = r;
-				p->port[ti].buffer_done = 0;
-				TRACE(if (!p->port[ti].tap) hdump("pty recv", p->port[ti].buffer, r);)
-			}
-			if (p->port[ti].buffer_done < p->port[ti].buffer_len) {
-				// write them in fifo
-				while (p->port[ti].buffer_done < p->port[ti].buffer_len &&
-						!uart_pty_fifo_isfull(&p->port[ti].out)) {
-					int index = p->port[ti].buffer_done++;
-					TRACE(int wi = p->port[ti].out.write;)
-					uart_pty_fifo_write(&p->port[ti].out,
-							p->port[ti].buffer[index]);
-					TRACE(printf("w %3d:%02x\n", wi, p->port[ti].buffer[index]);)
-				}
-			}
-			if (FD_ISSET(p->port[ti].s, &write_set)) {
-				uint8_t buffer[512];
-				// write them in fifo
-				uint8_t * dst = buffer;
-				while (!uart_pty_fifo_isempty(&p->port[ti].in) &&
-						dst < (buffer + sizeof(buffer)))
-					*dst++ = uart_pty_fifo_read(&p->port[ti].in);
-				size_t len = dst - buffer;
-				TRACE(size_t r =) write(p->port[ti].s, buffer, len);
-				TRACE(if (!p->port[ti].tap) hdump("pty send", buffer, r);)
-			}
-		}
-		/* DO NOT call this, this create a concurency issue with the
-		 * FIFO that can't be solved cleanly with a memory barrier
-			uart_pty_flush_incoming(p);
-		  */
+		io_hub_fifo_read_offset(out, r);
 	}
-	return NULL;
+	io_hub_want(h,
+			(port->buffer_done == port->buffer_len ? IO_HUB_READ : 0) |
+			(io_hub_fifo_isempty(out) ? 0 : IO_HUB_WRITE));
 }
 
-static const char * irq_names[IRQ_UART_PTY_COUNT] = {
-	[IRQ_UART_PTY_BYTE_IN] = "8<uart_pty.in",
-	[IRQ_UART_PTY_BYTE_OUT] = "8>uart_pty.out",
-};
-
 void
 uart_pty_init(
 		struct avr_t * avr,
@@ -210,8 +126,6 @@ uart_pty_init(
 	memset(p, 0, sizeof(*p));
 
 	p->avr = avr;
-	p->irq = avr_alloc_irq(&avr->irq_pool, 0, IRQ_UART_PTY_COUNT, irq_names);
-	avr_irq_register_notify(p->irq + IRQ_UART_PTY_BYTE_IN, uart_pty_in_hook, p);
 
 	int hastap = (getenv("SIMAVR_UART_TAP") && atoi(getenv("SIMAVR_UART_TAP"))) ||
 			(getenv("SIMAVR_UART_XTERM") && atoi(getenv("SIMAVR_UART_XTERM"))) ;
@@ -227,15 +141,21 @@ uart_pty_init(
 		tcgetattr(m, &tio);
 		cfmakeraw(&tio);
 		tcsetattr(m, TCSANOW, &tio);
+		// the hub thread can't wait for whoever is on the other side
+		fcntl(m, F_SETFL, fcntl(m, F_GETFL) | O_NONBLOCK);
 		p->port[ti].s = m;
 		p->port[ti].tap = ti != 0;
 		p->port[ti].crlf = ti != 0;
 		printf("uart_pty_init %s on port *** %s ***\n",
 				ti == 0 ? "bridge" : "tap", p->port[ti].slavename);
+		p->port[ti].hub = (io_hub_fd_t) {
+			.fd = m, .want = IO_HUB_READ, .ready = uart_pty_ready, .param = p };
+		io_hub_watch(&p->port[ti].hub);
+	}
+	if (hastap) {
+		p->uart.received = p->uart.sent = uart_pty_tap;
+		p->uart.param = p;
 	}
-
-	pthread_create(&p->thread, NULL, uart_pty_thread, p);
-
 }
 
 void
@@ -243,12 +163,11 @@ uart_pty_stop(
 		uart_pty_t * p)
 {
 	puts(__func__);
-	pthread_kill(p->thread, SIGINT);
 	for (int ti = 0; ti < 2; ti++)
-		if (p->port[ti].s)
+		if (p->port[ti].s) {
+			io_hub_unwatch(&p->port[ti].hub);
 			close(p->port[ti].s);
-	void * ret;
-	pthread_join(p->thread, &ret);
+		}
 }
 
 void
@@ -256,24 +175,7 @@ uart_pty_connect(
 		uart_pty_t * p,
 		char uart)
 {
-	// disable the stdio dump, as we are sending binary there
-	uint32_t f = 0;
-	avr_ioctl(p->avr, AVR_IOCTL_UART_GET_FLAGS(uart), &f);
-	f &= ~AVR_UART_FLAG_STDIO;
-	avr_ioctl(p->avr, AVR_IOCTL_UART_SET_FLAGS(uart), &f);
-
-	avr_irq_t * src = avr_io_getirq(p->avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUTPUT);
-	avr_irq_t * dst = avr_io_getirq(p->avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_INPUT);
-	avr_irq_t * xon = avr_io_getirq(p->avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUT_XON);
-	avr_irq_t * xoff = avr_io_getirq(p->avr, AVR_IOCTL_UART_GETIRQ(uart), UART_IRQ_OUT_XOFF);
-	if (src && dst) {
-		avr_connect_irq(src, p->irq + IRQ_UART_PTY_BYTE_IN);
-		avr_connect_irq(p->irq + IRQ_UART_PTY_BYTE_OUT, dst);
-	}
-	if (xon)
-		avr_irq_register_notify(xon, uart_pty_xon_hook, p);
-	if (xoff)
-		avr_irq_register_notify(xoff, uart_pty_xoff_hook, p);
+	io_hub_uart_connect(&p->uart, p->avr, uart, &p->pty.hub);
 
 	for (int ti = 0; ti < 1; ti++) if (p->port[ti].s) {
 		char link[128];
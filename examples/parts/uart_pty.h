@@ -23,34 +23,23 @@
 #ifndef __UART_PTY_H___
 #define __UART_PTY_H___
 
-#include <pthread.h>
 #include "sim_irq.h"
-#include "fifo_declare.h"
-
-enum {
-	IRQ_UART_PTY_BYTE_IN = 0,
-	IRQ_UART_PTY_BYTE_OUT,
-	IRQ_UART_PTY_COUNT
-};
-
-DECLARE_FIFO(uint8_t,uart_pty_fifo, 512);
+#include "io_hub.h"
 
 typedef struct uart_pty_port_t {
 	int			tap : 1, crlf : 1;
 	int 		s;			// socket we chat on
 	char 		slavename[64];
-	uart_pty_fifo_t in;
-	uart_pty_fifo_t out;
-	uint8_t		buffer[512];
+	io_hub_fd_t	hub;
+	io_hub_fifo_t in;		// the tap's, the pty uses the bridge's
+	uint8_t		buffer[512];	// read, waiting for room in the bridge
 	size_t		buffer_len, buffer_done;
 } uart_pty_port_t, *uart_pty_port_p;
 
 typedef struct uart_pty_t {
-	avr_irq_t *	irq;		// irq list
 	struct avr_t *avr;		// keep it around so we can pause it
 
-	pthread_t	thread;
-	int			xon;
+	io_hub_uart_t uart;		// the bridge to the AVR
 
 	union {
 		struct {
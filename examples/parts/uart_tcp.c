@@ -0,0 +1,149 @@
+/*
+	uart_tcp.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "uart_tcp.h"
+#include "avr_uart.h"
+
+DEFINE_FIFO(uint8_t, io_hub_fifo);
+
+static void uart_tcp_drop(uart_tcp_t * p)
+{
+	io_hub_unwatch(&p->client);
+	close(p->client.fd);
+	p->client.fd = -1;
+	p->buffer_len = p->buffer_done = 0;
+}
+
+/*
+ * Called on the hub thread when the client has something to read or room
+ * to write, or when the bridge has news: the AVR sent something, or took
+ * some of what was read
+ */
+static void uart_tcp_ready(io_hub_fd_t * h, uint32_t what)
+{
+	uart_tcp_t * p = (uart_tcp_t*)h->param;
+
+	// read more only if buffer was flushed
+	if ((what & IO_HUB_READ) && p->buffer_done == p->buffer_len) {
+		ssize_t r = read(h->fd, p->buffer, sizeof(p->buffer));
+		if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+			printf("%s: client gone\n", __func__);
+			uart_tcp_drop(p);
+			return;
+		}
+		p->buffer_len = r > 0 ? r : 0;
+		p->buffer_done = 0;
+	}
+	// write them in the bridge's fifo, as far as there is room
+	size_t done = p->buffer_done;
+	while (p->buffer_done < p->buffer_len && !io_hub_fifo_isfull(&p->uart.rx))
+		io_hub_fifo_write(&p->uart.rx, p->buffer[p->buffer_done++]);
+	if (p->buffer_done != done)
+		io_hub_uart_wake(&p->uart);
+
+	while (!io_hub_fifo_isempty(&p->uart.tx)) {
+		uint8_t buffer[512];
+		uint16_t len = io_hub_fifo_get_read_size(&p->uart.tx);
+		if (len > sizeof(buffer))
+			len = sizeof(buffer);
+		for (uint16_t i = 0; i < len; i++)
+			buffer[i] = io_hub_fifo_read_at(&p->uart.tx, i);
+		ssize_t r = write(h->fd, buffer, len);
+		if (r <= 0)
+			break;
+		io_hub_fifo_read_offset(&p->uart.tx, r);
+	}
+	io_hub_want(h,
+			(p->buffer_done == p->buffer_len ? IO_HUB_READ : 0) |
+			(io_hub_fifo_isempty(&p->uart.tx) ? 0 : IO_HUB_WRITE));
+}
+
+static void uart_tcp_accept(io_hub_fd_t * h, uint32_t what)
+{
+	uart_tcp_t * p = (uart_tcp_t*)h->param;
+
+	int s = accept(h->fd, NULL, NULL);
+	if (s < 0)
+		return;
+	if (p->client.fd >= 0) {
+		printf("%s: already have a client\n", __func__);
+		close(s);
+		return;
+	}
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+	// what was sent while nobody was there is gone
+	io_hub_fifo_read_offset(&p->uart.tx, io_hub_fifo_get_read_size(&p->uart.tx));
+	p->client.fd = s;
+	p->client.want = IO_HUB_READ;
+	io_hub_watch(&p->client);
+	printf("%s: client connected\n", __func__);
+}
+
+int uart_tcp_init(struct avr_t * avr, uart_tcp_t * p, uint16_t port)
+{
+	memset(p, 0, sizeof(*p));
+	p->avr = avr;
+	p->client = (io_hub_fd_t) { .fd = -1, .ready = uart_tcp_ready, .param = p };
+
+	int s = socket(PF_INET, SOCK_STREAM, 0);
+	if (s < 0) {
+		fprintf(stderr, "%s: Can't create socket: %s", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+	int one = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons (port);
+
+	if (bind(s, (struct sockaddr *) &address, sizeof(address)) || listen(s, 1)) {
+		fprintf(stderr, "%s: Can not bind socket: %s", __FUNCTION__, strerror(errno));
+		close(s);
+		return -1;
+	}
+	printf("uart_tcp_init bridge on port %d\n", port);
+
+	p->listen = (io_hub_fd_t) {
+		.fd = s, .want = IO_HUB_READ, .ready = uart_tcp_accept, .param = p };
+	return io_hub_watch(&p->listen);
+}
+
+void uart_tcp_connect(uart_tcp_t * p, char uart)
+{
+	io_hub_uart_connect(&p->uart, p->avr, uart, &p->client);
+}
+
+void uart_tcp_stop(uart_tcp_t * p)
+{
+	io_hub_unwatch(&p->listen);
+	close(p->listen.fd);
+	if (p->client.fd >= 0)
+		uart_tcp_drop(p);
+}
@@ -0,0 +1,48 @@
+/*
+	uart_tcp.h
+
+	A UART bridged to a TCP port, one client at a time.
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __UART_TCP_H___
+#define __UART_TCP_H___
+
+#include "sim_network.h"
+#include "io_hub.h"
+
+typedef struct uart_tcp_t {
+	struct avr_t *avr;		// keep it around so we can pause it
+
+	io_hub_fd_t	listen;
+	io_hub_fd_t	client;		// fd is -1 when nobody is connected
+	io_hub_uart_t uart;
+
+	uint8_t		buffer[512];	// read, waiting for room in the bridge
+	size_t		buffer_len, buffer_done;
+} uart_tcp_t;
+
+int uart_tcp_init(struct avr_t * avr, uart_tcp_t * p, uint16_t port);
+
+void uart_tcp_connect(uart_tcp_t * p, char uart);
+
+void uart_tcp_stop(uart_tcp_t * p);
+
+#endif /* __UART_TCP_H___ */
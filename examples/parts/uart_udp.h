@@ -24,28 +24,15 @@
 #define __UART_UDP_H___
 
 #include "sim_network.h"
-#include "sim_irq.h"
-#include "fifo_declare.h"
-
-enum {
-	IRQ_UART_UDP_BYTE_IN = 0,
-	IRQ_UART_UDP_BYTE_OUT,
-	IRQ_UART_UDP_COUNT
-};
-
-DECLARE_FIFO(uint8_t,uart_udp_fifo, 512);
+#include "io_hub.h"
 
 typedef struct uart_udp_t {
-	avr_irq_t *	irq;		// irq list
 	struct avr_t *avr;		// keep it around so we can pause it
 
-	pthread_t	thread;
 	int 		s;			// socket we chat on
 	struct sockaddr_in peer;
-
-	int			xon;
-	uart_udp_fifo_t in;
-	uart_udp_fifo_t out;
+	io_hub_fd_t	hub;
+	io_hub_uart_t uart;
 } uart_udp_t;
 
 void uart_udp_init(struct avr_t * avr, uart_udp_t * b);
@@ -39,8 +39,15 @@
  * This declares a typical AVR core, using constants what appears
  * to be in every io*.h file...
  */
+// the IO registers end where the SRAM starts; without it, avr_init() uses 0xff
+#ifdef RAMSTART
+#define _DEFAULT_CORE_IOEND .ioend = RAMSTART - 1,
+#else
+#define _DEFAULT_CORE_IOEND
+#endif
 #ifdef SIGNATURE_0
 #define DEFAULT_CORE(_vector_size) \
+	_DEFAULT_CORE_IOEND \
 	.ramend = RAMEND, \
 	.flashend = FLASHEND, \
 	.e2end = E2END, \
@@ -50,6 +57,7 @@
 #else
 // Disable signature for now, for ubuntu, gentoo and other using old avr toolchain
 #define DEFAULT_CORE(_vector_size) \
+	_DEFAULT_CORE_IOEND \
 	.ramend = RAMEND, \
 	.flashend = FLASHEND, \
 	.e2end = E2END, \
@@ -118,7 +118,9 @@ const struct mcu_t SIM_CORENAME = {
 
 		.txen = AVR_IO_REGBIT(UCSR0B, TXEN0),
 		.rxen = AVR_IO_REGBIT(UCSR0B, RXEN0),
+		.u2x = AVR_IO_REGBIT(UCSR0A, U2X0),
 		.usbs = AVR_IO_REGBIT(UCSR0C, USBS0),
+		.upm = AVR_IO_REGBITS(UCSR0C, UPM00, 0x3),
 		.ucsz = AVR_IO_REGBITS(UCSR0C, UCSZ00, 0x3), // 2 bits
 		.ucsz2 = AVR_IO_REGBIT(UCSR0B, UCSZ02), 	// 1 bits
 
@@ -183,12 +185,15 @@ const struct mcu_t SIM_CORENAME = {
 		.wgm = { AVR_IO_REGBIT(TCCR0A, WGM00), AVR_IO_REGBIT(TCCR0A, WGM01), AVR_IO_REGBIT(TCCR0B, WGM02) },
 		.wgm_op = {
 			[0] = AVR_TIMER_WGM_NORMAL8(),
+			[1] = AVR_TIMER_WGM_FCPWM8(),
 			[2] = AVR_TIMER_WGM_CTC(),
 			[3] = AVR_TIMER_WGM_FASTPWM8(),
+			[5] = AVR_TIMER_WGM_OCFCPWM(),
 			[7] = AVR_TIMER_WGM_OCPWM(),
 		},
 		.cs = { AVR_IO_REGBIT(TCCR0B, CS00), AVR_IO_REGBIT(TCCR0B, CS01), AVR_IO_REGBIT(TCCR0B, CS02) },
 		.cs_div = { 0, 0, 3 /* 8 */, 6 /* 64 */, 8 /* 256 */, 10 /* 1024 */ },
+		.psr = AVR_IO_REGBIT(GTCCR, PSRSYNC),
 
 		.r_tcnt = TCNT0,
 
@@ -227,18 +232,24 @@ const struct mcu_t SIM_CORENAME = {
 					AVR_IO_REGBIT(TCCR1B, WGM12), AVR_IO_REGBIT(TCCR1B, WGM13) },
 		.wgm_op = {
 			[0] = AVR_TIMER_WGM_NORMAL16(),
+			[1] = AVR_TIMER_WGM_FCPWM8(),
+			[2] = AVR_TIMER_WGM_FCPWM9(),
+			[3] = AVR_TIMER_WGM_FCPWM10(),
 			[4] = AVR_TIMER_WGM_CTC(),
 			[5] = AVR_TIMER_WGM_FASTPWM8(),
 			[6] = AVR_TIMER_WGM_FASTPWM9(),
 			[7] = AVR_TIMER_WGM_FASTPWM10(),
-			[8] = AVR_TIMER_WGM_ICPWM(),
-			[9] = AVR_TIMER_WGM_OCPWM(),
+			[8] = AVR_TIMER_WGM_ICPFCPWM(),
+			[9] = AVR_TIMER_WGM_OCPFCPWM(),
+			[10] = AVR_TIMER_WGM_ICFCPWM(),
+			[11] = AVR_TIMER_WGM_OCFCPWM(),
 			[12] = AVR_TIMER_WGM_ICCTC(),
 			[14] = AVR_TIMER_WGM_ICPWM(),
 			[15] = AVR_TIMER_WGM_OCPWM(),
 		},
 		.cs = { AVR_IO_REGBIT(TCCR1B, CS10), AVR_IO_REGBIT(TCCR1B, CS11), AVR_IO_REGBIT(TCCR1B, CS12) },
 		.cs_div = { 0, 0, 3 /* 8 */, 6 /* 64 */, 8 /* 256 */, 10 /* 1024 */  /* External clock T1 is not handled */},
+		.psr = AVR_IO_REGBIT(GTCCR, PSRSYNC),
 
 		.r_tcnt = TCNT1L,
 		.r_tcnth = TCNT1H,
@@ -289,13 +300,16 @@ const struct mcu_t SIM_CORENAME = {
 		.wgm = { AVR_IO_REGBIT(TCCR2A, WGM20), AVR_IO_REGBIT(TCCR2A, WGM21), AVR_IO_REGBIT(TCCR2B, WGM22) },
 		.wgm_op = {
 			[0] = AVR_TIMER_WGM_NORMAL8(),
+			[1] = AVR_TIMER_WGM_FCPWM8(),
 			[2] = AVR_TIMER_WGM_CTC(),
 			[3] = AVR_TIMER_WGM_FASTPWM8(),
+			[5] = AVR_TIMER_WGM_OCFCPWM(),
 			[7] = AVR_TIMER_WGM_OCPWM(),
 		},
 
 		.cs = { AVR_IO_REGBIT(TCCR2B, CS20), AVR_IO_REGBIT(TCCR2B, CS21), AVR_IO_REGBIT(TCCR2B, CS22) },
 		.cs_div = { 0, 0, 3 /* 8 */, 5 /* 32 */, 6 /* 64 */, 7 /* 128 */, 8 /* 256 */, 10 /* 1024 */ },
+		.psr = AVR_IO_REGBIT(GTCCR, PSRASY),
 
 		.r_tcnt = TCNT2,
 		
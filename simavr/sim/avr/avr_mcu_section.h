@@ -61,6 +61,7 @@ enum {
 	AVR_MMCU_TAG_VCD_PERIOD,
 	AVR_MMCU_TAG_VCD_TRACE,
 	AVR_MMCU_TAG_PORT_EXTERNAL_PULL,
+	AVR_MMCU_TAG_SIMAVR_SEMIHOST,
 };
 
 enum {
@@ -68,8 +69,41 @@ enum {
 	SIMAVR_CMD_VCD_START_TRACE,
 	SIMAVR_CMD_VCD_STOP_TRACE,
 	SIMAVR_CMD_UART_LOOPBACK,
+	SIMAVR_CMD_CORE_START_TRACE,	// instruction by instruction trace
+	SIMAVR_CMD_CORE_STOP_TRACE,
 };
 
+/*
+ * Semihosting requests, see AVR_MCU_SIMAVR_SEMIHOST()
+ */
+enum {
+	SIMAVR_SEMIHOST_NONE = 0,
+	SIMAVR_SEMIHOST_WRITE,		// 'size' bytes at 'buffer' to file 'fd'
+	SIMAVR_SEMIHOST_READ,		// up to 'size' bytes of file 'fd' in 'buffer'
+	SIMAVR_SEMIHOST_OPEN,		// file named in 'buffer', 'fd' is the mode below
+	SIMAVR_SEMIHOST_CLOSE,		// file 'fd'
+	SIMAVR_SEMIHOST_CYCLES,		// cycle counter, 8 bytes in 'buffer'
+};
+// modes for SIMAVR_SEMIHOST_OPEN
+enum {
+	SIMAVR_SEMIHOST_O_READ = 0,
+	SIMAVR_SEMIHOST_O_WRITE,	// created, or truncated
+	SIMAVR_SEMIHOST_O_APPEND,
+};
+
+/*
+ * The request block, in SRAM; 'fd' 0 to 2 are the simulator's stdin,
+ * stdout and stderr, the others come from SIMAVR_SEMIHOST_OPEN. 'result'
+ * is set by the simulator: bytes written or read, the new file, or -1
+ */
+struct avr_semihost_block_t {
+	uint8_t op;
+	uint8_t fd;
+	uint16_t buffer;
+	uint16_t size;
+	int16_t result;
+} __attribute__((__packed__));
+
 #if __AVR__
 
 #define _MMCU_ __attribute__((section(".mmcu")))
@@ -177,6 +211,30 @@ struct avr_mmcu_vcd_trace_t {
 		.len = sizeof(void *),\
 		.what = (void*)_register, \
 	}
+/*!
+ * Semihosting: the firmware fills a struct avr_semihost_block_t, and
+ * writes its address to this register, low byte first; simavr does the
+ * request when it gets the high byte, in no simulated time. Use
+ * avr_semihost() for that, with the interrupts off if an interrupt
+ * routine might use it too.
+ */
+#define AVR_MCU_SIMAVR_SEMIHOST(_register) \
+	const struct avr_mmcu_addr_t _simavr_semihost_register _MMCU_ = {\
+		.tag = AVR_MMCU_TAG_SIMAVR_SEMIHOST,\
+		.len = sizeof(void *),\
+		.what = (void*)_register, \
+	}
+
+static inline void
+avr_semihost(
+		volatile uint8_t * reg,
+		struct avr_semihost_block_t * block)
+{
+	uint16_t a = (uintptr_t)block;
+	*reg = a;
+	*reg = a >> 8;
+}
+
 /*!
  * Allows the firmware to hint simavr as to wether there are external
  * pullups/down on PORT pins. It helps if the firmware uses "open drain"
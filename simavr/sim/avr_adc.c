@@ -229,7 +229,7 @@ static const char * irq_names[ADC_IRQ_COUNT] = {
 	[ADC_IRQ_ADC5] = "16<adc5",
 	[ADC_IRQ_ADC6] = "16<adc6",
 	[ADC_IRQ_ADC7] = "16<adc7",
-	[ADC_IRQ_ADC8] = "16<adc0",
+	[ADC_IRQ_ADC8] = "16<adc8",
 	[ADC_IRQ_ADC9] = "16<adc9",
 	[ADC_IRQ_ADC10] = "16<adc10",
 	[ADC_IRQ_ADC11] = "16<adc11",
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "avr_eeprom.h"
+#include "sim_file_map.h"
 
 static avr_cycle_count_t avr_eempe_clear(struct avr_t * avr, avr_cycle_count_t when, void * param)
 {
@@ -59,6 +60,8 @@ static void avr_eeprom_write(avr_t * avr, avr_io_addr_t addr, uint8_t v, void *
 			addr = avr->data[p->r_eearl];
 	//	printf("eeprom write %04x <- %02x\n", addr, avr->data[p->r_eedr]);
 		p->eeprom[addr] = avr->data[p->r_eedr];	
+		if (p->map)
+			avr_file_map_dirty(p->map, addr, 1);
 		// Automatically clears that bit (?)
 		avr_regbit_clear(avr, p->eempe);
 
@@ -93,8 +96,11 @@ static int avr_eeprom_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_para
 				return -2;
 			}
 			memcpy(p->eeprom + desc->offset, desc->ee, desc->size);
+			if (p->map)
+				avr_file_map_dirty(p->map, desc->offset, desc->size);
 			AVR_LOG(port->avr, LOG_TRACE, "EEPROM: %s: AVR_IOCTL_EEPROM_SET Loaded %d at offset %d\n",
 					__FUNCTION__, desc->size, desc->offset);
+			res = 0;
 		}	break;
 		case AVR_IOCTL_EEPROM_GET: {
 			avr_eeprom_desc_t * desc = (avr_eeprom_desc_t*)io_param;
@@ -107,6 +113,7 @@ static int avr_eeprom_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_para
 				memcpy(desc->ee, p->eeprom + desc->offset, desc->size);
 			else	// allow to get access to the read data, for gdb support
 				desc->ee = p->eeprom + desc->offset;
+			res = 0;
 		}	break;
 	}
 	
@@ -116,13 +123,23 @@ static int avr_eeprom_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_para
 static void avr_eeprom_dealloc(struct avr_io_t * port)
 {
 	avr_eeprom_t * p = (avr_eeprom_t *)port;
-	if (p->eeprom)
+	if (p->map)
+		avr_file_map_close(p->map);
+	else if (p->eeprom)
 		free(p->eeprom);
+	p->map = NULL;
 	p->eeprom = NULL;
 }
 
+static void avr_eeprom_reset(struct avr_io_t * port)
+{
+	avr_eeprom_t * p = (avr_eeprom_t *)port;
+	avr_file_map_reset(p->map);
+}
+
 static	avr_io_t	_io = {
 	.kind = "eeprom",
+	.reset = avr_eeprom_reset,
 	.ioctl = avr_eeprom_ioctl,
 	.dealloc = avr_eeprom_dealloc,
 };
@@ -133,11 +150,22 @@ void avr_eeprom_init(avr_t * avr, avr_eeprom_t * p)
 //	printf("%s init (%d bytes) EEL/H:%02x/%02x EED=%02x EEC=%02x\n",
 //			__FUNCTION__, p->size, p->r_eearl, p->r_eearh, p->r_eedr, p->r_eecr);
 
-	p->eeprom = malloc(p->size);
-	memset(p->eeprom, 0xff, p->size);
+	if (avr->eeprom_file) {
+		p->map = avr_file_map_open(avr, avr->eeprom_file, p->size);
+		if (!p->map)
+			AVR_LOG(avr, LOG_ERROR, "EEPROM: Unable to map %s\n", avr->eeprom_file);
+	}
+	if (p->map)
+		p->eeprom = p->map->base;
+	else {
+		p->eeprom = malloc(p->size);
+		memset(p->eeprom, 0xff, p->size);
+	}
 	
 	avr_register_io(avr, &p->io);
 	avr_register_vector(avr, &p->ready);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_EEPROM_GET);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_EEPROM_SET);
 
 	avr_register_io_write(avr, p->r_eecr, avr_eeprom_write, p);
 }
@@ -33,6 +33,7 @@ typedef struct avr_eeprom_t {
 
 	uint8_t *	eeprom;	// actual bytes
 	uint16_t	size;	// size for this MCU
+	struct avr_file_map_t * map;	// set if avr->eeprom_file is used
 	
 	uint8_t r_eearh;
 	uint8_t r_eearl;
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "avr_flash.h"
+#include "sim_file_map.h"
+#include "sim_core.h"
 
 static avr_cycle_count_t avr_progen_clear(struct avr_t * avr, avr_cycle_count_t when, void * param)
 {
@@ -64,15 +66,22 @@ static int avr_flash_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_param
 	if (avr_regbit_get(avr, p->pgers)) {
 		z &= ~1;
 		AVR_LOG(avr, LOG_TRACE, "FLASH: Erasing page %04x (%d)\n", (z / p->spm_pagesize), p->spm_pagesize);
+		if (avr->flash_map)
+			avr_file_map_dirty(avr->flash_map, z, p->spm_pagesize);
+		avr_superinsn_flush(avr, z, p->spm_pagesize);
 		for (int i = 0; i < p->spm_pagesize; i++)
 			avr->flash[z++] = 0xff;
 	} else if (avr_regbit_get(avr, p->pgwrt)) {
 		z &= ~1;
 		AVR_LOG(avr, LOG_TRACE, "FLASH: Writing page %04x (%d)\n", (z / p->spm_pagesize), p->spm_pagesize);
+		// the buffer writes went straight to flash, the page is complete now
+		if (avr->flash_map)
+			avr_file_map_dirty(avr->flash_map, z & ~(p->spm_pagesize - 1), p->spm_pagesize);
 	} else if (avr_regbit_get(avr, p->blbset)) {
 		AVR_LOG(avr, LOG_TRACE, "FLASH: Setting lock bits (ignored)\n");
 	} else {
 		z &= ~1;
+		avr_superinsn_flush(avr, z, 2);
 		avr->flash[z++] = r01;
 		avr->flash[z] = r01 >> 8;
 	}
@@ -91,6 +100,7 @@ void avr_flash_init(avr_t * avr, avr_flash_t * p)
 
 	avr_register_io(avr, &p->io);
 	avr_register_vector(avr, &p->flash);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_FLASH_SPM);
 
 	avr_register_io_write(avr, p->r_spm, avr_flash_write, p);
 }
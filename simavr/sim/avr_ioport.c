@@ -189,6 +189,20 @@ avr_ioport_ioctl(
 				return o;
 			}
 		}	break;
+		case AVR_IOCTL_IOPORT_WATCHED: {
+			avr_ioport_getirq_t * r = (avr_ioport_getirq_t*)io_param;
+
+			if (r->bit.reg != p->r_port && r->bit.reg != p->r_pin && r->bit.reg != p->r_ddr)
+				break;
+			uint8_t mask = r->bit.mask << r->bit.bit;
+			res = (p->r_pcint && (avr->data[p->r_pcint] & mask)) ||
+					avr_irq_hook_count(&p->io.irq[IOPORT_IRQ_PIN_ALL]) ||
+					avr_irq_hook_count(&p->io.irq[IOPORT_IRQ_REG_PORT]);
+			// our own notify is always there
+			for (int bi = 0; bi < 8 && !res; bi++)
+				if (mask & (1 << bi))
+					res = avr_irq_hook_count(&p->io.irq[bi]) > 1;
+		}	break;
 		default: {
 			/*
 			 * Return the port state if the IOCTL matches us.
@@ -253,12 +267,20 @@ void avr_ioport_init(avr_t * avr, avr_ioport_t * p)
 	avr_register_vector(avr, &p->pcint);
 	// allocate this module's IRQ
 	avr_io_setirqs(&p->io, AVR_IOCTL_IOPORT_GETIRQ(p->name), IOPORT_IRQ_COUNT, NULL);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_IOPORT_GETIRQ_REGBIT);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_IOPORT_WATCHED);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_IOPORT_GETSTATE(p->name));
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_IOPORT_SET_EXTERNAL(p->name));
 
-	for (int i = 0; i < IOPORT_IRQ_COUNT; i++)
+	// a new hook changes what AVR_IOCTL_IOPORT_WATCHED returns
+	for (int i = 0; i < IOPORT_IRQ_COUNT; i++) {
 		p->io.irq[i].flags |= IRQ_FLAG_FILTERED;
+		avr_irq_watch_hooks(&p->io.irq[i]);
+	}
 
 	avr_register_io_write(avr, p->r_port, avr_ioport_write, p);
 	avr_register_io_read(avr, p->r_pin, avr_ioport_read, p);
+	avr_io_set_read_stable(avr, p->r_pin, 1);
 	avr_register_io_write(avr, p->r_pin, avr_ioport_pin_write, p);
 	avr_register_io_write(avr, p->r_ddr, avr_ioport_ddr_write, p);
 }
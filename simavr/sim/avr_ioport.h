@@ -54,6 +54,11 @@ typedef struct avr_ioport_getirq_t {
 
 #define AVR_IOCTL_IOPORT_GETIRQ_REGBIT AVR_IOCTL_DEF('i','o','g','r')
 
+// takes the same avr_ioport_getirq_t, returns 1 if a change of these pins
+// would be seen by anything else than the port itself: a hook on the pins
+// or on the port IRQs, or a pin change interrupt; 0 if not
+#define AVR_IOCTL_IOPORT_WATCHED AVR_IOCTL_DEF('i','o','w','r')
+
 /*
  * ioctl used to get a port state.
  *
@@ -59,13 +59,14 @@ avr_lin_baud_write(
 	uint32_t lbrr = (avr->data[p->r_linbrrh] << 8) | avr->data[p->r_linbrrl];
 	AVR_LOG(avr, LOG_TRACE, "LIN: UART LBT/LBRR to %04x/%04x\n", lbt, lbrr);
 	uint32_t baud = avr->frequency / (lbt * (lbrr + 1));
-	uint32_t word_size = 1 /*start*/+ 8 /*data bits*/+ 1 /*parity*/+ 1 /*stop*/;
+	uint32_t word_size = 1 /*start*/+ 8 /*data bits*/+ 1 /*stop*/;
 
 	AVR_LOG(avr, LOG_TRACE, "LIN: UART configured to %04x/%04x = %d bps, 8 data 1 stop\n", lbt,
 	        lbrr, baud);
 
-	p->uart.usec_per_byte = 1000000 / (baud / word_size);
-	AVR_LOG(avr, LOG_TRACE, "LIN: Roughly %d usec per bytes\n", (int) p->uart.usec_per_byte);
+	// a bit is LBT samples of LINBRR + 1 cycles
+	p->uart.cycles_per_byte = (avr_cycle_count_t)lbt * (lbrr + 1) * word_size;
+	AVR_LOG(avr, LOG_TRACE, "LIN: %d cycles per byte\n", (int) p->uart.cycles_per_byte);
 }
 
 static void
@@ -3,8 +3,10 @@
 
 	Handles the 8 bits and 16 bits AVR timer.
 	Handles
-	+ CDC
+	+ Normal and CTC
 	+ Fast PWM
+	+ Phase correct and phase and frequency correct PWM
+	+ Input capture
 
 	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
 
@@ -25,6 +27,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "avr_timer.h"
 #include "avr_ioport.h"
 #include "sim_time.h"
@@ -38,12 +41,6 @@ static uint16_t _timer_get_ocr(avr_timer_t * p, int compi)
 	return p->io.avr->data[p->comp[compi].r_ocr] |
 		      (p->comp[compi].r_ocrh ? (p->io.avr->data[p->comp[compi].r_ocrh] << 8) : 0);
 }
-static uint16_t _timer_get_comp_ocr(struct avr_t * avr, avr_timer_comp_p comp)
-{
-	int ocrh = comp->r_ocrh;
-	return avr->data[comp->r_ocr] |
-		(ocrh ? (avr->data[ocrh] << 8) : 0);
-}
 static uint16_t _timer_get_tcnt(avr_timer_t * p)
 {
 	return p->io.avr->data[p->r_tcnt] |
@@ -52,92 +49,548 @@ static uint16_t _timer_get_tcnt(avr_timer_t * p)
 static uint16_t _timer_get_icr(avr_timer_t * p)
 {
 	return p->io.avr->data[p->r_icr] |
-				(p->r_tcnth ? (p->io.avr->data[p->r_icrh] << 8) : 0);
+				(p->r_icrh ? (p->io.avr->data[p->r_icrh] << 8) : 0);
+}
+
+/*
+ * The modes a core doesn't list come from the usual tables, all the 8 and
+ * 16 bits timers with WGM bits number them that way
+ */
+static const avr_timer_wgm_t avr_timer_wgm8[8] = {
+	[0] = AVR_TIMER_WGM_NORMAL8(),
+	[1] = AVR_TIMER_WGM_FCPWM8(),
+	[2] = AVR_TIMER_WGM_CTC(),
+	[3] = AVR_TIMER_WGM_FASTPWM8(),
+	[5] = AVR_TIMER_WGM_OCFCPWM(),
+	[7] = AVR_TIMER_WGM_OCPWM(),
+};
+static const avr_timer_wgm_t avr_timer_wgm16[16] = {
+	[0] = AVR_TIMER_WGM_NORMAL16(),
+	[1] = AVR_TIMER_WGM_FCPWM8(),
+	[2] = AVR_TIMER_WGM_FCPWM9(),
+	[3] = AVR_TIMER_WGM_FCPWM10(),
+	[4] = AVR_TIMER_WGM_CTC(),
+	[5] = AVR_TIMER_WGM_FASTPWM8(),
+	[6] = AVR_TIMER_WGM_FASTPWM9(),
+	[7] = AVR_TIMER_WGM_FASTPWM10(),
+	[8] = AVR_TIMER_WGM_ICPFCPWM(),
+	[9] = AVR_TIMER_WGM_OCPFCPWM(),
+	[10] = AVR_TIMER_WGM_ICFCPWM(),
+	[11] = AVR_TIMER_WGM_OCFCPWM(),
+	[12] = AVR_TIMER_WGM_ICCTC(),
+	[14] = AVR_TIMER_WGM_ICPWM(),
+	[15] = AVR_TIMER_WGM_OCPWM(),
+};
+
+static avr_timer_wgm_t avr_timer_get_mode(avr_timer_t * p)
+{
+	uint8_t mode = avr_regbit_get_array(p->io.avr, p->wgm, ARRAY_SIZE(p->wgm));
+	if (p->wgm_op[mode].kind != avr_timer_wgm_none)
+		return p->wgm_op[mode];
+	return p->r_tcnth ? avr_timer_wgm16[mode & 15] : avr_timer_wgm8[mode & 7];
+}
+
+static uint32_t avr_timer_max(avr_timer_t * p)
+{
+	return p->r_tcnth ? 0xffff : 0xff;
+}
+
+static uint32_t avr_timer_top(avr_timer_t * p)
+{
+	switch (p->mode.top) {
+		case avr_timer_wgm_reg_ocra:
+			return p->comp[AVR_TIMER_COMPA].ocr;
+		case avr_timer_wgm_reg_icr:
+			return _timer_get_icr(p);
+	}
+	return p->mode.size ? (1 << p->mode.size) - 1 : avr_timer_max(p);
+}
+
+// counts up to TOP and back down to BOTTOM
+static int avr_timer_dual(avr_timer_t * p, uint32_t top)
+{
+	return top && (p->mode.kind == avr_timer_wgm_fc_pwm ||
+			p->mode.kind == avr_timer_wgm_pfc_pwm);
+}
+
+// OCR is double buffered in the PWM modes
+static int avr_timer_buffered(avr_timer_t * p)
+{
+	return p->mode.kind >= avr_timer_wgm_pwm;
+}
+
+// single slope PWM, the compare outputs change at BOTTOM too
+static int avr_timer_fast(avr_timer_t * p)
+{
+	return p->mode.kind == avr_timer_wgm_pwm || p->mode.kind == avr_timer_wgm_fast_pwm;
+}
+
+static uint64_t avr_timer_period(avr_timer_t * p, uint32_t top)
+{
+	return avr_timer_dual(p, top) ? 2 * top : top + 1;
+}
+
+static avr_cycle_count_t avr_timer_tick_cycle(avr_timer_t * p, uint64_t tick)
+{
+	return p->origin + tick * p->tick_num / p->tick_den;
+}
+
+// last tick at or before 'cycle'
+static uint64_t avr_timer_cycle_tick(avr_timer_t * p, avr_cycle_count_t cycle)
+{
+	return ((cycle - p->origin + 1) * p->tick_den - 1) / p->tick_num;
+}
+
+/*
+ * Where a counter at 'c' gets to after 'n' ticks. Above TOP, it counts up
+ * to MAX and wraps around to BOTTOM; or when counting down, it goes on down
+ * to TOP and joins the usual slope.
+ */
+static void avr_timer_count(avr_timer_t * p, uint64_t n, uint16_t * tcnt, uint8_t * down)
+{
+	uint32_t top = avr_timer_top(p), max = avr_timer_max(p), c = *tcnt;
+	int dual = avr_timer_dual(p, top);
+	if (!n)
+		return;
+	if (!dual)
+		*down = 0;
+	if (c > top && !*down) {
+		if (n <= max - c) {
+			*tcnt = c + n;
+			return;
+		}
+		n -= max - c + 1;
+		c = 0;
+	} else if (c > top) {
+		if (n <= c - top) {
+			*tcnt = c - n;
+			return;
+		}
+		n -= c - top;
+		c = top;
+	}
+	if (!dual) {
+		*tcnt = (c + n) % (top + 1);
+		return;
+	}
+	uint64_t period = 2 * top;
+	uint64_t pos = ((*down && c ? period - c : c) + n) % period;
+	*down = pos > top;
+	*tcnt = *down ? period - pos : pos;
+}
+
+// ticks until a counter at 'c' goes past 'v', 0 if it never does
+static uint64_t avr_timer_ticks_to(avr_timer_t * p, uint32_t c, uint8_t down, uint32_t v)
+{
+	uint32_t top = avr_timer_top(p), max = avr_timer_max(p);
+	int dual = avr_timer_dual(p, top);
+	uint64_t n = 0;
+	if (!dual)
+		down = 0;
+	if (c > top && !down) {
+		if (v >= c)
+			return v - c + 1;
+		n = max - c + 1;
+		c = 0;
+	} else if (c > top) {
+		if (v > top)
+			return v <= c ? c - v + 1 : 0;
+		n = c - top;
+		c = top;
+	}
+	if (v > top)
+		return 0;
+	if (!dual)
+		return n + (v + top + 1 - c) % (top + 1) + 1;
+	uint64_t period = 2 * top;
+	uint64_t pos = down && c ? period - c : c;
+	uint64_t t = (v + period - pos) % period + 1;
+	if (v && v < top) {	// on the way down too
+		uint64_t t2 = (2 * period - v - pos) % period + 1;
+		if (t2 < t)
+			t = t2;
+	}
+	return n + t;
+}
+
+static int avr_timer_vector_idle(avr_t * avr, avr_int_vector_t * vector)
+{
+	return !avr_regbit_get(avr, vector->enable) && !vector->irq.hook && !vector->trace;
+}
+
+// somebody sees the flag of 'vector' when it's raised
+static int avr_timer_flag_seen(avr_timer_t * p, avr_int_vector_t * vector)
+{
+	return p->shared_tifr || !avr_timer_vector_idle(p->io.avr, vector);
 }
-static avr_cycle_count_t avr_timer_comp(avr_timer_t *p, avr_cycle_count_t when, uint8_t comp)
+
+// somebody looks at the edges of the output of comparator 'compi'
+static int avr_timer_edges_seen(avr_timer_t * p, int compi)
+{
+	avr_ioport_getirq_t req = {
+		.bit = p->comp[compi].com_pin
+	};
+	// the pin, if there is one, is connected to the output IRQ
+	int pin = req.bit.reg ? avr_ioctl(p->io.avr, AVR_IOCTL_IOPORT_WATCHED, &req) : -1;
+	return pin > 0 ||
+			avr_irq_hook_count(p->io.irq + TIMER_IRQ_OUT_COMP + compi) > (pin == 0);
+}
+
+static int avr_timer_comp_seen(avr_timer_t * p, int compi)
+{
+	return avr_timer_flag_seen(p, &p->comp[compi].interrupt) ||
+			(avr_regbit_get(p->io.avr, p->comp[compi].com) != avr_timer_com_normal &&
+					avr_timer_edges_seen(p, compi));
+}
+
+// all the flags are raised on time, polling TIFR doesn't change them
+static int avr_timer_flags_seen(avr_timer_t * p)
+{
+	if (!avr_timer_flag_seen(p, &p->overflow))
+		return 0;
+	if (p->mode.top == avr_timer_wgm_reg_icr && !avr_timer_flag_seen(p, &p->icr))
+		return 0;
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+		if (p->comp[compi].r_ocr && !avr_timer_comp_seen(p, compi))
+			return 0;
+	return 1;
+}
+
+static void avr_timer_next_min(uint64_t * next, uint64_t n)
+{
+	if (n && (!*next || n < *next))
+		*next = n;
+}
+
+/*
+ * Ticks to the next event, 0 if there is none; with 'all' the flags
+ * nobody waits for count too
+ */
+static uint64_t avr_timer_next(avr_timer_t * p, int all)
+{
+	avr_t * avr = p->io.avr;
+	uint32_t top = avr_timer_top(p), max = avr_timer_max(p);
+	uint64_t next = 0;
+
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
+		if (!p->comp[compi].r_ocr || !(all || avr_timer_comp_seen(p, compi)))
+			continue;
+		uint64_t n = avr_timer_ticks_to(p, p->tcnt, p->down, p->comp[compi].ocr);
+		if (n == 1 && p->block) {	// that one is blocked, take the next one
+			uint16_t c = p->tcnt;
+			uint8_t down = p->down;
+			avr_timer_count(p, 1, &c, &down);
+			n = avr_timer_ticks_to(p, c, down, p->comp[compi].ocr);
+			n = n ? n + 1 : 0;
+		}
+		avr_timer_next_min(&next, n);
+	}
+	if (all || avr_timer_flag_seen(p, &p->overflow)) {
+		if (avr_timer_dual(p, top))
+			avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, 0));
+		else if (avr_timer_fast(p))
+			avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, top));
+		else
+			avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, max));
+	}
+	int at_top = p->mode.top == avr_timer_wgm_reg_icr && (all || avr_timer_flag_seen(p, &p->icr));
+	if (avr_timer_fast(p)) {
+		at_top |= p->pending;
+		for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+			at_top |= avr_regbit_get(avr, p->comp[compi].com) >= avr_timer_com_clear;
+	} else if (p->mode.kind == avr_timer_wgm_fc_pwm)
+		at_top |= p->pending;
+	else if (p->mode.kind == avr_timer_wgm_pfc_pwm && p->pending)
+		avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, 0));
+	if (at_top)
+		avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, top));
+	// wrapping around from above TOP
+	if (p->tcnt > top && !(avr_timer_dual(p, top) && p->down))
+		avr_timer_next_min(&next, avr_timer_ticks_to(p, p->tcnt, p->down, max));
+	return next;
+}
+
+static uint32_t avr_timer_ticks_cycles(avr_timer_t * p, uint64_t ticks)
+{
+	return (ticks * p->tick_num + p->tick_den / 2) / p->tick_den;
+}
+
+// the waveform of the output of comparator 'compi', with these settings
+static void avr_timer_pwm_get(avr_timer_t * p, int compi, avr_timer_pwm_t * pwm)
+{
+	avr_t * avr = p->io.avr;
+	uint8_t mode = avr_regbit_get(avr, p->comp[compi].com);
+	uint32_t top = avr_timer_top(p), ocr = p->comp[compi].ocr;
+	int dual = avr_timer_dual(p, top);
+	uint64_t period, high;
+
+	memset(pwm, 0, sizeof(*pwm));
+	pwm->comp = compi;
+	pwm->inverted = mode == avr_timer_com_set;
+	// unless it says otherwise, it stays as it is
+	pwm->level = p->io.irq[TIMER_IRQ_OUT_COMP + compi].value & 1;
+	if (!p->tick_num || mode == avr_timer_com_normal)
+		return;
+	if (avr_timer_fast(p) && mode != avr_timer_com_toggle) {
+		// set at BOTTOM, cleared at the match, unless that's TOP
+		period = top + 1;
+		high = ocr >= top ? period : ocr + 1;
+	} else if (ocr > top)	// never matches
+		return;
+	else if (mode == avr_timer_com_toggle) {
+		// a square wave if it matches once per period
+		if (avr_timer_buffered(p) &&
+				(compi != AVR_TIMER_COMPA || p->mode.top == avr_timer_wgm_reg_constant))
+			return;
+		if (dual && ocr && ocr < top)
+			return;
+		period = 2 * avr_timer_period(p, top);
+		high = period / 2;
+	} else if (dual) {
+		period = 2 * top;
+		high = 2 * ocr;
+	} else {	// set or cleared at the first match
+		pwm->level = pwm->inverted;
+		return;
+	}
+	if (pwm->inverted)
+		high = period - high;
+	pwm->level = high != 0;
+	if (!high || high == period)
+		return;
+	pwm->period = avr_timer_ticks_cycles(p, period);
+	pwm->duty = avr_timer_ticks_cycles(p, high);
+}
+
+// tells whoever wants to know about the waveforms that changed
+static void avr_timer_pwm_update(avr_timer_t * p)
+{
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
+		avr_timer_pwm_t pwm, * old = &p->comp[compi].pwm;
+		if (!p->comp[compi].r_ocr)
+			continue;
+		avr_timer_pwm_get(p, compi, &pwm);
+		if (pwm.inverted == old->inverted && pwm.level == old->level &&
+				pwm.period == old->period && pwm.duty == old->duty)
+			continue;
+		*old = pwm;
+		avr_raise_irq(p->io.irq + TIMER_IRQ_OUT_PWM + compi,
+				pwm.period ? (uint64_t)pwm.duty * 0x10000 / pwm.period :
+						pwm.level ? 0x10000 : 0);
+	}
+}
+
+// the OCR buffers get to the compare units
+static void avr_timer_update_ocr(avr_timer_t * p)
+{
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+		if (p->comp[compi].r_ocr)
+			p->comp[compi].ocr = _timer_get_ocr(p, compi);
+	p->pending = 0;
+	if (p->tick_num)
+		avr_timer_pwm_update(p);
+	if (!avr_timer_buffered(p))
+		return;
+	if (p->mode.top != avr_timer_wgm_reg_ocra)
+		avr_raise_irq(p->io.irq + TIMER_IRQ_OUT_PWM0, p->comp[AVR_TIMER_COMPA].ocr);
+	avr_raise_irq(p->io.irq + TIMER_IRQ_OUT_PWM1, p->comp[AVR_TIMER_COMPB].ocr);
+}
+
+static void avr_timer_comp_out(avr_timer_t * p, int comp, int value)
+{
+	avr_t * avr = p->io.avr;
+	avr_irq_t * irq = &p->io.irq[TIMER_IRQ_OUT_COMP + comp];
+
+	if (value >= 0) {
+		avr_raise_irq(irq, value);
+		return;
+	}
+	if (p->comp[comp].com_pin.reg)	// we got a physical pin
+		avr_raise_irq(irq,
+				AVR_IOPORT_OUTPUT | (avr_regbit_get(avr, p->comp[comp].com_pin) ? 0 : 1));
+	else // no pin, toggle the IRQ anyway
+		avr_raise_irq(irq, irq->value ? 0 : 1);
+}
+
+// compare match, 'down' if the counter is on its way down
+static void avr_timer_comp(avr_timer_t * p, int comp, int down)
 {
 	avr_t * avr = p->io.avr;
 	avr_raise_interrupt(avr, &p->comp[comp].interrupt);
 
 	// check output compare mode and set/clear pins
 	uint8_t mode = avr_regbit_get(avr, p->comp[comp].com);
-	avr_irq_t * irq = &p->io.irq[TIMER_IRQ_OUT_COMP + comp];
+	int pwm = avr_timer_buffered(p);
 
 	switch (mode) {
 		case avr_timer_com_normal: // Normal mode OCnA disconnected
 			break;
 		case avr_timer_com_toggle: // Toggle OCnA on compare match
-			if (p->comp[comp].com_pin.reg)	// we got a physical pin
-				avr_raise_irq(irq,
-						AVR_IOPORT_OUTPUT | (avr_regbit_get(avr, p->comp[comp].com_pin) ? 0 : 1));
-			else // no pin, toggle the IRQ anyway
-				avr_raise_irq(irq,
-						p->io.irq[TIMER_IRQ_OUT_COMP + comp].value ? 0 : 1);
+			// in PWM modes, only OCnA toggles, and only with a variable TOP
+			if (!pwm || (comp == AVR_TIMER_COMPA && p->mode.top != avr_timer_wgm_reg_constant))
+				avr_timer_comp_out(p, comp, -1);
 			break;
 		case avr_timer_com_clear:
-			avr_raise_irq(irq, 0);
+			avr_timer_comp_out(p, comp, down);
 			break;
 		case avr_timer_com_set:
-			avr_raise_irq(irq, 1);
+			avr_timer_comp_out(p, comp, !down);
 			break;
 	}
-
-	return p->tov_cycles ? 0 :
-				p->comp[comp].comp_cycles ?
-						when + p->comp[comp].comp_cycles : 0;
 }
 
-static avr_cycle_count_t avr_timer_compa(struct avr_t * avr, avr_cycle_count_t when, void * param)
+// one tick of the counter, with what happens as it leaves its value
+static void avr_timer_tick(avr_timer_t * p)
 {
-	return avr_timer_comp((avr_timer_t*)param, when, AVR_TIMER_COMPA);
+	avr_t * avr = p->io.avr;
+	uint32_t top = avr_timer_top(p), max = avr_timer_max(p);
+	uint32_t c = p->tcnt;
+	int dual = avr_timer_dual(p, top);
+	int above = c > top && !(dual && p->down);
+	int at_top = c == top && !(dual && p->down);
+	int down = dual && c && (p->down || c == top);
+	// the counter goes back to BOTTOM, from TOP or from MAX
+	int wrap = above ? c == max : !dual && at_top;
+	int block = p->block;
+
+	avr_timer_count(p, 1, &p->tcnt, &p->down);
+	p->block = 0;
+	p->base++;
+
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+		if (p->comp[compi].r_ocr && p->comp[compi].ocr == c && !block)
+			avr_timer_comp(p, compi, down);
+
+	int tov;
+	if (dual)
+		tov = !c || wrap;
+	else if (avr_timer_fast(p))
+		tov = wrap;
+	else
+		tov = c == max;
+	if (tov)
+		avr_raise_interrupt(avr, &p->overflow);
+	if (at_top && p->mode.top == avr_timer_wgm_reg_icr)
+		avr_raise_interrupt(avr, &p->icr);
+
+	if (avr_timer_fast(p) && wrap) {
+		// non inverting outputs are set at BOTTOM, inverting ones cleared
+		for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
+			uint8_t mode = avr_regbit_get(avr, p->comp[compi].com);
+			if (mode >= avr_timer_com_clear)
+				avr_timer_comp_out(p, compi, mode == avr_timer_com_clear);
+		}
+	}
+	if (p->pending) {
+		// fast PWM and phase and frequency correct update OCR at BOTTOM, phase correct at TOP
+		if ((avr_timer_fast(p) && wrap) ||
+				(p->mode.kind == avr_timer_wgm_fc_pwm && at_top) ||
+				(p->mode.kind == avr_timer_wgm_pfc_pwm && !c))
+			avr_timer_update_ocr(p);
+	}
 }
 
-static avr_cycle_count_t avr_timer_compb(struct avr_t * avr, avr_cycle_count_t when, void * param)
+/*
+ * Brings the counter and the flags up to 'when': goes through the events
+ * since it was last looked at, including the ones that weren't scheduled
+ */
+static void avr_timer_run(avr_timer_t * p, avr_cycle_count_t when)
 {
-	return avr_timer_comp((avr_timer_t*)param, when, AVR_TIMER_COMPB);
+	if (!p->tick_num || when < p->origin)
+		return;
+	uint64_t last = avr_timer_cycle_tick(p, when);
+	// the counter repeats itself after 'from', as long as it's set
+	uint64_t from = 0;
+	int periodic = 0;
+
+	while (p->base < last) {
+		uint64_t n = avr_timer_next(p, 1);
+		if (!n || n > last - p->base) {
+			avr_timer_count(p, last - p->base, &p->tcnt, &p->down);
+			p->block = 0;
+			p->base = last;
+			break;
+		}
+		if (n > 1) {
+			avr_timer_count(p, n - 1, &p->tcnt, &p->down);
+			p->block = 0;
+			p->base += n - 1;
+		}
+		avr_timer_tick(p);
+		/*
+		 * Once the counter is between BOTTOM and TOP with nothing pending,
+		 * after a whole period the next ones are the same
+		 */
+		uint32_t top = avr_timer_top(p);
+		if (p->pending || p->tcnt > top) {
+			periodic = 0;
+			continue;
+		}
+		if (!periodic) {
+			periodic = 1;
+			from = p->base;
+			continue;
+		}
+		uint64_t period = avr_timer_period(p, top);
+		// a toggling output takes two
+		for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+			if (avr_regbit_get(p->io.avr, p->comp[compi].com) == avr_timer_com_toggle)
+				period = 2 * avr_timer_period(p, top);
+		if (p->base - from > period) {
+			p->base += (last - p->base) / period * period;
+			from = p->base;
+		}
+	}
+	// keep the numbers small
+	if (p->base >= p->tick_den) {
+		uint64_t q = p->base / p->tick_den;
+		p->origin += q * p->tick_num;
+		p->base -= q * p->tick_den;
+	}
 }
 
-static avr_cycle_count_t avr_timer_compc(struct avr_t * avr, avr_cycle_count_t when, void * param)
+static avr_cycle_count_t avr_timer_next_cycle(avr_timer_t * p)
 {
-	return avr_timer_comp((avr_timer_t*)param, when, AVR_TIMER_COMPC);
+	if (!p->tick_num)
+		return 0;
+	uint64_t n = avr_timer_next(p, 0);
+	return n ? avr_timer_tick_cycle(p, p->base + n) : 0;
 }
 
-// timer overflow
-static avr_cycle_count_t avr_timer_tov(struct avr_t * avr, avr_cycle_count_t when, void * param)
+static avr_cycle_count_t avr_timer_event(struct avr_t * avr, avr_cycle_count_t when, void * param)
 {
 	avr_timer_t * p = (avr_timer_t *)param;
-	int start = p->tov_base == 0;
-
-	if (!start)
-		avr_raise_interrupt(avr, &p->overflow);
-	p->tov_base = when;
-
-	static const avr_cycle_timer_t dispatch[AVR_TIMER_COMP_COUNT] =
-		{ avr_timer_compa, avr_timer_compb, avr_timer_compc };
-
-	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
-		if (p->comp[compi].comp_cycles) {
-			if (p->comp[compi].comp_cycles < p->tov_cycles)
-				avr_cycle_timer_register(avr,
-					p->comp[compi].comp_cycles,
-					dispatch[compi], p);
-			else if (p->tov_cycles == p->comp[compi].comp_cycles && !start)
-				dispatch[compi](avr, when, param);
-		}
-	}
+	avr_timer_run(p, when);
+	// what it raised might have rescheduled it already
+	avr_cycle_timer_cancel(avr, avr_timer_event, p);
+	return avr_timer_next_cycle(p);
+}
 
-	return when + p->tov_cycles;
+// one cycle timer, for the next event anybody would see; the timer is up to date
+static void avr_timer_schedule(avr_timer_t * p)
+{
+	avr_t * avr = p->io.avr;
+	avr_timer_pwm_update(p);
+	avr_cycle_count_t when = avr_timer_next_cycle(p);
+
+	if (when)
+		avr_cycle_timer_register(avr, when - avr->cycle, avr_timer_event, p);
+	else
+		avr_cycle_timer_cancel(avr, avr_timer_event, p);
+	if (!p->shared_tifr)
+		avr_io_set_read_stable(avr, p->overflow.raised.reg,
+				!p->tick_num || avr_timer_flags_seen(p));
 }
 
 static uint16_t _avr_timer_get_current_tcnt(avr_timer_t * p)
 {
 	avr_t * avr = p->io.avr;
-	if (p->tov_cycles) {
-		uint64_t when = avr->cycle - p->tov_base;
-
-		return (when * (((uint32_t)p->tov_top)+1)) / p->tov_cycles;
-	}
-	return 0;
+	uint16_t c = p->tcnt;
+	uint8_t down = p->down;
+	// nothing that changes the count was left for later
+	if (p->tick_num)
+		avr_timer_count(p, avr_timer_cycle_tick(p, avr->cycle) - p->base, &c, &down);
+	return c;
 }
 
 static uint8_t avr_timer_tcnt_read(struct avr_t * avr, avr_io_addr_t addr, void * param)
@@ -154,177 +607,109 @@ static uint8_t avr_timer_tcnt_read(struct avr_t * avr, avr_io_addr_t addr, void
 	return avr_core_watch_read(avr, addr);
 }
 
-static void avr_timer_cancel_all_cycle_timers(struct avr_t * avr, avr_timer_t *timer) {
-	avr_cycle_timer_cancel(avr, avr_timer_tov, timer);
-	avr_cycle_timer_cancel(avr, avr_timer_compa, timer);
-	avr_cycle_timer_cancel(avr, avr_timer_compb, timer);
-	avr_cycle_timer_cancel(avr, avr_timer_compc, timer);
+static uint8_t avr_timer_tifr_read(struct avr_t * avr, avr_io_addr_t addr, void * param)
+{
+	avr_timer_run((avr_timer_t *)param, avr->cycle);
+	return avr_core_watch_read(avr, addr);
 }
 
 static void avr_timer_tcnt_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
 {
 	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, avr->cycle);
 	avr_core_watch_write(avr, addr, v);
-	uint16_t tcnt = _timer_get_tcnt(p);
-
-	if (!p->tov_top)
-		return;
-		
-	if (tcnt >= p->tov_top)
-		tcnt = 0;
-	
-	// this involves some magicking
-	// cancel the current timers, recalculate the "base" we should be at, reset the
-	// timer base as it should, and re-schedule the timers using that base.
-	
-	avr_timer_cancel_all_cycle_timers(avr, p);
-
-	uint64_t cycles = (tcnt * p->tov_cycles) / p->tov_top;
-
-//	printf("%s-%c %d/%d -- cycles %d/%d\n", __FUNCTION__, p->name, tcnt, p->tov_top, (uint32_t)cycles, (uint32_t)p->tov_cycles);
-
-	// this reset the timers bases to the new base
-	if (p->tov_cycles > 1) {
-		avr_cycle_timer_register(avr, p->tov_cycles - cycles, avr_timer_tov, p);
-		p->tov_base = 0;
-		avr_timer_tov(avr, avr->cycle - cycles, p);
-	}
 
-//	tcnt = ((avr->cycle - p->tov_base) * p->tov_top) / p->tov_cycles;
-//	printf("%s-%c new tnt derive to %d\n", __FUNCTION__, p->name, tcnt);	
+	// it counts on from there, with the next compare match blocked
+	p->tcnt = _timer_get_tcnt(p);
+	if (!avr_timer_dual(p, avr_timer_top(p)))
+		p->down = 0;
+	p->block = 1;
+	avr_timer_schedule(p);
 }
 
-static void avr_timer_configure(avr_timer_t * p, uint32_t clock, uint32_t top)
+static uint64_t avr_timer_gcd(uint64_t a, uint64_t b)
 {
-	float t = clock / (float)(top+1);
-	float frequency = p->io.avr->frequency;
-
-	p->tov_cycles = 0;
-	p->tov_top = top;
-
-	p->tov_cycles = frequency / t; // avr_hz_to_cycles(frequency, t);
-
-	AVR_LOG(p->io.avr, LOG_TRACE, "TIMER: %s-%c TOP %.2fHz = %d cycles = %dusec\n",
-			__FUNCTION__, p->name, t, (int)p->tov_cycles,
-			(int)avr_cycles_to_usec(p->io.avr, p->tov_cycles));
-
-	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
-		if (!p->comp[compi].r_ocr)
-			continue;
-		uint32_t ocr = _timer_get_ocr(p, compi);
-		float fc = clock / (float)(ocr+1);
-
-		p->comp[compi].comp_cycles = 0;
-	//	printf("%s-%c clock %d top %d OCR%c %d\n", __FUNCTION__, p->name, clock, top, 'A'+compi, ocr);
-
-		if (ocr && ocr <= top) {
-			p->comp[compi].comp_cycles = frequency / fc; // avr_hz_to_cycles(p->io.avr, fa);
-			AVR_LOG(p->io.avr, LOG_TRACE, "TIMER: %s-%c %c %.2fHz = %d cycles\n", 
-					__FUNCTION__, p->name,
-					'A'+compi, fc, (int)p->comp[compi].comp_cycles);
-		}
-	}
-
-	if (p->tov_cycles > 1) {
-		avr_cycle_timer_register(p->io.avr, p->tov_cycles, avr_timer_tov, p);
-		// calling it once, with when == 0 tells it to arm the A/B/C timers if needed
-		p->tov_base = 0;
-		avr_timer_tov(p->io.avr, p->io.avr->cycle, p);
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
 	}
+	return a;
 }
 
 static void avr_timer_reconfigure(avr_timer_t * p)
 {
 	avr_t * avr = p->io.avr;
+	avr_timer_wgm_t old = p->mode;
+	int running = p->tick_num != 0;
 
-	avr_timer_wgm_t zero={0};
-	p->mode = zero;
-	// cancel everything
-	p->comp[AVR_TIMER_COMPA].comp_cycles = 0;
-	p->comp[AVR_TIMER_COMPB].comp_cycles = 0;
-	p->comp[AVR_TIMER_COMPC].comp_cycles = 0;
-	p->tov_cycles = 0;
-	
-	avr_timer_cancel_all_cycle_timers(avr, p);
-
-	long clock = avr->frequency;
+	p->mode = avr_timer_get_mode(p);
+	p->tick_num = 0;
 
 	// only can exists on "asynchronous" 8 bits timers
-	if (avr_regbit_get(avr, p->as2))
-		clock = 32768;
+	uint32_t clock = avr_regbit_get(avr, p->as2) ? 32768 : avr->frequency;
 
 	uint8_t cs = avr_regbit_get_array(avr, p->cs, ARRAY_SIZE(p->cs));
 	if (cs == 0) {
 		AVR_LOG(avr, LOG_TRACE, "TIMER: %s-%c clock turned off\n", __FUNCTION__, p->name);
 		return;
 	}
-
-	uint8_t mode = avr_regbit_get_array(avr, p->wgm, ARRAY_SIZE(p->wgm));
-	uint8_t cs_div = p->cs_div[cs];
-	uint32_t f = clock >> cs_div;
-
-	p->mode = p->wgm_op[mode];
-	//printf("%s-%c clock %d, div %d(/%d) = %d ; mode %d\n", __FUNCTION__, p->name, clock, cs, 1 << cs_div, f, mode);
-	switch (p->mode.kind) {
-		case avr_timer_wgm_normal:
-			avr_timer_configure(p, f, (1 << p->mode.size) - 1);
-			break;
-		case avr_timer_wgm_fc_pwm:
-			avr_timer_configure(p, f, (1 << p->mode.size) - 1);
-			break;
-		case avr_timer_wgm_ctc: {
-			avr_timer_configure(p, f, _timer_get_ocr(p, AVR_TIMER_COMPA));
-		}	break;
-		case avr_timer_wgm_pwm: {
-			uint16_t top = p->mode.top == avr_timer_wgm_reg_ocra ? _timer_get_ocr(p, AVR_TIMER_COMPA) : _timer_get_icr(p);
-			avr_timer_configure(p, f, top);
-		}	break;
-		case avr_timer_wgm_fast_pwm:
-			avr_timer_configure(p, f, (1 << p->mode.size) - 1);
-			break;
-		default:
-			AVR_LOG(avr, LOG_WARNING, "TIMER: %s-%c unsupported timer mode wgm=%d (%d)\n",
-					__FUNCTION__, p->name, mode, p->mode.kind);
-	}	
+	if (p->mode.kind == avr_timer_wgm_none) {
+		AVR_LOG(avr, LOG_WARNING, "TIMER: %s-%c unsupported timer mode wgm=%d (%d)\n",
+				__FUNCTION__, p->name,
+				avr_regbit_get_array(avr, p->wgm, ARRAY_SIZE(p->wgm)), p->mode.kind);
+		return;
+	}
+	// the OCR buffers wait for TOP or BOTTOM in a counter running that way
+	if (!running || old.kind != p->mode.kind || old.top != p->mode.top)
+		avr_timer_update_ocr(p);
+
+	// cycles per tick, exactly, even with the 32kHz clock
+	uint64_t num = (uint64_t)avr->frequency << p->cs_div[cs], den = clock;
+	uint64_t gcd = avr_timer_gcd(num, den);
+	p->tick_num = num / gcd;
+	p->tick_den = den / gcd;
+	// the prescaler keeps running, the next tick is where it would be anyway
+	p->base = avr_timer_cycle_tick(p, avr->cycle);
+
+	uint32_t top = avr_timer_top(p);
+	if (!avr_timer_dual(p, top))
+		p->down = 0;
+	uint64_t period = avr_timer_period(p, top) * p->tick_num;
+	AVR_LOG(avr, LOG_TRACE, "TIMER: %s-%c TOP %d, %d/%d cycles per tick, period %d cycles = %dusec\n",
+			__FUNCTION__, p->name, top, (int)p->tick_num, (int)p->tick_den,
+			(int)(period / p->tick_den),
+			(int)avr_cycles_to_usec(avr, period / p->tick_den));
 }
 
 static void avr_timer_write_ocr(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
 {
 	avr_timer_comp_p comp = (avr_timer_comp_p)param;
 	avr_timer_t *timer = comp->timer;
-	uint16_t oldv;
 
-	/* check to see if the OCR values actually changed */
-	oldv = _timer_get_comp_ocr(avr, comp);
+	avr_timer_run(timer, avr->cycle);
 	avr_core_watch_write(avr, addr, v);
 
-	switch (timer->mode.kind) {
-		case avr_timer_wgm_normal:
-			avr_timer_reconfigure(timer);
-			break;
-		case avr_timer_wgm_fc_pwm:	// OCR is not used here
-			avr_timer_reconfigure(timer);
-			break;
-		case avr_timer_wgm_ctc:
-			avr_timer_reconfigure(timer);
-			break;
-		case avr_timer_wgm_pwm:
-			if (timer->mode.top != avr_timer_wgm_reg_ocra) {
-				avr_raise_irq(timer->io.irq + TIMER_IRQ_OUT_PWM0, _timer_get_ocr(timer, AVR_TIMER_COMPA));
-				avr_raise_irq(timer->io.irq + TIMER_IRQ_OUT_PWM1, _timer_get_ocr(timer, AVR_TIMER_COMPB));
-			}
-			break;
-		case avr_timer_wgm_fast_pwm:
-			if (oldv != _timer_get_comp_ocr(avr, comp))
-				avr_timer_reconfigure(timer);
-			avr_raise_irq(timer->io.irq + TIMER_IRQ_OUT_PWM0, _timer_get_ocr(timer, AVR_TIMER_COMPA));
-			avr_raise_irq(timer->io.irq + TIMER_IRQ_OUT_PWM1, _timer_get_ocr(timer, AVR_TIMER_COMPB));
-			break;
-		default:
-			AVR_LOG(avr, LOG_WARNING, "TIMER: %s-%c mode %d UNSUPPORTED\n", __FUNCTION__, timer->name, timer->mode.kind);
-			avr_timer_reconfigure(timer);
-			break;
-	}
+	// in the PWM modes, the new value waits in the buffer
+	if (avr_timer_buffered(timer) && timer->tick_num) {
+		timer->pending = 0;
+		for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+			if (timer->comp[compi].r_ocr &&
+					_timer_get_ocr(timer, compi) != timer->comp[compi].ocr)
+				timer->pending = 1;
+	} else
+		avr_timer_update_ocr(timer);
+	avr_timer_schedule(timer);
+}
+
+// ICR as TOP isn't buffered
+static void avr_timer_write_icr(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
+{
+	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, avr->cycle);
+	avr_core_watch_write(avr, addr, v);
+	if (p->mode.top == avr_timer_wgm_reg_icr)
+		avr_timer_schedule(p);
 }
 
 static void avr_timer_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
@@ -335,6 +720,7 @@ static void avr_timer_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, v
 	uint8_t cs = avr_regbit_get_array(avr, p->cs, ARRAY_SIZE(p->cs));
 	uint8_t mode = avr_regbit_get_array(avr, p->wgm, ARRAY_SIZE(p->wgm));
 
+	avr_timer_run(p, avr->cycle);
 	avr_core_watch_write(avr, addr, v);
 
 	// only reconfigure the timer if "relevant" bits have changed
@@ -345,6 +731,32 @@ static void avr_timer_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, v
 					avr_regbit_get(avr, p->as2) != as2) {
 		avr_timer_reconfigure(p);
 	}
+	// the compare output modes might have changed
+	avr_timer_schedule(p);
+}
+
+// the interrupts were turned on or off
+static void avr_timer_write_enable(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
+{
+	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, avr->cycle);
+	avr_core_watch_write(avr, addr, v);
+	avr_timer_schedule(p);
+}
+
+// prescaler reset, the bit clears itself
+static void avr_timer_write_psr(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
+{
+	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, avr->cycle);
+	avr_core_watch_write(avr, addr, v);
+	if (!avr_regbit_get(avr, p->psr))
+		return;
+	avr_regbit_clear(avr, p->psr);
+	// the next tick is a whole prescaler period away
+	p->origin = avr->cycle;
+	p->base = 0;
+	avr_timer_schedule(p);
 }
 
 /*
@@ -354,6 +766,7 @@ static void avr_timer_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, v
 static void avr_timer_write_pending(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
 {
 	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, avr->cycle);
 	// save old bits values
 	uint8_t ov = avr_regbit_get(avr, p->overflow.raised);
 	uint8_t ic = avr_regbit_get(avr, p->icr.raised);
@@ -399,17 +812,40 @@ static void avr_timer_irq_icp(struct avr_irq_t * irq, uint32_t value, void * par
 	avr_raise_interrupt(avr, &p->icr);
 }
 
+// something listens to an output now, or stopped it, see avr_timer_edges_seen()
+static avr_cycle_count_t avr_timer_rescan(struct avr_t * avr, avr_cycle_count_t when, void * param)
+{
+	avr_timer_t * p = (avr_timer_t *)param;
+	avr_timer_run(p, when);
+	avr_timer_schedule(p);
+	return 0;
+}
+
+// the hook might be added from the middle of a run, look at it from the run loop
+static void avr_timer_irq_hooked(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+	avr_timer_t * p = (avr_timer_t *)param;
+	avr_cycle_timer_register(p->io.avr, 1, avr_timer_rescan, p);
+}
+
 static void avr_timer_reset(avr_io_t * port)
 {
 	avr_timer_t * p = (avr_timer_t *)port;
-	avr_timer_cancel_all_cycle_timers(p->io.avr, p);
+	avr_cycle_timer_cancel(p->io.avr, avr_timer_event, p);
+	p->mode = avr_timer_get_mode(p);
+	p->tick_num = 0;
+	p->origin = p->io.avr->cycle;
+	p->base = 0;
+	p->tcnt = 0;
+	p->down = p->block = p->pending = 0;
 
 	// check to see if the comparators have a pin output. If they do,
 	// (try) to get the ioport corresponding IRQ and connect them
 	// they will automagically be triggered when the comparator raises
 	// it's own IRQ
 	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++) {
-		p->comp[compi].comp_cycles = 0;
+		p->comp[compi].ocr = 0;
+		p->comp[compi].pwm = (avr_timer_pwm_t) { .comp = compi };
 
 		avr_ioport_getirq_t req = {
 			.bit = p->comp[compi].com_pin
@@ -428,7 +864,7 @@ static void avr_timer_reset(avr_io_t * port)
 //		printf("%s-%c ICP Connecting PIN IRQ %d\n", __FUNCTION__, p->name, req.irq[0]->irq);
 		avr_irq_register_notify(req.irq[0], avr_timer_irq_icp, p);
 	}
-
+	avr_timer_schedule(p);
 }
 
 static const char * irq_names[TIMER_IRQ_COUNT] = {
@@ -437,11 +873,30 @@ static const char * irq_names[TIMER_IRQ_COUNT] = {
 	[TIMER_IRQ_OUT_COMP + 0] = ">compa",
 	[TIMER_IRQ_OUT_COMP + 1] = ">compb",
 	[TIMER_IRQ_OUT_COMP + 2] = ">compc",
+	[TIMER_IRQ_OUT_PWM + 0] = "32>pwma",
+	[TIMER_IRQ_OUT_PWM + 1] = "32>pwmb",
+	[TIMER_IRQ_OUT_PWM + 2] = "32>pwmc",
 };
 
+static int avr_timer_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_param)
+{
+	avr_timer_t * p = (avr_timer_t *)port;
+	int res = -1;
+
+	if (ctl == AVR_IOCTL_TIMER_GETPWM(p->name)) {
+		avr_timer_pwm_t * pwm = (avr_timer_pwm_t *)io_param;
+		if (!pwm || pwm->comp >= AVR_TIMER_COMP_COUNT || !p->comp[pwm->comp].r_ocr)
+			return -2;
+		*pwm = p->comp[pwm->comp].pwm;
+		res = 0;
+	}
+	return res;
+}
+
 static	avr_io_t	_io = {
 	.kind = "timer",
 	.reset = avr_timer_reset,
+	.ioctl = avr_timer_ioctl,
 	.irq_names = irq_names,
 };
 
@@ -455,12 +910,19 @@ void avr_timer_init(avr_t * avr, avr_timer_t * p)
 
 	// allocate this module's IRQ
 	avr_io_setirqs(&p->io, AVR_IOCTL_TIMER_GETIRQ(p->name), TIMER_IRQ_COUNT, NULL);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_TIMER_GETPWM(p->name));
 
 	// marking IRQs as "filtered" means they don't propagate if the
 	// new value raised is the same as the last one.. in the case of the
 	// pwm value it makes sense not to bother.
 	p->io.irq[TIMER_IRQ_OUT_PWM0].flags |= IRQ_FLAG_FILTERED;
 	p->io.irq[TIMER_IRQ_OUT_PWM1].flags |= IRQ_FLAG_FILTERED;
+	// the edges are only raised on time when hooked, tell us when they are;
+	// the ioport watches the pins the same way
+	for (int compi = 0; compi < AVR_TIMER_COMP_COUNT; compi++)
+		avr_irq_register_notify(
+				avr_irq_watch_hooks(p->io.irq + TIMER_IRQ_OUT_COMP + compi),
+				avr_timer_irq_hooked, p);
 
 	if (p->wgm[0].reg) // these are not present on older AVRs
 		avr_register_io_write(avr, p->wgm[0].reg, avr_timer_write, p);
@@ -469,6 +931,18 @@ void avr_timer_init(avr_t * avr, avr_timer_t * p)
 	// this assumes all the "pending" interrupt bits are in the same
 	// register. Might not be true on all devices ?
 	avr_register_io_write(avr, p->overflow.raised.reg, avr_timer_write_pending, p);
+	// reading it raises the flags that weren't scheduled
+	avr_io_addr_t tifr = AVR_DATA_TO_IO(p->overflow.raised.reg);
+	if (p->overflow.raised.reg && avr->io_r[tifr].c == avr_timer_tifr_read) {
+		((avr_timer_t *)avr->io_r[tifr].param)->shared_tifr = 1;
+		p->shared_tifr = 1;
+	} else if (p->overflow.raised.reg && !avr->io_r[tifr].c) {
+		avr_register_io_read(avr, p->overflow.raised.reg, avr_timer_tifr_read, p);
+		avr_io_set_read_stable(avr, p->overflow.raised.reg, 1);
+	} else
+		p->shared_tifr = 1;
+	if (p->overflow.enable.reg)
+		avr_register_io_write(avr, p->overflow.enable.reg, avr_timer_write_enable, p);
 
 	/*
 	 * Even if the timer is 16 bits, we don't care to have watches on the
@@ -480,9 +954,22 @@ void avr_timer_init(avr_t * avr, avr_timer_t * p)
 		
 		avr_register_vector(avr, &p->comp[compi].interrupt);
 
-		if (p->comp[compi].r_ocr) // not all timers have all comparators
+		if (p->comp[compi].r_ocr) { // not all timers have all comparators
 			avr_register_io_write(avr, p->comp[compi].r_ocr, avr_timer_write_ocr, &p->comp[compi]);
+			if (p->comp[compi].interrupt.enable.reg)
+				avr_register_io_write(avr, p->comp[compi].interrupt.enable.reg,
+						avr_timer_write_enable, p);
+			if (p->comp[compi].com.reg)
+				avr_register_io_write(avr, p->comp[compi].com.reg, avr_timer_write, p);
+		}
 	}
 	avr_register_io_write(avr, p->r_tcnt, avr_timer_tcnt_write, p);
 	avr_register_io_read(avr, p->r_tcnt, avr_timer_tcnt_read, p);
+	// ICR as TOP takes each byte as it comes
+	if (p->r_icr)
+		avr_register_io_write(avr, p->r_icr, avr_timer_write_icr, p);
+	if (p->r_icrh)
+		avr_register_io_write(avr, p->r_icrh, avr_timer_write_icr, p);
+	if (p->psr.reg)
+		avr_register_io_write(avr, p->psr.reg, avr_timer_write_psr, p);
 }
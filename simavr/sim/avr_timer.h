@@ -40,13 +40,38 @@ enum {
 	TIMER_IRQ_OUT_PWM0 = 0,
 	TIMER_IRQ_OUT_PWM1,
 	TIMER_IRQ_OUT_COMP,	// comparator pins output IRQ
+	// comparator waveform changes, see avr_timer_pwm_t
+	TIMER_IRQ_OUT_PWM = TIMER_IRQ_OUT_COMP + AVR_TIMER_COMP_COUNT,
 
-	TIMER_IRQ_COUNT = TIMER_IRQ_OUT_COMP + AVR_TIMER_COMP_COUNT
+	TIMER_IRQ_COUNT = TIMER_IRQ_OUT_PWM + AVR_TIMER_COMP_COUNT
 };
 
 // Get the internal IRQ corresponding to the INT
 #define AVR_IOCTL_TIMER_GETIRQ(_name) AVR_IOCTL_DEF('t','m','r',(_name))
 
+/*
+ * What a comparator output does, worked out from the timer settings rather
+ * than from its edges. The TIMER_IRQ_OUT_PWM IRQ of the comparator is raised
+ * when that changes, with the part of the period the output is high, 0x10000
+ * being always high; the whole thing is returned by the ioctl, for the
+ * comparator in 'comp'.
+ * The edges on TIMER_IRQ_OUT_COMP and the pin are only raised on time when
+ * somebody looks at them, otherwise they're caught up with whenever the
+ * timer runs; something that only wants the average output can hook this
+ * one instead. A hook added later, on these or on the port, is seen from
+ * the next cycle on; a pin change interrupt enabled on the pin only at the
+ * next timer register write.
+ */
+typedef struct avr_timer_pwm_t {
+	uint8_t		comp;		// AVR_TIMER_COMPA...
+	uint8_t		inverted;	// "set on compare match" mode
+	uint8_t		level;		// output when it doesn't change, 1 otherwise
+	uint32_t	period;		// cycles, 0 when the output doesn't change
+	uint32_t	duty;		// cycles the output is high, in each period
+} avr_timer_pwm_t;
+
+#define AVR_IOCTL_TIMER_GETPWM(_name) AVR_IOCTL_DEF('t','m','p',(_name))
+
 // Waveform generation modes
 enum {
 	avr_timer_wgm_none = 0,	// invalid mode
@@ -54,7 +79,8 @@ enum {
 	avr_timer_wgm_ctc,
 	avr_timer_wgm_pwm,
 	avr_timer_wgm_fast_pwm,
-	avr_timer_wgm_fc_pwm,
+	avr_timer_wgm_fc_pwm,	// phase correct
+	avr_timer_wgm_pfc_pwm,	// phase and frequency correct
 };
 
 // Compare output modes
@@ -85,6 +111,10 @@ typedef struct avr_timer_wgm_t {
 #define AVR_TIMER_WGM_FCPWM8() { .kind = avr_timer_wgm_fc_pwm, .size=8 }
 #define AVR_TIMER_WGM_FCPWM9() { .kind = avr_timer_wgm_fc_pwm, .size=9 }
 #define AVR_TIMER_WGM_FCPWM10() { .kind = avr_timer_wgm_fc_pwm, .size=10 }
+#define AVR_TIMER_WGM_OCFCPWM() { .kind = avr_timer_wgm_fc_pwm, .top = avr_timer_wgm_reg_ocra }
+#define AVR_TIMER_WGM_ICFCPWM() { .kind = avr_timer_wgm_fc_pwm, .top = avr_timer_wgm_reg_icr }
+#define AVR_TIMER_WGM_OCPFCPWM() { .kind = avr_timer_wgm_pfc_pwm, .top = avr_timer_wgm_reg_ocra }
+#define AVR_TIMER_WGM_ICPFCPWM() { .kind = avr_timer_wgm_pfc_pwm, .top = avr_timer_wgm_reg_icr }
 #define AVR_TIMER_WGM_OCPWM() { .kind = avr_timer_wgm_pwm, .top = avr_timer_wgm_reg_ocra }
 #define AVR_TIMER_WGM_ICPWM() { .kind = avr_timer_wgm_pwm, .top = avr_timer_wgm_reg_icr }
 
@@ -95,7 +125,8 @@ typedef struct avr_timer_comp_t {
 		avr_io_addr_t		r_ocrh;			// comparator register hi byte
 		avr_regbit_t		com;			// comparator output mode registers
 		avr_regbit_t		com_pin;		// where comparator output is connected
-		uint64_t		comp_cycles;
+		uint16_t		ocr;			// compared to TCNT, OCR is double buffered in PWM modes
+		avr_timer_pwm_t		pwm;			// last one raised on TIMER_IRQ_OUT_PWM
 } avr_timer_comp_t, *avr_timer_comp_p;
 
 typedef struct avr_timer_t {
@@ -115,6 +146,7 @@ typedef struct avr_timer_t {
 	avr_regbit_t	as2;		// asynchronous clock 32khz
 	avr_regbit_t	icp;		// input capture pin, to link IRQs
 	avr_regbit_t	ices;		// input capture edge select
+	avr_regbit_t	psr;		// prescaler reset
 
 	avr_timer_comp_t comp[AVR_TIMER_COMP_COUNT];
 
@@ -122,9 +154,27 @@ typedef struct avr_timer_t {
 	avr_int_vector_t icr;	// input capture
 
 	avr_timer_wgm_t	mode;
-	uint64_t		tov_cycles;
-	uint64_t		tov_base;	// when we last were called
-	uint16_t		tov_top;	// current top value to calculate tnct
+	/*
+	 * The counter ticks at cycle 'origin' + n * 'tick_num' / 'tick_den',
+	 * 'origin' being when the prescaler last started over; a stopped timer
+	 * has no 'tick_num'. At tick 'base', the counter was at 'tcnt', and
+	 * counting down if 'down' is set.
+	 */
+	avr_cycle_count_t	origin;
+	uint64_t		tick_num, tick_den;
+	uint64_t		base;
+	uint16_t		tcnt;
+	uint8_t			down;
+	uint8_t			block;		// TCNT was written, no compare match on the next tick
+	uint8_t			pending;	// an OCR buffer waits for TOP or BOTTOM
+
+	/*
+	 * Only the next event somebody would see when it happens (an enabled
+	 * interrupt, a compare output, an OCR update) has a cycle timer; the
+	 * flags nobody waits for are raised when TIFR is read or written. A
+	 * timer sharing TIFR with another one has all its events scheduled.
+	 */
+	uint8_t			shared_tifr;
 } avr_timer_t;
 
 void avr_timer_init(avr_t * avr, avr_timer_t * port);
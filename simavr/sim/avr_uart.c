@@ -45,14 +45,84 @@
 
 DEFINE_FIFO(uint8_t, uart_fifo);
 
+static avr_cycle_count_t avr_uart_drain_timer(struct avr_t * avr, avr_cycle_count_t when, void * param);
+
+static void avr_uart_drain_flush(avr_uart_t * p)
+{
+	avr_uart_drain_t * d = p->drain;
+
+	avr_cycle_timer_cancel(p->io.avr, avr_uart_drain_timer, p);
+	if (!d || !d->len)
+		return;
+	uint32_t len = d->len;
+	d->len = 0;
+	d->flush(d, len);
+}
+
+// the first byte of the batch has waited long enough
+static avr_cycle_count_t avr_uart_drain_timer(struct avr_t * avr, avr_cycle_count_t when, void * param)
+{
+	avr_uart_drain_flush((avr_uart_t *)param);
+	return 0;
+}
+
+static void avr_uart_drain_byte(avr_uart_t * p, uint8_t v, avr_cycle_count_t when)
+{
+	avr_t * avr = p->io.avr;
+	avr_uart_drain_t * d = p->drain;
+
+	if (!d->len && d->latency)
+		avr_cycle_timer_register(avr, d->latency, avr_uart_drain_timer, p);
+	if (d->cycles)
+		d->cycles[d->len] = when;
+	d->buf[d->len++] = v;
+	if (d->len == d->size)
+		avr_uart_drain_flush(p);
+}
+
+// the shift register takes 'v' at cycle 'when', it's on the wire from then on
+static void avr_uart_transmit(avr_uart_t * p, uint8_t v, avr_cycle_count_t when)
+{
+	avr_t * avr = p->io.avr;
+
+	if (p->flags & AVR_UART_FLAG_STDIO) {
+		const int maxsize = 256;
+		if (!p->stdio_out)
+			p->stdio_out = malloc(maxsize);
+		p->stdio_out[p->stdio_len++] = v < ' ' ? '.' : v;
+		p->stdio_out[p->stdio_len] = 0;
+		if (v == '\n' || p->stdio_len == maxsize - 1) {
+			p->stdio_len = 0;
+			AVR_LOG(avr, LOG_TRACE, FONT_GREEN "%s\n" FONT_DEFAULT, p->stdio_out);
+		}
+	}
+	// tell other modules we are "outputting" a byte
+	if (avr_regbit_get(avr, p->txen)) {
+		if (p->drain)
+			avr_uart_drain_byte(p, v, when);
+		avr_raise_irq(p->io.irq + UART_IRQ_OUTPUT, v);
+	}
+}
+
+/*
+ * The shift register is done with a frame: it takes the byte waiting in
+ * UDR if there is one, and UDR is empty again, otherwise the transmission
+ * is complete.
+ */
 static avr_cycle_count_t avr_uart_txc_raise(struct avr_t * avr, avr_cycle_count_t when, void * param)
 {
 	avr_uart_t * p = (avr_uart_t *)param;
-	if (avr_regbit_get(avr, p->txen)) {
-		// if the interrupts are not used, still raise the UDRE and TXC flag
-		avr_raise_interrupt(avr, &p->udrc);
-		avr_raise_interrupt(avr, &p->txc);
+
+	if (p->tx_pending) {
+		p->tx_pending = 0;
+		avr_uart_transmit(p, p->tx_data, when);
+		if (avr_regbit_get(avr, p->txen))
+			avr_raise_interrupt(avr, &p->udrc);
+		return when + p->cycles_per_byte;
 	}
+	// if the interrupts are not used, still raise the TXC flag
+	if (avr_regbit_get(avr, p->txen))
+		avr_raise_interrupt(avr, &p->txc);
 	return 0;
 }
 
@@ -64,6 +134,55 @@ static avr_cycle_count_t avr_uart_rxc_raise(struct avr_t * avr, avr_cycle_count_
 	return 0;
 }
 
+// a byte gets to the input fifo, RXC follows a byte later
+static void avr_uart_receive(avr_uart_t * p, uint8_t v)
+{
+	avr_t * avr = p->io.avr;
+
+	if (uart_fifo_isempty(&p->input))
+		avr_cycle_timer_register(avr, p->cycles_per_byte, avr_uart_rxc_raise, p);
+	uart_fifo_write(&p->input, v); // add to fifo
+
+	TRACE(printf("UART IRQ in %02x (%d/%d) %s\n", v, p->input.read, p->input.write, uart_fifo_isfull(&p->input) ? "FULL!!" : "");)
+
+	if (uart_fifo_isfull(&p->input))
+		avr_raise_irq(p->io.irq + UART_IRQ_OUT_XOFF, 1);
+}
+
+// moves the queued buffers to the input fifo, as long as it has room
+static void avr_uart_feed(avr_uart_t * p)
+{
+	if (!avr_regbit_get(p->io.avr, p->rxen))
+		return;
+	while (p->queue) {
+		avr_uart_buffer_t * b = p->queue;
+		while (b->pos < b->size && !uart_fifo_isfull(&p->input))
+			avr_uart_receive(p, b->data[b->pos++]);
+		if (b->pos < b->size)
+			break;
+		p->queue = b->next;
+		b->next = NULL;
+		if (b->done)	// might queue another one
+			b->done(b);
+	}
+}
+
+// gives back the buffers that didn't make it, reset or terminate; the ones
+// their 'done' queues again stay for later
+static void avr_uart_queue_cancel(avr_uart_t * p)
+{
+	avr_uart_buffer_t * b = p->queue;
+
+	p->queue = NULL;
+	while (b) {
+		avr_uart_buffer_t * next = b->next;
+		b->next = NULL;
+		if (b->done)
+			b->done(b);
+		b = next;
+	}
+}
+
 static uint8_t avr_uart_rxc_read(struct avr_t * avr, avr_io_addr_t addr, void * param)
 {
 	avr_uart_t * p = (avr_uart_t *)param;
@@ -85,6 +204,7 @@ static uint8_t avr_uart_rxc_read(struct avr_t * avr, avr_io_addr_t addr, void *
 		if (ri && ti)
 			usleep(1);
 	}
+	avr_uart_feed(p);
 	// if reception is idle and the fifo is empty, tell whomever there is room
 	if (avr_regbit_get(avr, p->rxen) && uart_fifo_isempty(&p->input)) {
 		avr_raise_irq(p->io.irq + UART_IRQ_OUT_XOFF, 0);
@@ -116,32 +236,44 @@ static uint8_t avr_uart_read(struct avr_t * avr, avr_io_addr_t addr, void * para
 
 	// trigger timer if more characters are pending
 	if (!uart_fifo_isempty(&p->input))
-		avr_cycle_timer_register_usec(avr, p->usec_per_byte, avr_uart_rxc_raise, p);
+		avr_cycle_timer_register(avr, p->cycles_per_byte, avr_uart_rxc_raise, p);
+	// there is room for one more queued byte
+	avr_uart_feed(p);
 
 	return v;
 }
 
-static void avr_uart_baud_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
+/*
+ * A frame takes (UBRR + 1) * 16 cycles per bit, 8 with U2X; it's worked
+ * out again whenever one of the registers it depends on is written.
+ */
+static void avr_uart_frame_update(avr_uart_t * p)
 {
-	avr_uart_t * p = (avr_uart_t *)param;
-	avr_core_watch_write(avr, addr, v);
-	uint32_t val = avr->data[p->r_ubrrl] | (avr->data[p->r_ubrrh] << 8);
-	uint32_t baud = avr->frequency / (val+1);
-	if (avr_regbit_get(avr, p->u2x))
-		baud /= 8;
-	else
-		baud /= 16;
+	avr_t * avr = p->io.avr;
+	uint32_t val = 0;
+	if (p->r_ubrrl)
+		val = avr->data[p->r_ubrrl] | (p->r_ubrrh ? avr->data[p->r_ubrrh] << 8 : 0);
+	uint32_t div = avr_regbit_get(avr, p->u2x) ? 8 : 16;
 
 	const int databits[] = { 5,6,7,8,  /* 'reserved', assume 8 */8,8,8, 9 };
-	int db = databits[avr_regbit_get(avr, p->ucsz) | (avr_regbit_get(avr, p->ucsz2) << 2)];
+	// cores that don't say are 8 bits
+	int db = p->ucsz.mask ?
+			databits[avr_regbit_get(avr, p->ucsz) | (avr_regbit_get(avr, p->ucsz2) << 2)] : 8;
+	int pb = avr_regbit_get(avr, p->upm) ? 1 : 0;
 	int sb = 1 + avr_regbit_get(avr, p->usbs);
-	int word_size = 1 /* start */ + db /* data bits */ + 1 /* parity */ + sb /* stops */;
+	int word_size = 1 /* start */ + db /* data bits */ + pb /* parity */ + sb /* stops */;
 
-	AVR_LOG(avr, LOG_TRACE, "UART: %c configured to %04x = %d bps (x%d), %d data %d stop\n",
-			p->name, val, baud, avr_regbit_get(avr, p->u2x)?2:1, db, sb);
-	// TODO: Use the divider value and calculate the straight number of cycles
-	p->usec_per_byte = 1000000 / (baud / word_size);
-	AVR_LOG(avr, LOG_TRACE, "UART: Roughly %d usec per bytes\n", (int)p->usec_per_byte);
+	p->cycles_per_byte = (avr_cycle_count_t)(val + 1) * div * word_size;
+	AVR_LOG(avr, LOG_TRACE, "UART: %c configured to %04x = %d bps (x%d), %d data %d parity %d stop, %d cycles per byte\n",
+			p->name, val, (int)(avr->frequency / ((val + 1) * div)), div == 8 ? 2 : 1, db, pb, sb,
+			(int)p->cycles_per_byte);
+}
+
+static void avr_uart_baud_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
+{
+	avr_uart_t * p = (avr_uart_t *)param;
+	avr_core_watch_write(avr, addr, v);
+	avr_uart_frame_update(p);
 }
 
 static void avr_uart_udr_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param)
@@ -149,27 +281,23 @@ static void avr_uart_udr_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v
 	avr_uart_t * p = (avr_uart_t *)param;
 
 	avr_core_watch_write(avr, addr, v);
+	TRACE(printf("UDR%c(%02x) = %02x\n", p->name, addr, v);)
 
-	if ( p->udrc.vector)
-		avr_regbit_clear(avr, p->udrc.raised);
-	avr_cycle_timer_register_usec(avr,
-			p->usec_per_byte, avr_uart_txc_raise, p); // should be uart speed dependent
-
-	if (p->flags & AVR_UART_FLAG_STDIO) {
-		const int maxsize = 256;
-		if (!p->stdio_out)
-			p->stdio_out = malloc(maxsize);
-		p->stdio_out[p->stdio_len++] = v < ' ' ? '.' : v;
-		p->stdio_out[p->stdio_len] = 0;
-		if (v == '\n' || p->stdio_len == maxsize) {
-			p->stdio_len = 0;
-			AVR_LOG(avr, LOG_TRACE, FONT_GREEN "%s\n" FONT_DEFAULT, p->stdio_out);
-		}
+	if (avr_cycle_timer_status(avr, avr_uart_txc_raise, p)) {
+		// the shift register is busy, UDR holds on to the byte until it's done
+		p->tx_data = v;
+		p->tx_pending = 1;
+		if (p->udrc.vector)
+			avr_regbit_clear(avr, p->udrc.raised);
+		return;
 	}
-	TRACE(printf("UDR%c(%02x) = %02x\n", p->name, addr, v);)
-	// tell other modules we are "outputting" a byte
+	avr_uart_transmit(p, v, avr->cycle);
+	avr_cycle_timer_register(avr, p->cycles_per_byte, avr_uart_txc_raise, p);
+	// the byte went straight to the shift register, UDR is empty again
+	if (p->udrc.vector)
+		avr_regbit_clear(avr, p->udrc.raised);
 	if (avr_regbit_get(avr, p->txen))
-		avr_raise_irq(p->io.irq + UART_IRQ_OUTPUT, v);
+		avr_raise_interrupt(avr, &p->udrc);
 }
 
 
@@ -185,10 +313,9 @@ static void avr_uart_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, vo
 		avr_core_watch_write(avr, addr, v);
 		uint8_t nudrce = avr_regbit_get(avr, p->udrc.enable);
 		if (!udrce && nudrce) {
-			// if the FIDO is not empty (clear timer is flying) we don't
-			// need to raise the interrupt, it will happen when the timer
-			// is fired.
-			if (avr_cycle_timer_status(avr, avr_uart_txc_raise, p) == 0)
+			// if UDR is still full we don't need to raise the interrupt,
+			// it will happen when the shift register takes the byte.
+			if (!p->tx_pending)
 				avr_raise_interrupt(avr, &p->udrc);
 		}
 	}
@@ -206,6 +333,10 @@ static void avr_uart_write(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, vo
 		//avr_clear_interrupt_if(avr, &p->udrc, udre);
 		avr_clear_interrupt_if(avr, &p->txc, txc);
 	}
+	// U2X and UCSZ2 live here
+	avr_uart_frame_update(p);
+	// the receiver might just have been turned on
+	avr_uart_feed(p);
 }
 
 static void avr_uart_irq_input(struct avr_irq_t * irq, uint32_t value, void * param)
@@ -217,14 +348,7 @@ static void avr_uart_irq_input(struct avr_irq_t * irq, uint32_t value, void * pa
 	if (!avr_regbit_get(avr, p->rxen))
 		return;
 
-	if (uart_fifo_isempty(&p->input))
-		avr_cycle_timer_register_usec(avr, p->usec_per_byte, avr_uart_rxc_raise, p); // should be uart speed dependent
-	uart_fifo_write(&p->input, value); // add to fifo
-
-	TRACE(printf("UART IRQ in %02x (%d/%d) %s\n", value, p->input.read, p->input.write, uart_fifo_isfull(&p->input) ? "FULL!!" : "");)
-
-	if (uart_fifo_isfull(&p->input))
-		avr_raise_irq(p->io.irq + UART_IRQ_OUT_XOFF, 1);
+	avr_uart_receive(p, value);
 }
 
 
@@ -237,14 +361,17 @@ void avr_uart_reset(struct avr_io_t *io)
 	avr_irq_register_notify(p->io.irq + UART_IRQ_INPUT, avr_uart_irq_input, p);
 	avr_cycle_timer_cancel(avr, avr_uart_rxc_raise, p);
 	avr_cycle_timer_cancel(avr, avr_uart_txc_raise, p);
+	p->tx_pending = 0;
 	uart_fifo_reset(&p->input);
+	avr_uart_queue_cancel(p);
+	avr_uart_drain_flush(p);
 
         avr_regbit_set(avr, p->ucsz);
         avr_regbit_clear(avr, p->ucsz2);
 
 	// DEBUG allow printf without fiddling with enabling the uart
 	avr_regbit_set(avr, p->txen);
-	p->usec_per_byte = 100;
+	avr_uart_frame_update(p);
 }
 
 static int avr_uart_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_param)
@@ -252,6 +379,17 @@ static int avr_uart_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_param)
 	avr_uart_t * p = (avr_uart_t *)port;
 	int res = -1;
 
+	if (ctl == AVR_IOCTL_UART_DRAIN(p->name)) {
+		avr_uart_drain_t * d = (avr_uart_drain_t *)io_param;
+		if (d && (!d->buf || !d->size || !d->flush))
+			return -2;
+		// the bytes gathered so far go to the old one
+		avr_uart_drain_flush(p);
+		p->drain = d;
+		if (d)
+			d->len = 0;
+		return 0;
+	}
 	if (!io_param)
 		return res;
 
@@ -263,10 +401,34 @@ static int avr_uart_ioctl(struct avr_io_t * port, uint32_t ctl, void * io_param)
 		*(uint32_t*)io_param = p->flags;
 		res = 0;
 	}
+	if (ctl == AVR_IOCTL_UART_QUEUE(p->name)) {
+		avr_uart_buffer_t * b = (avr_uart_buffer_t *)io_param, ** q = &p->queue;
+		if (!b->data && b->size)
+			return -2;
+		while (*q)
+			q = &(*q)->next;
+		b->pos = 0;
+		b->next = NULL;
+		*q = b;
+		avr_uart_feed(p);
+		res = 0;
+	}
 
 	return res;
 }
 
+static void avr_uart_dealloc(struct avr_io_t * port)
+{
+	avr_uart_t * p = (avr_uart_t *)port;
+
+	avr_uart_queue_cancel(p);
+	avr_uart_drain_flush(p);
+	p->drain = NULL;
+	if (p->stdio_out)
+		free(p->stdio_out);
+	p->stdio_out = NULL;
+}
+
 static const char * irq_names[UART_IRQ_COUNT] = {
 	[UART_IRQ_INPUT] = "8<in",
 	[UART_IRQ_OUTPUT] = "8>out",
@@ -278,6 +440,7 @@ static	avr_io_t	_io = {
 	.kind = "uart",
 	.reset = avr_uart_reset,
 	.ioctl = avr_uart_ioctl,
+	.dealloc = avr_uart_dealloc,
 	.irq_names = irq_names,
 };
 
@@ -296,6 +459,10 @@ void avr_uart_init(avr_t * avr, avr_uart_t * p)
 
 	// allocate this module's IRQ
 	avr_io_setirqs(&p->io, AVR_IOCTL_UART_GETIRQ(p->name), UART_IRQ_COUNT, NULL);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_UART_SET_FLAGS(p->name));
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_UART_GET_FLAGS(p->name));
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_UART_QUEUE(p->name));
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_UART_DRAIN(p->name));
 	// Only call callbacks when the value change...
 	p->io.irq[UART_IRQ_OUT_XOFF].flags |= IRQ_FLAG_FILTERED;
 
@@ -310,5 +477,8 @@ void avr_uart_init(avr_t * avr, avr_uart_t * p)
 		avr_register_io_write(avr, p->r_ucsra, avr_uart_write, p);
 	if (p->r_ubrrl)
 		avr_register_io_write(avr, p->r_ubrrl, avr_uart_baud_write, p);
+	// frame size, unless UCSRC shares the address with UBRRH
+	if (p->r_ucsrc && p->r_ucsrc != p->r_ubrrh)
+		avr_register_io_write(avr, p->r_ucsrc, avr_uart_baud_write, p);
 }
 
@@ -83,6 +83,43 @@ enum {
 	AVR_UART_FLAG_STDIO = (1 << 1),			// print lines on the console
 };
 
+/*
+ * Bulk input, for sending a whole file without going through the IRQ: the
+ * buffers queued with AVR_IOCTL_UART_QUEUE go into the UART as its input
+ * fifo has room, ahead of the bytes coming from UART_IRQ_INPUT, and are
+ * received at the baud rate like these. 'data' isn't copied, it has to stay
+ * there until 'done' is called, after the last byte went into the fifo --
+ * or when the AVR is reset or terminated, 'pos' tells how far it got then.
+ * Bytes wait in the buffer while the receiver is off.
+ */
+typedef struct avr_uart_buffer_t {
+	const uint8_t *	data;
+	uint32_t		size;
+	uint32_t		pos;		// bytes received so far
+	void (*done)(struct avr_uart_buffer_t * buffer);
+	void *			param;		// for 'done'
+	struct avr_uart_buffer_t * next;	// used by the queue
+} avr_uart_buffer_t;
+
+/*
+ * Bulk output: the bytes the firmware sends are gathered in 'buf' and handed
+ * to 'flush' when it is full, 'latency' cycles after the first of them if
+ * 'latency' isn't 0, and when the AVR is reset or terminated. If 'cycles'
+ * isn't NULL, it gets the cycle each byte went to the shift register, so the
+ * timing can be played back. The bytes are still raised on UART_IRQ_OUTPUT,
+ * that costs nothing if nothing listens to it.
+ * Set with AVR_IOCTL_UART_DRAIN, NULL removes it.
+ */
+typedef struct avr_uart_drain_t {
+	uint8_t *		buf;
+	avr_cycle_count_t *	cycles;		// optional, 'size' of them too
+	uint32_t		size;
+	avr_cycle_count_t	latency;
+	void (*flush)(struct avr_uart_drain_t * drain, uint32_t len);
+	void *			param;		// for 'flush'
+	uint32_t		len;		// bytes in 'buf', until flushed
+} avr_uart_drain_t;
+
 typedef struct avr_uart_t {
 	avr_io_t	io;
 	char name;
@@ -99,6 +136,7 @@ typedef struct avr_uart_t {
 	avr_regbit_t	usbs;		// stop bits
 	avr_regbit_t	ucsz;		// data bits
 	avr_regbit_t	ucsz2;		// data bits, continued
+	avr_regbit_t	upm;		// parity mode
 
 	avr_io_addr_t r_ubrrl,r_ubrrh;
 
@@ -107,9 +145,13 @@ typedef struct avr_uart_t {
 	avr_int_vector_t udrc;	
 
 	uart_fifo_t	input;
+	avr_uart_buffer_t * queue;		// bulk input, oldest first
+	avr_uart_drain_t * drain;		// bulk output
 
 	uint32_t		flags;
-	avr_cycle_count_t usec_per_byte;
+	avr_cycle_count_t cycles_per_byte;	// a whole frame, start to stop bits
+	uint8_t			tx_data;	// in UDR, waiting for the shift register
+	uint8_t			tx_pending;
 
 	uint8_t *		stdio_out;
 	int				stdio_len;	// current size in the stdio output
@@ -118,6 +160,10 @@ typedef struct avr_uart_t {
 /* takes a uint32_t* as parameter */
 #define AVR_IOCTL_UART_SET_FLAGS(_name)	AVR_IOCTL_DEF('u','a','s',(_name))
 #define AVR_IOCTL_UART_GET_FLAGS(_name)	AVR_IOCTL_DEF('u','a','g',(_name))
+/* takes an avr_uart_buffer_t*, queued at the end */
+#define AVR_IOCTL_UART_QUEUE(_name)	AVR_IOCTL_DEF('u','a','q',(_name))
+/* takes an avr_uart_drain_t*, or NULL */
+#define AVR_IOCTL_UART_DRAIN(_name)	AVR_IOCTL_DEF('u','a','d',(_name))
 
 void avr_uart_init(avr_t * avr, avr_uart_t * port);
 
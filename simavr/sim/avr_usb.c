@@ -776,6 +776,10 @@ void avr_usb_init(avr_t * avr, avr_usb_t * p)
 	register_vectors(avr, p);
 	// allocate this module's IRQ
 	avr_io_setirqs(&p->io, AVR_IOCTL_USB_GETIRQ(), USB_IRQ_COUNT, NULL);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_USB_READ);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_USB_WRITE);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_USB_SETUP);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_USB_RESET);
 
 	avr_register_io_write(avr, p->r_usbcon + udaddr, avr_usb_udaddr_write, p);
 	avr_register_io_write(avr, p->r_usbcon + udcon, avr_usb_udcon_write, p);
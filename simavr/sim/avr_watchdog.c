@@ -123,6 +123,7 @@ void avr_watchdog_init(avr_t * avr, avr_watchdog_t * p)
 
 	avr_register_io(avr, &p->io);
 	avr_register_vector(avr, &p->watchdog);
+	avr_io_register_ioctl(&p->io, AVR_IOCTL_WATCHDOG_RESET);
 
 	avr_register_io_write(avr, p->wdce.reg, avr_watchdog_write, p);
 }
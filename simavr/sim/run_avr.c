@@ -26,20 +26,31 @@
 #include <signal.h>
 #include "sim_avr.h"
 #include "sim_elf.h"
+#include "sim_elf_cache.h"
 #include "sim_core.h"
 #include "sim_gdb.h"
 #include "sim_hex.h"
+#include "sim_aot.h"
+#include "sim_shadow.h"
+#include "sim_hle.h"
 
 #include "sim_core_decl.h"
 
 void display_usage(char * app)
 {
-	printf("Usage: %s [-t] [-g] [-v] [-m <device>] [-f <frequency>] firmware\n", app);
+	printf("Usage: %s [-t] [-g] [-v] [-si] [-idle] [-aot <lib>] [-aot-gen <file.c>] [-shadow] [-hle] [-m <device>] [-f <frequency>] [-cache <dir>] firmware\n", app);
 	printf("       -t: Run full scale decoder trace\n"
 		   "       -g: Listen for gdb connection on port 1234\n"
 		   "       -ff: Load next .hex file as flash\n"
 		   "       -ee: Load next .hex file as eeprom\n"
 		   "       -v: Raise verbosity level (can be passed more than once)\n"
+		   "       -cache: Keep parsed firmware images in <dir>, for faster loading\n"
+		   "       -si: Run common instruction sequences as superinstructions\n"
+		   "       -idle: Skip the polling and delay loops to the next event\n"
+		   "       -aot-gen: Write the firmware code translated to C in <file.c>, and exit\n"
+		   "       -aot: Run the firmware translated in library <lib> (see sim_aot.h)\n"
+		   "       -shadow: Check the core against the reference decoder, in lockstep\n"
+		   "       -hle: Run the libc memory, multiply, divide and float routines in C\n"
 		   "   Supported AVR cores:\n");
 	for (int i = 0; avr_kind[i]; i++) {
 		printf("       ");
@@ -52,6 +63,38 @@ void display_usage(char * app)
 
 avr_t * avr = NULL;
 
+/*
+ * Loads the chunks of an ihex file in 'f', they go in the flash, or the
+ * eeprom, depending on their address and 'loadBase'
+ */
+static int
+load_ihex(
+		const char * filename,
+		uint32_t loadBase,
+		elf_firmware_t * f)
+{
+	ihex_chunk_p chunk = NULL;
+	int cnt = read_ihex_chunks(filename, &chunk);
+	if (cnt <= 0)
+		return -1;
+	printf("Loaded %d section of ihex\n", cnt);
+	for (int ci = 0; ci < cnt; ci++) {
+		if (chunk[ci].baseaddr < (1*1024*1024)) {
+			f->flash = chunk[ci].data;
+			f->flashsize = chunk[ci].size;
+			f->flashbase = chunk[ci].baseaddr;
+			printf("Load HEX flash %08x, %d\n", f->flashbase, f->flashsize);
+		} else if (chunk[ci].baseaddr >= AVR_SEGMENT_OFFSET_EEPROM ||
+				chunk[ci].baseaddr + loadBase >= AVR_SEGMENT_OFFSET_EEPROM) {
+			// eeprom!
+			f->eeprom = chunk[ci].data;
+			f->eesize = chunk[ci].size;
+			printf("Load HEX eeprom %08x, %d\n", chunk[ci].baseaddr, f->eesize);
+		}
+	}
+	return 0;
+}
+
 void
 sig_int(
 		int sign)
@@ -73,6 +116,10 @@ int main(int argc, char *argv[])
 	uint32_t loadBase = AVR_SEGMENT_OFFSET_FLASH;
 	int trace_vectors[8] = {0};
 	int trace_vectors_count = 0;
+	const char * cache = NULL;
+	uint32_t flags = 0;
+	const char * aot = NULL, * aot_gen = NULL;
+	int shadow = 0, hle = 0;
 
 	if (argc == 1)
 		display_usage(basename(argv[0]));
@@ -97,6 +144,29 @@ int main(int argc, char *argv[])
 				trace_vectors[trace_vectors_count++] = atoi(argv[++pi]);
 		} else if (!strcmp(argv[pi], "-g") || !strcmp(argv[pi], "-gdb")) {
 			gdb++;
+		} else if (!strcmp(argv[pi], "-cache")) {
+			if (pi < argc-1)
+				cache = argv[++pi];
+			else
+				display_usage(basename(argv[0]));
+		} else if (!strcmp(argv[pi], "-si")) {
+			flags |= AVR_FLAG_SUPERINSN;
+		} else if (!strcmp(argv[pi], "-idle")) {
+			flags |= AVR_FLAG_IDLE_LOOPS;
+		} else if (!strcmp(argv[pi], "-aot")) {
+			if (pi < argc-1)
+				aot = argv[++pi];
+			else
+				display_usage(basename(argv[0]));
+		} else if (!strcmp(argv[pi], "-shadow")) {
+			shadow++;
+		} else if (!strcmp(argv[pi], "-hle")) {
+			hle++;
+		} else if (!strcmp(argv[pi], "-aot-gen")) {
+			if (pi < argc-1)
+				aot_gen = argv[++pi];
+			else
+				display_usage(basename(argv[0]));
 		} else if (!strcmp(argv[pi], "-v")) {
 			log++;
 		} else if (!strcmp(argv[pi], "-ee")) {
@@ -111,30 +181,30 @@ int main(int argc, char *argv[])
 					fprintf(stderr, "%s: -mcu and -freq are mandatory to load .hex files\n", argv[0]);
 					exit(1);
 				}
-				ihex_chunk_p chunk = NULL;
-				int cnt = read_ihex_chunks(filename, &chunk);
-				if (cnt <= 0) {
-					fprintf(stderr, "%s: Unable to load IHEX file %s\n", 
-						argv[0], argv[pi]);
-					exit(1);
-				}
-				printf("Loaded %d section of ihex\n", cnt);
-				for (int ci = 0; ci < cnt; ci++) {
-					if (chunk[ci].baseaddr < (1*1024*1024)) {
-						f.flash = chunk[ci].data;
-						f.flashsize = chunk[ci].size;
-						f.flashbase = chunk[ci].baseaddr;
-						printf("Load HEX flash %08x, %d\n", f.flashbase, f.flashsize);
-					} else if (chunk[ci].baseaddr >= AVR_SEGMENT_OFFSET_EEPROM ||
-							chunk[ci].baseaddr + loadBase >= AVR_SEGMENT_OFFSET_EEPROM) {
-						// eeprom!
-						f.eeprom = chunk[ci].data;
-						f.eesize = chunk[ci].size;
-						printf("Load HEX eeprom %08x, %d\n", chunk[ci].baseaddr, f.eesize);
+				// the image only has what this file holds, merge it in 'f'
+				elf_firmware_t hf = {{0}};
+				uint64_t hash;
+				int cached = cache && !elf_cache_hash(filename, loadBase, &hash);
+				if (!cached || elf_cache_load(cache, hash, &hf)) {
+					if (load_ihex(filename, loadBase, &hf)) {
+						fprintf(stderr, "%s: Unable to load IHEX file %s\n",
+							argv[0], argv[pi]);
+						exit(1);
 					}
+					if (cached)
+						elf_cache_store(cache, hash, &hf);
+				}
+				if (hf.flash) {
+					f.flash = hf.flash;
+					f.flashsize = hf.flashsize;
+					f.flashbase = hf.flashbase;
+				}
+				if (hf.eeprom) {
+					f.eeprom = hf.eeprom;
+					f.eesize = hf.eesize;
 				}
 			} else {
-				if (elf_read_firmware(filename, &f) == -1) {
+				if (elf_read_firmware_cached(cache, filename, &f) == -1) {
 					fprintf(stderr, "%s: Unable to load firmware from file %s\n",
 							argv[0], filename);
 					exit(1);
@@ -147,26 +217,53 @@ int main(int argc, char *argv[])
 		strcpy(f.mmcu, name);
 	if (f_cpu)
 		f.frequency = f_cpu;
+	if (aot_gen)
+		exit(avr_aot_generate(&f, aot_gen) ? 1 : 0);
 
 	avr = avr_make_mcu_by_name(f.mmcu);
 	if (!avr) {
 		fprintf(stderr, "%s: AVR '%s' not known\n", argv[0], f.mmcu);
 		exit(1);
 	}
+	avr->flags |= flags;
 	avr_init(avr);
 	avr_load_firmware(avr, &f);
 	if (f.flashbase) {
 		printf("Attempted to load a bootloader at %04x\n", f.flashbase);
 		avr->pc = f.flashbase;
 	}
+	if (aot && avr_aot_load(avr, aot)) {
+		fprintf(stderr, "%s: Unable to use translated firmware %s\n", argv[0], aot);
+		exit(1);
+	}
 	avr->log = (log > LOG_TRACE ? LOG_TRACE : log);
-	avr->trace = trace;
+	if (hle && avr_hle_init(avr, &f) < 0) {
+		fprintf(stderr, "%s: -hle needs the firmware symbols\n", argv[0]);
+		exit(1);
+	}
+	avr_set_trace(avr, trace);
 	for (int ti = 0; ti < trace_vectors_count; ti++) {
 		for (int vi = 0; vi < avr->interrupts.vector_count; vi++)
 			if (avr->interrupts.vector[vi]->vector == trace_vectors[ti])
 				avr->interrupts.vector[vi]->trace = 1;
 	}
 
+	avr_shadow_t check = { 0 };
+	if (shadow) {
+		if (gdb) {
+			fprintf(stderr, "%s: -shadow doesn't work with gdb\n", argv[0]);
+			exit(1);
+		}
+		if (hle) {
+			fprintf(stderr, "%s: -shadow doesn't work with -hle\n", argv[0]);
+			exit(1);
+		}
+		avr_t * ref = avr_shadow_make(avr, &f);
+		if (!ref)
+			exit(1);
+		avr_shadow_init(&check, avr, ref);
+	}
+
 	// even if not setup at startup, activate gdb if crashing
 	avr->gdb_port = 1234;
 	if (gdb) {
@@ -177,11 +274,14 @@ int main(int argc, char *argv[])
 	signal(SIGINT, sig_int);
 	signal(SIGTERM, sig_int);
 
+	int state;
 	for (;;) {
-		int state = avr_run(avr);
-		if ( state == cpu_Done || state == cpu_Crashed)
+		state = check.ref ? avr_shadow_run(&check) : avr_run(avr);
+		if ( state == cpu_Done || state == cpu_Crashed || state == -1)
 			break;
 	}
 	
+	avr_shadow_free(&check);
 	avr_terminate(avr);
+	return state == -1 ? 1 : 0;
 }
@@ -0,0 +1,607 @@
+/*
+	sim_aot.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifndef __MINGW32__
+#include <dlfcn.h>
+#endif
+#include "sim_aot.h"
+#include "sim_core.h"
+
+// FNV-1a, 64 bits, as the firmware cache
+static uint64_t
+aot_hash(
+		const uint8_t * b,
+		uint32_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (uint32_t i = 0; i < size; i++)
+		h = (h ^ b[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+ * Start of the generated file. The flag helpers are the decoder's own.
+ */
+static const char * aot_prologue =
+	"#include \"sim_avr.h\"\n"
+	"#include \"sim_aot.h\"\n"
+	"#include \"sim_core_flags.h\"\n"
+	"\n"
+	"#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+	"\n"
+	"static avr_flashaddr_t aot_run(avr_t * avr);\n"
+	"extern avr_aot_t avr_aot;\n"
+	"\n"
+	"/*\n"
+	" * The run loop would have nothing to do before the next instruction\n"
+	" */\n"
+	"#define CHAIN() (avr->state == cpu_Running && s[S_I] == avr->i_shadow && \\\n"
+	"		avr->interrupts.pending_r == avr->interrupts.pending_w && \\\n"
+	"		(!avr->cycle_timers.timer || avr->cycle_timers.timer->when > avr->cycle) && \\\n"
+	"		--b)\n"
+	"// end of an instruction, that took _c cycles\n"
+	"#define NEXT(_c, _pc) { avr->cycle += (_c); new_pc = (_pc); \\\n"
+	"		if (!CHAIN()) { *budget = 0; return new_pc; } }\n"
+	"// not translated, let the decoder do it; it might also switch decoders (tracing...)\n"
+	"#define INTERP() { new_pc = avr_aot.interp(avr); \\\n"
+	"		if (avr->run_one != aot_run || !CHAIN()) { *budget = 0; return new_pc; } \\\n"
+	"		goto dispatch; }\n"
+	"// goes on in another chunk\n"
+	"#define LEAVE() { *budget = b; return new_pc; }\n"
+	"\n";
+
+/*
+ * The code is cut in functions of that many bytes of flash, compilers
+ * don't like huge ones; jumps from one to another go through aot_run()
+ */
+#define AOT_CHUNK	512
+
+typedef struct aot_gen_t {
+	FILE *			o;
+	elf_firmware_t *	fw;
+	uint32_t		start, end;
+	uint32_t		chunk, chunk_end;	// the one being written
+} aot_gen_t;
+
+// reads the flash word at 'a', if it is in the image
+static int
+aot_word(
+		aot_gen_t * g,
+		uint32_t a,
+		uint16_t * w)
+{
+	if (a < g->fw->flashbase || a + 1 >= g->fw->flashbase + g->fw->flashsize)
+		return 0;
+	uint8_t * f = g->fw->flash + (a - g->fw->flashbase);
+	*w = f[0] | (f[1] << 8);
+	return 1;
+}
+
+// same as _avr_is_instruction_32_bits()
+static int
+aot_is_32(
+		uint16_t o)
+{
+	o &= 0xfc0f;
+	return	o == 0x9200 || o == 0x9000 || o == 0x940c ||
+			o == 0x940d || o == 0x940e || o == 0x940f;
+}
+
+// end of an instruction, that goes on at 'to'
+static void
+aot_next(
+		aot_gen_t * g,
+		const char * in,
+		uint32_t a,
+		int cycle,
+		uint32_t to)
+{
+	fprintf(g->o, "%sNEXT(%d, 0x%x);\n", in, cycle, to);
+	if (to == a + 2)
+		return;	// falls in the next one, or out of the chunk
+	if (!(to & 1) && to >= g->chunk && to < g->chunk_end)
+		fprintf(g->o, "%sgoto a_%x;\n", in, to);
+	else
+		fprintf(g->o, "%sLEAVE();\n", in);
+}
+
+/*
+ * Skips the next instruction if 'cond', as CPSE/SBRC/SBRS; returns
+ * zero if the size of that instruction isn't known
+ */
+static int
+aot_skip(
+		aot_gen_t * g,
+		uint32_t a,
+		const char * cond)
+{
+	uint16_t next;
+	if (!aot_word(g, a + 2, &next))
+		return 0;
+	int is32 = aot_is_32(next);
+	fprintf(g->o, "\t\tif (%s) {\n", cond);
+	aot_next(g, "\t\t\t", a, is32 ? 3 : 2, a + (is32 ? 6 : 4));
+	fprintf(g->o, "\t\t}\n");
+	return 1;
+}
+
+#define AOT_S		"\t\ts[S_S] = s[S_N] ^ s[S_V];\n"
+#define AOT_ZNV0	"\t\ts[S_Z] = res == 0;\n" \
+					"\t\ts[S_N] = (res >> 7) & 1;\n" \
+					"\t\ts[S_V] = 0;\n" AOT_S
+#define AOT_RD		"\t\tuint8_t vd = d[%d], vr = d[%d];\n"
+
+/*
+ * Writes the native code for the instruction at 'a', following the
+ * decoder line by line. Returns zero for the ones left to the decoder.
+ */
+static int
+aot_insn(
+		aot_gen_t * g,
+		uint32_t a,
+		uint16_t opcode)
+{
+	FILE * o = g->o;
+	uint32_t new_pc = a + 2;
+	// as get_r_d_10() and get_k_r16()
+	uint8_t r = ((opcode >> 5) & 0x10) | (opcode & 0xf);
+	uint8_t d = (opcode >> 4) & 0x1f;
+	uint8_t h = 16 + ((opcode >> 4) & 0xf);
+	uint8_t k = ((opcode & 0x0f00) >> 4) | (opcode & 0xf);
+	int cycle = 1;
+
+	switch (opcode & 0xf000) {
+		case 0x0000: {
+			if (opcode == 0x0000)	// NOP
+				break;
+			switch (opcode & 0xfc00) {
+				case 0x0400:	// CPC
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd - vr - s[S_C];\n"
+						"\t\tif (res)\n"
+						"\t\t\ts[S_Z] = 0;\n"
+						"\t\ts[S_H] = get_compare_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_compare_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = (res >> 7) & 1;\n"
+						"\t\ts[S_C] = get_compare_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r);
+					break;
+				case 0x0c00:	// ADD
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd + vr;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_H] = get_add_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_add_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = (res >> 7) & 1;\n"
+						"\t\ts[S_C] = get_add_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r, d);
+					break;
+				case 0x0800:	// SBC
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd - vr - s[S_C];\n"
+						"\t\td[%d] = res;\n"
+						"\t\tif (res)\n"
+						"\t\t\ts[S_Z] = 0;\n"
+						"\t\ts[S_H] = get_sub_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_sub_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = (res >> 7) & 1;\n"
+						"\t\ts[S_C] = get_sub_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r, d);
+					break;
+				default:
+					if ((opcode & 0xff00) != 0x0100)
+						return 0;
+					// MOVW
+					fprintf(o, "\t\td[%d] = d[%d];\n\t\td[%d] = d[%d];\n",
+							((opcode >> 4) & 0xf) << 1, (opcode & 0xf) << 1,
+							(((opcode >> 4) & 0xf) << 1) + 1, ((opcode & 0xf) << 1) + 1);
+			}
+		}	break;
+		case 0x1000: {
+			switch (opcode & 0xfc00) {
+				case 0x1800:	// SUB
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd - vr;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_H] = get_sub_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_sub_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = (res >> 7) & 1;\n"
+						"\t\ts[S_C] = get_sub_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r, d);
+					break;
+				case 0x1000: {	// CPSE
+					char cond[32];
+					sprintf(cond, "d[%d] == d[%d]", d, r);
+					if (!aot_skip(g, a, cond))
+						return 0;
+				}	break;
+				case 0x1400:	// CP
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd - vr;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_H] = get_compare_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_compare_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = res >> 7;\n"
+						"\t\ts[S_C] = get_compare_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r);
+					break;
+				case 0x1c00:	// ADC
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd + vr + s[S_C];\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_H] = get_add_carry(res, vd, vr, 3);\n"
+						"\t\ts[S_V] = get_add_overflow(res, vd, vr);\n"
+						"\t\ts[S_N] = (res >> 7) & 1;\n"
+						"\t\ts[S_C] = get_add_carry(res, vd, vr, 7);\n"
+						AOT_S, d, r, d);
+					break;
+			}
+		}	break;
+		case 0x2000: {
+			switch (opcode & 0xfc00) {
+				case 0x2000:	// AND
+				case 0x2400:	// EOR
+				case 0x2800:	// OR
+					fprintf(o, AOT_RD
+						"\t\tuint8_t res = vd %c vr;\n"
+						"\t\td[%d] = res;\n"
+						AOT_ZNV0, d, r,
+						(opcode & 0xfc00) == 0x2000 ? '&' :
+							(opcode & 0xfc00) == 0x2400 ? '^' : '|', d);
+					break;
+				case 0x2c00:	// MOV
+					fprintf(o, "\t\td[%d] = d[%d];\n", d, r);
+					break;
+			}
+		}	break;
+		case 0x3000:	// CPI
+			fprintf(o, "\t\tuint8_t vr = d[%d];\n"
+				"\t\tuint8_t res = vr - 0x%02x;\n"
+				"\t\ts[S_Z] = res == 0;\n"
+				"\t\ts[S_H] = get_compare_carry(res, vr, 0x%02x, 3);\n"
+				"\t\ts[S_V] = get_compare_overflow(res, vr, 0x%02x);\n"
+				"\t\ts[S_N] = (res >> 7) & 1;\n"
+				"\t\ts[S_C] = get_compare_carry(res, vr, 0x%02x, 7);\n"
+				AOT_S, h, k, k, k, k);
+			break;
+		case 0x4000:	// SBCI
+			fprintf(o, "\t\tuint8_t vr = d[%d];\n"
+				"\t\tuint8_t res = vr - 0x%02x - s[S_C];\n"
+				"\t\td[%d] = res;\n"
+				"\t\tif (res)\n"
+				"\t\t\ts[S_Z] = 0;\n"
+				"\t\ts[S_N] = (res >> 7) & 1;\n"
+				"\t\ts[S_C] = (0x%02x + s[S_C]) > vr;\n"
+				AOT_S, h, k, h, k);
+			break;
+		case 0x5000:	// SUBI
+			fprintf(o, "\t\tuint8_t vr = d[%d];\n"
+				"\t\tuint8_t res = vr - 0x%02x;\n"
+				"\t\td[%d] = res;\n"
+				"\t\ts[S_Z] = res == 0;\n"
+				"\t\ts[S_N] = (res >> 7) & 1;\n"
+				"\t\ts[S_C] = 0x%02x > vr;\n"
+				AOT_S, h, k, h, k);
+			break;
+		case 0x6000:	// ORI
+		case 0x7000:	// ANDI
+			fprintf(o, "\t\tuint8_t res = d[%d] %c 0x%02x;\n"
+				"\t\td[%d] = res;\n"
+				AOT_ZNV0, h, (opcode & 0xf000) == 0x6000 ? '|' : '&', k, h);
+			break;
+		case 0x9000: {
+			if ((opcode & 0xff0f) == 0x9408)	// SREG set/clear, I might change
+				return 0;
+			switch (opcode & 0xfe0f) {
+				case 0x9400:	// COM
+					fprintf(o, "\t\tuint8_t res = 0xff - d[%d];\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_N] = res >> 7;\n"
+						"\t\ts[S_V] = 0;\n"
+						"\t\ts[S_C] = 1;\n"
+						AOT_S, d, d);
+					break;
+				case 0x9401:	// NEG
+					fprintf(o, "\t\tuint8_t rd = d[%d];\n"
+						"\t\tuint8_t res = 0x00 - rd;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_H] = ((res >> 3) | (rd >> 3)) & 1;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_N] = res >> 7;\n"
+						"\t\ts[S_V] = res == 0x80;\n"
+						"\t\ts[S_C] = res != 0;\n"
+						AOT_S, d, d);
+					break;
+				case 0x9402:	// SWAP
+					fprintf(o, "\t\td[%d] = (d[%d] >> 4) | (d[%d] << 4);\n", d, d, d);
+					break;
+				case 0x9403:	// INC
+				case 0x940a:	// DEC
+					fprintf(o, "\t\tuint8_t res = d[%d] %c 1;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_N] = res >> 7;\n"
+						"\t\ts[S_V] = res == 0x%02x;\n"
+						AOT_S, d, opcode & 0x8 ? '-' : '+', d,
+						opcode & 0x8 ? 0x7f : 0x80);
+					break;
+				case 0x9405:	// ASR
+				case 0x9406:	// LSR
+				case 0x9407:	// ROR
+					fprintf(o, "\t\tuint8_t vr = d[%d];\n"
+						"\t\tuint8_t res = %s;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_Z] = res == 0;\n"
+						"\t\ts[S_C] = vr & 1;\n"
+						"\t\ts[S_N] = %s;\n"
+						"\t\ts[S_V] = s[S_N] ^ s[S_C];\n"
+						AOT_S, d,
+						(opcode & 0xf) == 5 ? "(vr >> 1) | (vr & 0x80)" :
+							(opcode & 0xf) == 6 ? "vr >> 1" :
+							"(s[S_C] ? 0x80 : 0) | vr >> 1",
+						d, (opcode & 0xf) == 6 ? "0" : "res >> 7");
+					break;
+				default: {
+					if ((opcode & 0xfe00) != 0x9600)
+						return 0;
+					// ADIW, SBIW
+					uint8_t w = 24 + ((opcode >> 3) & 0x6);
+					uint8_t wk = ((opcode & 0x00c0) >> 2) | (opcode & 0xf);
+					int add = (opcode & 0xff00) == 0x9600;
+					fprintf(o, "\t\tuint8_t rdl = d[%d], rdh = d[%d];\n"
+						"\t\tuint32_t res = rdl | (rdh << 8);\n"
+						"\t\tres %c= 0x%02x;\n"
+						"\t\td[%d] = res >> 8;\n"
+						"\t\td[%d] = res;\n"
+						"\t\ts[S_V] = %s;\n"
+						"\t\ts[S_Z] = (res & 0xffff) == 0;\n"
+						"\t\ts[S_N] = (res >> 15) & 1;\n"
+						"\t\ts[S_C] = %s;\n"
+						AOT_S, w, w + 1, add ? '+' : '-', wk, w + 1, w,
+						add ? "~(rdh >> 7) & ((res >> 15) & 1)" :
+							"(rdh >> 7) & (~(res >> 15) & 1)",
+						add ? "~((res >> 15) & 1) & (rdh >> 7)" :
+							"((res >> 15) & 1) & (~rdh >> 7)");
+					cycle++;
+				}
+			}
+		}	break;
+		case 0xc000: {	// RJMP
+			int16_t off = ((int16_t)((opcode << 4) & 0xffff)) >> 4;
+			aot_next(g, "\t\t", a, 2, new_pc + (off << 1));
+			return 1;
+		}
+		case 0xe000:	// LDI
+			fprintf(o, "\t\td[%d] = 0x%02x;\n", h, k);
+			break;
+		case 0xf000: {
+			switch (opcode & 0xfe00) {
+				case 0xf000:
+				case 0xf200:
+				case 0xf400:
+				case 0xf600: {	// All the SREG branches
+					int16_t off = ((int16_t)(opcode << 6)) >> 9;
+					int set = (opcode & 0x0400) == 0;
+					fprintf(o, "\t\tif (%ss[%d]) {\n", set ? "" : "!", opcode & 7);
+					aot_next(g, "\t\t\t", a, 2, new_pc + (off << 1));
+					fprintf(o, "\t\t}\n");
+				}	break;
+				case 0xfc00:
+				case 0xfe00: {	// SBRC, SBRS
+					char cond[32];
+					sprintf(cond, "%s(d[%d] & 0x%02x)",
+							opcode & 0x0200 ? "" : "!", d, 1 << (opcode & 7));
+					if (!aot_skip(g, a, cond))
+						return 0;
+				}	break;
+				default:
+					return 0;
+			}
+		}	break;
+		default:
+			return 0;
+	}
+	aot_next(g, "\t\t", a, cycle, new_pc);
+	return 1;
+}
+
+int
+avr_aot_generate(
+		elf_firmware_t * firmware,
+		const char * filename)
+{
+	aot_gen_t g = {
+		.fw = firmware,
+		.start = (firmware->flashbase + 1) & ~1,
+		.end = (firmware->flashbase + firmware->flashsize - firmware->datasize) & ~1,
+	};
+	if (!firmware->flash || g.end <= g.start) {
+		AVR_LOG(NULL, LOG_ERROR, "AOT: %s: no code to translate\n", __FUNCTION__);
+		return -1;
+	}
+	g.o = fopen(filename, "w");
+	if (!g.o) {
+		AVR_LOG(NULL, LOG_ERROR, "AOT: %s: %s: %s\n", __FUNCTION__,
+				filename, strerror(errno));
+		return -1;
+	}
+	const char ** names = NULL;
+#if ELF_SYMBOLS
+	names = calloc((g.end - g.start) >> 1, sizeof(names[0]));
+	for (int i = 0; i < firmware->symbolcount; i++) {
+		uint32_t a = firmware->symbol[i]->addr;
+		if (a >= g.start && a < g.end && !(a & 1))
+			names[(a - g.start) >> 1] = firmware->symbol[i]->symbol;
+	}
+#endif
+	fprintf(g.o, "/*\n"
+			" * %s, translated by simavr, see sim_aot.h\n"
+			" */\n", firmware->mmcu[0] ? firmware->mmcu : "firmware");
+	fputs(aot_prologue, g.o);
+	/*
+	 * Every word gets its block, as we can't tell the code from the data
+	 * in .text, nor where a jump table or a computed jump lands
+	 */
+	for (g.chunk = g.start; g.chunk < g.end; g.chunk = g.chunk_end) {
+		g.chunk_end = g.chunk + AOT_CHUNK < g.end ? g.chunk + AOT_CHUNK : g.end;
+		fprintf(g.o, "static avr_flashaddr_t\n"
+				"aot_%x(\n"
+				"		avr_t * avr,\n"
+				"		avr_flashaddr_t new_pc,\n"
+				"		int * budget)\n"
+				"{\n"
+				"	uint8_t * d = avr->data;\n"
+				"	uint8_t * s = avr->sreg;\n"
+				"	int b = *budget;\n"
+				"dispatch:\n"
+				"	switch (new_pc) {\n", g.chunk);
+		for (uint32_t a = g.chunk; a < g.chunk_end; a += 2) {
+			uint16_t opcode = 0;
+			aot_word(&g, a, &opcode);
+			if (names && names[(a - g.start) >> 1])
+				fprintf(g.o, "	// %s\n", names[(a - g.start) >> 1]);
+			fprintf(g.o, "	case 0x%x: a_%x: {	// %04x\n"
+					"		avr->pc = 0x%x;\n", a, a, opcode, a);
+			if (!aot_insn(&g, a, opcode))
+				fprintf(g.o, "		INTERP();\n");
+			fprintf(g.o, "	}\n");
+		}
+		fprintf(g.o, "	}\n"
+				"	LEAVE();\n"
+				"}\n\n");
+	}
+	fprintf(g.o, "static avr_flashaddr_t (* const aot_chunk[])(avr_t *, avr_flashaddr_t, int *) = {\n");
+	for (uint32_t c = g.start; c < g.end; c += AOT_CHUNK)
+		fprintf(g.o, "	aot_%x,\n", c);
+	fprintf(g.o, "};\n\n"
+			"static avr_flashaddr_t\n"
+			"aot_run(\n"
+			"		avr_t * avr)\n"
+			"{\n"
+			"	avr_flashaddr_t new_pc = avr->pc;\n"
+			"	int budget = AVR_AOT_BUDGET;\n"
+			"	do {\n"
+			"		if ((new_pc & 1) || new_pc < 0x%x || new_pc >= 0x%x)\n"
+			"			// not translated, the decoder runs it if it's the first one\n"
+			"			return budget == AVR_AOT_BUDGET ? avr_aot.interp(avr) : new_pc;\n"
+			"		new_pc = aot_chunk[(new_pc - 0x%x) / %d](avr, new_pc, &budget);\n"
+			"	} while (budget);\n"
+			"	return new_pc;\n"
+			"}\n\n", g.start, g.end, g.start, AOT_CHUNK);
+	fprintf(g.o, "avr_aot_t avr_aot = {\n"
+			"	.version = AVR_AOT_VERSION,\n"
+			"	.avrsize = sizeof(avr_t),\n"
+			"	.base = 0x%x, .size = 0x%x,\n"
+			"	.start = 0x%x, .end = 0x%x,\n"
+			"	.hash = 0x%016llxULL,\n"
+			"	.run = aot_run,\n"
+			"};\n",
+			firmware->flashbase, firmware->flashsize, g.start, g.end,
+			(unsigned long long)aot_hash(firmware->flash, firmware->flashsize));
+	free(names);
+	int res = ferror(g.o) ? -1 : 0;
+	if (fclose(g.o) || res) {
+		AVR_LOG(NULL, LOG_ERROR, "AOT: %s: unable to write %s\n", __FUNCTION__, filename);
+		return -1;
+	}
+	return 0;
+}
+
+#ifdef __MINGW32__
+/*
+ * No dlopen() there; the C file can still be generated, but not loaded
+ */
+int
+avr_aot_load(
+		avr_t * avr,
+		const char * filename)
+{
+	AVR_LOG(avr, LOG_ERROR, "AOT: %s: %s: not supported on this platform\n",
+			__FUNCTION__, filename);
+	return -1;
+}
+
+void
+avr_aot_unload(
+		avr_t * avr)
+{
+	avr->aot = NULL;
+	avr->aot_lib = NULL;
+	avr->run_one = avr_get_run_one(avr);
+}
+
+#else
+
+int
+avr_aot_load(
+		avr_t * avr,
+		const char * filename)
+{
+	void * lib = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		AVR_LOG(avr, LOG_ERROR, "AOT: %s: %s\n", __FUNCTION__, dlerror());
+		return -1;
+	}
+	avr_aot_t * aot = dlsym(lib, "avr_aot");
+	if (!aot || aot->version != AVR_AOT_VERSION || aot->avrsize != sizeof(avr_t)) {
+		AVR_LOG(avr, LOG_ERROR, "AOT: %s: %s was not made for this simavr\n",
+				__FUNCTION__, filename);
+		dlclose(lib);
+		return -1;
+	}
+	if (aot->size > avr->flashend + 1 || aot->base > avr->flashend + 1 - aot->size ||
+			aot_hash(avr->flash + aot->base, aot->size) != aot->hash) {
+		AVR_LOG(avr, LOG_ERROR, "AOT: %s: %s was not made for this firmware\n",
+				__FUNCTION__, filename);
+		dlclose(lib);
+		return -1;
+	}
+	avr_aot_unload(avr);
+	// the library can be shared by several cores, this decoder works for all
+	aot->interp = avr_run_one;
+	avr->aot = aot;
+	avr->aot_lib = lib;
+	avr->run_one = avr_get_run_one(avr);
+	AVR_LOG(avr, LOG_TRACE, "AOT: loaded %s, code %04x-%04x\n",
+			filename, aot->start, aot->end);
+	return 0;
+}
+
+void
+avr_aot_unload(
+		avr_t * avr)
+{
+	avr->aot = NULL;
+	avr->run_one = avr_get_run_one(avr);
+	if (avr->aot_lib)
+		dlclose(avr->aot_lib);
+	avr->aot_lib = NULL;
+}
+
+#endif /* __MINGW32__ */
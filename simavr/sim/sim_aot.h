@@ -0,0 +1,97 @@
+/*
+	sim_aot.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Ahead of time translation of a firmware.
+ *
+ * avr_aot_generate() writes the code of a firmware as a C file, with one
+ * block per flash word; built as a shared library, avr_aot_load() uses it
+ * in place of the instruction decoder:
+ *
+ *	gcc -O1 -shared -fPIC -I simavr/sim -o firmware.so firmware.c
+ *
+ * The register and flow instructions (ALU, compares, immediate loads,
+ * relative jumps, branches and skips) are native code; the others call the
+ * decoder, as does any PC outside of the translated code. The translated
+ * code runs instructions back to back as long as the run loop would have
+ * nothing to do between them: no interrupt pending, no cycle timer due and
+ * no change of the I flag. Otherwise it returns, so the timing and the
+ * state seen by the peripherals are the same as with the decoder.
+ *
+ * The library is only valid for the flash it was made from, that is checked
+ * when it is loaded; if the firmware changes its flash while running, the
+ * translation is dropped, and the decoder takes over.
+ *
+ * The flags are computed by the decoder's own helpers, sim_core_flags.h.
+ * There is no dlopen() on MinGW, avr_aot_load() always fails there.
+ */
+#ifndef __SIM_AOT_H__
+#define __SIM_AOT_H__
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// change this when the generated code or avr_aot_t change
+#define AVR_AOT_VERSION	1
+// most instructions run in one call, so the caller gets control back
+#define AVR_AOT_BUDGET	1024
+
+/*
+ * Exported as 'avr_aot' by the generated library
+ */
+typedef struct avr_aot_t {
+	uint32_t	version;
+	uint32_t	avrsize;		// sizeof(avr_t) the library was built with
+	uint32_t	base, size;		// flash image the code was made from
+	uint32_t	start, end;		// part that is translated
+	uint64_t	hash;			// of the flash image
+	avr_flashaddr_t (*run)(struct avr_t * avr);
+	// filled by avr_aot_load(), runs what isn't translated
+	avr_flashaddr_t (*interp)(struct avr_t * avr);
+} avr_aot_t;
+
+// writes the translation of 'firmware' as C in 'filename'
+int
+avr_aot_generate(
+		elf_firmware_t * firmware,
+		const char * filename);
+/*
+ * Loads the translation from library 'filename', and runs it instead of
+ * the decoder. Returns -1 if it can't be loaded, or doesn't match the flash.
+ */
+int
+avr_aot_load(
+		avr_t * avr,
+		const char * filename);
+// goes back to the decoder, and closes the library
+void
+avr_aot_unload(
+		avr_t * avr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_AOT_H__ */
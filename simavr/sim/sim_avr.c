@@ -24,12 +24,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "sim_avr.h"
 #include "sim_core.h"
 #include "sim_time.h"
 #include "sim_gdb.h"
 #include "avr_uart.h"
 #include "sim_vcd_file.h"
+#include "sim_data_map.h"
+#include "sim_data_guard.h"
+#include "sim_file_map.h"
+#include "sim_aot.h"
+#include "sim_hle.h"
+#include "sim_semihost.h"
+#include "sim_mailbox.h"
 #include "avr/avr_mcu_section.h"
 
 #define AVR_KIND_DECL
@@ -66,22 +76,167 @@ avr_global_logger_get(void)
 }
 
 
+/*
+ * 'posted' is set by avr_wake(), on any thread, and taken by the next raw
+ * sleep, which then sets 'woken' and the cycles it didn't sleep in 'cut';
+ * these are for the run loop, on the simulator thread.
+ */
+typedef struct avr_wake_t {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	clockid_t			clock;		// of the 'cond' deadlines
+	volatile int		posted;
+	int					woken;
+	avr_cycle_count_t	cut;
+	avr_irq_t *			irq;
+} avr_wake_t;
+
+static void
+avr_wake_init(
+		avr_t * avr)
+{
+	static const char * name[] = { "1>wake" };
+	avr_wake_t * w = calloc(1, sizeof(*w));
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_condattr_init(&attr);
+	w->clock = CLOCK_REALTIME;
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__)
+	// so setting the date doesn't make a sleep last forever, or not at all
+	if (!pthread_condattr_setclock(&attr, CLOCK_MONOTONIC))
+		w->clock = CLOCK_MONOTONIC;
+#endif
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	w->irq = avr_alloc_irq(&avr->irq_pool, 0, 1, name);
+	avr->wake = w;
+}
+
+static void
+avr_wake_free(
+		avr_t * avr)
+{
+	avr_wake_t * w = avr->wake;
+
+	if (!w)
+		return;
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);	// the IRQ goes with the pool
+	avr->wake = NULL;
+}
+
+void
+avr_wake(
+		avr_t * avr)
+{
+	avr_wake_t * w = avr->wake;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->lock);
+	w->posted = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+avr_irq_t *
+avr_wake_getirq(
+		avr_t * avr)
+{
+	return avr->wake ? avr->wake->irq : NULL;
+}
+
+static uint64_t
+avr_wake_now_usec(
+		clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Waits for 'usec', or until avr_wake() is called; returns how long that
+ * was then, or -1 if it wasn't called
+ */
+static int64_t
+avr_wake_wait(
+		avr_wake_t * w,
+		uint32_t usec)
+{
+	uint64_t start = 0, end = 0;
+	if (usec) {
+		// how long it slept is measured on a clock that doesn't jump
+		start = avr_wake_now_usec(CLOCK_MONOTONIC);
+		end = usec + (w->clock == CLOCK_MONOTONIC ?
+				start : avr_wake_now_usec(w->clock));
+	}
+	struct timespec deadline = {
+		.tv_sec = end / 1000000,
+		.tv_nsec = (end % 1000000) * 1000,
+	};
+	int res = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->posted && usec && res != ETIMEDOUT)
+		res = pthread_cond_timedwait(&w->cond, &w->lock, &deadline);
+	int posted = w->posted;
+	w->posted = 0;
+	pthread_mutex_unlock(&w->lock);
+
+	if (!posted)
+		return -1;
+	uint64_t slept = usec ? avr_wake_now_usec(CLOCK_MONOTONIC) - start : 0;
+	return slept < usec ? slept : usec;
+}
+
+/*
+ * Called by the run loops when a sleep was cut short: the cycles that
+ * weren't slept are given back, so what woke the core happens when it did.
+ */
+static void
+avr_wake_woken(
+		avr_t * avr)
+{
+	avr_wake_t * w = avr->wake;
+
+	avr->cycle -= w->cut;
+	w->cut = 0;
+	w->woken = 0;
+	avr_raise_irq(w->irq, 1);
+}
+
 int avr_init(avr_t * avr)
 {
-	avr->flash = malloc(avr->flashend + 1);
-	memset(avr->flash, 0xff, avr->flashend + 1);
+	if (avr->flash_file) {
+		avr->flash_map = avr_file_map_open(avr, avr->flash_file, avr->flashend + 1);
+		if (!avr->flash_map)
+			AVR_LOG(avr, LOG_ERROR, "CORE: Unable to map flash file %s\n", avr->flash_file);
+	}
+	if (avr->flash_map)
+		avr->flash = avr->flash_map->base;
+	else {
+		avr->flash = malloc(avr->flashend + 1);
+		memset(avr->flash, 0xff, avr->flashend + 1);
+	}
 	avr->codeend = avr->flashend;
-	avr->data = malloc(avr->ramend + 1);
+	if ((avr->flags & AVR_FLAG_DATA_GUARD) && avr_data_guard_init(avr)) {
+		AVR_LOG(avr, LOG_WARNING, "CORE: guarded data space not available\n");
+		avr->flags &= ~AVR_FLAG_DATA_GUARD;
+	}
+	if (!avr->data_guard)
+		avr->data = malloc(avr->ramend + 1);
 	memset(avr->data, 0, avr->ramend + 1);
-#ifdef CONFIG_SIMAVR_TRACE
 	avr->trace_data = calloc(1, sizeof(struct avr_trace_data_t));
-#endif
 	
 	AVR_LOG(avr, LOG_TRACE, "%s init\n", avr->mmcu);
 
 	// cpu is in limbo before init is finished.
 	avr->state = cpu_Limbo;
 	avr->frequency = 1000000;	// can be overridden via avr_mcu_section
+	avr_allocate_ios(avr);
 	avr_interrupt_init(avr);
 	if (avr->special_init)
 		avr->special_init(avr, avr->special_data);
@@ -90,9 +245,16 @@ int avr_init(avr_t * avr)
 	// set default (non gdb) fast callbacks
 	avr->run = avr_callback_run_raw;
 	avr->sleep = avr_callback_sleep_raw;
+	avr_wake_init(avr);
+	avr_mailbox_init(avr);
 	avr->state = cpu_Running;
 	// number of address bytes to push/pull on/off the stack
 	avr->address_size = avr->eind ? 3 : 2;
+	if (avr->flags & AVR_FLAG_SUPERINSN)
+		avr->superinsn = calloc((avr->flashend + 1) >> 1, 1);
+	if (avr->flags & AVR_FLAG_IDLE_LOOPS)
+		avr->idle = calloc((avr->flashend + 1) >> 1, 1);
+	avr->run_one = avr_get_run_one(avr);
 	avr->log = 1;
 	avr_reset(avr);	
 	return 0;
@@ -110,11 +272,44 @@ void avr_terminate(avr_t * avr)
 		avr_vcd_close(avr->vcd);
 		avr->vcd = NULL;
 	}
+	if (avr->aot_lib)
+		avr_aot_unload(avr);
+	avr_hle_free(avr);
+	avr_semihost_free(avr);
 	avr_deallocate_ios(avr);
-
+	avr_wake_free(avr);
+	avr_mailbox_free(avr);
+	// IRQs, hooks and names, all in one go
+	avr_free_irq_pool(&avr->irq_pool);
+	avr_data_map_free(avr);
+
+	if (avr->flash_map) {
+		if (avr->flash == avr->flash_map->base)
+			avr->flash = NULL;
+		avr_file_map_close(avr->flash_map);
+		avr->flash_map = NULL;
+	}
 	if (avr->flash) free(avr->flash);
-	if (avr->data) free(avr->data);
+	if (avr->data_guard)
+		avr_data_guard_free(avr);
+	else if (avr->data)
+		free(avr->data);
 	avr->flash = avr->data = NULL;
+	free(avr->superinsn);
+	avr->superinsn = NULL;
+	free(avr->idle);
+	avr->idle = NULL;
+	if (avr->trace_data) {
+		free(avr->trace_data->codeline);
+		free(avr->trace_data);
+		avr->trace_data = NULL;
+	}
+}
+
+void avr_set_trace(avr_t * avr, int trace)
+{
+	avr->trace = trace != 0;
+	avr->run_one = avr_get_run_one(avr);
 }
 
 void avr_reset(avr_t * avr)
@@ -128,6 +323,9 @@ void avr_reset(avr_t * avr)
 		avr->sreg[i] = 0;
 	avr_interrupt_reset(avr);
 	avr_cycle_timer_reset(avr);
+	avr_mailbox_reset(avr);
+	avr_file_map_reset(avr->flash_map);
+	avr_semihost_reset(avr);
 	if (avr->reset)
 		avr->reset(avr);
 	avr_io_t * port = avr->io_port;
@@ -163,6 +361,12 @@ static void _avr_io_command_write(struct avr_t * avr, avr_io_addr_t addr, uint8_
 			if (avr->vcd)
 				avr_vcd_stop(avr->vcd);
 			break;
+		case SIMAVR_CMD_CORE_START_TRACE:
+			avr_set_trace(avr, 1);
+			break;
+		case SIMAVR_CMD_CORE_STOP_TRACE:
+			avr_set_trace(avr, 0);
+			break;
 		case SIMAVR_CMD_UART_LOOPBACK: {
 			avr_irq_t * src = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT);
 			avr_irq_t * dst = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
@@ -215,6 +419,7 @@ void avr_loadcode(avr_t * avr, uint8_t * code, uint32_t size, avr_flashaddr_t ad
 		abort();
 	}
 	memcpy(avr->flash + address, code, size);
+	avr_superinsn_flush(avr, address, size);
 }
 
 /**
@@ -250,6 +455,9 @@ void avr_callback_run_gdb(avr_t * avr)
 	if (avr->state == cpu_Stopped)
 		return ;
 
+	if (unlikely(avr->mailbox_posted))
+		avr_mailbox_drain(avr);
+
 	// if we are stepping one instruction, we "run" for one..
 	int step = avr->state == cpu_Step;
 	if (step)
@@ -258,10 +466,7 @@ void avr_callback_run_gdb(avr_t * avr)
 	avr_flashaddr_t new_pc = avr->pc;
 
 	if (avr->state == cpu_Running) {
-		new_pc = avr_run_one(avr);
-#if CONFIG_SIMAVR_TRACE
-		avr_dump_state(avr);
-#endif
+		new_pc = avr->run_one(avr);
 	}
 
 	// if we just re-enabled the interrupts...
@@ -288,6 +493,8 @@ void avr_callback_run_gdb(avr_t * avr)
 		 */
 		avr->sleep(avr, sleep);
 		avr->cycle += 1 + sleep;
+		if (avr->wake->woken)
+			avr_wake_woken(avr);
 	}
 	// Interrupt servicing might change the PC too, during 'sleep'
 	if (avr->state == cpu_Running || avr->state == cpu_Sleeping)
@@ -302,20 +509,47 @@ void avr_callback_run_gdb(avr_t * avr)
 void avr_callback_sleep_raw(avr_t * avr, avr_cycle_count_t howLong)
 {
 	uint32_t usec = avr_pending_sleep_usec(avr, howLong);
-	if (usec > 0) {
-		usleep(usec);
-	}
+	avr_wake_t * w = avr->wake;
+
+	// short sleeps are only added up, but avr_wake() still cuts them
+	if (!usec && !w->posted)
+		return;
+	int64_t slept = avr_wake_wait(w, usec);
+	if (slept < 0)
+		return;
+	/*
+	 * 'usec' also has the short sleeps before this one, which were counted
+	 * but not slept; the core is that far ahead of the wall clock, so
+	 * whatever is left after them was slept on this one
+	 */
+	uint32_t mine = avr_cycles_to_usec(avr, howLong);
+	uint32_t ahead = usec > mine ? usec - mine : 0;
+	avr_cycle_count_t done = slept > ahead ?
+			avr_usec_to_cycles(avr, slept - ahead) : 0;
+	w->cut = done < howLong ? howLong - done : 0;
+	w->woken = 1;
+}
+
+void
+avr_wake_sleep(
+		avr_t * avr,
+		avr_cycle_count_t howLong)
+{
+	avr->sleep(avr, howLong);
+	avr->cycle += howLong;
+	if (avr->wake->woken)
+		avr_wake_woken(avr);
 }
 
 void avr_callback_run_raw(avr_t * avr)
 {
+	if (unlikely(avr->mailbox_posted))
+		avr_mailbox_drain(avr);
+
 	avr_flashaddr_t new_pc = avr->pc;
 
 	if (avr->state == cpu_Running) {
-		new_pc = avr_run_one(avr);
-#if CONFIG_SIMAVR_TRACE
-		avr_dump_state(avr);
-#endif
+		new_pc = avr->run_one(avr);
 	}
 
 	// if we just re-enabled the interrupts...
@@ -342,6 +576,8 @@ void avr_callback_run_raw(avr_t * avr)
 		 */
 		avr->sleep(avr, sleep);
 		avr->cycle += 1 + sleep;
+		if (avr->wake->woken)
+			avr_wake_woken(avr);
 	}
 	// Interrupt servicing might change the PC too, during 'sleep'
 	if (avr->state == cpu_Running || avr->state == cpu_Sleeping)
@@ -351,7 +587,10 @@ void avr_callback_run_raw(avr_t * avr)
 
 int avr_run(avr_t * avr)
 {
-	avr->run(avr);
+	if (avr->flags & AVR_FLAG_DATA_GUARD)
+		avr_data_guard_run(avr);
+	else
+		avr->run(avr);
 	return avr->state;
 }
 
@@ -365,18 +604,22 @@ avr_core_allocate(
 	return (avr_t *)b;
 }
 
+avr_kind_t *
+avr_find_kind(
+		const char *name)
+{
+	for (int i = 0; avr_kind[i]; i++)
+		for (int j = 0; j < 4 && avr_kind[i]->names[j]; j++)
+			if (!strcmp(avr_kind[i]->names[j], name))
+				return avr_kind[i];
+	return NULL;
+}
+
 avr_t *
 avr_make_mcu_by_name(
 		const char *name)
 {
-	avr_kind_t * maker = NULL;
-	for (int i = 0; avr_kind[i] && !maker; i++) {
-		for (int j = 0; avr_kind[i]->names[j]; j++)
-			if (!strcmp(avr_kind[i]->names[j], name)) {
-				maker = avr_kind[i];
-				break;
-			}
-	}
+	avr_kind_t * maker = avr_find_kind(name);
 	if (!maker) {
 		AVR_LOG(((avr_t*)0), LOG_ERROR, "%s: AVR '%s' not known\n", __FUNCTION__, name);
 		return NULL;
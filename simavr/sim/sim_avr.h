@@ -54,8 +54,6 @@ enum {
 	// real SREG
 	R_SREG	= 32+0x3f,
 
-	// maximum number of IO registers, on normal AVRs
-	MAX_IOs	= 279,	// Bigger AVRs need more than 256-32 (mega1280)
 };
 
 #define AVR_DATA_TO_IO(v) ((v) - 32)
@@ -99,7 +97,16 @@ enum {
 	cpu_Crashed,    // avr software crashed (watchdog fired)
 };
 
-// this is only ever used if CONFIG_SIMAVR_TRACE is defined
+/*
+ * Options for avr_t 'flags', set them before calling avr_init()
+ */
+enum {
+	AVR_FLAG_DATA_GUARD	= (1 << 0),	// catch out of ram accesses with guard pages, see sim_data_guard.h
+	AVR_FLAG_SUPERINSN	= (1 << 1),	// run common instruction sequences in one go, see sim_core.c
+	AVR_FLAG_IDLE_LOOPS	= (1 << 2),	// skip polling and delay loops to the next event, see sim_core.c
+};
+
+// only filled by the traced decoder, see avr_set_trace()
 struct avr_trace_data_t {
 	struct avr_symbol_t ** codeline;
 
@@ -132,42 +139,151 @@ struct avr_trace_data_t {
 	uint32_t	touched[256 / 32];	// debug
 };
 
+// entries of the IO callback tables, see avr_t
+struct avr_io_r_t {
+	void * param;
+	avr_io_read_t c;
+	int stable;		// see avr_io_set_read_stable()
+};
+struct avr_io_w_t {
+	void * param;
+	avr_io_write_t c;
+};
+
 /*
  * Main AVR instance. Some of these fields are set by the AVR "Core" definition files
  * the rest is runtime data (as little as possible)
+ *
+ * Configuration and bookkeeping that are only used now and then come after
+ * the per instruction state and the timer/interrupt queues, don't move
+ * these up.
  */
 typedef struct avr_t {
+	/*
+	 * Per instruction state: what the decoder and avr_run() look at for
+	 * every instruction, kept together in the first two cache lines on
+	 * 64 bits hosts. The members are reached as avr->pc and so on.
+	 */
+	struct {
+		/* 
+		 * ** current PC **
+		 * Note that the PC is representing /bytes/ while the AVR value is
+		 * assumed to be "words". This is in line with what GDB does...
+		 * this is why you will see >>1 and <<1 in the decoder to handle jumps.
+		 * It CAN be a little confusing, so concentrate, young grasshopper.
+		 */
+		avr_flashaddr_t	pc;
+		int					state;		// stopped, running, sleeping
+
+		// cycles gets incremented when sleeping and when running; it corresponds
+		// not only to "cycles that runs" but also "cycles that might have run"
+		// like, sleeping.
+		avr_cycle_count_t	cycle;		// current cycle
+
+		// Mirror of the SREG register, to facilitate the access to bits
+		// in the opcode decoder.
+		// This array is re-synthesized back/forth when SREG changes
+		uint8_t		sreg[8];
+		uint8_t		i_shadow;	// used to detect edges on I flag
+		uint8_t		address_size;	// 2, or 3 for cores >128KB in flash
+
+		// DEBUG ONLY -- change it with avr_set_trace(), that picks the decoder
+		uint8_t	trace : 1,
+				log : 2; // log level, default to 1
+		// raises posted by other threads are waiting, see sim_mailbox.h
+		volatile uint8_t	mailbox_posted;
+
+		// these are filled by sim_core_declare from constants in /usr/lib/avr/include/avr/io*.h
+		// (see further down for the others)
+		uint16_t 	ramend;		
+		uint16_t	ioend;		// last IO register (RAMSTART-1), or hooked SRAM; optional
+		uint32_t	flashend;
+		avr_io_addr_t	rampz;	// optional, only for ELPM/SPM on >64Kb cores
+		avr_io_addr_t	eind;	// optional, only for EIJMP/EICALL on >64Kb cores
+		uint32_t	flags;			// AVR_FLAG_* options
+
+		// filled by the ELF data, this allow tracking of invalid jumps
+		uint32_t			codeend;
+
+		// flash memory (initialized to 0xff, and code loaded into it)
+		uint8_t *	flash;
+		// this is the general purpose registers, IO registers, and SRAM
+		uint8_t *	data;
+
+		/*
+		 * callback when specific IO registers are read/written.
+		 * These tables are allocated by avr_init() to cover the IO space of the
+		 * core, from 32 to 'ioend', and are indexed with AVR_DATA_TO_IO().
+		 * Hooking a register in SRAM moves 'ioend' up to it, see sim_io.h.
+		 * When several modules want to see the writes to the same register
+		 * (some tiny* registers have bits used by different IO modules) a
+		 * "dispatch" callback is installed on that register only, so the
+		 * other, normal registers are not impacted.
+		 */
+		struct avr_io_r_t *	io_r;
+		struct avr_io_w_t *	io_w;
+		int			io_count;	// number of entries in the tables
+
+		/*!
+		 * Default AVR core run function.
+		 * Two modes are available, a "raw" run that goes as fast as
+		 * it can, and a "gdb" mode that also watchouts for gdb events
+		 * and is a little bit slower.
+		 */
+		void (*run)(struct avr_t * avr);
+		// instruction decoder for this core, see avr_get_run_one()
+		avr_flashaddr_t (*run_one)(struct avr_t * avr);
+
+		/*!
+		 * Sleep default behaviour.
+		 * In "raw" mode, it waits, unless avr_wake() is called; in gdb mode, it waits
+		 * for howLong for gdb command on it's sockets.
+		 */
+		void (*sleep)(struct avr_t * avr, avr_cycle_count_t howLong);
+	};
+	// cycle timers tracking & delivery; the active list is first, right
+	// after the state above
+	avr_cycle_timer_pool_t	cycle_timers;
+	// interrupt vectors and delivery fifo
+	avr_int_table_t	interrupts;
+
+	// optional, map of the data space past ramend, see sim_data_map.h
+	struct avr_data_page_t * data_map;
+	// with AVR_FLAG_DATA_GUARD, the window avr->data is in
+	struct avr_data_guard_t * data_guard;
+	// with AVR_FLAG_SUPERINSN, the instruction sequence at each flash word
+	uint8_t *	superinsn;
+	// with AVR_FLAG_IDLE_LOOPS, the loop starting at each flash word, and
+	// the decoder for everything else
+	uint8_t *	idle;
+	avr_flashaddr_t (*idle_run_one)(struct avr_t * avr);
+
+	// Only used when tracing, see avr_set_trace()
+	struct avr_trace_data_t *trace_data;
+
+	/*
+	 * Cold part. Configuration, and state only used by the modules,
+	 * the loaders, gdb and so on
+	 */
 	const char * mmcu;	// name of the AVR
 	// these are filled by sim_core_declare from constants in /usr/lib/avr/include/avr/io*.h
-	uint16_t 	ramend;		
-	uint32_t	flashend;
 	uint32_t	e2end;
 	uint8_t		vector_size;
 	uint8_t		signature[3];
 	uint8_t		fuse[4];
-	avr_io_addr_t	rampz;	// optional, only for ELPM/SPM on >64Kb cores
-	avr_io_addr_t	eind;	// optional, only for EIJMP/EICALL on >64Kb cores
-	uint8_t		address_size;	// 2, or 3 for cores >128KB in flash
-	
-	// filled by the ELF data, this allow tracking of invalid jumps
-	uint32_t			codeend;
 
-	int					state;		// stopped, running, sleeping
 	uint32_t			frequency;	// frequency we are running at
 	// mostly used by the ADC for now
 	uint32_t			vcc,avcc,aref; // (optional) voltages in millivolts
 
-	// cycles gets incremented when sleeping and when running; it corresponds
-	// not only to "cycles that runs" but also "cycles that might have run"
-	// like, sleeping.
-	avr_cycle_count_t	cycle;		// current cycle
-
 	/**
 	 * Sleep requests are accumulated in sleep_usec until the minimum sleep value
 	 * is reached, at which point sleep_usec is cleared and the sleep request
 	 * is passed on to the operating system.
 	 */
 	uint32_t sleep_usec;
+	// lets avr_wake() cut a raw sleep short, from another thread
+	struct avr_wake_t * wake;
 
 	// called at init time
 	void (*init)(struct avr_t * avr);
@@ -180,100 +296,29 @@ typedef struct avr_t {
 	// called at reset time
 	void (*reset)(struct avr_t * avr);
 
-	/*!
-	 * Default AVR core run function.
-	 * Two modes are available, a "raw" run that goes as fast as
-	 * it can, and a "gdb" mode that also watchouts for gdb events
-	 * and is a little bit slower.
-	 */
-	void (*run)(struct avr_t * avr);
-
-	/*!
-	 * Sleep default behaviour.
-	 * In "raw" mode, it calls usleep, in gdb mode, it waits
-	 * for howLong for gdb command on it's sockets.
-	 */
-	void (*sleep)(struct avr_t * avr, avr_cycle_count_t howLong);
-
 	/*!
 	 * Every IRQs will be stored in this pool. It is not
 	 * mandatory (yet) but will allow listing IRQs and their connections
 	 */
 	avr_irq_pool_t	irq_pool;
 
-	// Mirror of the SREG register, to facilitate the access to bits
-	// in the opcode decoder.
-	// This array is re-synthesized back/forth when SREG changes
-	uint8_t		sreg[8];
-	uint8_t		i_shadow;	// used to detect edges on I flag
-
-	/* 
-	 * ** current PC **
-	 * Note that the PC is representing /bytes/ while the AVR value is
-	 * assumed to be "words". This is in line with what GDB does...
-	 * this is why you will see >>1 and <<1 in the decoder to handle jumps.
-	 * It CAN be a little confusing, so concentrate, young grasshopper.
-	 */
-	avr_flashaddr_t	pc;
+	// optional, used only if asked for with avr_iomem_getirq()
+	struct avr_irq_t ** io_irq;
 
 	/*
-	 * callback when specific IO registers are read/written.
-	 * There is one drawback here, there is in way of knowing what is the
-	 * "beginning of useful sram" on a core, so there is no way to deduce
-	 * what is the maximum IO register for a core, and thus, we can't
-	 * allocate this table dynamically.
-	 * If you wanted to emulate the BIG AVRs, and XMegas, this would need
-	 * work.
+	 * Optional files backing the flash and the eeprom, set them before
+	 * calling avr_init(). avr_load_firmware() writes over them, see
+	 * sim_file_map.h
 	 */
-	struct {
-		struct avr_irq_t * irq;	// optional, used only if asked for with avr_iomem_getirq()
-		struct {
-			void * param;
-			avr_io_read_t c;
-		} r;
-		struct {
-			void * param;
-			avr_io_write_t c;
-		} w;
-	} io[MAX_IOs];
-
-	/*
-	 * This block allows sharing of the IO write/read on addresses between
-	 * multiple callbacks. In 99% of case it's not needed, however on the tiny*
-	 * (tiny85 at last) some registers have bits that are used by different
-	 * IO modules.
-	 * If this case is detected, a special "dispatch" callback is installed that
-	 * will handle this particular case, without impacting the performance of the
-	 * other, normal cases...
-	 */
-	int	io_shared_io_count;
-	struct {
-		int used;
-		struct {
-			void * param;
-			void * c;
-		} io[4];
-	} io_shared_io[4];
-
-	// flash memory (initialized to 0xff, and code loaded into it)
-	uint8_t *	flash;
-	// this is the general purpose registers, IO registers, and SRAM
-	uint8_t *	data;
+	const char *	flash_file;
+	const char *	eeprom_file;
+	uint32_t		file_sync_usec;	// if non zero, msync() changes after that long
+	struct avr_file_map_t * flash_map;
 
 	// queue of io modules
 	struct avr_io_t *io_port;
-
-	// cycle timers tracking & delivery
-	avr_cycle_timer_pool_t	cycle_timers;
-	// interrupt vectors and delivery fifo
-	avr_int_table_t	interrupts;
-
-	// DEBUG ONLY -- value ignored if CONFIG_SIMAVR_TRACE = 0
-	uint8_t	trace : 1,
-			log : 2; // log level, default to 1
-	
-	// Only used if CONFIG_SIMAVR_TRACE is defined
-	struct avr_trace_data_t *trace_data;
+	// index of the ioctls the io modules answer to, see avr_ioctl()
+	struct avr_io_ctl_t ** io_ctl;
 
 	// VALUE CHANGE DUMP file (waveforms)
 	// this is the VCD file that gets allocated if the 
@@ -281,7 +326,17 @@ typedef struct avr_t {
 	// to be generated, and allocates it's own symbols
 	// using AVR_MMCU_TAG_VCD_TRACE (see avr_mcu_section.h)
 	struct avr_vcd_t * vcd;
+	// firmware requests to the host, see sim_semihost.h
+	struct avr_semihost_t * semihost;
 	
+	// translated firmware and the library it's in, see sim_aot.h
+	struct avr_aot_t * aot;
+	void *		aot_lib;
+	// libc routines run in C, see sim_hle.h
+	struct avr_hle_t * hle;
+	// IRQs raised from other threads, see sim_mailbox.h
+	struct avr_mailbox_t * mailbox;
+
 	// gdb hooking structure. Only present when gdb server is active
 	struct avr_gdb_t * gdb;
 
@@ -304,6 +359,10 @@ typedef struct avr_symbol_t {
 	const char  symbol[0];
 } avr_symbol_t;
 
+// locate the maker for mcu "name", or NULL
+avr_kind_t *
+avr_find_kind(
+		const char *name);
 // locate the maker for mcu "name" and allocates a new avr instance
 avr_t *
 avr_make_mcu_by_name(
@@ -326,11 +385,39 @@ avr_reset(
 int
 avr_run(
 		avr_t * avr);
+/*
+ * Can be called from any thread, once something the AVR waits for is there:
+ * the raw sleep in progress returns straight away (or the next one doesn't
+ * happen), and the core only counts the cycles it did sleep. Then, on the
+ * simulator thread, the IRQ from avr_wake_getirq() is raised, so whoever
+ * called this can hand over what arrived.
+ */
+void
+avr_wake(
+		avr_t * avr);
+struct avr_irq_t *
+avr_wake_getirq(
+		avr_t * avr);
+/*
+ * Lets 'howLong' cycles go by like a sleep does, with avr->sleep(): only
+ * what another thread does, through avr_wake(), can cut it short. For
+ * the decoders that find the core waiting while it's running
+ */
+void
+avr_wake_sleep(
+		avr_t * avr,
+		avr_cycle_count_t howLong);
 // finish any pending operations 
 void
 avr_terminate(
 		avr_t * avr);
 
+// turns instruction tracing on or off, and switches decoder accordingly
+void
+avr_set_trace(
+		avr_t * avr,
+		int trace);
+
 // set an IO register to receive commands from the AVR firmware
 // it's optional, and uses the ELF tags
 void
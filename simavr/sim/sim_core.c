@@ -25,7 +25,12 @@
 #include <ctype.h>
 #include "sim_avr.h"
 #include "sim_core.h"
+#include "sim_core_flags.h"
 #include "sim_gdb.h"
+#include "sim_data_map.h"
+#include "sim_aot.h"
+#include "sim_hle.h"
+#include "sim_time.h"
 #include "avr_flash.h"
 #include "avr_watchdog.h"
 
@@ -36,9 +41,11 @@ const char * _sreg_bit_name = "cznvshti";
  * Handle "touching" registers, marking them changed.
  * This is used only for debugging purposes to be able to
  * print the effects of each instructions on registers
+ *
+ * The tracing code is always built, but only in the traced decoder (see
+ * avr_get_run_one()), where 'trace' is a constant; in the others, these
+ * macros compile to nothing.
  */
-#if CONFIG_SIMAVR_TRACE
-
 #define T(w) w
 
 #define REG_TOUCH(a, r) (a)->trace_data->touched[(r) >> 5] |= (1 << ((r) & 0x1f))
@@ -63,7 +70,7 @@ int dont_trace(const char * name)
 int donttrace = 0;
 
 #define STATE(_f, args...) { \
-	if (avr->trace) {\
+	if (trace && avr->trace) {\
 		if (avr->trace_data->codeline && avr->trace_data->codeline[avr->pc>>1]) {\
 			const char * symn = avr->trace_data->codeline[avr->pc>>1]->symbol; \
 			int dont = 0 && dont_trace(symn);\
@@ -77,7 +84,7 @@ int donttrace = 0;
 			printf("%s: %04x: " _f, __FUNCTION__, avr->pc, ## args);\
 		}\
 	}
-#define SREG() if (avr->trace && donttrace == 0) {\
+#define SREG() if (trace && avr->trace && donttrace == 0) {\
 	printf("%04x: \t\t\t\t\t\t\t\t\tSREG = ", avr->pc); \
 	for (int _sbi = 0; _sbi < 8; _sbi++)\
 		printf("%c", avr->sreg[_sbi] ? toupper(_sreg_bit_name[_sbi]) : '.');\
@@ -86,6 +93,10 @@ int donttrace = 0;
 
 void crash(avr_t* avr)
 {
+	if (!avr->trace) {
+		avr_sadly_crashed(avr, 0);
+		return;
+	}
 	DUMP_REG();
 	printf("*** CYCLE %" PRI_avr_cycle_count "PC %04x\n", avr->cycle, avr->pc);
 
@@ -100,29 +111,23 @@ void crash(avr_t* avr)
 
 	avr_sadly_crashed(avr, 0);
 }
-#else
-#define T(w)
-#define REG_TOUCH(a, r)
-#define STATE(_f, args...)
-#define SREG()
-
-void crash(avr_t* avr)
-{
-	avr_sadly_crashed(avr, 0);
-}
-#endif
 
 void avr_core_watch_write(avr_t *avr, uint16_t addr, uint8_t v)
 {
-	if (addr > avr->ramend) {
-		AVR_LOG(avr, LOG_ERROR, "CORE: *** Invalid write address PC=%04x SP=%04x O=%04x Address %04x=%02x out of ram\n",
-				avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8), addr, v);
-		crash(avr);
-	}
-	if (addr < 32) {
-		AVR_LOG(avr, LOG_ERROR, "CORE: *** Invalid write address PC=%04x SP=%04x O=%04x Address %04x=%02x low registers\n",
-				avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8), addr, v);
-		crash(avr);
+	avr_data_page_t * page = NULL;
+	// with a guarded data space, the invalid accesses fault by themselves
+	if (!(avr->flags & AVR_FLAG_DATA_GUARD)) {
+		if (addr > avr->ramend && !(page = avr_data_map_page(avr, addr))) {
+			AVR_LOG(avr, LOG_ERROR, "CORE: *** Invalid write address PC=%04x SP=%04x O=%04x Address %04x=%02x out of ram\n",
+					avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8), addr, v);
+			crash(avr);
+			return;	// don't scribble past the end of avr->data
+		}
+		if (addr < 32) {
+			AVR_LOG(avr, LOG_ERROR, "CORE: *** Invalid write address PC=%04x SP=%04x O=%04x Address %04x=%02x low registers\n",
+					avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8), addr, v);
+			crash(avr);
+		}
 	}
 #if AVR_STACK_WATCH
 	/*
@@ -139,50 +144,68 @@ void avr_core_watch_write(avr_t *avr, uint16_t addr, uint8_t v)
 		avr_gdb_handle_watchpoints(avr, addr, AVR_GDB_WATCH_WRITE);
 	}
 
-	avr->data[addr] = v;
+	if (unlikely(page))
+		avr_data_map_write(avr, page, addr, v);
+	else
+		avr->data[addr] = v;
 }
 
 uint8_t avr_core_watch_read(avr_t *avr, uint16_t addr)
 {
-	if (addr > avr->ramend) {
+	avr_data_page_t * page = NULL;
+	if (!(avr->flags & AVR_FLAG_DATA_GUARD) &&
+			addr > avr->ramend && !(page = avr_data_map_page(avr, addr))) {
 		AVR_LOG(avr, LOG_ERROR, FONT_RED "CORE: *** Invalid read address PC=%04x SP=%04x O=%04x Address %04x out of ram (%04x)\n" FONT_DEFAULT,
 				avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8), addr, avr->ramend);
 		crash(avr);
+		return 0;
 	}
 
 	if (avr->gdb) {
 		avr_gdb_handle_watchpoints(avr, addr, AVR_GDB_WATCH_READ);
 	}
 
+	if (unlikely(page))
+		return avr_data_map_read(avr, page, addr);
 	return avr->data[addr];
 }
 
+/*
+ * Write an IO register (31 < addr <= ioend), (try to) call any callback that
+ * was registered to track changes to that register.
+ */
+static inline void _avr_set_io(avr_t * avr, uint16_t addr, uint8_t v)
+{
+	avr_io_addr_t io = AVR_DATA_TO_IO(addr);
+	if (avr->io_w[io].c)
+		avr->io_w[io].c(avr, addr, v, avr->io_w[io].param);
+	else
+		avr->data[addr] = v;
+	if (avr->io_irq[io]) {
+		avr_raise_irq(avr->io_irq[io] + AVR_IOMEM_IRQ_ALL, v);
+		for (int i = 0; i < 8; i++)
+			avr_raise_irq(avr->io_irq[io] + i, (v >> i) & 1);
+	}
+}
+
 /*
  * Set a register (r < 256)
  * if it's an IO register (> 31) also (try to) call any callback that was
- * registered to track changes to that register.
+ * registered to track changes to that register. Past 'ioend', on the small
+ * cores, that's SRAM already.
  */
 static inline void _avr_set_r(avr_t * avr, uint8_t r, uint8_t v)
 {
-	REG_TOUCH(avr, r);
-
 	if (r == R_SREG) {
 		avr->data[R_SREG] = v;
 		// unsplit the SREG
 		SET_SREG_FROM(avr, v);
-		SREG();
 	}
 	if (r > 31) {
-		uint8_t io = AVR_DATA_TO_IO(r);
-		if (avr->io[io].w.c)
-			avr->io[io].w.c(avr, r, v, avr->io[io].w.param);
+		if (r <= avr->ioend)
+			_avr_set_io(avr, r, v);
 		else
-			avr->data[r] = v;
-		if (avr->io[io].irq) {
-			avr_raise_irq(avr->io[io].irq + AVR_IOMEM_IRQ_ALL, v);
-			for (int i = 0; i < 8; i++)
-				avr_raise_irq(avr->io[io].irq + i, (v >> i) & 1);				
-		}
+			avr_core_watch_write(avr, r, v);
 	} else
 		avr->data[r] = v;
 }
@@ -208,6 +231,8 @@ static inline void _avr_set_ram(avr_t * avr, uint16_t addr, uint8_t v)
 {
 	if (addr < 256)
 		_avr_set_r(avr, addr, v);
+	else if (addr <= avr->ioend)	// extended IO space, on the bigger cores
+		_avr_set_io(avr, addr, v);
 	else
 		avr_core_watch_write(avr, addr, v);
 }
@@ -224,17 +249,17 @@ static inline uint8_t _avr_get_ram(avr_t * avr, uint16_t addr)
 		 */
 		READ_SREG_INTO(avr, avr->data[R_SREG]);
 		
-	} else if (addr > 31 && addr < 256) {
-		uint8_t io = AVR_DATA_TO_IO(addr);
+	} else if (addr > 31 && addr <= avr->ioend) {
+		avr_io_addr_t io = AVR_DATA_TO_IO(addr);
 		
-		if (avr->io[io].r.c)
-			avr->data[addr] = avr->io[io].r.c(avr, addr, avr->io[io].r.param);
+		if (avr->io_r[io].c)
+			avr->data[addr] = avr->io_r[io].c(avr, addr, avr->io_r[io].param);
 		
-		if (avr->io[io].irq) {
+		if (avr->io_irq[io]) {
 			uint8_t v = avr->data[addr];
-			avr_raise_irq(avr->io[io].irq + AVR_IOMEM_IRQ_ALL, v);
+			avr_raise_irq(avr->io_irq[io] + AVR_IOMEM_IRQ_ALL, v);
 			for (int i = 0; i < 8; i++)
-				avr_raise_irq(avr->io[io].irq + i, (v >> i) & 1);				
+				avr_raise_irq(avr->io_irq[io] + i, (v >> i) & 1);				
 		}
 	}
 	return avr_core_watch_read(avr, addr);
@@ -258,22 +283,25 @@ static inline uint8_t _avr_pop8(avr_t * avr)
 	return res;
 }
 
-int _avr_push_addr(avr_t * avr, avr_flashaddr_t addr)
+/*
+ * 'size' is a constant in the specialized decoders, so these loops unroll
+ */
+static inline int _avr_push_addr_size(avr_t * avr, avr_flashaddr_t addr, int size)
 {
 	uint16_t sp = _avr_sp_get(avr);
 	addr >>= 1;
-	for (int i = 0; i < avr->address_size; i++, addr >>= 8, sp--) {
+	for (int i = 0; i < size; i++, addr >>= 8, sp--) {
 		_avr_set_ram(avr, sp, addr);	
 	}
 	_avr_sp_set(avr, sp);
-	return avr->address_size;
+	return size;
 }
 
-avr_flashaddr_t _avr_pop_addr(avr_t * avr)
+static inline avr_flashaddr_t _avr_pop_addr_size(avr_t * avr, int size)
 {
 	uint16_t sp = _avr_sp_get(avr) + 1;
 	avr_flashaddr_t res = 0;
-	for (int i = 0; i < avr->address_size; i++, sp++) {
+	for (int i = 0; i < size; i++, sp++) {
 		res = (res << 8) | _avr_get_ram(avr, sp);
 	}
 	res <<= 1;
@@ -281,6 +309,16 @@ avr_flashaddr_t _avr_pop_addr(avr_t * avr)
 	return res;
 }
 
+int _avr_push_addr(avr_t * avr, avr_flashaddr_t addr)
+{
+	return _avr_push_addr_size(avr, addr, avr->address_size);
+}
+
+avr_flashaddr_t _avr_pop_addr(avr_t * avr)
+{
+	return _avr_pop_addr_size(avr, avr->address_size);
+}
+
 /*
  * "Pretty" register names
  */
@@ -311,16 +349,14 @@ const char * avr_regname(uint8_t reg)
  */
 static void _avr_invalid_opcode(avr_t * avr)
 {
-#if CONFIG_SIMAVR_TRACE
-	printf( FONT_RED "*** %04x: %-25s Invalid Opcode SP=%04x O=%04x \n" FONT_DEFAULT,
-			avr->pc, avr->trace_data->codeline[avr->pc>>1]->symbol, _avr_sp_get(avr), avr->flash[avr->pc] | (avr->flash[avr->pc+1]<<8));
-#else
-	AVR_LOG(avr, LOG_ERROR, FONT_RED "CORE: *** %04x: Invalid Opcode SP=%04x O=%04x \n" FONT_DEFAULT,
-			avr->pc, _avr_sp_get(avr), avr->flash[avr->pc] | (avr->flash[avr->pc+1]<<8));
-#endif
+	if (avr->trace && avr->trace_data->codeline && avr->trace_data->codeline[avr->pc>>1])
+		printf( FONT_RED "*** %04x: %-25s Invalid Opcode SP=%04x O=%04x \n" FONT_DEFAULT,
+				avr->pc, avr->trace_data->codeline[avr->pc>>1]->symbol, _avr_sp_get(avr), avr->flash[avr->pc] | (avr->flash[avr->pc+1]<<8));
+	else
+		AVR_LOG(avr, LOG_ERROR, FONT_RED "CORE: *** %04x: Invalid Opcode SP=%04x O=%04x \n" FONT_DEFAULT,
+				avr->pc, _avr_sp_get(avr), avr->flash[avr->pc] | (avr->flash[avr->pc+1]<<8));
 }
 
-#if CONFIG_SIMAVR_TRACE
 /*
  * Dump changed registers when tracing
  */
@@ -350,7 +386,6 @@ void avr_dump_state(avr_t * avr)
 		}
 	printf("\n");
 }
-#endif
 
 #define get_r_d_10(o) \
 		const uint8_t r = ((o >> 5) & 0x10) | (o & 0xf); \
@@ -367,93 +402,26 @@ void avr_dump_state(avr_t * avr)
 /*
  * Add a "jump" address to the jump trace buffer
  */
-#if CONFIG_SIMAVR_TRACE
-#define TRACE_JUMP()\
+#define TRACE_JUMP() if (trace) {\
 	avr->trace_data->old[avr->trace_data->old_pci].pc = avr->pc;\
 	avr->trace_data->old[avr->trace_data->old_pci].sp = _avr_sp_get(avr);\
 	avr->trace_data->old_pci = (avr->trace_data->old_pci + 1) & (OLD_PC_SIZE-1);\
+}
 
 #if AVR_STACK_WATCH
-#define STACK_FRAME_PUSH()\
+#define STACK_FRAME_PUSH() if (trace) {\
 	avr->trace_data->stack_frame[avr->trace_data->stack_frame_index].pc = avr->pc;\
 	avr->trace_data->stack_frame[avr->trace_data->stack_frame_index].sp = _avr_sp_get(avr);\
-	avr->trace_data->stack_frame_index++; 
+	avr->trace_data->stack_frame_index++; \
+}
 #define STACK_FRAME_POP()\
-	if (avr->trace_data->stack_frame_index > 0) \
+	if (trace && avr->trace_data->stack_frame_index > 0) \
 		avr->trace_data->stack_frame_index--;
 #else
 #define STACK_FRAME_PUSH()
 #define STACK_FRAME_POP()
-#endif
-#else /* CONFIG_SIMAVR_TRACE */
-
-#define TRACE_JUMP()
-#define STACK_FRAME_PUSH()
-#define STACK_FRAME_POP()
-
 #endif
 
-/****************************************************************************\
- *
- * Helper functions for calculating the status register bit values.
- * See the Atmel data sheet for the instruction set for more info.
- *
-\****************************************************************************/
-
-static uint8_t
-get_add_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
-{
-    uint8_t resb = res >> b & 0x1;
-    uint8_t rdb = rd >> b & 0x1;
-    uint8_t rrb = rr >> b & 0x1;
-    return (rdb & rrb) | (rrb & ~resb) | (~resb & rdb);
-}
-
-static  uint8_t
-get_add_overflow (uint8_t res, uint8_t rd, uint8_t rr)
-{
-    uint8_t res7 = res >> 7 & 0x1;
-    uint8_t rd7 = rd >> 7 & 0x1;
-    uint8_t rr7 = rr >> 7 & 0x1;
-    return (rd7 & rr7 & ~res7) | (~rd7 & ~rr7 & res7);
-}
-
-static  uint8_t
-get_sub_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
-{
-    uint8_t resb = res >> b & 0x1;
-    uint8_t rdb = rd >> b & 0x1;
-    uint8_t rrb = rr >> b & 0x1;
-    return (~rdb & rrb) | (rrb & resb) | (resb & ~rdb);
-}
-
-static  uint8_t
-get_sub_overflow (uint8_t res, uint8_t rd, uint8_t rr)
-{
-    uint8_t res7 = res >> 7 & 0x1;
-    uint8_t rd7 = rd >> 7 & 0x1;
-    uint8_t rr7 = rr >> 7 & 0x1;
-    return (rd7 & ~rr7 & ~res7) | (~rd7 & rr7 & res7);
-}
-
-static  uint8_t
-get_compare_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
-{
-    uint8_t resb = (res >> b) & 0x1;
-    uint8_t rdb = (rd >> b) & 0x1;
-    uint8_t rrb = (rr >> b) & 0x1;
-    return (~rdb & rrb) | (rrb & resb) | (resb & ~rdb);
-}
-
-static  uint8_t
-get_compare_overflow (uint8_t res, uint8_t rd, uint8_t rr)
-{
-    res >>= 7; rd >>= 7; rr >>= 7;
-    /* The atmel data sheet says the second term is ~rd7 for CP
-     * but that doesn't make any sense. You be the judge. */
-    return (rd & ~rr & ~res) | (~rd & rr & res);
-}
-
 static inline int _avr_is_instruction_32_bits(avr_t * avr, avr_flashaddr_t pc)
 {
 	uint16_t o = (avr->flash[pc] | (avr->flash[pc+1] << 8)) & 0xfc0f;
@@ -481,20 +449,55 @@ static inline int _avr_is_instruction_32_bits(avr_t * avr, avr_flashaddr_t pc)
  * 
  * The number of cycles taken by instruction has been added, but might not be
  * entirely accurate.
+ *
+ * The decoder is instantiated once for each AVR_DECODER_* variant, in which
+ * the size of the PC and the presence of EIND/RAMPZ are constants; only
+ * AVR_DECODER_ANY looks them up in avr_t.
  */
-avr_flashaddr_t avr_run_one(avr_t * avr)
+#define DECODER_ADDRESS_SIZE \
+	(decoder == AVR_DECODER_SMALL ? 2 : decoder == AVR_DECODER_LARGE ? 3 : avr->address_size)
+#define DECODER_HAS_EIND \
+	(decoder == AVR_DECODER_SMALL ? 0 : decoder == AVR_DECODER_LARGE ? 1 : avr->eind != 0)
+#define DECODER_HAS_RAMPZ \
+	(decoder == AVR_DECODER_SMALL ? 0 : decoder == AVR_DECODER_LARGE ? 1 : avr->rampz != 0)
+
+/*
+ * Marks the registers the instruction changed, for avr_dump_state()
+ */
+static void
+_avr_trace_touched(
+		avr_t * avr,
+		const uint8_t * regs,
+		int count)
+{
+	for (int r = 0; r < count; r++)
+		if (regs[r] != avr->data[r])
+			REG_TOUCH(avr, r);
+	avr_dump_state(avr);
+}
+
+static inline __attribute__((always_inline)) avr_flashaddr_t
+_avr_run_one(
+		avr_t * avr,
+		const int decoder,
+		const int trace)
 {
+	uint8_t regs[32 + 64];	// registers and IOs before the instruction
+
+	if (trace) {
 #if CONFIG_SIMAVR_TRACE
-	/*
-	 * this traces spurious reset or bad jumps
-	 */
-	if ((avr->pc == 0 && avr->cycle > 0) || avr->pc >= avr->codeend || _avr_sp_get(avr) > avr->ramend) {
-		avr->trace = 1;
-		STATE("RESET\n");
-		crash(avr);
-	}
-	avr->trace_data->touched[0] = avr->trace_data->touched[1] = avr->trace_data->touched[2] = 0;
+		/*
+		 * this traces spurious reset or bad jumps
+		 */
+		if ((avr->pc == 0 && avr->cycle > 0) || avr->pc >= avr->codeend || _avr_sp_get(avr) > avr->ramend) {
+			avr->trace = 1;
+			STATE("RESET\n");
+			crash(avr);
+		}
 #endif
+		avr->trace_data->touched[0] = avr->trace_data->touched[1] = avr->trace_data->touched[2] = 0;
+		memcpy(regs, avr->data, sizeof(regs));
+	}
 
 	/* Ensure we don't crash simavr due to a bad instruction reading past
 	 * the end of the flash.
@@ -886,22 +889,22 @@ avr_flashaddr_t avr_run_one(avr_t * avr)
 				case 0x9519: { // EICALL Indirect Call to Subroutine	1001 0101 0001 1001   bit 8 is "push pc"
 					int e = opcode & 0x10;
 					int p = opcode & 0x100;
-					if (e && !avr->eind)
+					if (e && !DECODER_HAS_EIND)
 						_avr_invalid_opcode(avr);
 					uint32_t z = avr->data[R_ZL] | (avr->data[R_ZH] << 8);
 					if (e)
 						z |= avr->data[avr->eind] << 16;
 					STATE("%si%s Z[%04x]\n", e?"e":"", p?"call":"jmp", z << 1);
 					if (p)
-						cycle += _avr_push_addr(avr, new_pc) - 1;
+						cycle += _avr_push_addr_size(avr, new_pc, DECODER_ADDRESS_SIZE) - 1;
 					new_pc = z << 1;
 					cycle++;
 					TRACE_JUMP();
 				}	break;
 				case 0x9518: 	// RETI
 				case 0x9508: {	// RET
-					new_pc = _avr_pop_addr(avr);
-					cycle += 1 + avr->address_size;
+					new_pc = _avr_pop_addr_size(avr, DECODER_ADDRESS_SIZE);
+					cycle += 1 + DECODER_ADDRESS_SIZE;
 					if (opcode & 0x10)	// reti
 						avr->sreg[S_I] = 1;
 					STATE("ret%s\n", opcode & 0x10 ? "i" : "");
@@ -956,7 +959,7 @@ avr_flashaddr_t avr_run_one(avr_t * avr)
 						}	break;
 						case 0x9006:
 						case 0x9007: {	// ELPM Extended Load Program Memory 1001 000d dddd 01oo
-							if (!avr->rampz)
+							if (!DECODER_HAS_RAMPZ)
 								_avr_invalid_opcode(avr);
 							uint32_t z = avr->data[R_ZL] | (avr->data[R_ZH] << 8) | (avr->data[avr->rampz] << 16);
 							uint8_t r = (opcode >> 4) & 0x1f;
@@ -1194,7 +1197,7 @@ avr_flashaddr_t avr_run_one(avr_t * avr)
 							a = (a << 16) | x;
 							STATE("call 0x%06x\n", a);
 							new_pc += 2;
-							cycle += 1 + _avr_push_addr(avr, new_pc);
+							cycle += 1 + _avr_push_addr_size(avr, new_pc, DECODER_ADDRESS_SIZE);
 							new_pc = a << 1;
 							TRACE_JUMP();
 							STACK_FRAME_PUSH();
@@ -1333,7 +1336,7 @@ avr_flashaddr_t avr_run_one(avr_t * avr)
 //			int16_t o = ((int16_t)(opcode << 4)) >> 4; // CLANG BUG!
 			int16_t o = ((int16_t)((opcode << 4) & 0xffff)) >> 4;
 			STATE("rcall .%d [%04x]\n", o, new_pc + (o << 1));
-			cycle += _avr_push_addr(avr, new_pc) - 1;
+			cycle += _avr_push_addr_size(avr, new_pc, DECODER_ADDRESS_SIZE) - 1;
 			new_pc = new_pc + (o << 1);
 			// 'rcall .1' is used as a cheap "push 16 bits of room on the stack"
 			if (o != 0) {
@@ -1412,7 +1415,689 @@ avr_flashaddr_t avr_run_one(avr_t * avr)
 
 	}
 	avr->cycle += cycle;
+	if (trace)
+		_avr_trace_touched(avr, regs, sizeof(regs));
 	return new_pc;
 }
 
+avr_flashaddr_t avr_run_one(avr_t * avr)
+{
+	return _avr_run_one(avr, AVR_DECODER_ANY, 0);
+}
+
+avr_flashaddr_t avr_run_one_trace(avr_t * avr)
+{
+	return _avr_run_one(avr, AVR_DECODER_ANY, 1);
+}
+
+static avr_flashaddr_t avr_run_one_small(avr_t * avr)
+{
+	return _avr_run_one(avr, AVR_DECODER_SMALL, 0);
+}
+
+static avr_flashaddr_t avr_run_one_large(avr_t * avr)
+{
+	return _avr_run_one(avr, AVR_DECODER_LARGE, 0);
+}
+
+/*
+ * Superinstructions, with AVR_FLAG_SUPERINSN.
+ *
+ * avr-gcc output is mostly made of a handful of instruction sequences. The
+ * first time the PC lands on a flash word, it is checked for one of them,
+ * and what was found is kept in avr->superinsn. The sequence is then run in one
+ * go, with the same results and cycle count as the instructions it is made
+ * of, without going back to the run loop between them.
+ *
+ * The run loop processes the cycle timers and the interrupts between two
+ * instructions, so a sequence is only fused if no timer is due before it
+ * ends, and no interrupt is pending. The memory it accesses also has to be
+ * plain SRAM, and the stack pointer must not have an IO callback or IRQ.
+ * Otherwise, the instruction goes through the normal decoder.
+ */
+enum {
+	AVR_SI_UNKNOWN = 0,	// not looked at yet
+	AVR_SI_NONE,
+	AVR_SI_LDI_LDI,		// ldi ; ldi
+	AVR_SI_CP_CPC_BR,		// cp/cpi ; cpc ; brxx -- 16 bits compare
+	AVR_SI_SUBI_SBCI,		// subi ; sbci -- 16 bits add/subtract
+	AVR_SI_SUBI_SBCI_BR,	// subi ; sbci ; brxx -- 16 bits loop counter
+	AVR_SI_LD_ST,			// ld r, X+ ; st Y+/Z+, r -- copy loops
+	AVR_SI_PUSH,			// push run, length in the top bits
+	AVR_SI_POP,			// pop run, length in the top bits
+};
+#define AVR_SI_MAX		15	// longest run, in instructions
+#define AVR_SI_COUNT(_f)	((_f) >> 4)
+#define AVR_SI_KIND(_f)	((_f) & 0xf)
+
+// all the SREG branches, brbs/brbc
+#define AVR_IS_BRANCH(_o)	(((_o) & 0xf800) == 0xf000)
+
+/*
+ * Idle loops, with AVR_FLAG_IDLE_LOOPS.
+ *
+ * A firmware waiting for something spends its time in short loops, polling
+ * a flag in an IO register or in SRAM, or counting down in _delay_ms().
+ * When the PC lands on one, and nothing can happen before the next cycle
+ * timer (no interrupt pending), all its iterations until then are the same:
+ * most of them are skipped by moving the cycle count on, up to just before
+ * that timer. The registers, SREG and the cycle count are left as if each
+ * instruction had been run.
+ *
+ * With no timer at all, a delay loop is skipped to its end; a polling loop
+ * can only be ended by another thread, so it waits for avr_wake() like a
+ * sleep would, see avr_wake_sleep().
+ *
+ * A polling loop only reads registers, SREG, SRAM and IO registers without
+ * a read callback or with one marked by avr_io_set_read_stable(). One
+ * iteration is run by the decoder, and if it leaves the registers and SREG
+ * as they were, the next ones would too. A delay loop is a dec, sbiw or
+ * subi/sbci count down ending in a brne; the iterations skipped are taken
+ * off the counter, and the last one before the deadline is run by the
+ * decoder, for SREG.
+ */
+enum {
+	AVR_IDLE_UNKNOWN = 0,	// not looked at yet
+	AVR_IDLE_NONE,
+	AVR_IDLE_POLL,		// reads and compares, length in the top bits
+	AVR_IDLE_DELAY,		// count down, length in the top bits
+};
+#define AVR_IDLE_MAX		8	// longest loop, in words
+#define AVR_IDLE_WORDS(_f)	((_f) >> 2)
+#define AVR_IDLE_KIND(_f)	((_f) & 3)
+
+static inline uint16_t
+_avr_flash_opcode(
+		avr_t * avr,
+		avr_flashaddr_t pc)
+{
+	return avr->flash[pc] | (avr->flash[pc + 1] << 8);
+}
+
+static uint8_t
+_avr_si_scan(
+		avr_t * avr,
+		avr_flashaddr_t pc)
+{
+	uint32_t left = (avr->flashend + 1 - pc) >> 1;	// words
+	if (left < 2)
+		return AVR_SI_NONE;
+	uint16_t o0 = _avr_flash_opcode(avr, pc);
+	uint16_t o1 = _avr_flash_opcode(avr, pc + 2);
+	uint16_t o2 = left > 2 ? _avr_flash_opcode(avr, pc + 4) : 0;
+
+	if ((o0 & 0xf000) == 0xe000 && (o1 & 0xf000) == 0xe000)
+		return AVR_SI_LDI_LDI;
+	if (((o0 & 0xfc00) == 0x1400 || (o0 & 0xf000) == 0x3000) &&
+			(o1 & 0xfc00) == 0x0400 && AVR_IS_BRANCH(o2))
+		return AVR_SI_CP_CPC_BR;
+	if ((o0 & 0xf000) == 0x5000 && (o1 & 0xf000) == 0x4000)
+		return AVR_IS_BRANCH(o2) ? AVR_SI_SUBI_SBCI_BR : AVR_SI_SUBI_SBCI;
+	// the register moved can't be one of the pointers
+	if ((o0 & 0xfe0f) == 0x900d &&
+			((o1 & 0xfe0f) == 0x9201 || (o1 & 0xfe0f) == 0x9209) &&
+			(o0 & 0x01f0) == (o1 & 0x01f0) && ((o0 >> 4) & 0x1f) < R_XL)
+		return AVR_SI_LD_ST;
+	uint16_t run = o0 & 0xfe0f;
+	if (run == 0x920f || run == 0x900f) {
+		int count = 1;
+		while (count < AVR_SI_MAX && count < left &&
+				(_avr_flash_opcode(avr, pc + (count << 1)) & 0xfe0f) == run)
+			count++;
+		if (count > 1)
+			return (count << 4) | (run == 0x920f ? AVR_SI_PUSH : AVR_SI_POP);
+	}
+	return AVR_SI_NONE;
+}
+
+void
+avr_superinsn_flush(
+		avr_t * avr,
+		avr_flashaddr_t addr,
+		uint32_t size)
+{
+	// the translated code is only good for the flash it was made from
+	if (avr->aot && size && addr < avr->aot->base + avr->aot->size &&
+			addr + size > avr->aot->base) {
+		AVR_LOG(avr, LOG_TRACE, "CORE: flash changed, dropping the translated code\n");
+		avr->aot = NULL;
+		avr->run_one = avr_get_run_one(avr);
+	}
+	if (avr->hle && size)
+		avr_hle_flush(avr, addr, size);
+	if (avr->idle && size) {
+		uint32_t start = addr >> 1, end = (addr + size + 1) >> 1;
+		uint32_t words = (avr->flashend + 1) >> 1;
+		start = start > AVR_IDLE_MAX ? start - AVR_IDLE_MAX : 0;
+		if (end > words)
+			end = words;
+		if (start < end)
+			memset(avr->idle + start, AVR_IDLE_UNKNOWN, end - start);
+	}
+	if (!avr->superinsn || !size)
+		return;
+	// a sequence starting up to AVR_SI_MAX words before might cover it
+	uint32_t start = addr >> 1, end = (addr + size + 1) >> 1;
+	uint32_t words = (avr->flashend + 1) >> 1;
+	start = start > AVR_SI_MAX ? start - AVR_SI_MAX : 0;
+	if (end > words)
+		end = words;
+	if (start < end)
+		memset(avr->superinsn + start, AVR_SI_UNKNOWN, end - start);
+}
+
+/*
+ * 'size' bytes at 'addr' are SRAM, where an instruction would neither call
+ * an IO callback, go through the data map, nor crash the core
+ */
+static inline int
+_avr_si_ram(
+		avr_t * avr,
+		int addr,
+		int size)
+{
+	return addr > 0xff && addr > avr->ioend && addr + size - 1 <= avr->ramend;
+}
+
+static inline int
+_avr_si_sp(
+		avr_t * avr)
+{
+	avr_io_addr_t l = AVR_DATA_TO_IO(R_SPL), h = AVR_DATA_TO_IO(R_SPH);
+	return !avr->io_w[l].c && !avr->io_w[h].c && !avr->io_irq[l] && !avr->io_irq[h];
+}
+
+/*
+ * Same as the decoder SREG branch. Returns the new PC
+ */
+static inline avr_flashaddr_t
+_avr_si_branch(
+		avr_t * avr,
+		uint16_t opcode,
+		avr_flashaddr_t new_pc,
+		int * cycle)
+{
+	int16_t o = ((int16_t)(opcode << 6)) >> 9; // offset
+	uint8_t s = opcode & 7;
+	int set = (opcode & 0x0400) == 0;		// this bit means BRXC otherwise BRXS
+	if ((avr->sreg[s] && set) || (!avr->sreg[s] && !set)) {
+		(*cycle)++;
+		new_pc = new_pc + (o << 1);
+	}
+	return new_pc;
+}
+
+/*
+ * Runs sequence 'f' at avr->pc, returns zero if it can't be done now
+ */
+static int
+_avr_si_run(
+		avr_t * avr,
+		uint8_t f,
+		avr_flashaddr_t * new_pc)
+{
+	avr_flashaddr_t pc = avr->pc;
+	int count = AVR_SI_COUNT(f);
+	int cycle = 0;
+
+	// longest it can take, the pushes and pops are 2 cycles each
+	int most = count ? count * 2 : 4;
+	if (avr->interrupts.pending_r != avr->interrupts.pending_w ||
+			(avr->cycle_timers.timer && avr->cycle_timers.timer->when <= avr->cycle + most))
+		return 0;
+
+	switch (AVR_SI_KIND(f)) {
+		case AVR_SI_LDI_LDI: {
+			for (int i = 0; i < 2; i++, pc += 2) {
+				uint16_t opcode = _avr_flash_opcode(avr, pc);
+				get_k_r16(opcode);
+				avr->data[r] = k;
+			}
+			cycle = 2;
+		}	break;
+		case AVR_SI_CP_CPC_BR: {
+			uint16_t opcode = _avr_flash_opcode(avr, pc);
+			uint8_t vd, vr;
+			if ((opcode & 0xf000) == 0x3000) {	// cpi
+				get_k_r16(opcode);
+				vd = avr->data[r];
+				vr = k;
+			} else {	// cp
+				vd = avr->data[(opcode >> 4) & 0x1f];
+				vr = avr->data[((opcode >> 5) & 0x10) | (opcode & 0xf)];
+			}
+			uint8_t res = vd - vr;
+			avr->sreg[S_Z] = res == 0;
+			avr->sreg[S_H] = get_compare_carry(res, vd, vr, 3);
+			avr->sreg[S_V] = get_compare_overflow(res, vd, vr);
+			avr->sreg[S_N] = res >> 7;
+			avr->sreg[S_C] = get_compare_carry(res, vd, vr, 7);
+			avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+			opcode = _avr_flash_opcode(avr, pc + 2);
+			{	// cpc
+				get_r_d_10(opcode);
+				uint8_t res = vd - vr - avr->sreg[S_C];
+				if (res)
+					avr->sreg[S_Z] = 0;
+				avr->sreg[S_H] = get_compare_carry(res, vd, vr, 3);
+				avr->sreg[S_V] = get_compare_overflow(res, vd, vr);
+				avr->sreg[S_N] = (res >> 7) & 1;
+				avr->sreg[S_C] = get_compare_carry(res, vd, vr, 7);
+				avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+			}
+			cycle = 3;
+			pc = _avr_si_branch(avr, _avr_flash_opcode(avr, pc + 4), pc + 6, &cycle);
+		}	break;
+		case AVR_SI_SUBI_SBCI:
+		case AVR_SI_SUBI_SBCI_BR: {
+			uint16_t opcode = _avr_flash_opcode(avr, pc);
+			{	// subi
+				get_k_r16(opcode);
+				uint8_t vr = avr->data[r];
+				uint8_t res = vr - k;
+				avr->data[r] = res;
+				avr->sreg[S_Z] = res  == 0;
+				avr->sreg[S_N] = (res >> 7) & 1;
+				avr->sreg[S_C] = k > vr;
+				avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+			}
+			opcode = _avr_flash_opcode(avr, pc + 2);
+			{	// sbci
+				get_k_r16(opcode);
+				uint8_t vr = avr->data[r];
+				uint8_t res = vr - k - avr->sreg[S_C];
+				avr->data[r] = res;
+				if (res)
+					avr->sreg[S_Z] = 0;
+				avr->sreg[S_N] = (res >> 7) & 1;
+				avr->sreg[S_C] = (k + avr->sreg[S_C]) > vr;
+				avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+			}
+			cycle = 2;
+			pc += 4;
+			if (AVR_SI_KIND(f) == AVR_SI_SUBI_SBCI_BR) {
+				cycle++;
+				pc = _avr_si_branch(avr, _avr_flash_opcode(avr, pc), pc + 2, &cycle);
+			}
+		}	break;
+		case AVR_SI_LD_ST: {
+			uint16_t st = _avr_flash_opcode(avr, pc + 2);
+			uint8_t r = (st >> 4) & 0x1f;
+			uint8_t p = (st & 0xfe0f) == 0x9201 ? R_ZL : R_YL;
+			uint16_t x = (avr->data[R_XH] << 8) | avr->data[R_XL];
+			uint16_t z = (avr->data[p + 1] << 8) | avr->data[p];
+			if (!_avr_si_ram(avr, x, 1) || !_avr_si_ram(avr, z, 1))
+				return 0;
+			avr->data[r] = avr->data[x++];
+			avr->data[R_XH] = x >> 8;
+			avr->data[R_XL] = x;
+			avr->data[z++] = avr->data[r];
+			avr->data[p + 1] = z >> 8;
+			avr->data[p] = z;
+			cycle = 4;
+			pc += 4;
+		}	break;
+		case AVR_SI_PUSH: {
+			uint16_t sp = _avr_sp_get(avr);
+			if (!_avr_si_ram(avr, sp - count + 1, count) || !_avr_si_sp(avr))
+				return 0;
+			for (int i = 0; i < count; i++, pc += 2)
+				avr->data[sp--] = avr->data[(_avr_flash_opcode(avr, pc) >> 4) & 0x1f];
+			avr->data[R_SPL] = sp;
+			avr->data[R_SPH] = sp >> 8;
+			cycle = count * 2;
+		}	break;
+		case AVR_SI_POP: {
+			uint16_t sp = _avr_sp_get(avr);
+			if (!_avr_si_ram(avr, sp + 1, count) || !_avr_si_sp(avr))
+				return 0;
+			for (int i = 0; i < count; i++, pc += 2)
+				avr->data[(_avr_flash_opcode(avr, pc) >> 4) & 0x1f] = avr->data[++sp];
+			avr->data[R_SPL] = sp;
+			avr->data[R_SPH] = sp >> 8;
+			cycle = count * 2;
+		}	break;
+		default:
+			return 0;
+	}
+	avr->cycle += cycle;
+	*new_pc = pc;
+	return 1;
+}
+
+static inline __attribute__((always_inline)) int
+_avr_run_si(
+		avr_t * avr,
+		avr_flashaddr_t * new_pc)
+{
+	if (unlikely(avr->pc >= avr->flashend))
+		return 0;
+	uint8_t * f = avr->superinsn + (avr->pc >> 1);
+	if (unlikely(*f == AVR_SI_UNKNOWN))
+		*f = _avr_si_scan(avr, avr->pc);
+	return *f != AVR_SI_NONE && _avr_si_run(avr, *f, new_pc);
+}
+
+static avr_flashaddr_t avr_run_one_si(avr_t * avr)
+{
+	avr_flashaddr_t new_pc;
+	if (_avr_run_si(avr, &new_pc))
+		return new_pc;
+	return avr_run_one(avr);
+}
+
+static avr_flashaddr_t avr_run_one_si_small(avr_t * avr)
+{
+	avr_flashaddr_t new_pc;
+	if (_avr_run_si(avr, &new_pc))
+		return new_pc;
+	return avr_run_one_small(avr);
+}
+
+static avr_flashaddr_t avr_run_one_si_large(avr_t * avr)
+{
+	avr_flashaddr_t new_pc;
+	if (_avr_run_si(avr, &new_pc))
+		return new_pc;
+	return avr_run_one_large(avr);
+}
+
+/*
+ * Counter 'reg' of 'count' bytes, low byte first, decremented by the loop
+ * at 'head', that takes 'cycles' per iteration. Returns the loop length in
+ * words, or zero if 'head' is not a delay loop
+ */
+static int
+_avr_idle_delay(
+		avr_t * avr,
+		avr_flashaddr_t head,
+		uint8_t * reg,
+		int * count,
+		int * cycles)
+{
+	uint32_t left = (avr->flashend + 1 - head) >> 1;	// words
+	uint16_t o = _avr_flash_opcode(avr, head);
+	int n = 0, words = 1;
+
+	if ((o & 0xfe0f) == 0x940a) {	// dec r
+		reg[n++] = (o >> 4) & 0x1f;
+		*cycles = 1;
+	} else if ((o & 0xff00) == 0x9700 && (((o & 0x00c0) >> 2) | (o & 0xf)) == 1) {	// sbiw r, 1
+		reg[n++] = 24 + ((o >> 3) & 6);
+		reg[n] = reg[n - 1] + 1;
+		n++;
+		*cycles = 2;
+	} else if ((o & 0xff0f) == 0x5001) {	// subi r, 1
+		reg[n++] = 16 + ((o >> 4) & 0xf);
+		while (n < 4 && words < left) {	// sbci r, 0
+			o = _avr_flash_opcode(avr, head + (words << 1));
+			if ((o & 0xff0f) != 0x4000)
+				break;
+			reg[n] = 16 + ((o >> 4) & 0xf);
+			for (int i = 0; i < n; i++)
+				if (reg[i] == reg[n])
+					return 0;
+			n++;
+			words++;
+		}
+		*cycles = n;
+	} else
+		return 0;
+	if (words >= left)
+		return 0;
+	// brne back to the head
+	o = _avr_flash_opcode(avr, head + (words << 1));
+	if ((o & 0xfc07) != 0xf401 ||
+			(((int16_t)(o << 6)) >> 9) != -(words + 1))
+		return 0;
+	*count = n;
+	*cycles += 2;
+	return words + 1;
+}
+
+/*
+ * Length in words of instruction 'o' if it may be part of a polling loop:
+ * it only changes registers and SREG, and reads at a fixed address or
+ * through X, Y, Z. Zero otherwise
+ */
+static inline int
+_avr_idle_insn(
+		uint16_t o)
+{
+	if (o == 0 || (o & 0xff00) == 0x0100)		// nop, movw
+		return 1;
+	if (o >= 0x0400 && o < 0x8000)		// 2 operands ALU, cp*, cpse, immediates
+		return 1;
+	if ((o & 0xf000) == 0xe000 || (o & 0xf000) == 0xc000)	// ldi, rjmp
+		return 1;
+	if ((o & 0xf800) == 0xb000 || (o & 0xfd00) == 0x9900)	// in, sbic/sbis
+		return 1;
+	if ((o & 0xfc08) == 0xfc00 || AVR_IS_BRANCH(o))	// sbrc/sbrs, brxx
+		return 1;
+	if ((o & 0xfe0f) == 0x900c || (o & 0xd200) == 0x8000)	// ld X, ldd Y/Z
+		return 1;
+	if ((o & 0xfe00) == 0x9600)		// adiw, sbiw
+		return 1;
+	if ((o & 0xfe00) == 0x9400) {
+		switch (o & 0xf) {
+			case 0x0: case 0x1: case 0x2: case 0x3:	// com, neg, swap, inc
+			case 0x5: case 0x6: case 0x7: case 0xa:	// asr, lsr, ror, dec
+				return 1;
+		}
+		return 0;
+	}
+	if ((o & 0xfe0f) == 0x9000)		// lds
+		return 2;
+	return 0;
+}
+
+static uint8_t
+_avr_idle_scan(
+		avr_t * avr,
+		avr_flashaddr_t head)
+{
+	uint8_t reg[4];
+	int count, cycles;
+	int words = _avr_idle_delay(avr, head, reg, &count, &cycles);
+	if (words)
+		return (words << 2) | AVR_IDLE_DELAY;
+
+	// a polling loop ends with a jump back to the head
+	avr_flashaddr_t pc = head;
+	for (words = 0; words < AVR_IDLE_MAX; ) {
+		if (pc + 1 >= avr->flashend)
+			return AVR_IDLE_NONE;
+		uint16_t o = _avr_flash_opcode(avr, pc);
+		int size = _avr_idle_insn(o);
+		if (!size || pc + (size << 1) > avr->flashend + 1)
+			return AVR_IDLE_NONE;
+		pc += size << 1;
+		words += size;
+		int16_t offset;
+		if (AVR_IS_BRANCH(o))
+			offset = ((int16_t)(o << 6)) >> 9;
+		else if ((o & 0xf000) == 0xc000)
+			offset = ((int16_t)(o << 4)) >> 4;
+		else
+			continue;
+		if (pc + (offset << 1) == head)
+			return words <= AVR_IDLE_MAX ? (words << 2) | AVR_IDLE_POLL : AVR_IDLE_NONE;
+	}
+	return AVR_IDLE_NONE;
+}
+
+/*
+ * Reading 'addr' gives the same value each time, with no other effect
+ */
+static inline int
+_avr_idle_read(
+		avr_t * avr,
+		uint16_t addr)
+{
+	if (addr > avr->ramend)
+		return 0;
+	if (addr < 32 || addr == R_SREG || addr > avr->ioend)
+		return 1;
+	avr_io_addr_t io = AVR_DATA_TO_IO(addr);
+	return (!avr->io_r[io].c || avr->io_r[io].stable) && !avr->io_irq[io];
+}
+
+// all the reads of the polling loop at 'head' are safe to repeat
+static int
+_avr_idle_reads(
+		avr_t * avr,
+		avr_flashaddr_t head,
+		int words)
+{
+	avr_flashaddr_t pc = head, end = head + (words << 1);
+	while (pc < end) {
+		uint16_t o = _avr_flash_opcode(avr, pc);
+		int addr = -1;
+		if ((o & 0xf800) == 0xb000)		// in
+			addr = 32 + (((o & 0x0600) >> 5) | (o & 0xf));
+		else if ((o & 0xfd00) == 0x9900)	// sbic/sbis
+			addr = 32 + ((o >> 3) & 0x1f);
+		else if ((o & 0xfe0f) == 0x9000)	// lds
+			addr = _avr_flash_opcode(avr, pc + 2);
+		else if ((o & 0xfe0f) == 0x900c)	// ld X
+			addr = (avr->data[R_XH] << 8) | avr->data[R_XL];
+		else if ((o & 0xd200) == 0x8000) {	// ldd Y/Z
+			uint8_t p = (o & 0x0008) ? R_YL : R_ZL;
+			addr = ((avr->data[p + 1] << 8) | avr->data[p]) +
+					(((o & 0x2000) >> 8) | ((o & 0x0c00) >> 7) | (o & 7));
+		}
+		if (addr >= 0 && !_avr_idle_read(avr, addr))
+			return 0;
+		pc += _avr_idle_insn(o) << 1;
+	}
+	return 1;
+}
+
+/*
+ * Whole iterations of 'cycles' that end before the next cycle timer is due,
+ * with no limit if there is none
+ */
+static inline uint64_t
+_avr_idle_room(
+		avr_t * avr,
+		int cycles)
+{
+	if (!avr->cycle_timers.timer)
+		return ~0ULL;
+	return (avr->cycle_timers.timer->when - avr->cycle - 1) / cycles;
+}
+
+/*
+ * Runs the loop 'f' at avr->pc, returns zero if it can't be done now
+ */
+static int
+_avr_idle_run(
+		avr_t * avr,
+		uint8_t f,
+		avr_flashaddr_t * new_pc)
+{
+	avr_flashaddr_t head = avr->pc;
+	int words = AVR_IDLE_WORDS(f);
+
+	// no instruction in there takes more than 3 cycles
+	if ((avr->sreg[S_I] && avr->interrupts.pending_r != avr->interrupts.pending_w) ||
+			(avr->cycle_timers.timer &&
+				avr->cycle_timers.timer->when <= avr->cycle + words * 3))
+		return 0;
+
+	if (AVR_IDLE_KIND(f) == AVR_IDLE_DELAY) {
+		uint8_t reg[4];
+		int count, cycles;
+		_avr_idle_delay(avr, head, reg, &count, &cycles);
+		uint64_t v = 0;
+		for (int i = 0; i < count; i++)
+			v |= (uint64_t)avr->data[reg[i]] << (i * 8);
+		uint64_t left = v ? v : 1ULL << (count * 8);	// iterations until it falls through
+		// skip all but the last taken iteration that fits, then run that one
+		uint64_t skip = _avr_idle_room(avr, cycles);
+		if (skip > left - 1)
+			skip = left - 1;
+		if (skip < 2)
+			return 0;
+		skip--;
+		v -= skip;
+		for (int i = 0; i < count; i++)
+			avr->data[reg[i]] = v >> (i * 8);
+		avr->cycle += skip * cycles;
+		avr_flashaddr_t pc = head;
+		for (int i = 0; i < words; i++) {
+			avr->pc = pc;
+			pc = avr_run_one(avr);
+		}
+		*new_pc = pc;
+		return 1;
+	}
+
+	if (!_avr_idle_reads(avr, head, words))
+		return 0;
+	uint8_t regs[32], sreg[8];
+	memcpy(regs, avr->data, 32);
+	memcpy(sreg, avr->sreg, 8);
+	avr_cycle_count_t start = avr->cycle;
+	avr_flashaddr_t pc = head, end = head + (words << 1);
+	int count = 0;
+	do {
+		avr->pc = pc;
+		pc = avr_run_one(avr);
+	} while (++count < words && pc > head && pc < end);
+	*new_pc = pc;
+	// the next iterations do the same, if this one changed nothing
+	if (pc != head || memcmp(regs, avr->data, 32) || memcmp(sreg, avr->sreg, 8))
+		return 1;
+	int cycles = avr->cycle - start;
+	if (avr->cycle_timers.timer)
+		avr->cycle += _avr_idle_room(avr, cycles) * cycles;
+	else	// as long as the run loops sleep when no timer is due
+		avr_wake_sleep(avr, (1000 / cycles) * cycles);
+	return 1;
+}
+
+static avr_flashaddr_t avr_run_one_idle(avr_t * avr)
+{
+	avr_flashaddr_t new_pc;
+	if (likely(avr->pc < avr->flashend)) {
+		uint8_t * f = avr->idle + (avr->pc >> 1);
+		if (unlikely(*f == AVR_IDLE_UNKNOWN))
+			*f = _avr_idle_scan(avr, avr->pc);
+		if (*f != AVR_IDLE_NONE && _avr_idle_run(avr, *f, &new_pc))
+			return new_pc;
+	}
+	return avr->idle_run_one(avr);
+}
+
+static avr_run_one_p _avr_get_decoder(avr_t * avr)
+{
+	// gdb steps and stops on single instructions
+	if (avr->aot && !avr->gdb)
+		return avr->aot->run;
+	int si = avr->superinsn && !avr->gdb;
+	if (!avr->eind && !avr->rampz && avr->address_size == 2)
+		return si ? avr_run_one_si_small : avr_run_one_small;
+	if (avr->eind && avr->rampz && avr->address_size == 3)
+		return si ? avr_run_one_si_large : avr_run_one_large;
+	return si ? avr_run_one_si : avr_run_one;
+}
+
+avr_run_one_p avr_get_run_one(avr_t * avr)
+{
+	if (avr->trace)
+		return avr_run_one_trace;
+	avr_run_one_p run = _avr_get_decoder(avr);
+	if (avr->idle && !avr->gdb) {
+		avr->idle_run_one = run;
+		run = avr_run_one_idle;
+	}
+	// the emulated routines are looked for first, see sim_hle.h
+	if (avr->hle && !avr->gdb) {
+		avr->hle->run_one = run;
+		return avr_hle_run_one;
+	}
+	return run;
+}
+
 
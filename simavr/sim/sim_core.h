@@ -40,6 +40,35 @@ extern "C" {
  * Instruction decoder, run ONE instruction
  */
 avr_flashaddr_t avr_run_one(avr_t * avr);
+/*
+ * Same, tracing the instruction and the registers it changed when
+ * avr->trace is set. The other decoders have no tracing code at all.
+ */
+avr_flashaddr_t avr_run_one_trace(avr_t * avr);
+
+/*
+ * The decoder is also built specialized for the common core families,
+ * where the PC size and EIND/RAMPZ are known at compile time.
+ * avr_init() picks the one for the core in avr->run_one, avr_set_trace()
+ * switches to avr_run_one_trace() and back
+ */
+enum {
+	AVR_DECODER_ANY = 0,	// looks at avr_t, this is avr_run_one()
+	AVR_DECODER_SMALL,		// 2 bytes PC, no EIND or RAMPZ (tinies, most megas)
+	AVR_DECODER_LARGE,		// 3 bytes PC, EIND and RAMPZ (>128KB flash)
+};
+typedef avr_flashaddr_t (*avr_run_one_p)(avr_t * avr);
+
+avr_run_one_p avr_get_run_one(avr_t * avr);
+
+/*
+ * With AVR_FLAG_SUPERINSN, the decoders run common instruction sequences in
+ * one go; this forgets the ones found around 'size' bytes of flash at 'addr',
+ * call it when the flash is changed while running. It also drops the
+ * translated code covering it, see sim_aot.h, the emulated routines
+ * in it, see sim_hle.h, and the idle loops found there
+ */
+void avr_superinsn_flush(avr_t * avr, avr_flashaddr_t addr, uint32_t size);
 
 /*
  * These are for internal access to the stack (for interrupts)
@@ -47,8 +76,12 @@ avr_flashaddr_t avr_run_one(avr_t * avr);
 uint16_t _avr_sp_get(avr_t * avr);
 void _avr_sp_set(avr_t * avr, uint16_t sp);
 int _avr_push_addr(avr_t * avr, avr_flashaddr_t addr);
+avr_flashaddr_t _avr_pop_addr(avr_t * avr);
 
-#if CONFIG_SIMAVR_TRACE
+/*
+ * Dumps the core state (if tracing) and stops it, called on invalid accesses
+ */
+void crash(avr_t * avr);
 
 /*
  * Get a "pretty" register name
@@ -83,13 +116,6 @@ void avr_dump_state(avr_t * avr);
 #define DUMP_STACK()
 #endif
 
-#else /* CONFIG_SIMAVR_TRACE */
-
-#define DUMP_STACK()
-#define DUMP_REG();
-
-#endif 
-
 /**
  * Reconstructs the SREG value from avr->sreg into dst.
  */
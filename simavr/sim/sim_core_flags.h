@@ -0,0 +1,88 @@
+/*
+	sim_core_flags.h
+
+	Copyright 2008, 2009 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helper functions for calculating the status register bit values.
+ * See the Atmel data sheet for the instruction set for more info.
+ *
+ * Shared by the decoder (sim_core.c) and the code generated by
+ * avr_aot_generate(), so both compute the flags the same way.
+ */
+#ifndef __SIM_CORE_FLAGS_H__
+#define __SIM_CORE_FLAGS_H__
+
+#include <stdint.h>
+
+static inline uint8_t
+get_add_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
+{
+    uint8_t resb = res >> b & 0x1;
+    uint8_t rdb = rd >> b & 0x1;
+    uint8_t rrb = rr >> b & 0x1;
+    return (rdb & rrb) | (rrb & ~resb) | (~resb & rdb);
+}
+
+static inline uint8_t
+get_add_overflow (uint8_t res, uint8_t rd, uint8_t rr)
+{
+    uint8_t res7 = res >> 7 & 0x1;
+    uint8_t rd7 = rd >> 7 & 0x1;
+    uint8_t rr7 = rr >> 7 & 0x1;
+    return (rd7 & rr7 & ~res7) | (~rd7 & ~rr7 & res7);
+}
+
+static inline uint8_t
+get_sub_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
+{
+    uint8_t resb = res >> b & 0x1;
+    uint8_t rdb = rd >> b & 0x1;
+    uint8_t rrb = rr >> b & 0x1;
+    return (~rdb & rrb) | (rrb & resb) | (resb & ~rdb);
+}
+
+static inline uint8_t
+get_sub_overflow (uint8_t res, uint8_t rd, uint8_t rr)
+{
+    uint8_t res7 = res >> 7 & 0x1;
+    uint8_t rd7 = rd >> 7 & 0x1;
+    uint8_t rr7 = rr >> 7 & 0x1;
+    return (rd7 & ~rr7 & ~res7) | (~rd7 & rr7 & res7);
+}
+
+static inline uint8_t
+get_compare_carry (uint8_t res, uint8_t rd, uint8_t rr, int b)
+{
+    uint8_t resb = (res >> b) & 0x1;
+    uint8_t rdb = (rd >> b) & 0x1;
+    uint8_t rrb = (rr >> b) & 0x1;
+    return (~rdb & rrb) | (rrb & resb) | (resb & ~rdb);
+}
+
+static inline uint8_t
+get_compare_overflow (uint8_t res, uint8_t rd, uint8_t rr)
+{
+    res >>= 7; rd >>= 7; rr >>= 7;
+    /* The atmel data sheet says the second term is ~rd7 for CP
+     * but that doesn't make any sense. You be the judge. */
+    return (rd & ~rr & ~res) | (~rd & rr & res);
+}
+
+#endif /* __SIM_CORE_FLAGS_H__ */
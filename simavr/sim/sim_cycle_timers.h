@@ -68,9 +68,10 @@ typedef struct avr_cycle_timer_slot_t {
  * when done
  */
 typedef struct avr_cycle_timer_pool_t {
-	avr_cycle_timer_slot_t timer_slots[MAX_CYCLE_TIMERS];
-	avr_cycle_timer_slot_p timer_free;
+	// the active queue is looked at after every instruction, keep it first
 	avr_cycle_timer_slot_p timer;
+	avr_cycle_timer_slot_p timer_free;
+	avr_cycle_timer_slot_t timer_slots[MAX_CYCLE_TIMERS];
 } avr_cycle_timer_pool_t, *avr_cycle_timer_pool_p;
 
 
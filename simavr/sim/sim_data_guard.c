@@ -0,0 +1,187 @@
+/*
+	sim_data_guard.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "sim_data_guard.h"
+#include "sim_core.h"
+
+#ifndef __MINGW32__
+
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// the whole 16 bits data space
+#define DATA_GUARD_WINDOW	0x10000
+
+typedef struct avr_data_guard_t {
+	uint8_t *	base;		// of the mapping, avr->data is a bit further
+	size_t		size;
+	sigjmp_buf	jmp;		// back to avr_data_guard_run()
+	uint8_t *	fault;		// where the access was
+} avr_data_guard_t;
+
+/*
+ * The handler is process wide; it only looks at the core that is in
+ * avr_data_guard_run() on the faulting thread, so the accesses of the
+ * other threads, or to the other cores, are not mistaken for it's own.
+ */
+static __thread avr_t * _running;
+static volatile int _installed;
+static struct sigaction _old_segv, _old_bus;
+
+static void
+_avr_data_guard_fault(
+		int sig,
+		siginfo_t * info,
+		void * context)
+{
+	avr_t * avr = _running;
+	uint8_t * fault = (uint8_t *)info->si_addr;
+
+	if (avr && fault > avr->data + avr->ramend &&
+			fault < avr->data + DATA_GUARD_WINDOW) {
+		avr->data_guard->fault = fault;
+		siglongjmp(avr->data_guard->jmp, 1);
+	}
+	/*
+	 * Not one of ours, give it to whoever was there before, or restore
+	 * the default handler, and the fault will happen again when we return
+	 */
+	struct sigaction * old = sig == SIGBUS ? &_old_bus : &_old_segv;
+	if (old->sa_flags & SA_SIGINFO)
+		old->sa_sigaction(sig, info, context);
+	else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN)
+		old->sa_handler(sig);
+	else
+		sigaction(sig, old, NULL);
+}
+
+int
+avr_data_guard_init(
+		avr_t * avr)
+{
+	/*
+	 * avr->data is placed so that 'ramend+1' lands on a page boundary,
+	 * so even the first byte past the end of SRAM is caught
+	 */
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t ram = avr->ramend + 1;
+	size_t offset = ((ram + page - 1) & ~(page - 1)) - ram;
+	size_t size = (offset + DATA_GUARD_WINDOW + page - 1) & ~(page - 1);
+
+	uint8_t * base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED) {
+		AVR_LOG(avr, LOG_ERROR, "CORE: %s: mmap: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+	if (mprotect(base, offset + ram, PROT_READ | PROT_WRITE)) {
+		AVR_LOG(avr, LOG_ERROR, "CORE: %s: mprotect: %s\n", __FUNCTION__, strerror(errno));
+		munmap(base, size);
+		return -1;
+	}
+	if (__sync_bool_compare_and_swap(&_installed, 0, 1)) {
+		struct sigaction sa = {
+			.sa_sigaction = _avr_data_guard_fault,
+			.sa_flags = SA_SIGINFO,
+		};
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &_old_segv);
+		sigaction(SIGBUS, &sa, &_old_bus);	// some systems raise that one instead
+	}
+	avr_data_guard_t * g = calloc(1, sizeof(*g));
+	g->base = base;
+	g->size = size;
+	avr->data_guard = g;
+	avr->data = base + offset;
+	return 0;
+}
+
+void
+avr_data_guard_run(
+		avr_t * avr)
+{
+	avr_data_guard_t * g = avr->data_guard;
+	avr_t * outer = _running;	// a core run from another one's callback
+
+	_running = avr;
+	// not saving the signal mask keeps this cheap, it's done below instead
+	if (!sigsetjmp(g->jmp, 0))
+		avr->run(avr);
+	else {
+		// the handler was left with the signal still blocked
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGSEGV);
+		sigaddset(&set, SIGBUS);
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+		AVR_LOG(avr, LOG_ERROR, FONT_RED "CORE: *** Invalid access PC=%04x SP=%04x O=%04x Address %04x out of ram (%04x)\n" FONT_DEFAULT,
+				avr->pc, _avr_sp_get(avr), avr->flash[avr->pc + 1] | (avr->flash[avr->pc]<<8),
+				(unsigned)(g->fault - avr->data), avr->ramend);
+		crash(avr);
+	}
+	_running = outer;
+}
+
+void
+avr_data_guard_free(
+		avr_t * avr)
+{
+	avr_data_guard_t * g = avr->data_guard;
+
+	if (!g)
+		return;
+	munmap(g->base, g->size);
+	free(g);
+	avr->data_guard = NULL;
+	avr->data = NULL;
+}
+
+#else
+
+int
+avr_data_guard_init(
+		avr_t * avr)
+{
+	AVR_LOG(avr, LOG_WARNING, "CORE: %s: not supported on this platform\n", __FUNCTION__);
+	return -1;
+}
+
+void
+avr_data_guard_run(
+		avr_t * avr)
+{
+	avr->run(avr);
+}
+
+void
+avr_data_guard_free(
+		avr_t * avr)
+{
+}
+
+#endif
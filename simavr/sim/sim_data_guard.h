@@ -0,0 +1,64 @@
+/*
+	sim_data_guard.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Guarded data space. When AVR_FLAG_DATA_GUARD is set before avr_init(),
+ * avr->data is placed in a 64KB mmap()ed window where every page above
+ * 'ramend' is PROT_NONE, and avr_core_watch_write()/read() don't check the
+ * addresses anymore.
+ *
+ * An access past 'ramend' raises a SIGSEGV; the handler only jumps back
+ * to avr_run(), that abandons the instruction and reports it through
+ * crash(), with the usual PC/SP diagnostics. A fault anywhere else, or
+ * outside avr_run(), goes to the handler that was there before.
+ *
+ * Mapping a region with sim_data_map.h turns the checks back on, as
+ * these accesses have to go to the map. Writes to r0-r31 through the data
+ * space are not caught, they land in the registers like on the real part.
+ * Not available on MinGW, the flag is then ignored.
+ */
+#ifndef __SIM_DATA_GUARD_H__
+#define __SIM_DATA_GUARD_H__
+
+#include "sim_avr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// allocates avr->data as a guarded window, returns -1 if that can't be done
+int
+avr_data_guard_init(
+		avr_t * avr);
+// runs avr->run() once, catching the accesses past 'ramend'
+void
+avr_data_guard_run(
+		avr_t * avr);
+// unmaps avr->data
+void
+avr_data_guard_free(
+		avr_t * avr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_DATA_GUARD_H__ */
@@ -0,0 +1,107 @@
+/*
+	sim_data_map.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sim_data_map.h"
+
+static int
+_avr_data_map_check(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size)
+{
+	if ((addr | size) & (AVR_DATA_PAGE_SIZE - 1) ||
+			addr <= avr->ramend || addr + size > 0x10000 || !size) {
+		AVR_LOG(avr, LOG_ERROR, "MAP: Invalid region %04x size %04x (ramend %04x)\n",
+				addr, size, avr->ramend);
+		return -1;
+	}
+	if (!avr->data_map)
+		avr->data_map = calloc(AVR_DATA_PAGE_COUNT, sizeof(avr_data_page_t));
+	// these accesses don't fault, they go to the map, see sim_data_guard.h
+	avr->flags &= ~AVR_FLAG_DATA_GUARD;
+	return 0;
+}
+
+int
+avr_data_map_ram(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size,
+		uint8_t * ram)
+{
+	if (!ram || _avr_data_map_check(avr, addr, size))
+		return -1;
+	for (uint32_t o = 0; o < size; o += AVR_DATA_PAGE_SIZE) {
+		avr_data_page_t * p = &avr->data_map[(addr + o) >> AVR_DATA_PAGE_SHIFT];
+		memset(p, 0, sizeof(*p));
+		p->kind = AVR_DATA_PAGE_RAM;
+		p->ram = ram + o;
+	}
+	AVR_LOG(avr, LOG_TRACE, "MAP: RAM %04x-%04x\n", addr, addr + size - 1);
+	return 0;
+}
+
+int
+avr_data_map_device(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size,
+		avr_io_read_t r,
+		avr_io_write_t w,
+		void * param)
+{
+	if (_avr_data_map_check(avr, addr, size))
+		return -1;
+	for (uint32_t o = 0; o < size; o += AVR_DATA_PAGE_SIZE) {
+		avr_data_page_t * p = &avr->data_map[(addr + o) >> AVR_DATA_PAGE_SHIFT];
+		memset(p, 0, sizeof(*p));
+		p->kind = AVR_DATA_PAGE_DEVICE;
+		p->r = r;
+		p->w = w;
+		p->param = param;
+	}
+	AVR_LOG(avr, LOG_TRACE, "MAP: Device %04x-%04x\n", addr, addr + size - 1);
+	return 0;
+}
+
+void
+avr_data_unmap(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size)
+{
+	if (!avr->data_map)
+		return;
+	for (uint32_t o = 0; o < size && addr + o < 0x10000; o += AVR_DATA_PAGE_SIZE)
+		memset(&avr->data_map[(addr + o) >> AVR_DATA_PAGE_SHIFT], 0, sizeof(avr_data_page_t));
+}
+
+void
+avr_data_map_free(
+		avr_t * avr)
+{
+	if (avr->data_map)
+		free(avr->data_map);
+	avr->data_map = NULL;
+}
@@ -0,0 +1,129 @@
+/*
+	sim_data_map.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Data space memory map, for the part of the data space that is past
+ * 'ramend', like the external memory (XMEM) of the mega128/1280/2560.
+ *
+ * The map is a table of 256 bytes pages, each of them is either unmapped,
+ * backed by a buffer (external SRAM, FRAM...) or handled by read/write
+ * callbacks (an FPGA register window...). Internal SRAM is not affected;
+ * the map is only looked at when an access is past 'ramend', instead of
+ * crashing the core, and costs a single table index.
+ *
+ * The table is only allocated once a region is mapped. Note that the
+ * XMEM enable bits of the core are not looked at.
+ */
+#ifndef __SIM_DATA_MAP_H__
+#define __SIM_DATA_MAP_H__
+
+#include "sim_avr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVR_DATA_PAGE_SHIFT	8
+#define AVR_DATA_PAGE_SIZE	(1 << AVR_DATA_PAGE_SHIFT)
+#define AVR_DATA_PAGE_COUNT	(0x10000 >> AVR_DATA_PAGE_SHIFT)
+
+enum {
+	AVR_DATA_PAGE_UNMAPPED = 0,
+	AVR_DATA_PAGE_RAM,		// plain memory, in 'ram'
+	AVR_DATA_PAGE_DEVICE,	// accesses go to 'r' and 'w'
+};
+
+typedef struct avr_data_page_t {
+	uint8_t			kind;	// AVR_DATA_PAGE_*
+	uint8_t *		ram;	// AVR_DATA_PAGE_RAM, the 256 bytes of this page
+	avr_io_read_t	r;		// AVR_DATA_PAGE_DEVICE, optional
+	avr_io_write_t	w;		// AVR_DATA_PAGE_DEVICE, optional
+	void *			param;
+} avr_data_page_t;
+
+// maps 'size' bytes at 'addr' to the 'ram' buffer, that stays owned by the caller.
+// 'addr' and 'size' must be multiples of AVR_DATA_PAGE_SIZE, and past 'ramend'
+int
+avr_data_map_ram(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size,
+		uint8_t * ram);
+// maps 'size' bytes at 'addr' to a device; the callbacks get the data space address
+int
+avr_data_map_device(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size,
+		avr_io_read_t r,
+		avr_io_write_t w,
+		void * param);
+// removes a region; accesses to it will crash the core again
+void
+avr_data_unmap(
+		avr_t * avr,
+		uint16_t addr,
+		uint32_t size);
+// frees the map, called by avr_terminate()
+void
+avr_data_map_free(
+		avr_t * avr);
+
+// returns the page 'addr' is in, if it's mapped, or NULL
+static inline avr_data_page_t *
+avr_data_map_page(
+		avr_t * avr,
+		uint16_t addr)
+{
+	if (!avr->data_map || !avr->data_map[addr >> AVR_DATA_PAGE_SHIFT].kind)
+		return NULL;
+	return &avr->data_map[addr >> AVR_DATA_PAGE_SHIFT];
+}
+
+static inline uint8_t
+avr_data_map_read(
+		avr_t * avr,
+		avr_data_page_t * p,
+		uint16_t addr)
+{
+	if (p->kind == AVR_DATA_PAGE_RAM)
+		return p->ram[addr & (AVR_DATA_PAGE_SIZE - 1)];
+	return p->r ? p->r(avr, addr, p->param) : 0xff;
+}
+
+static inline void
+avr_data_map_write(
+		avr_t * avr,
+		avr_data_page_t * p,
+		uint16_t addr,
+		uint8_t v)
+{
+	if (p->kind == AVR_DATA_PAGE_RAM)
+		p->ram[addr & (AVR_DATA_PAGE_SIZE - 1)] = v;
+	else if (p->w)
+		p->w(avr, addr, v, p->param);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_DATA_MAP_H__ */
@@ -36,6 +36,7 @@
 #include "sim_vcd_file.h"
 #include "avr_eeprom.h"
 #include "avr_ioport.h"
+#include "sim_semihost.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -51,28 +52,42 @@ void avr_load_firmware(avr_t * avr, elf_firmware_t * firmware)
 		avr->avcc = firmware->avcc;
 	if (firmware->aref)
 		avr->aref = firmware->aref;
-#if CONFIG_SIMAVR_TRACE && ELF_SYMBOLS
-	int scount = firmware->flashsize >> 1;
-	avr->trace_data->codeline = malloc(scount * sizeof(avr_symbol_t*));
-	memset(avr->trace_data->codeline, 0, scount * sizeof(avr_symbol_t*));
-
-	for (int i = 0; i < firmware->symbolcount; i++)
-		if (firmware->symbol[i]->addr < firmware->flashsize)	// code address
-			avr->trace_data->codeline[firmware->symbol[i]->addr >> 1] =
-				firmware->symbol[i];
-	// "spread" the pointers for known symbols forward
-	avr_symbol_t * last = NULL;
-	for (int i = 0; i < scount; i++) {
-		if (!avr->trace_data->codeline[i])
-			avr->trace_data->codeline[i] = last;
-		else
-			last = avr->trace_data->codeline[i];
+#if ELF_SYMBOLS
+	/*
+	 * symbols for the traced decoder; sized for the whole flash, as
+	 * tracing can be turned on at any time, wherever the PC is
+	 */
+	int scount = (avr->flashend + 1) >> 1;
+	free(avr->trace_data->codeline);
+	avr->trace_data->codeline = NULL;
+	if (firmware->symbolcount)
+		avr->trace_data->codeline = calloc(scount, sizeof(avr_symbol_t*));
+	if (avr->trace_data->codeline) {
+		for (int i = 0; i < firmware->symbolcount; i++)
+			if (firmware->symbol[i]->addr < firmware->flashsize &&	// code address
+					(firmware->symbol[i]->addr >> 1) < scount)
+				avr->trace_data->codeline[firmware->symbol[i]->addr >> 1] =
+					firmware->symbol[i];
+		// "spread" the pointers for known symbols forward
+		avr_symbol_t * last = NULL;
+		for (int i = 0; i < scount; i++) {
+			if (!avr->trace_data->codeline[i])
+				avr->trace_data->codeline[i] = last;
+			else
+				last = avr->trace_data->codeline[i];
+		}
 	}
 #endif
 
+	if (avr->flash_map)
+		AVR_LOG(avr, LOG_WARNING, "ELF: %s: firmware written over flash file %s\n",
+				__FUNCTION__, avr->flash_file);
 	avr_loadcode(avr, firmware->flash, firmware->flashsize, firmware->flashbase);
 	avr->codeend = firmware->flashsize + firmware->flashbase - firmware->datasize;
 	if (firmware->eeprom && firmware->eesize) {
+		if (avr->eeprom_file)
+			AVR_LOG(avr, LOG_WARNING, "ELF: %s: .eeprom written over eeprom file %s\n",
+					__FUNCTION__, avr->eeprom_file);
 		avr_eeprom_desc_t d = { .ee = firmware->eeprom, .offset = 0, .size = firmware->eesize };
 		avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &d);
 	}
@@ -90,6 +105,7 @@ void avr_load_firmware(avr_t * avr, elf_firmware_t * firmware)
 		}
 	avr_set_command_register(avr, firmware->command_register_addr);
 	avr_set_console_register(avr, firmware->console_register_addr);
+	avr_semihost_init(avr, firmware->semihost_register_addr);
 
 	// rest is initialization of the VCD file
 
@@ -213,12 +229,34 @@ static void elf_parse_mmcu_section(elf_firmware_t * firmware, uint8_t * src, uin
 			case AVR_MMCU_TAG_SIMAVR_CONSOLE: {
 				firmware->console_register_addr = src[0] | (src[1] << 8);
 			}	break;
+			case AVR_MMCU_TAG_SIMAVR_SEMIHOST: {
+				firmware->semihost_register_addr = src[0] | (src[1] << 8);
+			}	break;
 		}
 		size -= next;
 		src += next - 2; // already incremented
 	}
 }
 
+#if ELF_SYMBOLS
+typedef struct elf_symbol_sort_t {
+	avr_symbol_t *	s;
+	int				index;	// order in the symbol table
+} elf_symbol_sort_t;
+
+/*
+ * Sorts by address; symbols at the same address are kept in the reverse
+ * order of the symbol table, as the old sorted insert used to do
+ */
+static int elf_symbol_compare(const void * a, const void * b)
+{
+	const elf_symbol_sort_t * sa = a, * sb = b;
+	if (sa->s->addr != sb->s->addr)
+		return sa->s->addr < sb->s->addr ? -1 : 1;
+	return sb->index - sa->index;
+}
+#endif
+
 int elf_read_firmware(const char * file, elf_firmware_t * firmware)
 {
 	Elf32_Ehdr elf_header;			/* ELF header */
@@ -241,6 +279,8 @@ int elf_read_firmware(const char * file, elf_firmware_t * firmware)
 #if ELF_SYMBOLS
 	firmware->symbolcount = 0;
 	firmware->symbol = NULL;
+	elf_symbol_sort_t * symbol = NULL;
+	int symbolcount = 0, symbolmax = 0;
 #endif
 
 	/* this is actually mandatory !! otherwise elf_begin() fails */
@@ -299,24 +339,13 @@ int elf_read_firmware(const char * file, elf_firmware_t * firmware)
 					avr_symbol_t * s = malloc(sizeof(avr_symbol_t) + strlen(name) + 1);
 					strcpy((char*)s->symbol, name);
 					s->addr = sym.st_value;
-					if (!(firmware->symbolcount % 8))
-						firmware->symbol = realloc(
-							firmware->symbol,
-							(firmware->symbolcount + 8) * sizeof(firmware->symbol[0]));
-
-					// insert new element, keep the array sorted
-					int insert = -1;
-					for (int si = 0; si < firmware->symbolcount && insert == -1; si++)
-						if (firmware->symbol[si]->addr >= s->addr)
-							insert = si;
-					if (insert == -1)
-						insert = firmware->symbolcount;
-					else
-						memmove(firmware->symbol + insert + 1,
-								firmware->symbol + insert,
-								(firmware->symbolcount - insert) * sizeof(firmware->symbol[0]));
-					firmware->symbol[insert] = s;
-					firmware->symbolcount++;
+					if (symbolcount == symbolmax) {
+						symbolmax = symbolmax ? symbolmax * 2 : 64;
+						symbol = realloc(symbol, symbolmax * sizeof(symbol[0]));
+					}
+					symbol[symbolcount].s = s;
+					symbol[symbolcount].index = symbolcount;
+					symbolcount++;
 				}
 			}
 		}
@@ -349,6 +378,17 @@ int elf_read_firmware(const char * file, elf_firmware_t * firmware)
 		AVR_LOG(NULL, LOG_TRACE, "Loaded %u .eeprom\n", (unsigned int)data_ee->d_size);
 		firmware->eesize = data_ee->d_size;
 	}
+#if ELF_SYMBOLS
+	// sort once everything is read, rather than inserting in place
+	if (symbolcount) {
+		qsort(symbol, symbolcount, sizeof(symbol[0]), elf_symbol_compare);
+		firmware->symbol = malloc(symbolcount * sizeof(firmware->symbol[0]));
+		for (int i = 0; i < symbolcount; i++)
+			firmware->symbol[i] = symbol[i].s;
+		firmware->symbolcount = symbolcount;
+	}
+	free(symbol);
+#endif
 //	hdump("flash", avr->flash, offset);
 	elf_end(elf);
 	close(fd);
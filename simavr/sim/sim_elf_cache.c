@@ -0,0 +1,236 @@
+/*
+	sim_elf_cache.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sim_elf_cache.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define ELF_CACHE_MAGIC	"SIMAVRFW"
+
+/*
+ * The image starts with this header, followed by the flash, the eeprom and
+ * the symbols, each of them 4 bytes aligned. Symbols are stored as
+ * avr_symbol_t, the address followed by the zero terminated name.
+ */
+typedef struct elf_cache_header_t {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	fwsize;		// sizeof(elf_firmware_t), changes with ELF_SYMBOLS
+	uint64_t	hash;
+	uint32_t	size;		// of the whole image
+	uint32_t	flash, eeprom, symbol;	// offsets in the image
+	elf_firmware_t	fw;		// with its pointers cleared
+} elf_cache_header_t;
+
+#define ELF_CACHE_ALIGN(_s)	(((_s) + 3) & ~3)
+
+static void
+elf_cache_path(
+		char * path,
+		size_t size,
+		const char * dir,
+		uint64_t hash)
+{
+	snprintf(path, size, "%s/%016llx.fw", dir, (unsigned long long)hash);
+}
+
+int
+elf_cache_hash(
+		const char * file,
+		uint32_t variant,
+		uint64_t * hash)
+{
+	int fd = open(file, O_RDONLY | O_BINARY);
+	if (fd == -1)
+		return -1;
+	// FNV-1a, 64 bits
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < 4; i++, variant >>= 8)
+		h = (h ^ (variant & 0xff)) * 0x100000001b3ULL;
+	uint8_t buf[65536];
+	ssize_t r;
+	while ((r = read(fd, buf, sizeof(buf))) > 0)
+		for (ssize_t i = 0; i < r; i++)
+			h = (h ^ buf[i]) * 0x100000001b3ULL;
+	close(fd);
+	if (r < 0)
+		return -1;
+	*hash = h;
+	return 0;
+}
+
+int
+elf_cache_load(
+		const char * dir,
+		uint64_t hash,
+		elf_firmware_t * firmware)
+{
+	char path[1024];
+	elf_cache_path(path, sizeof(path), dir, hash);
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd == -1)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < sizeof(elf_cache_header_t)) {
+		close(fd);
+		return -1;
+	}
+	// private, so the flash can be patched in place like a malloc()ed one
+	uint8_t * base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+	elf_cache_header_t * h = (elf_cache_header_t *)base;
+	if (memcmp(h->magic, ELF_CACHE_MAGIC, sizeof(h->magic)) ||
+			h->version != ELF_CACHE_VERSION ||
+			h->fwsize != sizeof(elf_firmware_t) ||
+			h->hash != hash || h->size != st.st_size ||
+			h->flash > h->size || h->fw.flashsize > h->size - h->flash ||
+			h->eeprom > h->size || h->fw.eesize > h->size - h->eeprom ||
+			h->symbol > h->size) {
+		AVR_LOG(NULL, LOG_WARNING, "ELF: %s: ignoring stale image %s\n", __FUNCTION__, path);
+		munmap(base, st.st_size);
+		return -1;
+	}
+	*firmware = h->fw;
+	firmware->flash = h->fw.flashsize ? base + h->flash : NULL;
+	firmware->eeprom = h->fw.eesize ? base + h->eeprom : NULL;
+#if ELF_SYMBOLS
+	firmware->symbol = NULL;
+	if (h->fw.symbolcount) {
+		firmware->symbol = malloc(h->fw.symbolcount * sizeof(firmware->symbol[0]));
+		uint32_t o = h->symbol;
+		for (int i = 0; i < h->fw.symbolcount; i++) {
+			avr_symbol_t * s = (avr_symbol_t *)(base + o);
+			const char * end = o + sizeof(avr_symbol_t) < h->size ?
+					memchr(s->symbol, 0, h->size - o - sizeof(avr_symbol_t)) : NULL;
+			if (!end) {
+				AVR_LOG(NULL, LOG_WARNING, "ELF: %s: truncated image %s\n", __FUNCTION__, path);
+				free(firmware->symbol);
+				munmap(base, st.st_size);
+				return -1;
+			}
+			firmware->symbol[i] = s;
+			o += ELF_CACHE_ALIGN(sizeof(avr_symbol_t) + (end - s->symbol) + 1);
+		}
+	}
+#endif
+	AVR_LOG(NULL, LOG_TRACE, "ELF: Loaded cached image %s\n", path);
+	return 0;
+}
+
+int
+elf_cache_store(
+		const char * dir,
+		uint64_t hash,
+		elf_firmware_t * firmware)
+{
+	elf_cache_header_t h = {
+		.magic = ELF_CACHE_MAGIC,
+		.version = ELF_CACHE_VERSION,
+		.fwsize = sizeof(elf_firmware_t),
+		.hash = hash,
+		.fw = *firmware,
+	};
+	h.fw.flash = h.fw.eeprom = NULL;
+	h.flash = ELF_CACHE_ALIGN(sizeof(h));
+	h.eeprom = h.flash + ELF_CACHE_ALIGN(firmware->flashsize);
+	h.symbol = h.eeprom + ELF_CACHE_ALIGN(firmware->eesize);
+	h.size = h.symbol;
+#if ELF_SYMBOLS
+	h.fw.symbol = NULL;
+	for (int i = 0; i < firmware->symbolcount; i++)
+		h.size += ELF_CACHE_ALIGN(sizeof(avr_symbol_t) +
+				strlen(firmware->symbol[i]->symbol) + 1);
+#endif
+	uint8_t * image = calloc(1, h.size);
+	memcpy(image, &h, sizeof(h));
+	if (firmware->flashsize)
+		memcpy(image + h.flash, firmware->flash, firmware->flashsize);
+	if (firmware->eesize)
+		memcpy(image + h.eeprom, firmware->eeprom, firmware->eesize);
+#if ELF_SYMBOLS
+	uint32_t o = h.symbol;
+	for (int i = 0; i < firmware->symbolcount; i++) {
+		avr_symbol_t * s = (avr_symbol_t *)(image + o);
+		s->addr = firmware->symbol[i]->addr;
+		strcpy((char*)s->symbol, firmware->symbol[i]->symbol);
+		o += ELF_CACHE_ALIGN(sizeof(avr_symbol_t) + strlen(s->symbol) + 1);
+	}
+#endif
+	/*
+	 * write it to a temporary file and rename it, so another simavr
+	 * looking at the cache never sees a partial image
+	 */
+	char path[1024], tmp[1100];
+	elf_cache_path(path, sizeof(path), dir, hash);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		goto error;
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	if (fd == -1)
+		goto error;
+	if (write(fd, image, h.size) != h.size) {
+		close(fd);
+		unlink(tmp);
+		goto error;
+	}
+	close(fd);
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		goto error;
+	}
+	free(image);
+	AVR_LOG(NULL, LOG_TRACE, "ELF: Stored cached image %s\n", path);
+	return 0;
+error:
+	AVR_LOG(NULL, LOG_WARNING, "ELF: %s: unable to write %s: %s\n",
+			__FUNCTION__, path, strerror(errno));
+	free(image);
+	return -1;
+}
+
+int
+elf_read_firmware_cached(
+		const char * dir,
+		const char * file,
+		elf_firmware_t * firmware)
+{
+	uint64_t hash;
+	if (!dir || elf_cache_hash(file, 0, &hash))
+		return elf_read_firmware(file, firmware);
+	if (elf_cache_load(dir, hash, firmware) == 0)
+		return 0;
+	if (elf_read_firmware(file, firmware))
+		return -1;
+	elf_cache_store(dir, hash, firmware);
+	return 0;
+}
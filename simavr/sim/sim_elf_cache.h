@@ -0,0 +1,83 @@
+/*
+	sim_elf_cache.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Firmware image cache. Once a firmware file (ELF or ihex) has been parsed,
+ * the resulting elf_firmware_t is written in a cache directory as a flat
+ * image: the structure itself, the flash, the eeprom and the symbol table,
+ * already sorted. The image file is named after a hash of the firmware file
+ * content, so a rebuilt firmware gets a new image, and later runs load it
+ * with a single mmap() instead of walking the ELF sections again.
+ *
+ * The image is only meant for the machine (and simavr build) that made it;
+ * it is in native byte order, and is ignored if its version or the size of
+ * elf_firmware_t do not match.
+ */
+#ifndef __SIM_ELF_CACHE_H__
+#define __SIM_ELF_CACHE_H__
+
+#include "sim_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// change this when the image layout changes
+#define ELF_CACHE_VERSION	1
+
+// hashes the content of 'file', mixed with 'variant' (ie how it's loaded)
+int
+elf_cache_hash(
+		const char * file,
+		uint32_t variant,
+		uint64_t * hash);
+/*
+ * Maps the image for 'hash' from 'dir' in 'firmware'. The flash, eeprom and
+ * symbols point into the mapping, that is kept for the life of the process.
+ * Returns 0, or -1 if there is no usable image.
+ */
+int
+elf_cache_load(
+		const char * dir,
+		uint64_t hash,
+		elf_firmware_t * firmware);
+// writes 'firmware' as the image for 'hash' in 'dir', creating 'dir' if needed
+int
+elf_cache_store(
+		const char * dir,
+		uint64_t hash,
+		elf_firmware_t * firmware);
+
+/*
+ * Same as elf_read_firmware(), but goes through the cache in 'dir' first,
+ * and fills it on a miss. If 'dir' is NULL, this is elf_read_firmware()
+ */
+int
+elf_read_firmware_cached(
+		const char * dir,
+		const char * file,
+		elf_firmware_t * firmware);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_ELF_CACHE_H__ */
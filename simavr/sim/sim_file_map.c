@@ -0,0 +1,185 @@
+/*
+	sim_file_map.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
+#include "sim_file_map.h"
+#include "sim_cycle_timers.h"
+
+#ifdef __MINGW32__
+/*
+ * No mmap() there, the callers fall back to their malloc()ed memories
+ */
+avr_file_map_t *
+avr_file_map_open(
+		avr_t * avr,
+		const char * path,
+		uint32_t size)
+{
+	AVR_LOG(avr, LOG_ERROR, "MAP: %s: file backed memories are not supported\n", path);
+	return NULL;
+}
+
+void
+avr_file_map_dirty(
+		avr_file_map_t * m,
+		uint32_t offset,
+		uint32_t size)
+{
+}
+
+void
+avr_file_map_sync(
+		avr_file_map_t * m)
+{
+}
+
+void
+avr_file_map_reset(
+		avr_file_map_t * m)
+{
+}
+
+void
+avr_file_map_close(
+		avr_file_map_t * m)
+{
+}
+
+#else
+
+avr_file_map_t *
+avr_file_map_open(
+		avr_t * avr,
+		const char * path,
+		uint32_t size)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || (st.st_size < size && ftruncate(fd, size))) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	uint8_t * base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+	// the part we just added is "erased"
+	if (st.st_size < size)
+		memset(base + st.st_size, 0xff, size - st.st_size);
+
+	avr_file_map_t * m = calloc(1, sizeof(avr_file_map_t));
+	m->avr = avr;
+	m->fd = fd;
+	m->base = base;
+	m->size = size;
+	AVR_LOG(avr, LOG_TRACE, "MAP: %s mapped, %d bytes\n", path, size);
+	return m;
+}
+
+void
+avr_file_map_sync(
+		avr_file_map_t * m)
+{
+	if (m->dirty_end <= m->dirty_start)
+		return;
+	uint32_t page = sysconf(_SC_PAGESIZE);
+	uint32_t start = m->dirty_start & ~(page - 1);
+	if (msync(m->base + start, m->dirty_end - start, MS_SYNC))
+		perror(__FUNCTION__);
+	m->dirty_start = m->dirty_end = 0;
+}
+
+static avr_cycle_count_t
+avr_file_map_sync_timer(
+		struct avr_t * avr,
+		avr_cycle_count_t when,
+		void * param)
+{
+	avr_file_map_sync((avr_file_map_t *)param);
+	return 0;
+}
+
+void
+avr_file_map_dirty(
+		avr_file_map_t * m,
+		uint32_t offset,
+		uint32_t size)
+{
+	if (offset >= m->size)
+		return;
+	if (offset + size > m->size)
+		size = m->size - offset;
+	if (m->dirty_end <= m->dirty_start) {
+		m->dirty_start = offset;
+		m->dirty_end = offset + size;
+	} else {
+		if (offset < m->dirty_start)
+			m->dirty_start = offset;
+		if (offset + size > m->dirty_end)
+			m->dirty_end = offset + size;
+	}
+	// don't push back a sync that is already scheduled, that's the batching
+	if (m->avr->file_sync_usec &&
+			!avr_cycle_timer_status(m->avr, avr_file_map_sync_timer, m))
+		avr_cycle_timer_register_usec(m->avr, m->avr->file_sync_usec,
+				avr_file_map_sync_timer, m);
+}
+
+void
+avr_file_map_reset(
+		avr_file_map_t * m)
+{
+	// avr_reset() dropped the pending sync with all the other timers
+	if (m && m->avr->file_sync_usec && m->dirty_end > m->dirty_start)
+		avr_cycle_timer_register_usec(m->avr, m->avr->file_sync_usec,
+				avr_file_map_sync_timer, m);
+}
+
+void
+avr_file_map_close(
+		avr_file_map_t * m)
+{
+	if (!m)
+		return;
+	avr_cycle_timer_cancel(m->avr, avr_file_map_sync_timer, m);
+	if (msync(m->base, m->size, MS_SYNC))
+		perror(__FUNCTION__);
+	munmap(m->base, m->size);
+	close(m->fd);
+	free(m);
+}
+
+#endif /* __MINGW32__ */
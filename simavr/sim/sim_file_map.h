@@ -0,0 +1,91 @@
+/*
+	sim_file_map.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent memories. The flash (avr->flash_file) and the eeprom
+ * (avr->eeprom_file) can be backed by a file that is mmap()ed MAP_SHARED
+ * instead of being malloc()ed. The file content is the initial state of
+ * the memory, without any copy, and every change made by the firmware or
+ * the host is in the file as soon as it's made. A file that is too short
+ * is extended with 0xff, like an erased part.
+ *
+ * Note that avr_load_firmware() copies the ELF flash image, and the
+ * .eeprom section if there is one, into these memories: what the files had
+ * there is replaced, the rest is kept. Clear the firmware 'eesize' before
+ * loading it to keep an eeprom file as it is.
+ *
+ * The kernel writes the pages back when it pleases, so only a clean
+ * avr_terminate() is certain to leave the file up to date. If
+ * avr->file_sync_usec is set, the pages changed by SPM and eeprom writes
+ * are also written back with msync(MS_SYNC), batched, that many simulated
+ * microseconds after the first change; that blocks the simulation for as
+ * long as the write takes.
+ *
+ * Not available on MinGW, where the memories are always malloc()ed.
+ */
+#ifndef __SIM_FILE_MAP_H__
+#define __SIM_FILE_MAP_H__
+
+#include "sim_avr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct avr_file_map_t {
+	avr_t *		avr;
+	int			fd;
+	uint8_t *	base;		// the memory itself
+	uint32_t	size;
+	uint32_t	dirty_start, dirty_end;	// range to msync(), if end > start
+} avr_file_map_t;
+
+// opens (or creates) 'path' and maps 'size' bytes of it. Returns NULL on error
+avr_file_map_t *
+avr_file_map_open(
+		avr_t * avr,
+		const char * path,
+		uint32_t size);
+// notes that 'size' bytes at 'offset' have changed, and schedule a msync()
+// if avr->file_sync_usec is set
+void
+avr_file_map_dirty(
+		avr_file_map_t * m,
+		uint32_t offset,
+		uint32_t size);
+// msync() what was changed since last time
+void
+avr_file_map_sync(
+		avr_file_map_t * m);
+// re-schedules the pending msync() that avr_reset() cancelled
+void
+avr_file_map_reset(
+		avr_file_map_t * m);
+// writes back everything, unmaps and closes the file
+void
+avr_file_map_close(
+		avr_file_map_t * m);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_FILE_MAP_H__ */
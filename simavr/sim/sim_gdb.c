@@ -32,6 +32,7 @@
 #include "sim_hex.h"
 #include "avr_eeprom.h"
 #include "sim_gdb.h"
+#include "sim_data_map.h"
 
 #define DBG(w)
 
@@ -278,6 +279,23 @@ gdb_read_register(
 	return strlen(rep);
 }
 
+/*
+ * Returns the buffer behind 'addr' if it is in a RAM page of the data
+ * map (external memory), and the access does not cross the page
+ */
+static uint8_t *
+_gdb_data_map_ram(
+		avr_t * avr,
+		uint32_t addr,
+		uint32_t len)
+{
+	avr_data_page_t * p = avr_data_map_page(avr, addr);
+	if (!p || p->kind != AVR_DATA_PAGE_RAM ||
+			(addr & (AVR_DATA_PAGE_SIZE - 1)) + len > AVR_DATA_PAGE_SIZE)
+		return NULL;
+	return p->ram + (addr & (AVR_DATA_PAGE_SIZE - 1));
+}
+
 static void 
 gdb_handle_command(
 		avr_gdb_t * g, 
@@ -328,8 +346,11 @@ gdb_handle_command(
 			uint8_t * src = NULL;
 			if (addr < avr->flashend) {
 				src = avr->flash + addr;
-			} else if (addr >= 0x800000 && (addr - 0x800000) <= avr->ramend) {
+			} else if (addr >= 0x800000 && (addr - 0x800000) + len <= avr->ramend + 1) {
 				src = avr->data + addr - 0x800000;
+			} else if (addr >= 0x800000 && addr < 0x810000 &&
+					_gdb_data_map_ram(avr, addr - 0x800000, len)) {
+				src = _gdb_data_map_ram(avr, addr - 0x800000, len);
 			} else if (addr >= 0x810000 && (addr - 0x810000) <= avr->e2end) {
 				avr_eeprom_desc_t ee = {.offset = (addr - 0x810000)};
 				avr_ioctl(avr, AVR_IOCTL_EEPROM_GET, &ee);
@@ -368,10 +389,15 @@ gdb_handle_command(
 			}
 			if (addr < 0xffff) {
 				read_hex_string(start + 1, avr->flash + addr, strlen(start+1));
+				avr_superinsn_flush(avr, addr, len);
 				gdb_send_reply(g, "OK");			
-			} else if (addr >= 0x800000 && (addr - 0x800000) <= avr->ramend) {
+			} else if (addr >= 0x800000 && (addr - 0x800000) + len <= avr->ramend + 1) {
 				read_hex_string(start + 1, avr->data + addr - 0x800000, strlen(start+1));
 				gdb_send_reply(g, "OK");							
+			} else if (addr >= 0x800000 && addr < 0x810000 &&
+					_gdb_data_map_ram(avr, addr - 0x800000, len)) {
+				read_hex_string(start + 1, _gdb_data_map_ram(avr, addr - 0x800000, len), strlen(start+1));
+				gdb_send_reply(g, "OK");
 			} else if (addr >= 0x810000 && (addr - 0x810000) <= avr->e2end) {
 				read_hex_string(start + 1, (uint8_t*)rep, strlen(start+1));
 				avr_eeprom_desc_t ee = {.offset = (addr - 0x810000), .size = len, .ee = (uint8_t*)rep };
@@ -388,6 +414,19 @@ gdb_handle_command(
 		case 's': {	// step
 			avr->state = cpu_Step;
 		}	break;
+		case 'q': {	// query, only "monitor trace on|off" for now
+			if (strncmp(cmd, "Rcmd,", 5)) {
+				gdb_send_reply(g, "");
+				break;
+			}
+			int len = read_hex_string(cmd + 5, (uint8_t*)rep, strlen(cmd + 5));
+			rep[len > 0 ? len : 0] = 0;
+			if (!strcmp(rep, "trace on") || !strcmp(rep, "trace off")) {
+				avr_set_trace(avr, !strcmp(rep, "trace on"));
+				gdb_send_reply(g, "OK");
+			} else
+				gdb_send_reply(g, "");
+		}	break;
 		case 'r': {	// deprecated, suggested for AVRStudio compatibility
 			avr->state = cpu_StepDone;
 			avr_reset(avr);
@@ -616,6 +655,8 @@ avr_gdb_init(
 	// change default run behaviour to use the slightly slower versions
 	avr->run = avr_callback_run_gdb;
 	avr->sleep = avr_callback_sleep_gdb;
+	// and a decoder that stops on every instruction
+	avr->run_one = avr_get_run_one(avr);
 	
 	return 0;
 }
@@ -0,0 +1,500 @@
+/*
+	sim_hle.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sim_hle.h"
+#include "sim_core.h"
+
+// registers 'first' to 'last', as a mask
+#define AVR_HLE_REGS(first, last) \
+	((uint32_t)(((1ull << ((last) - (first) + 1)) - 1) << (first)))
+// __zero_reg__ and the call-saved ones, any routine keeps them
+#define AVR_HLE_SAVED	(AVR_HLE_REGS(1, 17) | AVR_HLE_REGS(28, 29))
+
+typedef struct avr_hle_routine_t {
+	const char *	name;
+	uint32_t		result;		// registers the caller gets back
+	int				sized;		// its time depends on a length
+	/*
+	 * Does what the routine does to 'data', unless 'dry'; returns the
+	 * length its time depends on, or -1 if it's left to the decoder
+	 */
+	int (*run)(avr_t * avr, uint8_t * data, int dry);
+} avr_hle_routine_t;
+
+static inline uint16_t
+_hle_get16(
+		uint8_t * data,
+		int r)
+{
+	return data[r] | (data[r + 1] << 8);
+}
+
+static inline uint32_t
+_hle_get32(
+		uint8_t * data,
+		int r)
+{
+	return _hle_get16(data, r) | ((uint32_t)_hle_get16(data, r + 2) << 16);
+}
+
+static inline void
+_hle_set16(
+		uint8_t * data,
+		int r,
+		uint16_t v)
+{
+	data[r] = v;
+	data[r + 1] = v >> 8;
+}
+
+static inline void
+_hle_set32(
+		uint8_t * data,
+		int r,
+		uint32_t v)
+{
+	_hle_set16(data, r, v);
+	_hle_set16(data, r + 2, v >> 16);
+}
+
+// plain SRAM: no IO callback, no data map, no crash
+static inline int
+_hle_ram(
+		avr_t * avr,
+		uint32_t addr,
+		uint32_t size)
+{
+	return !size || (addr > 0xff && addr > avr->ioend && addr + size - 1 <= avr->ramend);
+}
+
+// void * memcpy(void * dst, const void * src, size_t n)
+static int
+avr_hle_memcpy(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	uint16_t dst = _hle_get16(data, 24), src = _hle_get16(data, 22);
+	uint16_t n = _hle_get16(data, 20);
+	if (!_hle_ram(avr, dst, n) || !_hle_ram(avr, src, n))
+		return -1;
+	if (!dry)	// forward, as the real one, for overlapping buffers
+		for (int i = 0; i < n; i++)
+			data[dst + i] = data[src + i];
+	return n;
+}
+
+// void * memset(void * dst, int c, size_t n)
+static int
+avr_hle_memset(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	uint16_t dst = _hle_get16(data, 24), n = _hle_get16(data, 20);
+	if (!_hle_ram(avr, dst, n))
+		return -1;
+	if (!dry)
+		memset(data + dst, data[22], n);
+	return n;
+}
+
+// size_t strlen(const char * s)
+static int
+avr_hle_strlen(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	uint16_t s = _hle_get16(data, 24);
+	int n = 0;
+	for (;; n++) {
+		if (!_hle_ram(avr, s + n, 1))
+			return -1;
+		if (!data[s + n])
+			break;
+	}
+	if (!dry)
+		_hle_set16(data, 24, n);
+	return n;
+}
+
+// r25:r22 = r25:r22 * r21:r18
+static int
+avr_hle_mulsi3(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	if (!dry)
+		_hle_set32(data, 22, _hle_get32(data, 22) * _hle_get32(data, 18));
+	return 0;
+}
+
+// r23:r22 = r25:r24 / r23:r22, r25:r24 = remainder
+static int
+avr_hle_udivmodhi4(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	uint16_t a = _hle_get16(data, 24), b = _hle_get16(data, 22);
+	if (!dry) {
+		// what the shift and subtract loop gives, dividing by zero
+		_hle_set16(data, 22, b ? a / b : 0xffff);
+		_hle_set16(data, 24, b ? a % b : a);
+	}
+	return 0;
+}
+
+// r21:r18 = r25:r22 / r21:r18, r25:r22 = remainder
+static int
+avr_hle_udivmodsi4(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	uint32_t a = _hle_get32(data, 22), b = _hle_get32(data, 18);
+	if (!dry) {
+		_hle_set32(data, 18, b ? a / b : 0xffffffff);
+		_hle_set32(data, 22, b ? a % b : a);
+	}
+	return 0;
+}
+
+static inline float
+_hle_getf(
+		uint8_t * data,
+		int r)
+{
+	uint32_t v = _hle_get32(data, r);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+/*
+ * r25:r22 = r25:r22 'op' r21:r18, as IEEE single floats. Only normal
+ * numbers (and zero operands) are done here, the libc has its own ways
+ * with NaNs, infinities, denormals and the sign of zero
+ */
+static int
+avr_hle_float(
+		avr_t * avr,
+		uint8_t * data,
+		int dry,
+		char op)
+{
+	float a = _hle_getf(data, 22), b = _hle_getf(data, 18), res;
+	if ((!isnormal(a) && a != 0) || (!isnormal(b) && b != 0))
+		return -1;
+	switch (op) {
+		case '+': res = a + b; break;
+		case '-': res = a - b; break;
+		default: res = a * b; break;
+	}
+	if (!isnormal(res))
+		return -1;
+	if (!dry) {
+		uint32_t v;
+		memcpy(&v, &res, sizeof(v));
+		_hle_set32(data, 22, v);
+	}
+	return 0;
+}
+
+static int
+avr_hle_addsf3(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	return avr_hle_float(avr, data, dry, '+');
+}
+
+static int
+avr_hle_subsf3(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	return avr_hle_float(avr, data, dry, '-');
+}
+
+static int
+avr_hle_mulsf3(
+		avr_t * avr,
+		uint8_t * data,
+		int dry)
+{
+	return avr_hle_float(avr, data, dry, '*');
+}
+
+static const avr_hle_routine_t avr_hle_routines[] = {
+	{ "memcpy", AVR_HLE_REGS(24, 25), 1, avr_hle_memcpy },
+	{ "memset", AVR_HLE_REGS(24, 25), 1, avr_hle_memset },
+	{ "strlen", AVR_HLE_REGS(24, 25), 1, avr_hle_strlen },
+	{ "__mulsi3", AVR_HLE_REGS(22, 25), 0, avr_hle_mulsi3 },
+	{ "__udivmodhi4", AVR_HLE_REGS(22, 25), 0, avr_hle_udivmodhi4 },
+	{ "__udivmodsi4", AVR_HLE_REGS(18, 25), 0, avr_hle_udivmodsi4 },
+	{ "__addsf3", AVR_HLE_REGS(22, 25), 0, avr_hle_addsf3 },
+	{ "__subsf3", AVR_HLE_REGS(22, 25), 0, avr_hle_subsf3 },
+	{ "__mulsf3", AVR_HLE_REGS(22, 25), 0, avr_hle_mulsf3 },
+};
+#define AVR_HLE_ROUTINES (sizeof(avr_hle_routines) / sizeof(avr_hle_routines[0]))
+
+static void
+avr_hle_off(
+		avr_t * avr,
+		avr_hle_fn_t * fn)
+{
+	avr_hle_t * hle = avr->hle;
+	fn->state = AVR_HLE_OFF;
+	hle->map[fn->addr >> 1] = 0;
+	if (hle->check.fn == fn)
+		hle->check.fn = NULL;
+}
+
+int
+avr_hle_init(
+		avr_t * avr,
+		elf_firmware_t * firmware)
+{
+#if ELF_SYMBOLS
+	if (!firmware->symbolcount) {
+		AVR_LOG(avr, LOG_ERROR, "HLE: %s: the firmware has no symbols\n", __FUNCTION__);
+		return -1;
+	}
+	avr_hle_free(avr);
+	avr_hle_t * hle = calloc(1, sizeof(*hle));
+	hle->map = calloc((avr->flashend + 1) >> 1, 1);
+	hle->fn = calloc(AVR_HLE_ROUTINES, sizeof(hle->fn[0]));
+	hle->check.data = malloc(avr->ramend + 1);
+	for (int i = 0; i < avr->interrupts.vector_count; i++) {
+		avr_flashaddr_t end = (avr->interrupts.vector[i]->vector + 1) * avr->vector_size;
+		if (end > hle->vectors)
+			hle->vectors = end;
+	}
+	for (int i = 0; i < firmware->symbolcount; i++) {
+		avr_symbol_t * s = firmware->symbol[i];
+		if ((s->addr & 1) || s->addr > avr->flashend || hle->map[s->addr >> 1])
+			continue;
+		const avr_hle_routine_t * r = NULL;
+		for (int ri = 0; ri < AVR_HLE_ROUTINES && !r; ri++)
+			if (!strcmp(s->symbol, avr_hle_routines[ri].name))
+				r = &avr_hle_routines[ri];
+		for (int fi = 0; fi < hle->count && r; fi++)
+			if (hle->fn[fi].r == r)
+				r = NULL;
+		if (!r)
+			continue;
+		avr_hle_fn_t * fn = &hle->fn[hle->count++];
+		fn->r = r;
+		fn->addr = s->addr;
+		// its code goes on to the next symbol, they are sorted
+		fn->end = avr->flashend + 1;
+		for (int j = i + 1; j < firmware->symbolcount; j++)
+			if (firmware->symbol[j]->addr > s->addr) {
+				if (firmware->symbol[j]->addr < fn->end)
+					fn->end = firmware->symbol[j]->addr;
+				break;
+			}
+		hle->map[s->addr >> 1] = hle->count;
+		AVR_LOG(avr, LOG_TRACE, "HLE: %s at %04x-%04x\n", r->name, fn->addr, fn->end);
+	}
+	avr->hle = hle;
+	avr->run_one = avr_get_run_one(avr);
+	return hle->count;
+#else
+	AVR_LOG(avr, LOG_ERROR, "HLE: %s: built without ELF symbols\n", __FUNCTION__);
+	return -1;
+#endif
+}
+
+void
+avr_hle_free(
+		avr_t * avr)
+{
+	avr_hle_t * hle = avr->hle;
+	if (!hle)
+		return;
+	avr->hle = NULL;
+	avr->run_one = avr_get_run_one(avr);
+	free(hle->map);
+	free(hle->fn);
+	free(hle->check.data);
+	free(hle);
+}
+
+void
+avr_hle_flush(
+		avr_t * avr,
+		avr_flashaddr_t addr,
+		uint32_t size)
+{
+	avr_hle_t * hle = avr->hle;
+	for (int i = 0; i < hle->count; i++) {
+		avr_hle_fn_t * fn = &hle->fn[i];
+		if (fn->state == AVR_HLE_OFF || addr >= fn->end || addr + size <= fn->addr)
+			continue;
+		AVR_LOG(avr, LOG_TRACE, "HLE: flash changed, %s is left to the core\n", fn->r->name);
+		avr_hle_off(avr, fn);
+	}
+}
+
+/*
+ * Entering 'fn' with 'n' as the length: what the C version does is kept
+ * aside, and the decoder runs the routine until it returns
+ */
+static int
+avr_hle_check_start(
+		avr_t * avr,
+		avr_hle_fn_t * fn,
+		int n)
+{
+	avr_hle_t * hle = avr->hle;
+	uint16_t sp = _avr_sp_get(avr);
+	if (sp + avr->address_size > avr->ramend)
+		return 0;
+	avr_flashaddr_t ret = 0;
+	for (int i = 1; i <= avr->address_size; i++)
+		ret = (ret << 8) | avr->data[sp + i];
+	memcpy(hle->check.data, avr->data, avr->ramend + 1);
+	fn->r->run(avr, hle->check.data, 0);
+	hle->check.fn = fn;
+	hle->check.ret = ret << 1;
+	hle->check.sp = hle->check.sp_min = sp;
+	hle->check.n = n;
+	hle->check.valid = 1;
+	hle->check.cycle = avr->cycle;
+	hle->check.due = avr->cycle_timers.timer ? avr->cycle_timers.timer->when : ~0ull;
+	return 1;
+}
+
+// the routine being checked returned, compare and time it
+static void
+avr_hle_check_end(
+		avr_t * avr)
+{
+	avr_hle_t * hle = avr->hle;
+	avr_hle_fn_t * fn = hle->check.fn;
+	uint8_t * c = hle->check.data;
+	hle->check.fn = NULL;
+	// a cycle timer, or an interrupt, might have changed the SRAM too
+	if (!hle->check.valid || avr->cycle >= hle->check.due)
+		return;
+	int bad = -1;
+	uint32_t regs = fn->r->result | AVR_HLE_SAVED;
+	for (int r = 0; r < 32 && bad < 0; r++)
+		if ((regs & (1u << r)) && avr->data[r] != c[r])
+			bad = r;
+	// the SRAM, but for the stack the routine used
+	for (int a = avr->ioend + 1; a <= avr->ramend && bad < 0; a++)
+		if ((a <= hle->check.sp_min || a > hle->check.sp) && avr->data[a] != c[a])
+			bad = a;
+	if (bad >= 0) {
+		char n[16];
+		if (bad < 32)
+			strcpy(n, avr_regname(bad));
+		else
+			sprintf(n, "%04x", bad);
+		AVR_LOG(avr, LOG_WARNING, "HLE: %s at %04x doesn't match, %s is %02x instead of %02x; "
+				"left to the core\n", fn->r->name, fn->addr, n, avr->data[bad], c[bad]);
+		avr_hle_off(avr, fn);
+		return;
+	}
+	uint32_t n = hle->check.n;
+	double cycles = avr->cycle - hle->check.cycle;
+	if (!fn->samples || n < fn->nmin)
+		fn->nmin = n;
+	if (!fn->samples || n > fn->nmax)
+		fn->nmax = n;
+	fn->samples++;
+	fn->sn += n;
+	fn->sc += cycles;
+	fn->snn += (double)n * n;
+	fn->snc += n * cycles;
+	// the time per byte needs two lengths
+	if (fn->samples < AVR_HLE_SAMPLES || (fn->r->sized && fn->nmin == fn->nmax))
+		return;
+	double count = fn->samples, d = count * fn->snn - fn->sn * fn->sn;
+	fn->per = d > 0 ? (count * fn->snc - fn->sn * fn->sc) / d : 0;
+	fn->base = (fn->sc - fn->per * fn->sn) / count;
+	fn->state = AVR_HLE_NATIVE;
+	AVR_LOG(avr, LOG_TRACE, "HLE: %s runs in C, %.1f cycles + %.2f per byte\n",
+			fn->r->name, fn->base, fn->per);
+}
+
+// one instruction of the routine being checked
+static avr_flashaddr_t
+avr_hle_check_step(
+		avr_t * avr)
+{
+	avr_hle_t * hle = avr->hle;
+	uint16_t sp = _avr_sp_get(avr);
+	// an interrupt came in, its effects can't be told apart
+	if (avr->pc < hle->vectors)
+		hle->check.valid = 0;
+	if (sp < hle->check.sp_min)
+		hle->check.sp_min = sp;
+	if (avr->pc == hle->check.ret && sp == hle->check.sp + avr->address_size) {
+		avr_hle_check_end(avr);
+		return avr_hle_run_one(avr);
+	}
+	if (avr->cycle - hle->check.cycle > AVR_HLE_SAMPLE_MAX)
+		hle->check.fn = NULL;
+	return avr_run_one(avr);
+}
+
+avr_flashaddr_t
+avr_hle_run_one(
+		avr_t * avr)
+{
+	avr_hle_t * hle = avr->hle;
+	if (hle->check.fn)
+		return avr_hle_check_step(avr);
+	uint8_t i = avr->pc <= avr->flashend ? hle->map[avr->pc >> 1] : 0;
+	if (!i)
+		return hle->run_one(avr);
+
+	avr_hle_fn_t * fn = &hle->fn[i - 1];
+	int n = fn->r->run(avr, avr->data, 1);
+	if (n < 0)
+		return hle->run_one(avr);
+	if (fn->state == AVR_HLE_CHECKING)
+		return avr_hle_check_start(avr, fn, n) ? avr_run_one(avr) : hle->run_one(avr);
+
+	double c = fn->base + fn->per * n;
+	avr_cycle_count_t cycles = c < 1 ? 1 : (avr_cycle_count_t)(c + 0.5);
+	// the run loop must have nothing to do until it returns
+	if (avr->interrupts.pending_r != avr->interrupts.pending_w ||
+			avr->sreg[S_I] != avr->i_shadow ||
+			(avr->cycle_timers.timer && avr->cycle_timers.timer->when <= avr->cycle + cycles))
+		return hle->run_one(avr);
+	fn->r->run(avr, avr->data, 0);
+	fn->calls++;
+	avr->cycle += cycles;
+	return _avr_pop_addr(avr);
+}
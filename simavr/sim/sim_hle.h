@@ -0,0 +1,132 @@
+/*
+	sim_hle.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * High level emulation of the avr-libc and libgcc runtime routines.
+ *
+ * avr_hle_init() finds memcpy, memset, strlen, the 32 bits multiply and
+ * divisions and the float add, subtract and multiply in the firmware
+ * symbols; when the core gets to one of them, it runs the routine in C
+ * instead, with the same effect on the SRAM and on the registers the
+ * caller looks at (the results, r1 and the call-saved ones), returns, and
+ * adds the cycles the routine would have taken.
+ *
+ * The code behind a symbol isn't trusted: the first calls of each routine
+ * are run by the decoder, and compared with what the C version does. These
+ * calls also give the cycle count, as 'base + per_byte * length'; that is
+ * exact for the memory routines, and an average for the arithmetic ones,
+ * whose timing depends on the operands. A routine that doesn't match is
+ * left to the decoder.
+ *
+ * As with the superinstructions, a routine only runs in C when the run loop
+ * would have nothing to do until it returns: no pending interrupt, no cycle
+ * timer due. It is also left to the decoder for arguments outside plain
+ * SRAM, and for floats that aren't normal numbers.
+ *
+ * The scratch registers and SREG are not what the routine leaves, so this
+ * doesn't pass a sim_shadow.h check. It is off with gdb and with tracing;
+ * with translated code (sim_aot.h), routines reached by a jump rather than
+ * a call run translated.
+ */
+#ifndef __SIM_HLE_H__
+#define __SIM_HLE_H__
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// checked calls before a routine is run in C
+#define AVR_HLE_SAMPLES		8
+// a checked call that takes longer than that is dropped (longjmp...)
+#define AVR_HLE_SAMPLE_MAX	1000000
+
+struct avr_hle_routine_t;
+
+enum {
+	AVR_HLE_CHECKING = 0,	// calls are run by the decoder, and compared
+	AVR_HLE_NATIVE,			// calls are run in C
+	AVR_HLE_OFF,			// doesn't match, or its flash changed
+};
+
+// a routine found in the firmware
+typedef struct avr_hle_fn_t {
+	const struct avr_hle_routine_t * r;
+	avr_flashaddr_t	addr, end;		// its code
+	int				state;
+	uint32_t		calls;			// run in C
+	// checked calls, least squares of the cycles over the length
+	uint32_t		samples;
+	uint32_t		nmin, nmax;
+	double			sn, sc, snn, snc;
+	double			base, per;		// cycles = base + per * length
+} avr_hle_fn_t;
+
+typedef struct avr_hle_t {
+	// decoder for everything else, set by avr_get_run_one()
+	avr_flashaddr_t (*run_one)(struct avr_t * avr);
+	uint8_t *		map;			// routine + 1 at each flash word
+	avr_flashaddr_t	vectors;		// end of the vector table
+	int				count;
+	avr_hle_fn_t *	fn;
+	// the call being checked
+	struct {
+		avr_hle_fn_t *	fn;
+		avr_flashaddr_t	ret;
+		uint16_t		sp, sp_min;
+		uint32_t		n;
+		int				valid;		// no interrupt came in
+		avr_cycle_count_t cycle;
+		avr_cycle_count_t due;		// next cycle timer
+		uint8_t *		data;		// what the C version did
+	} check;
+} avr_hle_t;
+
+/*
+ * Looks for the routines in the 'firmware' loaded in 'avr', and emulates
+ * them from now on. Returns how many were found, or -1 without symbols.
+ */
+int
+avr_hle_init(
+		avr_t * avr,
+		elf_firmware_t * firmware);
+// back to the decoder for all routines
+void
+avr_hle_free(
+		avr_t * avr);
+// routines overlapping 'size' bytes of flash at 'addr' changed
+void
+avr_hle_flush(
+		avr_t * avr,
+		avr_flashaddr_t addr,
+		uint32_t size);
+// decoder used when avr->hle is set, see avr_get_run_one()
+avr_flashaddr_t
+avr_hle_run_one(
+		avr_t * avr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_HLE_H__ */
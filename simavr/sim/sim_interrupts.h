@@ -44,12 +44,13 @@ typedef struct avr_int_vector_t {
 
 // interrupt vectors, and their enable/clear registers
 typedef struct  avr_int_table_t {
-	avr_int_vector_t * vector[64];
-	uint8_t			vector_count;
+	// these are looked at after every instruction, keep them first
 	uint8_t			pending_wait;	// number of cycles to wait for pending
-	avr_int_vector_t * pending[64]; // needs to be >= vectors and a power of two
 	uint8_t			pending_w,
 					pending_r;	// fifo cursors
+	uint8_t			vector_count;
+	avr_int_vector_t * pending[64]; // needs to be >= vectors and a power of two
+	avr_int_vector_t * vector[64];
 } avr_int_table_t, *avr_int_table_p;
 
 /*
@@ -27,14 +27,86 @@
 #include <stdint.h>
 #include "sim_io.h"
 
+/*
+ * The ioctl index is a small hash table of the ioctl codes the modules have
+ * registered with avr_io_register_ioctl(), and of the IRQ ioctl they
+ * passed to avr_io_setirqs(). When the modules found there don't answer,
+ * it falls back to the old way of asking every module on the chain, so
+ * the ones that don't register (or set their IRQs by hand) still work.
+ * The table and the entries come from avr->irq_pool, and go with it.
+ */
+#define AVR_IO_CTL_HASH_SIZE	64
+
+enum {
+	AVR_IO_CTL_IOCTL	= (1 << 0),	// module answers to this in it's ioctl()
+	AVR_IO_CTL_IRQ		= (1 << 1),	// module's IRQs are returned by avr_io_getirq()
+};
+
+typedef struct avr_io_ctl_t {
+	struct avr_io_ctl_t * next;
+	uint32_t		ctl;
+	uint32_t		flags;
+	avr_io_t *		io;
+} avr_io_ctl_t;
+
+static inline int
+_avr_io_ctl_hash(
+		uint32_t ctl)
+{
+	return (ctl * 2654435761u) >> 26;	// top 6 bits, AVR_IO_CTL_HASH_SIZE
+}
+
+static void
+_avr_io_ctl_add(
+		avr_io_t * io,
+		uint32_t ctl,
+		uint32_t flags)
+{
+	avr_t * avr = io->avr;
+	if (!avr->io_ctl)
+		avr->io_ctl = avr_irq_pool_alloc(&avr->irq_pool,
+				AVR_IO_CTL_HASH_SIZE * sizeof(avr_io_ctl_t*));
+	avr_io_ctl_t ** head = &avr->io_ctl[_avr_io_ctl_hash(ctl)];
+	for (avr_io_ctl_t * e = *head; e; e = e->next)
+		if (e->ctl == ctl && e->io == io) {
+			e->flags |= flags;
+			return;
+		}
+	// newest first, like the module chain
+	avr_io_ctl_t * n = avr_irq_pool_alloc(&avr->irq_pool, sizeof(avr_io_ctl_t));
+	n->ctl = ctl;
+	n->flags = flags;
+	n->io = io;
+	n->next = *head;
+	*head = n;
+}
+
+void
+avr_io_register_ioctl(
+		avr_io_t * io,
+		uint32_t ctl)
+{
+	_avr_io_ctl_add(io, ctl, AVR_IO_CTL_IOCTL);
+}
+
 int
 avr_ioctl(
 		avr_t *avr,
 		uint32_t ctl,
 		void * io_param)
 {
-	avr_io_t * port = avr->io_port;
 	int res = -1;
+
+	if (avr->io_ctl) {
+		avr_io_ctl_t * e = avr->io_ctl[_avr_io_ctl_hash(ctl)];
+		for (; e && res == -1; e = e->next)
+			if (e->ctl == ctl && (e->flags & AVR_IO_CTL_IOCTL) && e->io->ioctl)
+				res = e->io->ioctl(e->io, ctl, io_param);
+	}
+	if (res != -1)
+		return res;
+
+	avr_io_t * port = avr->io_port;
 	while (port && res == -1) {
 		if (port->ioctl)
 			res = port->ioctl(port, ctl, io_param);
@@ -53,6 +125,40 @@ avr_register_io(
 	avr->io_port = io;
 }
 
+/*
+ * Makes sure the IO tables cover 'addr'. A register hooked past 'ioend' is
+ * SRAM, like a console register in a global variable: the IO space is
+ * extended to it, so the core goes through the tables for it. Returns -1
+ * when 'addr' isn't in the data space at all.
+ */
+static int
+_avr_io_cover(
+		avr_t * avr,
+		avr_io_addr_t addr,
+		const char * caller)
+{
+	if (addr < 32 || addr > avr->ramend) {
+		AVR_LOG(avr, LOG_ERROR, "IO: %s(): IO address 0x%04x out of range (max 0x%04x), ignored.\n",
+					caller, addr, avr->ramend);
+		return -1;
+	}
+	if (addr <= avr->ioend)
+		return 0;
+	AVR_LOG(avr, LOG_TRACE, "IO: %s(): 0x%04x is SRAM, extending the IO space to it.\n",
+				caller, addr);
+	int count = AVR_DATA_TO_IO(addr) + 1;
+	avr->io_r = realloc(avr->io_r, count * sizeof(struct avr_io_r_t));
+	avr->io_w = realloc(avr->io_w, count * sizeof(struct avr_io_w_t));
+	avr->io_irq = realloc(avr->io_irq, count * sizeof(avr_irq_t *));
+	int more = count - avr->io_count;
+	memset(avr->io_r + avr->io_count, 0, more * sizeof(struct avr_io_r_t));
+	memset(avr->io_w + avr->io_count, 0, more * sizeof(struct avr_io_w_t));
+	memset(avr->io_irq + avr->io_count, 0, more * sizeof(avr_irq_t *));
+	avr->io_count = count;
+	avr->ioend = addr;
+	return 0;
+}
+
 void
 avr_register_io_read(
 		avr_t *avr,
@@ -61,18 +167,41 @@ avr_register_io_read(
 		void * param)
 {
 	avr_io_addr_t a = AVR_DATA_TO_IO(addr);
-	if (avr->io[a].r.param || avr->io[a].r.c) {
-		if (avr->io[a].r.param != param || avr->io[a].r.c != readp) {
+	if (_avr_io_cover(avr, addr, __func__))
+		return;
+	if (avr->io_r[a].param || avr->io_r[a].c) {
+		if (avr->io_r[a].param != param || avr->io_r[a].c != readp) {
 			AVR_LOG(avr, LOG_ERROR, "IO: avr_register_io_read(): Already registered, refusing to override.\n");
 			AVR_LOG(avr, LOG_ERROR, "IO: avr_register_io_read(%04x : %p/%p): %p/%p\n", a,
-					avr->io[a].r.c, avr->io[a].r.param, readp, param);
+					avr->io_r[a].c, avr->io_r[a].param, readp, param);
 			abort();
 		}
 	}
-	avr->io[a].r.param = param;
-	avr->io[a].r.c = readp;
+	avr->io_r[a].param = param;
+	avr->io_r[a].c = readp;
+}
+
+void
+avr_io_set_read_stable(
+		avr_t *avr,
+		avr_io_addr_t addr,
+		int stable)
+{
+	avr_io_addr_t a = AVR_DATA_TO_IO(addr);
+	if (addr < 32 || a >= avr->io_count)
+		return;
+	avr->io_r[a].stable = stable;
 }
 
+/*
+ * List of the write callbacks for a register that is shared between
+ * several modules. It is the 'param' of the _avr_io_mux_write() dispatcher.
+ */
+typedef struct avr_io_shared_t {
+	int count;
+	struct avr_io_w_t io[];
+} avr_io_shared_t;
+
 static void
 _avr_io_mux_write(
 		avr_t * avr,
@@ -80,12 +209,9 @@ _avr_io_mux_write(
 		uint8_t v,
 		void * param)
 {
-	int io = (intptr_t)param;
-	for (int i = 0; i < avr->io_shared_io[io].used; i++) {
-		avr_io_write_t c = avr->io_shared_io[io].io[i].c;
-		if (c)
-			c(avr, addr, v, avr->io_shared_io[io].io[i].param);
-	}
+	avr_io_shared_t * s = (avr_io_shared_t *)param;
+	for (int i = 0; i < s->count; i++)
+		s->io[i].c(avr, addr, v, s->io[i].param);
 }
 
 void
@@ -97,45 +223,37 @@ avr_register_io_write(
 {
 	avr_io_addr_t a = AVR_DATA_TO_IO(addr);
 
-	if (a >= MAX_IOs) {
-		AVR_LOG(avr, LOG_ERROR, "IO: avr_register_io_write(): IO address 0x%04x out of range (max 0x%04x).\n",
-					a, MAX_IOs);
-		abort();
+	if (_avr_io_cover(avr, addr, __func__))
+		return;
+	struct avr_io_w_t * w = &avr->io_w[a];
+	if (!w->c || (w->param == param && w->c == writep)) {
+		w->param = param;
+		w->c = writep;
+		return;
 	}
 	/*
-	 * Verifying that some other piece of code is not installed to watch write
-	 * on this address. If there is, this code installs a "dispatcher" callback
-	 * instead to handle multiple clients, otherwise, it continues as usual
+	 * Some other piece of code is already installed to watch write
+	 * on this address. Install a "dispatcher" callback instead to handle
+	 * multiple clients, or add this one to it's list.
 	 */
-	if (avr->io[a].w.param || avr->io[a].w.c) {
-		if (avr->io[a].w.param != param || avr->io[a].w.c != writep) {
-			// if the muxer not already installed, allocate a new slot
-			if (avr->io[a].w.c != _avr_io_mux_write) {
-				int no = avr->io_shared_io_count++;
-				if (avr->io_shared_io_count > 4) {
-					AVR_LOG(avr, LOG_ERROR, "IO: avr_register_io_write(): Too many shared IO registers.\n");
-					abort();
-				}
-				AVR_LOG(avr, LOG_TRACE, "IO: avr_register_io_write(%04x): Installing muxer on register.\n", addr);
-				avr->io_shared_io[no].used = 1;
-				avr->io_shared_io[no].io[0].param = avr->io[a].w.param;
-				avr->io_shared_io[no].io[0].c = avr->io[a].w.c;
-				avr->io[a].w.param = (void*)(intptr_t)no;
-				avr->io[a].w.c = _avr_io_mux_write;
-			}
-			int no = (intptr_t)avr->io[a].w.param;
-			int d = avr->io_shared_io[no].used++;
-			if (avr->io_shared_io[no].used > 4) {
-				AVR_LOG(avr, LOG_ERROR, "IO: avr_register_io_write(): Too many callbacks on %04x.\n", addr);
-				abort();
-			}
-			avr->io_shared_io[no].io[d].param = param;
-			avr->io_shared_io[no].io[d].c = writep;
-		}
+	avr_io_shared_t * sh = NULL;
+	if (w->c != _avr_io_mux_write) {
+		AVR_LOG(avr, LOG_TRACE, "IO: avr_register_io_write(%04x): Installing muxer on register.\n", addr);
+		sh = malloc(sizeof(avr_io_shared_t) + 2 * sizeof(struct avr_io_w_t));
+		sh->count = 1;
+		sh->io[0] = *w;
+	} else {
+		sh = (avr_io_shared_t *)w->param;
+		for (int i = 0; i < sh->count; i++)
+			if (sh->io[i].c == writep && sh->io[i].param == param)
+				return;
+		sh = realloc(sh, sizeof(avr_io_shared_t) + (sh->count + 1) * sizeof(struct avr_io_w_t));
 	}
-
-	avr->io[a].w.param = param;
-	avr->io[a].w.c = writep;
+	sh->io[sh->count].param = param;
+	sh->io[sh->count].c = writep;
+	sh->count++;
+	w->param = sh;
+	w->c = _avr_io_mux_write;
 }
 
 avr_irq_t *
@@ -144,6 +262,16 @@ avr_io_getirq(
 		uint32_t ctl,
 		int index)
 {
+	if (avr->io_ctl) {
+		avr_io_ctl_t * e = avr->io_ctl[_avr_io_ctl_hash(ctl)];
+		for (; e; e = e->next) {
+			avr_io_t * port = e->io;
+			if (e->ctl == ctl && (e->flags & AVR_IO_CTL_IRQ) &&
+					port->irq && port->irq_ioctl_get == ctl && port->irq_count > index)
+				return port->irq + index;
+		}
+	}
+	// modules that set their 'irq' without avr_io_setirqs()
 	avr_io_t * port = avr->io_port;
 	while (port) {
 		if (port->irq && port->irq_ioctl_get == ctl && port->irq_count > index)
@@ -151,7 +279,6 @@ avr_io_getirq(
 		port = port->next;
 	}
 	return NULL;
-	
 }
 
 avr_irq_t *
@@ -164,7 +291,9 @@ avr_iomem_getirq(
 	if (index > 8)
 		return NULL;
 	avr_io_addr_t a = AVR_DATA_TO_IO(addr);
-	if (avr->io[a].irq == NULL) {
+	if (_avr_io_cover(avr, addr, __func__))
+		return NULL;
+	if (avr->io_irq[a] == NULL) {
 		/*
 		 * Prepare an array of names for the io IRQs. Ideally we'd love to have
 		 * a proper name for these, but it's not possible at this time.
@@ -180,20 +309,19 @@ avr_iomem_getirq(
 			namep[ni] = d;
 			d += strlen(d) + 1;
 		}
-		avr->io[a].irq = avr_alloc_irq(&avr->irq_pool, 0, 9, namep);
+		avr->io_irq[a] = avr_alloc_irq(&avr->irq_pool, 0, 9, namep);
 		// mark the pin ones as filtered, so they only are raised when changing
 		for (int i = 0; i < 8; i++)
-			avr->io[a].irq[i].flags |= IRQ_FLAG_FILTERED;
+			avr->io_irq[a][i].flags |= IRQ_FLAG_FILTERED;
 	}
 	// if given a name, replace the default one...
 	if (name) {
 		int l = strlen(name);
 		char n[l + 10];
 		sprintf(n, "avr.io.%s", name);
-		free((void*)avr->io[a].irq[index].name);
-		avr->io[a].irq[index].name = strdup(n);
+		avr_rename_irq(&avr->io_irq[a][index], n);
 	}
-	return avr->io[a].irq + index;
+	return avr->io_irq[a] + index;
 }
 
 avr_irq_t *
@@ -258,6 +386,7 @@ avr_io_setirqs(
 
 	io->irq = irqs;
 	io->irq_ioctl_get = ctl;
+	_avr_io_ctl_add(io, ctl, AVR_IO_CTL_IRQ);
 	return io->irq;
 }
 
@@ -267,13 +396,31 @@ avr_deallocate_io(
 {
 	if (io->dealloc)
 		io->dealloc(io);
-	avr_free_irq(io->irq, io->irq_count);
+	// the ones from avr->irq_pool are not unpicked one by one, that's
+	// quadratic, avr_terminate() drops the whole pool right after
+	if (io->irq && io->irq->pool != &io->avr->irq_pool)
+		avr_free_irq(io->irq, io->irq_count);
 	io->irq_count = 0;
 	io->irq_ioctl_get = 0;
 	io->avr = NULL;
 	io->next = NULL;
 }
 
+void
+avr_allocate_ios(
+		avr_t * avr)
+{
+	// the classic cores' IO space, for the ones that don't say
+	if (!avr->ioend)
+		avr->ioend = 0xff;
+	if (avr->ioend > avr->ramend)
+		avr->ioend = avr->ramend;
+	avr->io_count = AVR_DATA_TO_IO(avr->ioend) + 1;
+	avr->io_r = calloc(avr->io_count, sizeof(struct avr_io_r_t));
+	avr->io_w = calloc(avr->io_count, sizeof(struct avr_io_w_t));
+	avr->io_irq = calloc(avr->io_count, sizeof(avr_irq_t *));
+}
+
 void
 avr_deallocate_ios(
 		avr_t * avr)
@@ -285,4 +432,16 @@ avr_deallocate_ios(
 		port = next;
 	}
 	avr->io_port = NULL;
+	avr->io_ctl = NULL;	// it's in avr->irq_pool
+
+	for (int i = 0; i < avr->io_count; i++)
+		if (avr->io_w[i].c == _avr_io_mux_write)
+			free(avr->io_w[i].param);
+	free(avr->io_r);
+	free(avr->io_w);
+	free(avr->io_irq);
+	avr->io_r = NULL;
+	avr->io_w = NULL;
+	avr->io_irq = NULL;
+	avr->io_count = 0;
 }
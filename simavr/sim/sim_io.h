@@ -69,7 +69,8 @@ void
 avr_register_io(
 		avr_t *avr,
 		avr_io_t * io);
-// Sets an IO module "official" IRQs and the ioctl used to get to them. if 'irqs' is NULL,
+// Sets an IO module "official" IRQs and the ioctl used to get to them, and adds
+// that ioctl to the index avr_io_getirq() looks into. if 'irqs' is NULL,
 // 'count' will be allocated
 avr_irq_t *
 avr_io_setirqs(
@@ -78,13 +79,25 @@ avr_io_setirqs(
 		int count,
 		avr_irq_t * irqs );
 
-// register a callback for when IO register "addr" is read
+// register a callback for when IO register "addr" is read. An "addr" past
+// 'ioend', in SRAM, extends the IO space up to it; one past 'ramend' is
+// refused, with an error. Same for the write callbacks and avr_iomem_getirq()
 void
 avr_register_io_read(
 		avr_t *avr,
 		avr_io_addr_t addr,
 		avr_io_read_t read,
 		void * param);
+/*
+ * The read callback of "addr" has no further effect when the register is
+ * read again with nothing else happening in between, if 'stable'; a loop
+ * polling it can be skipped, see AVR_FLAG_IDLE_LOOPS
+ */
+void
+avr_io_set_read_stable(
+		avr_t *avr,
+		avr_io_addr_t addr,
+		int stable);
 // register a callback for when the IO register is written. callback has to set the memory itself
 void
 avr_register_io_write(
@@ -92,13 +105,23 @@ avr_register_io_write(
 		avr_io_addr_t addr,
 		avr_io_write_t write,
 		void * param);
-// call every IO modules until one responds to this
+// registers 'ctl' as an ioctl that 'io' answers to. This allows avr_ioctl()
+// to go straight to the module instead of asking every one of them in turn.
+// Several modules can register the same 'ctl', they will be called in turn.
+void
+avr_io_register_ioctl(
+		avr_io_t * io,
+		uint32_t ctl);
+// call the IO modules that registered 'ctl' until one responds to this.
+// If none of them did, call every IO modules until one responds
 int
 avr_ioctl(
 		avr_t *avr,
 		uint32_t ctl,
 		void * io_param);
-// get the specific irq for a module, check AVR_IOCTL_IOPORT_GETIRQ for example
+// get the specific irq for a module, check AVR_IOCTL_IOPORT_GETIRQ for example.
+// The modules that passed 'ctl' to avr_io_setirqs() are found straight away,
+// the others by walking the chain
 struct avr_irq_t * avr_io_getirq(avr_t * avr, uint32_t ctl, int index);
 
 // get the IRQ for an absolute IO address
@@ -116,7 +139,14 @@ avr_iomem_getirq(
 		const char * name /* Optional, if NULL, "ioXXXX" will be used */ ,
 		int index);
 
-// Terminates all IOs and remove from them from the io chain
+// Allocates the IO register tables, from 32 to avr->ioend. Called by avr_init(),
+// they grow when a register is hooked in SRAM
+void
+avr_allocate_ios(
+		avr_t *avr);
+
+// Terminates all IOs and remove from them from the io chain. Their IRQs
+// and the ioctl index are left to avr_free_irq_pool(), see avr_terminate()
 void
 avr_deallocate_ios(
 		avr_t *avr);
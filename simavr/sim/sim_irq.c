@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include "sim_irq.h"
 
 // internal structure for a hook, never seen by the notify procs
@@ -34,17 +35,184 @@ typedef struct avr_irq_hook_t {
 	void * param;				// "notify" parameter
 } avr_irq_hook_t;
 
+/*
+ * Pool arena. Memory is only ever given back all at once, by
+ * avr_free_irq_pool(); hooks and name index entries that are released
+ * before that are kept on a free list in the pool, for reuse.
+ */
+#define IRQ_ARENA_BLOCK		16384
+
+typedef struct avr_irq_arena_t {
+	struct avr_irq_arena_t * next;
+	size_t size, used;
+	uint8_t data[0];
+} avr_irq_arena_t;
+
+static void *
+_avr_irq_arena_alloc(
+		avr_irq_pool_t * pool,
+		size_t size)
+{
+	size = (size + 7) & ~7;
+	avr_irq_arena_t * a = pool->arena;
+	if (!a || a->used + size > a->size) {
+		size_t bs = size > IRQ_ARENA_BLOCK ? size : IRQ_ARENA_BLOCK;
+		a = calloc(1, sizeof(avr_irq_arena_t) + bs);
+		a->size = bs;
+		// a big block gets its own, the current one might still have room
+		if (size > IRQ_ARENA_BLOCK / 4 && pool->arena) {
+			a->next = pool->arena->next;
+			pool->arena->next = a;
+		} else {
+			a->next = pool->arena;
+			pool->arena = a;
+		}
+	}
+	void * res = a->data + a->used;
+	a->used += size;
+	return res;
+}
+
+/*
+ * Name index for the IRQ pool. IRQs are hashed on their name, minus the
+ * 'flags' prefix, so "=avr.portb.pin3" is found by "avr.portb.pin3".
+ * The index is allocated the first time a named IRQ is added to a pool.
+ */
+#define IRQ_NAME_HASH_SIZE	256
+
+typedef struct avr_irq_name_t {
+	struct avr_irq_name_t * next;
+	uint32_t hash;
+	struct avr_irq_t * irq;
+} avr_irq_name_t;
+
+static const char *
+_avr_irq_name_key(
+		const char * name)
+{
+	while (isdigit(*name))
+		name++;
+	while (*name && !isalpha(*name))
+		name++;
+	return name;
+}
+
+static uint32_t
+_avr_irq_name_hash(
+		const char * key)
+{
+	uint32_t h = 2166136261u;	// FNV-1a
+	while (*key)
+		h = (h ^ (uint8_t)*key++) * 16777619u;
+	return h;
+}
+
+/*
+ * Interned names; names are mostly the static tables of the modules, but
+ * can also be built on the stack, so they are copied once per pool
+ */
+#define IRQ_INTERN_HASH_SIZE	256
+
+typedef struct avr_irq_intern_t {
+	struct avr_irq_intern_t * next;
+	uint32_t hash;
+	char name[0];
+} avr_irq_intern_t;
+
+static const char *
+_avr_irq_intern(
+		avr_irq_pool_t * pool,
+		const char * name)
+{
+	if (!name)
+		return NULL;
+	if (!pool->intern)
+		pool->intern = _avr_irq_arena_alloc(pool,
+				IRQ_INTERN_HASH_SIZE * sizeof(avr_irq_intern_t*));
+	uint32_t h = _avr_irq_name_hash(name);
+	avr_irq_intern_t ** b = &pool->intern[h % IRQ_INTERN_HASH_SIZE];
+	for (avr_irq_intern_t * n = *b; n; n = n->next)
+		if (n->hash == h && !strcmp(n->name, name))
+			return n->name;
+	avr_irq_intern_t * n = _avr_irq_arena_alloc(pool,
+			sizeof(avr_irq_intern_t) + strlen(name) + 1);
+	n->hash = h;
+	strcpy(n->name, name);
+	n->next = *b;
+	*b = n;
+	return n->name;
+}
+
+static void
+_avr_irq_name_add(
+		avr_irq_pool_t * pool,
+		avr_irq_t * irq)
+{
+	if (!irq->name)
+		return;
+	if (!pool->name)
+		pool->name = _avr_irq_arena_alloc(pool,
+				IRQ_NAME_HASH_SIZE * sizeof(avr_irq_name_t*));
+	avr_irq_name_t * n = pool->free_name;
+	if (n)
+		pool->free_name = n->next;
+	else
+		n = _avr_irq_arena_alloc(pool, sizeof(avr_irq_name_t));
+	n->hash = _avr_irq_name_hash(_avr_irq_name_key(irq->name));
+	n->irq = irq;
+	n->next = pool->name[n->hash % IRQ_NAME_HASH_SIZE];
+	pool->name[n->hash % IRQ_NAME_HASH_SIZE] = n;
+}
+
+static int
+_avr_irq_name_remove_bucket(
+		avr_irq_pool_t * pool,
+		int bucket,
+		avr_irq_t * irq)
+{
+	avr_irq_name_t ** n = &pool->name[bucket];
+	while (*n) {
+		if ((*n)->irq == irq) {
+			avr_irq_name_t * d = *n;
+			*n = d->next;
+			d->next = pool->free_name;
+			pool->free_name = d;
+			return 1;
+		}
+		n = &(*n)->next;
+	}
+	return 0;
+}
+
+static void
+_avr_irq_name_remove(
+		avr_irq_pool_t * pool,
+		avr_irq_t * irq)
+{
+	if (!pool->name || !irq->name)
+		return;
+	uint32_t h = _avr_irq_name_hash(_avr_irq_name_key(irq->name));
+	if (_avr_irq_name_remove_bucket(pool, h % IRQ_NAME_HASH_SIZE, irq))
+		return;
+	// the name was changed behind our back, look everywhere
+	for (int i = 0; i < IRQ_NAME_HASH_SIZE; i++)
+		if (_avr_irq_name_remove_bucket(pool, i, irq))
+			return;
+}
+
 static void
 _avr_irq_pool_add(
 		avr_irq_pool_t * pool,
 		avr_irq_t * irq)
 {
-	if ((pool->count & 0xf) == 0) {
+	if (pool->count == pool->size) {
+		pool->size = pool->size ? pool->size * 2 : 64;
 		pool->irq = (avr_irq_t**)realloc(pool->irq,
-				(pool->count + 16) * sizeof(avr_irq_t *));
+				pool->size * sizeof(avr_irq_t *));
 	}
 	pool->irq[pool->count++] = irq;
 	irq->pool = pool;
+	_avr_irq_name_add(pool, irq);
 }
 
 static void
@@ -52,6 +220,7 @@ _avr_irq_pool_remove(
 		avr_irq_pool_t * pool,
 		avr_irq_t * irq)
 {
+	_avr_irq_name_remove(pool, irq);
 	for (int i = 0; i < pool->count; i++)
 		if (pool->irq[i] == irq) {
 			pool->irq[i] = 0;
@@ -59,6 +228,38 @@ _avr_irq_pool_remove(
 		}
 }
 
+avr_irq_t *
+avr_find_irq(
+		avr_irq_pool_t * pool,
+		const char * name)
+{
+	if (!pool || !pool->name || !name)
+		return NULL;
+	const char * key = _avr_irq_name_key(name);
+	uint32_t h = _avr_irq_name_hash(key);
+	for (avr_irq_name_t * n = pool->name[h % IRQ_NAME_HASH_SIZE]; n; n = n->next)
+		if (n->hash == h && n->irq->name &&
+				!strcmp(_avr_irq_name_key(n->irq->name), key))
+			return n->irq;
+	return NULL;
+}
+
+void
+avr_rename_irq(
+		avr_irq_t * irq,
+		const char * name)
+{
+	if (irq->pool) {
+		_avr_irq_name_remove(irq->pool, irq);
+		irq->name = _avr_irq_intern(irq->pool, name);
+		_avr_irq_name_add(irq->pool, irq);
+	} else {
+		if (irq->name)
+			free((char*)irq->name);
+		irq->name = name ? strdup(name) : NULL;
+	}
+}
+
 void
 avr_init_irq(
 		avr_irq_pool_t * pool,
@@ -72,13 +273,13 @@ avr_init_irq(
 	for (int i = 0; i < count; i++) {
 		irq[i].irq = base + i;
 		irq[i].flags = IRQ_FLAG_INIT;
-		if (pool)
-			_avr_irq_pool_add(pool, &irq[i]);
 		if (names && names[i])
-			irq[i].name = strdup(names[i]);
+			irq[i].name = pool ? _avr_irq_intern(pool, names[i]) : strdup(names[i]);
 		else {
 			printf("WARNING %s() with NULL name for irq %d.\n", __func__, irq[i].irq);
 		}
+		if (pool)
+			_avr_irq_pool_add(pool, &irq[i]);
 	}
 }
 
@@ -89,6 +290,11 @@ avr_alloc_irq(
 		uint32_t count,
 		const char ** names /* optional */)
 {
+	if (pool) {
+		avr_irq_t * irq = _avr_irq_arena_alloc(pool, sizeof(avr_irq_t) * count);
+		avr_init_irq(pool, irq, base, count, names);
+		return irq;
+	}
 	avr_irq_t * irq = (avr_irq_t*)malloc(sizeof(avr_irq_t) * count);
 	avr_init_irq(pool, irq, base, count, names);
 	for (int i = 0; i < count; i++)
@@ -100,13 +306,33 @@ static avr_irq_hook_t *
 _avr_alloc_irq_hook(
 		avr_irq_t * irq)
 {
-	avr_irq_hook_t *hook = malloc(sizeof(avr_irq_hook_t));
+	avr_irq_hook_t *hook;
+	avr_irq_pool_t * pool = irq->pool;
+	if (pool && pool->free_hook) {
+		hook = pool->free_hook;
+		pool->free_hook = hook->next;
+	} else if (pool)
+		hook = _avr_irq_arena_alloc(pool, sizeof(avr_irq_hook_t));
+	else
+		hook = malloc(sizeof(avr_irq_hook_t));
 	memset(hook, 0, sizeof(avr_irq_hook_t));
 	hook->next = irq->hook;
 	irq->hook = hook;
 	return hook;
 }
 
+static void
+_avr_free_irq_hook(
+		avr_irq_t * irq,
+		avr_irq_hook_t * hook)
+{
+	if (irq->pool) {
+		hook->next = irq->pool->free_hook;
+		irq->pool->free_hook = hook;
+	} else
+		free(hook);
+}
+
 void
 avr_free_irq(
 		avr_irq_t * irq,
@@ -118,23 +344,47 @@ avr_free_irq(
 		avr_irq_t * iq = irq + i;
 		if (iq->pool)
 			_avr_irq_pool_remove(iq->pool, iq);
-		if (iq->name)
+		else if (iq->name)
 			free((char*)iq->name);
 		iq->name = NULL;
 		// purge hooks
 		avr_irq_hook_t *hook = iq->hook;
 		while (hook) {
 			avr_irq_hook_t * next = hook->next;
-			free(hook);
+			_avr_free_irq_hook(iq, hook);
 			hook = next;
 		}
 		iq->hook = NULL;
 	}
-	// if that irq list was allocated by us, free it
+	// if that irq list was allocated by us, free it. The ones from
+	// a pool arena go with the pool
 	if (irq->flags & IRQ_FLAG_ALLOC)
 		free(irq);
 }
 
+void
+avr_free_irq_pool(
+		avr_irq_pool_t * pool)
+{
+	avr_irq_arena_t * a = pool->arena;
+	while (a) {
+		avr_irq_arena_t * next = a->next;
+		free(a);
+		a = next;
+	}
+	if (pool->irq)
+		free(pool->irq);
+	memset(pool, 0, sizeof(*pool));
+}
+
+void *
+avr_irq_pool_alloc(
+		avr_irq_pool_t * pool,
+		uint32_t size)
+{
+	return _avr_irq_arena_alloc(pool, size);
+}
+
 void
 avr_irq_register_notify(
 		avr_irq_t * irq,
@@ -153,6 +403,8 @@ avr_irq_register_notify(
 	hook = _avr_alloc_irq_hook(irq);
 	hook->notify = notify;
 	hook->param = param;
+	if (irq->flags & IRQ_FLAG_HOOKS_WATCHED)
+		avr_raise_irq(irq->pool->hooked, 1);
 }
 
 void
@@ -173,7 +425,7 @@ avr_irq_unregister_notify(
 				prev->next = hook->next;
 			else
 				irq->hook = hook->next;
-			free(hook);
+			_avr_free_irq_hook(irq, hook);
 			return;
 		}
 		prev = hook;
@@ -181,6 +433,16 @@ avr_irq_unregister_notify(
 	}
 }
 
+int
+avr_irq_hook_count(
+		avr_irq_t * irq)
+{
+	int count = 0;
+	for (avr_irq_hook_t * hook = irq->hook; hook; hook = hook->next)
+		count++;
+	return count;
+}
+
 void
 avr_raise_irq(
 		avr_irq_t * irq,
@@ -231,6 +493,8 @@ avr_connect_irq(
 	}
 	hook = _avr_alloc_irq_hook(src);
 	hook->chain = dst;
+	if (src->flags & IRQ_FLAG_HOOKS_WATCHED)
+		avr_raise_irq(src->pool->hooked, 1);
 }
 
 void
@@ -252,10 +516,25 @@ avr_unconnect_irq(
 				prev->next = hook->next;
 			else
 				src->hook = hook->next;
-			free(hook);
+			_avr_free_irq_hook(src, hook);
 			return;
 		}
 		prev = hook;
 		hook = hook->next;
 	}
 }
+
+avr_irq_t *
+avr_irq_watch_hooks(
+		avr_irq_t * irq)
+{
+	avr_irq_pool_t * pool = irq ? irq->pool : NULL;
+	if (!pool)
+		return NULL;
+	if (!pool->hooked) {
+		static const char * name[] = { "hooked" };
+		pool->hooked = avr_alloc_irq(pool, 0, 1, name);
+	}
+	irq->flags |= IRQ_FLAG_HOOKS_WATCHED;
+	return pool->hooked;
+}
@@ -54,16 +54,30 @@ typedef void (*avr_irq_notify_t)(
 enum {
 	IRQ_FLAG_NOT		= (1 << 0),	//!< change polarity of the IRQ
 	IRQ_FLAG_FILTERED	= (1 << 1),	//!< do not "notify" if "value" is the same as previous raise
-	IRQ_FLAG_ALLOC		= (1 << 2), //!< this irq structure was malloced via avr_alloc_irq
+	IRQ_FLAG_ALLOC		= (1 << 2), //!< this irq structure was malloced via avr_alloc_irq, without a pool
 	IRQ_FLAG_INIT		= (1 << 3), //!< this irq hasn't been used yet
+	IRQ_FLAG_HOOKS_WATCHED	= (1 << 4), //!< a new hook raises the pool 'hooked' IRQ, see avr_irq_watch_hooks()
 };
 
 /*
  * IRQ Pool structure
+ *
+ * The IRQs allocated with avr_alloc_irq() from a pool, the hooks and the
+ * names of all the IRQs of the pool come from an arena, so they are all
+ * released together by avr_free_irq_pool() (called by avr_terminate() for
+ * avr->irq_pool). Names are interned, an IRQ name is only stored once per
+ * pool.
  */
 typedef struct avr_irq_pool_t {
 	int count;						//!< number of irqs living in the pool
+	int size;						//!< allocated entries in 'irq'
 	struct avr_irq_t ** irq;		//!< irqs belonging in this pool
+	struct avr_irq_name_t ** name;	//!< name index, see avr_find_irq()
+	struct avr_irq_arena_t * arena;	//!< memory blocks, newest first
+	struct avr_irq_hook_t * free_hook;	//!< released hooks, to be reused
+	struct avr_irq_name_t * free_name;	//!< released name index entries
+	struct avr_irq_intern_t ** intern;	//!< interned names
+	struct avr_irq_t * hooked;		//!< raised when a watched IRQ gets a hook
 } avr_irq_pool_t;
 
 /*!
@@ -89,6 +103,15 @@ void
 avr_free_irq(
 		avr_irq_t * irq,
 		uint32_t count);
+//! releases all the memory of the pool, the IRQs allocated from it are gone too
+void
+avr_free_irq_pool(
+		avr_irq_pool_t * pool);
+//! zeroed memory that lives as long as the pool, for the pool owner's own tables
+void *
+avr_irq_pool_alloc(
+		avr_irq_pool_t * pool,
+		uint32_t size);
 
 //! init 'count' IRQs, initializes their "irq" starting from 'base' and increment
 void
@@ -98,6 +121,17 @@ avr_init_irq(
 		uint32_t base,
 		uint32_t count,
 		const char ** names /* optional */);
+//! find an IRQ in 'pool' by it's name, like "avr.portb.pin3". The 'flags' prefix
+//! of the name ("=", "8>" etc) is ignored. Returns NULL if not found
+avr_irq_t *
+avr_find_irq(
+		avr_irq_pool_t * pool,
+		const char * name);
+//! change the name of an IRQ, keeps the pool name index up to date
+void
+avr_rename_irq(
+		avr_irq_t * irq,
+		const char * name);
 //! 'raise' an IRQ. Ie call their 'hooks', and raise any chained IRQs, and set the new 'value'
 void
 avr_raise_irq(
@@ -126,6 +160,17 @@ avr_irq_unregister_notify(
 		avr_irq_notify_t notify,
 		void * param);
 
+//! number of hooks on 'irq', notify procs and connected IRQs
+int
+avr_irq_hook_count(
+		avr_irq_t * irq);
+//! from now on, adding a hook (notify or connection) to 'irq' raises the
+//! 'hooked' IRQ of its pool, which is returned; NULL if 'irq' has no pool.
+//! For the modules that only do some work when somebody listens
+avr_irq_t *
+avr_irq_watch_hooks(
+		avr_irq_t * irq);
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,208 @@
+/*
+	sim_mailbox.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "sim_avr.h"
+#include "sim_irq.h"
+#include "sim_cycle_timers.h"
+#include "sim_mailbox.h"
+
+/*
+ * The slots go round; 'seq' tells whose turn it is: a slot is free for the
+ * post at 'pos' when it is 'pos', and ready to drain once it is 'pos' + 1.
+ * The drain then makes it free for the post one turn later.
+ */
+typedef struct avr_mailbox_slot_t {
+	volatile uint32_t	seq;
+	avr_irq_t *			irq;
+	uint32_t			value;
+	avr_cycle_count_t	when;
+} avr_mailbox_slot_t;
+
+// a raise waiting for its cycle, only seen by the simulator thread
+typedef struct avr_mailbox_held_t {
+	avr_irq_t *			irq;
+	uint32_t			value;
+	avr_cycle_count_t	when;
+	struct avr_mailbox_held_t * next;
+} avr_mailbox_held_t;
+
+typedef struct avr_mailbox_t {
+	avr_mailbox_slot_t	slot[AVR_MAILBOX_SIZE];
+	volatile uint32_t	tail;		// next post, bumped by the posting threads
+	uint32_t			head;		// next drain
+	avr_mailbox_held_t * held;		// soonest first
+	volatile int		overflow;	// a post was refused
+	avr_irq_t *			irq;		// ...and that's raised when drained
+} avr_mailbox_t;
+
+int
+avr_mailbox_post(
+		avr_t * avr,
+		avr_irq_t * irq,
+		uint32_t value,
+		avr_cycle_count_t when)
+{
+	avr_mailbox_t * m = avr->mailbox;
+	avr_mailbox_slot_t * s;
+	uint32_t pos = m->tail;
+
+	for (;;) {
+		s = &m->slot[pos & (AVR_MAILBOX_SIZE - 1)];
+		int32_t turn = s->seq - pos;
+		if (turn < 0) {	// the drain hasn't been there yet, full
+			m->overflow = 1;
+			__sync_synchronize();
+			avr->mailbox_posted = 1;
+			avr_wake(avr);
+			return -1;
+		}
+		// otherwise, somebody else took it already
+		if (turn == 0 && __sync_bool_compare_and_swap(&m->tail, pos, pos + 1))
+			break;
+		pos = m->tail;
+	}
+	s->irq = irq;
+	s->value = value;
+	s->when = when;
+	__sync_synchronize();
+	s->seq = pos + 1;
+	__sync_synchronize();
+	avr->mailbox_posted = 1;
+	avr_wake(avr);
+	return 0;
+}
+
+static avr_cycle_count_t
+avr_mailbox_due(
+		avr_t * avr,
+		avr_cycle_count_t when,
+		void * param)
+{
+	avr_mailbox_t * m = (avr_mailbox_t*)param;
+
+	while (m->held && m->held->when <= when) {
+		avr_mailbox_held_t * h = m->held;
+		m->held = h->next;
+		avr_raise_irq(h->irq, h->value);
+		free(h);
+	}
+	return m->held ? m->held->when : 0;
+}
+
+static void
+avr_mailbox_hold(
+		avr_t * avr,
+		avr_irq_t * irq,
+		uint32_t value,
+		avr_cycle_count_t when)
+{
+	avr_mailbox_t * m = avr->mailbox;
+	avr_mailbox_held_t * h = malloc(sizeof(*h));
+
+	*h = (avr_mailbox_held_t) { .irq = irq, .value = value, .when = when };
+	// after the ones for the same cycle, they were posted first
+	avr_mailbox_held_t ** w = &m->held;
+	while (*w && (*w)->when <= when)
+		w = &(*w)->next;
+	h->next = *w;
+	*w = h;
+	if (m->held == h)
+		avr_cycle_timer_register(avr, when - avr->cycle, avr_mailbox_due, m);
+}
+
+void
+avr_mailbox_drain(
+		avr_t * avr)
+{
+	avr_mailbox_t * m = avr->mailbox;
+
+	// a post from now on sets it again
+	avr->mailbox_posted = 0;
+	__sync_synchronize();
+	for (;;) {
+		avr_mailbox_slot_t * s = &m->slot[m->head & (AVR_MAILBOX_SIZE - 1)];
+		if (s->seq != m->head + 1)
+			break;	// not posted yet
+		__sync_synchronize();
+		avr_irq_t * irq = s->irq;
+		uint32_t value = s->value;
+		avr_cycle_count_t when = s->when;
+		__sync_synchronize();
+		s->seq = m->head + AVR_MAILBOX_SIZE;
+		m->head++;
+
+		if (when > avr->cycle)
+			avr_mailbox_hold(avr, irq, value, when);
+		else
+			avr_raise_irq(irq, value);
+	}
+	// there is room again, for whoever missed out
+	if (__sync_lock_test_and_set(&m->overflow, 0))
+		avr_raise_irq(m->irq, 1);
+}
+
+void
+avr_mailbox_init(
+		avr_t * avr)
+{
+	avr_mailbox_t * m = calloc(1, sizeof(*m));
+
+	for (int i = 0; i < AVR_MAILBOX_SIZE; i++)
+		m->slot[i].seq = i;
+	static const char * name[] = { "1>mailbox.overflow" };
+	m->irq = avr_alloc_irq(&avr->irq_pool, 0, 1, name);
+	avr->mailbox = m;
+}
+
+avr_irq_t *
+avr_mailbox_overflow_getirq(
+		avr_t * avr)
+{
+	return avr->mailbox ? avr->mailbox->irq : NULL;
+}
+
+void
+avr_mailbox_reset(
+		avr_t * avr)
+{
+	avr_mailbox_t * m = avr->mailbox;
+
+	if (!m)
+		return;
+	avr_cycle_timer_cancel(avr, avr_mailbox_due, m);
+	while (m->held) {
+		avr_mailbox_held_t * h = m->held;
+		m->held = h->next;
+		free(h);
+	}
+}
+
+void
+avr_mailbox_free(
+		avr_t * avr)
+{
+	if (!avr->mailbox)
+		return;
+	avr_mailbox_reset(avr);
+	free(avr->mailbox);
+	avr->mailbox = NULL;
+}
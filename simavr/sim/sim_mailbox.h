@@ -0,0 +1,81 @@
+/*
+	sim_mailbox.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * IRQs raised from other threads (a GUI, a socket, a USB host...).
+ *
+ * avr_raise_irq() is only safe on the simulator thread, as it runs the hooks
+ * of the IRQ, and whatever they touch, there and then. Any other thread can
+ * avr_mailbox_post() the raise instead; it goes in a ring without taking a
+ * lock, and the run loop does it between two instructions, or when it's
+ * woken up if the core was sleeping (see avr_wake()).
+ * The raises are done in the order they were posted; if 'when' is a cycle
+ * still to come, that one is held until then, otherwise it's done as soon as
+ * possible. A reset drops the ones being held.
+ * A post that didn't fit isn't lost without trace: the IRQ from
+ * avr_mailbox_overflow_getirq() is raised on the simulator thread, after
+ * the next drain, so the posters can go and look for what they missed.
+ */
+#ifndef __SIM_MAILBOX_H__
+#define __SIM_MAILBOX_H__
+
+#include "sim_avr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVR_MAILBOX_SIZE	256		// power of two
+
+// returns 0, or -1 when the mailbox is full
+int
+avr_mailbox_post(
+		avr_t * avr,
+		struct avr_irq_t * irq,
+		uint32_t value,
+		avr_cycle_count_t when);
+// raised on the simulator thread when some posts were refused, see above
+struct avr_irq_t *
+avr_mailbox_overflow_getirq(
+		avr_t * avr);
+
+/*
+ * These are for the core, on the simulator thread; the run loops call
+ * avr_mailbox_drain() when 'mailbox_posted' is set.
+ */
+void
+avr_mailbox_init(
+		avr_t * avr);
+void
+avr_mailbox_drain(
+		avr_t * avr);
+void
+avr_mailbox_reset(
+		avr_t * avr);
+void
+avr_mailbox_free(
+		avr_t * avr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_MAILBOX_H__ */
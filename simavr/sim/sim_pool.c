@@ -0,0 +1,155 @@
+/*
+	sim_pool.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sim_pool.h"
+#include "sim_core.h"
+#include "avr_eeprom.h"
+
+avr_pool_t *
+avr_pool_new(
+		const char * mmcu,
+		elf_firmware_t * firmware,
+		avr_pool_setup_p setup,
+		void * param)
+{
+	avr_kind_t * kind = avr_find_kind(mmcu);
+	if (!kind) {
+		AVR_LOG(NULL, LOG_ERROR, "%s: AVR '%s' not known\n", __FUNCTION__, mmcu);
+		return NULL;
+	}
+	avr_pool_t * pool = calloc(1, sizeof(avr_pool_t));
+	pool->kind = kind;
+	pool->firmware = firmware;
+	pool->setup = setup;
+	pool->param = param;
+	return pool;
+}
+
+/*
+ * Keep the state of the first instance, once the firmware is loaded and
+ * the board is set up, that's what the recycled ones are rewound to
+ */
+static void
+avr_pool_snapshot(
+		avr_pool_t * pool,
+		avr_t * avr)
+{
+	pool->flash = malloc(avr->flashend + 1);
+	memcpy(pool->flash, avr->flash, avr->flashend + 1);
+	if (avr->e2end) {
+		pool->eeprom = malloc(avr->e2end + 1);
+		avr_eeprom_desc_t d = { .ee = pool->eeprom, .offset = 0, .size = avr->e2end + 1 };
+		if (avr_ioctl(avr, AVR_IOCTL_EEPROM_GET, &d) == 0)
+			pool->eesize = avr->e2end + 1;
+	}
+	pool->frequency = avr->frequency;
+	pool->vcc = avr->vcc;
+	pool->avcc = avr->avcc;
+	pool->aref = avr->aref;
+	pool->codeend = avr->codeend;
+	pool->pc = avr->pc;
+	pool->log = avr->log;
+	pool->ready = 1;
+}
+
+static void
+avr_pool_rewind(
+		avr_pool_t * pool,
+		avr_t * avr)
+{
+	// flushing would also drop the translated code, so only if it changed
+	if (memcmp(avr->flash, pool->flash, avr->flashend + 1)) {
+		memcpy(avr->flash, pool->flash, avr->flashend + 1);
+		avr_superinsn_flush(avr, 0, avr->flashend + 1);
+	}
+	if (pool->eesize) {
+		avr_eeprom_desc_t d = { .ee = pool->eeprom, .offset = 0, .size = pool->eesize };
+		avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &d);
+	}
+	avr->frequency = pool->frequency;
+	avr->vcc = pool->vcc;
+	avr->avcc = pool->avcc;
+	avr->aref = pool->aref;
+	avr->codeend = pool->codeend;
+	avr->log = pool->log;
+	avr->cycle = 0;
+	avr->sleep_usec = 0;
+	avr->i_shadow = 0;
+	avr->state = cpu_Running;
+	avr_reset(avr);
+	avr->pc = pool->pc;
+}
+
+avr_t *
+avr_pool_get(
+		avr_pool_t * pool)
+{
+	if (pool->count)
+		return pool->idle[--pool->count];
+
+	avr_t * avr = pool->kind->make();
+	avr_init(avr);
+	if (pool->firmware)
+		avr_load_firmware(avr, pool->firmware);
+	if (pool->setup)
+		pool->setup(avr, pool->param);
+	if (!pool->ready)
+		avr_pool_snapshot(pool, avr);
+	return avr;
+}
+
+void
+avr_pool_put(
+		avr_pool_t * pool,
+		avr_t * avr)
+{
+	// gdb replaced the run/sleep callbacks and has sockets open; not worth it
+	if (avr->gdb) {
+		avr_terminate(avr);
+		free(avr);
+		return;
+	}
+	avr_pool_rewind(pool, avr);
+	if (pool->count == pool->size) {
+		pool->size = pool->size ? pool->size * 2 : 8;
+		pool->idle = realloc(pool->idle, pool->size * sizeof(avr_t*));
+	}
+	pool->idle[pool->count++] = avr;
+}
+
+void
+avr_pool_free(
+		avr_pool_t * pool)
+{
+	if (!pool)
+		return;
+	for (int i = 0; i < pool->count; i++) {
+		avr_terminate(pool->idle[i]);
+		free(pool->idle[i]);
+	}
+	free(pool->idle);
+	free(pool->flash);
+	free(pool->eeprom);
+	free(pool);
+}
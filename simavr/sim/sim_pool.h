@@ -0,0 +1,98 @@
+/*
+	sim_pool.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Instance pool, for programs that run the same firmware on the same core
+ * over and over (test farms...).
+ *
+ * Creating an instance means finding the core, avr_init() (allocating the
+ * memories, the IO tables, every module and its IRQs) then loading the
+ * firmware. The pool only does that when it has no idle instance; an
+ * instance given back with avr_pool_put() is rewound instead: its flash,
+ * eeprom and the settings it had when it was built are restored, and it is
+ * reset, and that's all avr_pool_get() has to do to hand it out again.
+ *
+ * The 'setup' callback is called once on every new instance, after the
+ * firmware is loaded, to connect the board parts; these connections stay
+ * with the instance when it's recycled, so a part is re-used along with it.
+ * Parts connected later on by the job itself need to be disconnected before
+ * the instance is put back.
+ */
+#ifndef __SIM_POOL_H__
+#define __SIM_POOL_H__
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*avr_pool_setup_p)(
+		avr_t * avr,
+		void * param);
+
+typedef struct avr_pool_t {
+	avr_kind_t *		kind;
+	elf_firmware_t *	firmware;
+	avr_pool_setup_p	setup;		// optional, called on new instances
+	void *				param;
+
+	// state of the first instance after setup, restored on the others
+	int					ready;
+	uint8_t *			flash;
+	uint8_t *			eeprom;
+	uint32_t			eesize;
+	uint32_t			frequency, vcc, avcc, aref;
+	uint32_t			codeend;
+	avr_flashaddr_t		pc;
+	uint8_t				log;
+
+	int					count, size;	// idle instances
+	avr_t **			idle;
+} avr_pool_t;
+
+// make a pool of 'mmcu' running 'firmware'; both stay owned by the caller
+avr_pool_t *
+avr_pool_new(
+		const char * mmcu,
+		elf_firmware_t * firmware,
+		avr_pool_setup_p setup,
+		void * param);
+// returns an instance ready to run, recycled if possible
+avr_t *
+avr_pool_get(
+		avr_pool_t * pool);
+// gives an instance back to the pool
+void
+avr_pool_put(
+		avr_pool_t * pool,
+		avr_t * avr);
+// terminates the idle instances, and frees the pool
+void
+avr_pool_free(
+		avr_pool_t * pool);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_POOL_H__ */
@@ -0,0 +1,208 @@
+/*
+	sim_semihost.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "sim_semihost.h"
+#include "sim_io.h"
+#include "avr/avr_mcu_section.h"
+
+#define SH_OFF(_f)	offsetof(struct avr_semihost_block_t, _f)
+
+// 'size' bytes at 'addr' are SRAM, that can be used directly
+static int
+avr_semihost_ram(
+		avr_t * avr,
+		uint32_t addr,
+		uint32_t size)
+{
+	return addr > avr->ioend && addr + size <= avr->ramend + 1;
+}
+
+static int
+avr_semihost_open(
+		avr_t * avr,
+		avr_semihost_t * sh,
+		uint16_t name,
+		uint8_t mode)
+{
+	char n[256];
+	int len = 0;
+	while (len < sizeof(n) - 1 && avr_semihost_ram(avr, name + len, 1) &&
+			avr->data[name + len])
+		len++;
+	if (!avr_semihost_ram(avr, name + len, 1) || avr->data[name + len])
+		return -1;
+	memcpy(n, avr->data + name, len);
+	n[len] = 0;
+	if (!len || n[0] == '/' || n[0] == '\\' || strstr(n, "..")) {
+		AVR_LOG(avr, LOG_WARNING, "SEMIHOST: %s: '%s' is not a relative file name\n",
+				__FUNCTION__, n);
+		return -1;
+	}
+	int fd = 3;
+	while (fd < AVR_SEMIHOST_FILES && sh->file[fd].open)
+		fd++;
+	if (fd == AVR_SEMIHOST_FILES)
+		return -1;
+	FILE * f = NULL;
+	if (!sh->quiet || mode == SIMAVR_SEMIHOST_O_READ) {
+		static const char * modes[] = {
+			[SIMAVR_SEMIHOST_O_READ] = "rb",
+			[SIMAVR_SEMIHOST_O_WRITE] = "wb",
+			[SIMAVR_SEMIHOST_O_APPEND] = "ab",
+		};
+		if (mode > SIMAVR_SEMIHOST_O_APPEND)
+			return -1;
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%s", sh->dir, n);
+		f = fopen(path, modes[mode]);
+		if (!f) {
+			AVR_LOG(avr, LOG_TRACE, "SEMIHOST: %s: can't open %s\n", __FUNCTION__, path);
+			return -1;
+		}
+	}
+	sh->file[fd].f = f;
+	sh->file[fd].open = 1;
+	return fd;
+}
+
+static void
+avr_semihost_request(
+		avr_t * avr,
+		avr_semihost_t * sh,
+		uint16_t block)
+{
+	if (!avr_semihost_ram(avr, block, sizeof(struct avr_semihost_block_t))) {
+		AVR_LOG(avr, LOG_ERROR, "SEMIHOST: %s: request block at %04x isn't in SRAM\n",
+				__FUNCTION__, block);
+		return;
+	}
+	uint8_t * b = avr->data + block;
+	uint8_t op = b[SH_OFF(op)], fd = b[SH_OFF(fd)];
+	uint16_t buffer = b[SH_OFF(buffer)] | (b[SH_OFF(buffer) + 1] << 8);
+	uint16_t size = b[SH_OFF(size)] | (b[SH_OFF(size) + 1] << 8);
+	int result = -1;
+	int file = fd < AVR_SEMIHOST_FILES && sh->file[fd].open;
+
+	switch (op) {
+		case SIMAVR_SEMIHOST_WRITE:
+			if (!file || !avr_semihost_ram(avr, buffer, size))
+				break;
+			if (sh->quiet)
+				result = size;
+			else if (sh->file[fd].f) {
+				result = fwrite(avr->data + buffer, 1, size, sh->file[fd].f);
+				fflush(sh->file[fd].f);
+			}
+			break;
+		case SIMAVR_SEMIHOST_READ:
+			if (file && sh->file[fd].f && avr_semihost_ram(avr, buffer, size))
+				result = fread(avr->data + buffer, 1, size, sh->file[fd].f);
+			break;
+		case SIMAVR_SEMIHOST_OPEN:
+			result = avr_semihost_open(avr, sh, buffer, fd);
+			break;
+		case SIMAVR_SEMIHOST_CLOSE:
+			if (!file || fd < 3)
+				break;
+			if (sh->file[fd].f)
+				fclose(sh->file[fd].f);
+			sh->file[fd].f = NULL;
+			sh->file[fd].open = 0;
+			result = 0;
+			break;
+		case SIMAVR_SEMIHOST_CYCLES:
+			if (!avr_semihost_ram(avr, buffer, 8))
+				break;
+			for (int i = 0; i < 8; i++)
+				avr->data[buffer + i] = avr->cycle >> (i * 8);
+			result = 8;
+			break;
+		default:
+			AVR_LOG(avr, LOG_WARNING, "SEMIHOST: %s: unknown request %d\n", __FUNCTION__, op);
+	}
+	b[SH_OFF(result)] = result;
+	b[SH_OFF(result) + 1] = result >> 8;
+}
+
+static void
+avr_semihost_write(
+		struct avr_t * avr,
+		avr_io_addr_t addr,
+		uint8_t v,
+		void * param)
+{
+	avr_semihost_t * sh = avr->semihost;
+	if (!sh)
+		return;
+	if (!sh->has_low) {
+		sh->low = v;
+		sh->has_low = 1;
+		return;
+	}
+	sh->has_low = 0;
+	avr_semihost_request(avr, sh, sh->low | (v << 8));
+}
+
+void
+avr_semihost_init(
+		avr_t * avr,
+		avr_io_addr_t addr)
+{
+	if (!addr)
+		return;
+	avr_semihost_free(avr);
+	avr_semihost_t * sh = calloc(1, sizeof(*sh));
+	sh->addr = addr;
+	sh->dir = ".";
+	sh->file[0].f = stdin;
+	sh->file[1].f = stdout;
+	sh->file[2].f = stderr;
+	for (int i = 0; i < 3; i++)
+		sh->file[i].open = 1;
+	avr->semihost = sh;
+	avr_register_io_write(avr, addr, avr_semihost_write, NULL);
+}
+
+void
+avr_semihost_reset(
+		avr_t * avr)
+{
+	// a half written block address would be paired with the next write
+	if (avr->semihost)
+		avr->semihost->has_low = 0;
+}
+
+void
+avr_semihost_free(
+		avr_t * avr)
+{
+	avr_semihost_t * sh = avr->semihost;
+	if (!sh)
+		return;
+	for (int i = 3; i < AVR_SEMIHOST_FILES; i++)
+		if (sh->file[i].f)
+			fclose(sh->file[i].f);
+	free(sh);
+	avr->semihost = NULL;
+}
@@ -0,0 +1,81 @@
+/*
+	sim_semihost.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Semihosting, the firmware side is AVR_MCU_SIMAVR_SEMIHOST() in
+ * avr_mcu_section.h: a request block tells the simulator to write or read
+ * a buffer of SRAM to or from a host file, or to give the cycle counter.
+ * It's done when the register is written, so bulk logging and loading
+ * test data take no simulated time, unlike the UART or the console
+ * register, that go one byte at a time.
+ *
+ * The files are named relative to 'dir', the current directory by
+ * default; absolute names and ".." are refused. The buffers must be in
+ * SRAM, past the IO registers.
+ */
+#ifndef __SIM_SEMIHOST_H__
+#define __SIM_SEMIHOST_H__
+
+#include <stdio.h>
+#include "sim_avr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// files open at once, stdin, stdout and stderr included
+#define AVR_SEMIHOST_FILES	16
+
+typedef struct avr_semihost_t {
+	avr_io_addr_t	addr;		// register the firmware writes to
+	uint8_t			low;		// low byte of the block address
+	uint8_t			has_low;	// ...was written
+	/*
+	 * Nothing is written on the host, writes just succeed; for a second
+	 * core running the same firmware, see sim_shadow.h
+	 */
+	uint8_t			quiet;
+	const char *	dir;
+	struct {
+		FILE *		f;
+		uint8_t		open;
+	} file[AVR_SEMIHOST_FILES];
+} avr_semihost_t;
+
+// listens to the firmware requests on 'addr', if not zero
+void
+avr_semihost_init(
+		avr_t * avr,
+		avr_io_addr_t addr);
+// forgets a request that was half written, called by avr_reset()
+void
+avr_semihost_reset(
+		avr_t * avr);
+// closes the files the firmware left open
+void
+avr_semihost_free(
+		avr_t * avr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_SEMIHOST_H__ */
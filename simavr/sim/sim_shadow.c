@@ -0,0 +1,191 @@
+/*
+	sim_shadow.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sim_shadow.h"
+#include "sim_core.h"
+#include "sim_io.h"
+#include "sim_semihost.h"
+
+// doesn't print, nor store the value, as the console does
+static void
+avr_shadow_console_write(
+		struct avr_t * avr,
+		avr_io_addr_t addr,
+		uint8_t v,
+		void * param)
+{
+}
+
+static void
+avr_shadow_sleep(
+		avr_t * avr,
+		avr_cycle_count_t howLong)
+{
+}
+
+avr_t *
+avr_shadow_make(
+		avr_t * avr,
+		elf_firmware_t * firmware)
+{
+	avr_t * ref = avr_make_mcu_by_name(avr->mmcu);
+	if (!ref)
+		return NULL;
+	avr_init(ref);
+	elf_firmware_t fw = *firmware;
+	fw.tracecount = 0;
+	fw.console_register_addr = 0;
+	avr_load_firmware(ref, &fw);
+	if (firmware->console_register_addr)
+		avr_register_io_write(ref, firmware->console_register_addr,
+				avr_shadow_console_write, NULL);
+	// reads the same files, but doesn't write them twice
+	if (ref->semihost)
+		ref->semihost->quiet = 1;
+	ref->pc = avr->pc;
+	ref->log = avr->log;
+	// the core under test does the waiting
+	ref->sleep = avr_shadow_sleep;
+	return ref;
+}
+
+void
+avr_shadow_init(
+		avr_shadow_t * shadow,
+		avr_t * avr,
+		avr_t * ref)
+{
+	memset(shadow, 0, sizeof(*shadow));
+	shadow->avr = avr;
+	shadow->ref = ref;
+	ref->run_one = avr_run_one;
+}
+
+static void
+avr_shadow_sreg(
+		avr_t * avr,
+		char * s)
+{
+	for (int i = 0; i < 8; i++)
+		s[i] = avr->sreg[7 - i] ? "ITHSVNZC"[i] : '-';
+	s[8] = 0;
+}
+
+static void
+avr_shadow_dump(
+		avr_shadow_t * shadow,
+		avr_flashaddr_t from)
+{
+	avr_t * avr = shadow->avr, * ref = shadow->ref;
+
+	AVR_LOG(avr, LOG_ERROR, "SHADOW: diverged after %llu runs, %llu instructions; "
+			"this run started at %04x\n", (unsigned long long)shadow->blocks,
+			(unsigned long long)shadow->insns, from);
+	AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12s %12s\n", "", "core", "reference");
+	if (avr->pc != ref->pc)
+		AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12x %12x\n", "pc", avr->pc, ref->pc);
+	if (avr->cycle != ref->cycle)
+		AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12llu %12llu\n", "cycle",
+				(unsigned long long)avr->cycle, (unsigned long long)ref->cycle);
+	if (avr->state != ref->state)
+		AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12d %12d\n", "state", avr->state, ref->state);
+	if (memcmp(avr->sreg, ref->sreg, sizeof(avr->sreg))) {
+		char s1[9], s2[9];
+		avr_shadow_sreg(avr, s1);
+		avr_shadow_sreg(ref, s2);
+		AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12s %12s\n", "SREG", s1, s2);
+	}
+	int count = 0;
+	for (int i = 0; i <= avr->ramend; i++) {
+		if (avr->data[i] == ref->data[i])
+			continue;
+		if (count++ == 16) {
+			AVR_LOG(avr, LOG_ERROR, "SHADOW:   ...\n");
+			break;
+		}
+		char n[16];
+		if (i < 256)
+			strcpy(n, avr_regname(i));
+		else
+			sprintf(n, "%04x", i);
+		AVR_LOG(avr, LOG_ERROR, "SHADOW:   %-8s %12x %12x\n", n, avr->data[i], ref->data[i]);
+	}
+	// disassembly style, oldest first
+	AVR_LOG(avr, LOG_ERROR, "SHADOW: last instructions of the reference:\n");
+	uint32_t n = shadow->history_pos < AVR_SHADOW_HISTORY ?
+			shadow->history_pos : AVR_SHADOW_HISTORY;
+	for (uint32_t i = shadow->history_pos - n; i != shadow->history_pos; i++) {
+		avr_flashaddr_t pc = shadow->history[i & (AVR_SHADOW_HISTORY - 1)];
+		char sym[64] = "";
+		avr_symbol_t * s = ref->trace_data->codeline && pc <= ref->flashend ?
+				ref->trace_data->codeline[pc >> 1] : NULL;
+		if (s)
+			snprintf(sym, sizeof(sym), "<%s+0x%x>", s->symbol, pc - s->addr);
+		if (pc + 3 <= ref->flashend)
+			AVR_LOG(avr, LOG_ERROR, "SHADOW:   %04x %-28s %02x%02x %02x%02x\n", pc, sym,
+					ref->flash[pc + 1], ref->flash[pc], ref->flash[pc + 3], ref->flash[pc + 2]);
+		else
+			AVR_LOG(avr, LOG_ERROR, "SHADOW:   %04x %-28s\n", pc, sym);
+	}
+}
+
+int
+avr_shadow_run(
+		avr_shadow_t * shadow)
+{
+	avr_t * avr = shadow->avr, * ref = shadow->ref;
+	if (shadow->diverged)
+		return -1;
+
+	avr_flashaddr_t from = avr->pc;
+	int state = avr_run(avr);
+	shadow->blocks++;
+	// a crashed or stopped core adds no cycles, don't wait for it
+	do {
+		shadow->history[shadow->history_pos++ & (AVR_SHADOW_HISTORY - 1)] = ref->pc;
+		avr_run(ref);
+		shadow->insns++;
+	} while (ref->cycle < avr->cycle &&
+			(ref->state == cpu_Running || ref->state == cpu_Sleeping));
+
+	if (avr->pc != ref->pc || avr->cycle != ref->cycle || avr->state != ref->state ||
+			memcmp(avr->sreg, ref->sreg, sizeof(avr->sreg)) ||
+			memcmp(avr->data, ref->data, avr->ramend + 1)) {
+		shadow->diverged = 1;
+		avr_shadow_dump(shadow, from);
+		return -1;
+	}
+	return state;
+}
+
+void
+avr_shadow_free(
+		avr_shadow_t * shadow)
+{
+	if (!shadow->ref)
+		return;
+	avr_terminate(shadow->ref);
+	free(shadow->ref);
+	shadow->ref = NULL;
+}
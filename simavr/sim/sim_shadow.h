@@ -0,0 +1,94 @@
+/*
+	sim_shadow.h
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shadow execution, to check the faster ways of running a firmware
+ * (specialized decoders, superinstructions, translated code...) against
+ * the plain avr_run_one() decoder.
+ *
+ * A second, reference core runs the same firmware in lockstep: after each
+ * avr_run() of the core under test, that might have run a whole block of
+ * instructions, the reference runs one instruction at a time until it has
+ * used as many cycles, then the PC, the cycle count, the state, SREG and
+ * the whole data space (registers, IOs and SRAM) are compared. The first
+ * divergence is dumped with the last instructions the reference ran.
+ *
+ * Both cores need the same inputs; a firmware that only talks to the
+ * simulator is fine, parts connected to one core need their twin on the
+ * other one. gdb is not supported.
+ */
+#ifndef __SIM_SHADOW_H__
+#define __SIM_SHADOW_H__
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// instructions kept for the dump, power of two
+#define AVR_SHADOW_HISTORY	16
+
+typedef struct avr_shadow_t {
+	avr_t *		avr;		// under test, whatever decoder it uses
+	avr_t *		ref;		// reference, runs avr_run_one()
+	uint64_t	blocks;		// avr_run() of 'avr' checked so far
+	uint64_t	insns;		// instructions the reference ran
+	int			diverged;	// set at the first difference
+	// last PCs of the reference, for the dump
+	avr_flashaddr_t	history[AVR_SHADOW_HISTORY];
+	uint32_t	history_pos;
+} avr_shadow_t;
+
+/*
+ * Makes a reference for 'avr', that was loaded with 'firmware': same core,
+ * same firmware and settings, but no VCD file, and it stays quiet on the
+ * console register and doesn't write the semihosting files.
+ */
+avr_t *
+avr_shadow_make(
+		avr_t * avr,
+		elf_firmware_t * firmware);
+
+// checks 'avr' against 'ref', both ready to run from the same state
+void
+avr_shadow_init(
+		avr_shadow_t * shadow,
+		avr_t * avr,
+		avr_t * ref);
+/*
+ * avr_run() of the core under test, then the reference catches up;
+ * returns the state of the core, or -1 if they diverged.
+ */
+int
+avr_shadow_run(
+		avr_shadow_t * shadow);
+// terminates and frees the reference
+void
+avr_shadow_free(
+		avr_shadow_t * shadow);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SIM_SHADOW_H__ */
@@ -31,6 +31,15 @@
 #include "sim_time.h"
 
 void _avr_vcd_notify(struct avr_irq_t * irq, uint32_t value, void * param);
+static void avr_vcd_flush_log(avr_vcd_t * vcd);
+
+// flushes the changes logged in the last period, the next one will rearm it
+static avr_cycle_count_t _avr_vcd_timer(struct avr_t * avr, avr_cycle_count_t when, void * param)
+{
+	avr_vcd_t * vcd = param;
+	avr_vcd_flush_log(vcd);
+	return 0;
+}
 
 int avr_vcd_init(struct avr_t * avr, const char * filename, avr_vcd_t * vcd, uint32_t period)
 {
@@ -76,6 +85,9 @@ void _avr_vcd_notify(struct avr_irq_t * irq, uint32_t value, void * param)
 			return;
 		}
 	}
+	// nothing to flush until now, don't wake up for nothing
+	if (!vcd->logindex)
+		avr_cycle_timer_register(vcd->avr, vcd->period, _avr_vcd_timer, vcd);
 	avr_vcd_signal_t * s = (avr_vcd_signal_t*)irq;
 	avr_vcd_log_t *l = &vcd->log[vcd->logindex++];
 	l->signal = s;
@@ -154,12 +166,6 @@ static void avr_vcd_flush_log(avr_vcd_t * vcd)
 	vcd->logindex = 0;
 }
 
-static avr_cycle_count_t _avr_vcd_timer(struct avr_t * avr, avr_cycle_count_t when, void * param)
-{
-	avr_vcd_t * vcd = param;
-	avr_vcd_flush_log(vcd);
-	return when + vcd->period;
-}
 
 int avr_vcd_add_signal(avr_vcd_t * vcd,
 	avr_irq_t * signal_irq,
@@ -220,7 +226,6 @@ int avr_vcd_start(avr_vcd_t * vcd)
 	}
 	fprintf(vcd->output, "$end\n");
 	vcd->start = vcd->avr->cycle;
-	avr_cycle_timer_register(vcd->avr, vcd->period, _avr_vcd_timer, vcd);
 	return 0;
 }
 
@@ -0,0 +1,42 @@
+/*
+	atmega88_data_guard.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+/*
+ * Writes past the end of SRAM, see test_atmega88_data_guard.c; GPIOR0 tells
+ * how far it went
+ */
+int main()
+{
+	GPIOR0 = 1;
+	*((volatile uint8_t *)RAMEND + 1) = 0x55;
+	GPIOR0 = 2;
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
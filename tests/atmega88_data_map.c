@@ -0,0 +1,46 @@
+/*
+	atmega88_data_map.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+/*
+ * Accesses past the end of SRAM, that test_atmega88_data_map.c maps to a
+ * device page and to a RAM page; the values read are put in GPIOR0/1
+ */
+#define DEVICE	((volatile uint8_t *)0x1000)
+#define XRAM	((volatile uint8_t *)0x1100)
+
+int main()
+{
+	DEVICE[0] = 0x42;
+	GPIOR0 = DEVICE[1];
+	XRAM[0x10] = 0x77;
+	GPIOR1 = XRAM[0x10] + 1;
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
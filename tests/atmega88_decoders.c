@@ -0,0 +1,106 @@
+/*
+	atmega88_decoders.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
+
+#include "avr_mcu_section.h"
+#ifndef DECODERS_MCU
+#define DECODERS_MCU "atmega88"
+#endif
+AVR_MCU(F_CPU, DECODERS_MCU);
+
+/*
+ * A mix of loops, calls, indirect calls, flash reads, multiplications and
+ * divisions, with a timer interrupt going on. test_atmega88_decoders.c runs
+ * it with each of the decoders, that have to end in the same state, on the
+ * same cycle. Also built for the bigger cores, see atmega1280_decoders.c
+ * and atmega2560_decoders.c
+ */
+static const uint8_t table[16] PROGMEM = {
+	0x3c, 0x91, 0x07, 0xe2, 0x5a, 0x18, 0xc4, 0x7f,
+	0x26, 0xb3, 0x40, 0x9d, 0x01, 0xfe, 0x6b, 0x85,
+};
+volatile uint16_t ticks;
+uint8_t buf[48];
+uint32_t result;
+
+ISR(TIMER0_OVF_vect)
+{
+	ticks++;
+}
+
+static uint16_t crc16(const uint8_t * p, uint8_t n)
+{
+	uint16_t crc = 0xffff;
+	while (n--) {
+		crc ^= *p++;
+		for (uint8_t b = 0; b < 8; b++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+	}
+	return crc;
+}
+
+static void sort(uint8_t * a, uint8_t n)
+{
+	for (uint8_t i = 1; i < n; i++)
+		for (uint8_t j = i; j && a[j - 1] > a[j]; j--) {
+			uint8_t t = a[j];
+			a[j] = a[j - 1];
+			a[j - 1] = t;
+		}
+}
+
+static uint32_t op_mul(uint32_t v, uint8_t k)
+{
+	return v * k + 1;
+}
+
+static uint32_t op_div(uint32_t v, uint8_t k)
+{
+	return v / (k | 1) + ticks;
+}
+
+static uint32_t (* const ops[])(uint32_t, uint8_t) = { op_mul, op_div };
+
+int main()
+{
+	TCCR0B = (1 << CS00);
+	TIMSK0 = (1 << TOIE0);
+	sei();
+
+	for (uint8_t i = 0; i < sizeof(buf); i++)
+		buf[i] = pgm_read_byte(&table[i & 15]) ^ (i * 13);
+	uint32_t v = 1;
+	for (uint8_t round = 0; round < 16; round++) {
+		sort(buf, sizeof(buf));
+		v = ops[round & 1](v, buf[round]);
+		v += crc16(buf, sizeof(buf));
+		buf[round] ^= v;
+	}
+	result = v;
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
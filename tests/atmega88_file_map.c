@@ -0,0 +1,43 @@
+/*
+	atmega88_file_map.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+// loaded in the eeprom file by avr_load_firmware(), see test_atmega88_file_map.c
+uint8_t EEMEM image[4] = { 1, 2, 3, 4 };
+
+int main()
+{
+	eeprom_write_block("file", (void *)0x10, 4);
+	// long enough for the files to be synced
+	_delay_ms(10);
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
@@ -0,0 +1,76 @@
+/*
+	atmega88_hle.c
+
+	Calls the avr-libc and libgcc routines simavr can run in C (see sim_hle.h)
+	with varied arguments, and prints a checksum of the results on the UART.
+	test_atmega88_hle runs it with and without that emulation.
+ */
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+static int uart_putchar(char c, FILE *stream)
+{
+	if (c == '\n')
+		uart_putchar('\r', stream);
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+	UDR0 = c;
+	return 0;
+}
+
+static FILE mystdout = FDEV_SETUP_STREAM(uart_putchar, NULL,
+                                         _FDEV_SETUP_WRITE);
+
+char src[80], dst[80];
+// volatile, so the compiler calls the routines
+volatile uint32_t a, b;
+volatile float fa, fb;
+
+int main()
+{
+	stdout = &mystdout;
+
+	UCSR0C |= (3 << UCSZ00); // 8 bits
+#define BAUD 38400
+#include <util/setbaud.h>
+	UBRR0H = UBRRH_VALUE;
+	UBRR0L = UBRRL_VALUE;
+#if USE_2X
+	UCSR0A |= (1 << U2X0);
+#else
+	UCSR0A &= ~(1 << U2X0);
+#endif
+	UCSR0B |= (1 << TXEN0);
+
+	uint32_t seed = 1, sum = 0;
+	float fsum = 1;
+	for (uint16_t i = 0; i < 200; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint8_t n = (seed >> 16) % (sizeof(src) - 1);
+
+		memset(src, 'a' + (i % 26), n);
+		src[n] = 0;
+		memcpy(dst, src, n + 1);
+		sum += strlen(dst);
+
+		a = seed;
+		b = (seed >> (i % 24)) | 1;
+		sum += a / b + a % b;
+
+		fa = (float)(seed >> 8);
+		fb = (float)(i + 1) / 7;
+		fsum = fsum + fa * fb - fb;
+	}
+	union { float f; uint32_t u; } f = { .f = fsum };
+	printf("sum %08lx float %08lx\n", sum, f.u);
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
@@ -0,0 +1,48 @@
+/*
+	atmega88_io_hooks.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+/*
+ * The console register is a variable, in SRAM, past the IO space; see
+ * test_atmega88_io_hooks.c, that adds its own hooks to it, and to GPIOR0
+ */
+volatile uint8_t console;
+AVR_MCU_SIMAVR_CONSOLE(&console);
+
+int main()
+{
+	for (uint8_t i = 1; i <= 3; i++)
+		GPIOR0 = i;
+
+	const char * s = "hooks\r";
+	while (*s)
+		console = *s++;
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
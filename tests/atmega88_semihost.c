@@ -0,0 +1,68 @@
+/*
+	atmega88_semihost.c
+
+	Writes a file through semihosting, reads it back, and checks that a
+	bulk write takes no simulated time. The verdict is appended to the
+	same file, test_atmega88_semihost looks at it.
+ */
+
+#include <avr/io.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+AVR_MCU_SIMAVR_SEMIHOST(&GPIOR0);
+
+static struct avr_semihost_block_t req;
+
+static int16_t semihost(uint8_t op, uint8_t fd, void * buffer, uint16_t size)
+{
+	req.op = op;
+	req.fd = fd;
+	req.buffer = (uint16_t)buffer;
+	req.size = size;
+	avr_semihost(&GPIOR0, &req);
+	return req.result;
+}
+
+static uint64_t cycles(void)
+{
+	uint64_t c;
+	semihost(SIMAVR_SEMIHOST_CYCLES, 0, &c, sizeof(c));
+	return c;
+}
+
+static const char name[] = "atmega88_semihost.out";
+char message[] = "hello from the firmware\n";
+char buffer[64];
+
+static void verdict(const char * s)
+{
+	int16_t fd = semihost(SIMAVR_SEMIHOST_OPEN, SIMAVR_SEMIHOST_O_APPEND, (void*)name, 0);
+	semihost(SIMAVR_SEMIHOST_WRITE, fd, (void*)s, strlen(s));
+	semihost(SIMAVR_SEMIHOST_CLOSE, fd, NULL, 0);
+}
+
+int main()
+{
+	int16_t fd = semihost(SIMAVR_SEMIHOST_OPEN, SIMAVR_SEMIHOST_O_WRITE, (void*)name, 0);
+	uint64_t start = cycles();
+	int16_t len = semihost(SIMAVR_SEMIHOST_WRITE, fd, message, sizeof(message) - 1);
+	uint64_t end = cycles();
+	semihost(SIMAVR_SEMIHOST_CLOSE, fd, NULL, 0);
+
+	fd = semihost(SIMAVR_SEMIHOST_OPEN, SIMAVR_SEMIHOST_O_READ, (void*)name, 0);
+	int16_t got = semihost(SIMAVR_SEMIHOST_READ, fd, buffer, sizeof(buffer));
+	semihost(SIMAVR_SEMIHOST_CLOSE, fd, NULL, 0);
+
+	if (len == sizeof(message) - 1 && got == len && !memcmp(buffer, message, len))
+		verdict("read back\n");
+	if (end > start && end - start < 100)
+		verdict("no time\n");
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
@@ -0,0 +1,74 @@
+/*
+	atmega88_timer_lazy.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+volatile uint8_t overflows;
+
+ISR(TIMER0_OVF_vect)
+{
+	overflows++;
+}
+
+/*
+ * Waits for 'count' overflows of timer 0 by polling its flag, with the
+ * interrupt off. The counter has just wrapped around when the flag shows
+ */
+static void poll_overflows(uint8_t count)
+{
+	while (count--) {
+		loop_until_bit_is_set(TIFR0, TOV0);
+		if (TCNT0 > 16)
+			for (;;)
+				;	// the test times out
+		TIFR0 = (1 << TOV0);
+	}
+}
+
+int main()
+{
+	// clk/8, an overflow every 2048 cycles
+	TCCR0B = (1 << CS01);
+
+	// nothing listens to the timer, its flags are raised when read
+	poll_overflows(100);
+
+	// the interrupt makes it schedule the overflows
+	TIMSK0 = (1 << TOIE0);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	while (overflows < 100)
+		sleep_cpu();
+	cli();
+	TIMSK0 = 0;
+
+	// and back to polling
+	poll_overflows(100);
+
+	// sleeping with interrupt off is interpreted by simavr as "exit please"
+	sleep_cpu();
+}
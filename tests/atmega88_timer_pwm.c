@@ -0,0 +1,68 @@
+/*
+	atmega88_timer_pwm.c
+
+	Copyright 2008-2012 Michel Pollet <buserror@gmail.com>
+
+ 	This file is part of simavr.
+
+	simavr is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	simavr is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with simavr.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+volatile uint8_t overflows;
+volatile uint16_t matches;
+
+ISR(TIMER1_OVF_vect)
+{
+	overflows++;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	matches++;
+}
+
+int main()
+{
+	/*
+	 * Phase and frequency correct PWM, TOP in ICR1: counts up to 1000 and
+	 * back, a period of 2000 cycles. OC1A matches on the way up and on the
+	 * way down, the overflow flag is raised at BOTTOM
+	 */
+	ICR1 = 1000;
+	OCR1A = 250;
+	TCCR1A = (1 << COM1A1);
+	TIMSK1 = (1 << TOIE1) | (1 << OCIE1A);
+	TCCR1B = (1 << WGM13) | (1 << CS10);
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	while (overflows < 100)
+		sleep_cpu();
+	cli();
+	// the first overflow comes as the counter leaves BOTTOM
+	if (matches != 2 * 99)
+		for (;;)
+			;	// the test times out
+
+	// sleeping with interrupt off is interpreted by simavr as "exit please"
+	sleep_cpu();
+}
@@ -0,0 +1,40 @@
+/*
+	atmega88_uart_baud.c
+
+	Sends bytes back to back at 1Mbps (UBRR 0 with U2X at 8MHz), first as
+	8N1 then as 8E2; test_atmega88_uart_baud.c checks they go out one frame
+	after the other, to the cycle.
+ */
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+static void send(uint8_t first, uint8_t count)
+{
+	while (count--) {
+		loop_until_bit_is_set(UCSR0A, UDRE0);
+		UDR0 = first++;
+	}
+	loop_until_bit_is_set(UCSR0A, TXC0);
+	UCSR0A |= (1 << TXC0);
+}
+
+int main()
+{
+	UCSR0A = (1 << U2X0);
+	UBRR0H = 0;
+	UBRR0L = 0;
+	UCSR0B = (1 << TXEN0);
+
+	// 10 bits, 80 cycles a frame
+	send(0, 64);
+	// even parity and 2 stop bits, 12 bits, 96 cycles
+	UCSR0C = (1 << UPM01) | (1 << USBS0) | (3 << UCSZ00);
+	send(64, 16);
+
+	// this quits the simulator, since interupts are off
+	sleep_cpu();
+}
@@ -0,0 +1,54 @@
+/*
+	atmega88_uart_bulk.c
+
+	Receives 512 bytes on the uart with the RX interrupt and sends each
+	of them straight back. The other side (test_atmega88_uart_bulk.c)
+	queues them in bulk, and gets the echo back in batches.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+volatile uint16_t received;
+
+ISR(USART_RX_vect)
+{
+	uint8_t b = UDR0;
+
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+	UDR0 = b;
+	received++;
+}
+
+int main()
+{
+	UCSR0C |= (3 << UCSZ00); // 8 bits
+#define BAUD 38400
+#include <util/setbaud.h>
+	UBRR0H = UBRRH_VALUE;
+	UBRR0L = UBRRL_VALUE;
+#if USE_2X
+	UCSR0A |= (1 << U2X0);
+#else
+	UCSR0A &= ~(1 << U2X0);
+#endif
+
+	// enable receiver & transmitter, the queued bytes start coming in
+	UCSR0B |= (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	while (received < 512)
+		sleep_cpu();
+	cli();
+	// let the last byte out
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+
+	// this quits the simulator, since interupts are off
+	sleep_cpu();
+}
@@ -0,0 +1,49 @@
+/*
+	atmega88_uart_wake.c
+
+	Sleeps with only a slow timer to wake it up, every 32ms, until a byte
+	comes in, and sends it back; test_atmega88_uart_wake.c hands the byte
+	over from another thread, half way through one of these sleeps, and
+	test_atmega88_uart_mailbox.c posts it from there, for a later cycle.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+AVR_MCU(F_CPU, "atmega88");
+
+volatile uint8_t received;
+volatile uint8_t done;
+
+ISR(USART_RX_vect)
+{
+	received = UDR0;
+	done = 1;
+}
+
+// 256 * 1024 cycles
+EMPTY_INTERRUPT(TIMER2_OVF_vect);
+
+int main()
+{
+	UBRR0H = 0;
+	UBRR0L = 0;
+	UCSR0C = (3 << UCSZ00);
+	UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+
+	TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
+	TIMSK2 = (1 << TOIE2);
+	sei();
+
+	while (!done)
+		sleep_cpu();
+
+	UDR0 = received;
+	loop_until_bit_is_set(UCSR0A, TXC0);
+
+	// this quits the simulator, since interupts are off
+	cli();
+	sleep_cpu();
+}
@@ -0,0 +1,51 @@
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_shadow.h"
+
+static void no_sleep(avr_t *avr, avr_cycle_count_t howLong) {
+}
+
+/*
+ * Same firmware as test_atmega48_watchdog_test, that spends its time in
+ * _delay_ms() and polling the UART: run with the idle loops skipped, and
+ * checked against the reference decoder after every step
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega48_watchdog_test.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flags |= AVR_FLAG_IDLE_LOOPS;
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->sleep = no_sleep;
+
+	avr_shadow_t shadow;
+	avr_t *ref = avr_shadow_make(avr, &fw);
+	if (!ref)
+		fail("Creating the reference AVR failed.");
+	avr_shadow_init(&shadow, avr, ref);
+
+	int state;
+	do {
+		state = avr_shadow_run(&shadow);
+	} while (state != -1 && state != cpu_Done && state != cpu_Crashed &&
+			avr->cycle < 10000000);
+	if (state == -1)
+		fail("Diverged from the reference decoder after %llu instructions",
+		     (unsigned long long)shadow.insns);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count, state, avr->cycle);
+	// most of the delay loop iterations were skipped
+	if (shadow.insns < shadow.blocks * 4)
+		fail("Only %llu instructions in %llu runs, the loops were not skipped",
+		     (unsigned long long)shadow.insns, (unsigned long long)shadow.blocks);
+	avr_shadow_free(&shadow);
+	tests_success();
+	return 0;
+}
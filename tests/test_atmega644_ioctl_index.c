@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tests.h"
+#include "sim_io.h"
+#include "avr_adc.h"
+#include "avr_timer.h"
+#include "avr_spi.h"
+#include "avr_twi.h"
+#include "avr_uart.h"
+#include "avr_ioport.h"
+#include "avr_eeprom.h"
+
+#define TEST_IOCTL	AVR_IOCTL_DEF('t','s','t','1')
+#define TEST_GETIRQ	AVR_IOCTL_DEF('t','s','t','i')
+
+static int refuse_ioctl(struct avr_io_t *io, uint32_t ctl, void *param) {
+	return -1;
+}
+
+static int answer_ioctl(struct avr_io_t *io, uint32_t ctl, void *param) {
+	return ctl == TEST_IOCTL ? 42 : -1;
+}
+
+static avr_io_t refuse = { .kind = "refuse", .ioctl = refuse_ioctl };
+static avr_io_t answer = { .kind = "answer", .ioctl = answer_ioctl };
+
+static void check_irq(avr_t *avr, uint32_t ctl, int index, const char *name) {
+	avr_irq_t *irq = avr_io_getirq(avr, ctl, index);
+	if (!irq)
+		fail("No IRQ %d for %08x", index, ctl);
+	if (avr_find_irq(&avr->irq_pool, name) != irq)
+		fail("IRQ \"%s\" not found by name, it's \"%s\"", name, irq->name);
+}
+
+/*
+ * The module IRQs and ioctls are found through the index alone, with the
+ * module chain taken away; and the chain is still asked for the modules
+ * that don't register, or don't answer.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr_t *avr = tests_init_avr("atmega644_adc_test.axf");
+
+	avr_io_t *chain = avr->io_port;
+	avr->io_port = NULL;
+	check_irq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0, "avr.adc.adc0");
+	check_irq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC8, "avr.adc.adc8");
+	check_irq(avr, AVR_IOCTL_TIMER_GETIRQ('1'), TIMER_IRQ_OUT_COMP,
+		  "avr.timer1.compa");
+	check_irq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_OUTPUT, "avr.spi0.out");
+	check_irq(avr, AVR_IOCTL_TWI_GETIRQ('0'), TWI_IRQ_STATUS,
+		  "avr.twi0.status");
+	check_irq(avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_OUTPUT,
+		  "avr.uart1.out");
+	check_irq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), IOPORT_IRQ_PIN3,
+		  "=avr.portb.pin3");
+	if (avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_COUNT))
+		fail("Got an IRQ past the ADC ones");
+
+	uint8_t ee[4] = { 1, 2, 3, 4 };
+	avr_eeprom_desc_t d = { .ee = ee, .offset = 0, .size = sizeof(ee) };
+	if (avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &d))
+		fail("AVR_IOCTL_EEPROM_SET not found in the index");
+	avr_ioport_state_t state;
+	if (avr_ioctl(avr, AVR_IOCTL_IOPORT_GETSTATE('D'), &state) || state.name != 'D')
+		fail("AVR_IOCTL_IOPORT_GETSTATE('D') not found in the index");
+	avr->io_port = chain;
+
+	// set up by hand, only on the chain
+	avr_register_io(avr, &answer);
+	static const char *name[] = { "8>avr.test.irq" };
+	answer.irq = avr_alloc_irq(&avr->irq_pool, 0, 1, name);
+	answer.irq_count = 1;
+	answer.irq_ioctl_get = TEST_GETIRQ;
+	if (avr_io_getirq(avr, TEST_GETIRQ, 0) != answer.irq)
+		fail("IRQ of a module that didn't register not found");
+	// 'refuse' is first in the index, but 'answer' still gets asked
+	avr_register_io(avr, &refuse);
+	avr_io_register_ioctl(&refuse, TEST_IOCTL);
+	if (avr_ioctl(avr, TEST_IOCTL, NULL) != 42)
+		fail("ioctl not passed on to the module chain");
+
+	avr_irq_t *irq = avr_io_getirq(avr, AVR_IOCTL_TIMER_GETIRQ('1'),
+				       TIMER_IRQ_OUT_COMP);
+	avr_rename_irq(irq, ">avr.test.oc1a");
+	if (avr_find_irq(&avr->irq_pool, "avr.timer1.compa"))
+		fail("Renamed IRQ still found by it's old name");
+	if (avr_find_irq(&avr->irq_pool, "avr.test.oc1a") != irq)
+		fail("Renamed IRQ not found by it's new name");
+	if (avr_find_irq(&avr->irq_pool, "avr.test.nope"))
+		fail("Found an IRQ that doesn't exist");
+
+	tests_success();
+	return 0;
+}
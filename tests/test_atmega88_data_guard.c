@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include "tests.h"
+#include "sim_elf.h"
+
+#define GPIOR0	0x3e
+
+static avr_t *make(elf_firmware_t *fw) {
+	avr_t *avr = avr_make_mcu_by_name(fw->mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flags |= AVR_FLAG_DATA_GUARD;
+	avr_init(avr);
+	avr_load_firmware(avr, fw);
+	if (!(avr->flags & AVR_FLAG_DATA_GUARD))
+		fail("The data space isn't guarded");
+	return avr;
+}
+
+/*
+ * The firmware writes past 'ramend'; the core has to stop on that very
+ * instruction, and it has to do it again on a second core, as the first
+ * fault mustn't leave the signal blocked.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_data_guard.axf", &fw))
+		fail("Failed to read ELF firmware");
+
+	for (int i = 0; i < 2; i++) {
+		avr_t *avr = make(&fw);
+		int state;
+		do {
+			state = avr_run(avr);
+		} while (state != cpu_Done && state != cpu_Crashed);
+		if (state != cpu_Crashed)
+			fail("Core %d didn't crash; state=%d", i, state);
+		if (avr->data[GPIOR0] != 1)
+			fail("Core %d went on after the fault, GPIOR0=%d", i,
+			     avr->data[GPIOR0]);
+		avr->data[avr->ramend] = 0;	// that one is fine
+		avr_terminate(avr);
+	}
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_gdb.h"
+#include "sim_data_map.h"
+
+#define GPIOR0	0x3e
+#define GPIOR1	0x4a
+#define DEVICE	0x1000
+#define XRAM	0x1100
+
+static uint8_t xram[AVR_DATA_PAGE_SIZE];
+static int written = -1, write_addr, read_addr;
+
+static uint8_t device_read(avr_t *avr, avr_io_addr_t addr, void *param) {
+	read_addr = addr;
+	return 0xa5;
+}
+
+static void device_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	write_addr = addr;
+	written = v;
+}
+
+// sends 'cmd' to the gdb stub, and returns the reply, without the checksum
+static const char *gdb(avr_t *avr, int s, const char *cmd) {
+	static char reply[256];
+	char packet[256];
+	sprintf(packet, "$%s#00", cmd);	// the stub doesn't check it
+	send(s, packet, strlen(packet), 0);
+	avr_gdb_processor(avr, 100000);
+
+	int len = 0, hash = -1;
+	while (hash < 0 || len < hash + 3) {
+		ssize_t r = recv(s, reply + len, sizeof(reply) - 1 - len, 0);
+		if (r <= 0)
+			fail("No reply to '%s'", cmd);
+		len += r;
+		reply[len] = 0;
+		char *h = strchr(reply, '#');
+		hash = h ? h - reply : -1;
+	}
+	reply[hash] = 0;
+	return strchr(reply, '$') + 1;
+}
+
+static void check_gdb(avr_t *avr, int s, const char *cmd, const char *expected) {
+	const char *reply = gdb(avr, s, cmd);
+	if (strcmp(reply, expected))
+		fail("gdb '%s' replied '%s', expected '%s'", cmd, reply, expected);
+}
+
+/*
+ * The firmware reads and writes a device page and a RAM page past 'ramend';
+ * then gdb reads and writes the RAM page too, but not the device one
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_data_map.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	if (avr_data_map_device(avr, DEVICE, AVR_DATA_PAGE_SIZE,
+				device_read, device_write, NULL) ||
+			avr_data_map_ram(avr, XRAM, sizeof(xram), xram))
+		fail("Mapping the pages failed");
+
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d", state);
+	if (written != 0x42 || write_addr != DEVICE)
+		fail("Device write of %02x at %04x", written, write_addr);
+	if (read_addr != DEVICE + 1 || avr->data[GPIOR0] != 0xa5)
+		fail("Device read at %04x gave %02x", read_addr, avr->data[GPIOR0]);
+	if (xram[0x10] != 0x77 || avr->data[GPIOR1] != 0x78)
+		fail("RAM page has %02x, read back %02x", xram[0x10],
+		     avr->data[GPIOR1]);
+
+	avr->gdb_port = 20000 + getpid() % 10000;
+	if (avr_gdb_init(avr))
+		fail("Can't start the gdb stub");
+	int s = socket(PF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons(avr->gdb_port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(s, (struct sockaddr *)&address, sizeof(address)))
+		fail("Can't connect to the gdb stub");
+	avr_gdb_processor(avr, 100000);	// accepts it
+
+	check_gdb(avr, s, "m801110,1", "77");
+	check_gdb(avr, s, "M801120,2:abcd", "OK");
+	if (xram[0x20] != 0xab || xram[0x21] != 0xcd)
+		fail("gdb wrote %02x%02x", xram[0x20], xram[0x21]);
+	check_gdb(avr, s, "m801120,2", "abcd");
+	// device pages can't be read without side effects, nor read across
+	check_gdb(avr, s, "m801000,1", "E01");
+	check_gdb(avr, s, "m8011ff,2", "E01");
+	// nor can the end of SRAM, past it
+	check_gdb(avr, s, "m8004fe,4", "E01");
+	close(s);
+
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_core.h"
+#include "sim_time.h"
+
+static avr_t *make(elf_firmware_t *fw, uint32_t flags) {
+	avr_t *avr = avr_make_mcu_by_name(fw->mmcu);
+	if (!avr)
+		fail("Creating AVR %s failed.", fw->mmcu);
+	avr->flags |= flags;
+	avr_init(avr);
+	avr_load_firmware(avr, fw);
+	return avr;
+}
+
+static void run(avr_t *avr) {
+	avr_cycle_count_t limit = avr_usec_to_cycles(avr, 1000000);
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < limit);
+	if (state != cpu_Done)
+		fail("%s didn't finish properly; state=%d, cycles=%" PRI_avr_cycle_count,
+		     avr->mmcu, state, avr->cycle);
+}
+
+static void compare(avr_t *ref, avr_t *avr, const char *what) {
+	if (avr->cycle != ref->cycle || avr->pc != ref->pc)
+		fail("%s %s decoder ended at pc=%04x, cycle %" PRI_avr_cycle_count
+		     "; the generic one at pc=%04x, cycle %" PRI_avr_cycle_count,
+		     avr->mmcu, what, avr->pc, avr->cycle, ref->pc, ref->cycle);
+	for (int i = 0; i <= ref->ramend; i++)
+		if (avr->data[i] != ref->data[i])
+			fail("%s %s decoder left %02x at %04x, the generic one %02x",
+			     avr->mmcu, what, avr->data[i], i, ref->data[i]);
+}
+
+/*
+ * The firmware is run with the generic decoder, avr_run_one(); then with
+ * the one avr_init() picks for the core, specialized for its family, and
+ * with superinstructions. They have to take the same number of cycles,
+ * and leave the same registers and SRAM.
+ */
+int main(int argc, char **argv) {
+	static const char *firmware[] = {
+		"atmega88_decoders.axf",	// small decoder
+		"atmega1280_decoders.axf",	// generic, RAMPZ but no EIND
+		"atmega2560_decoders.axf",	// large decoder
+	};
+	tests_init(argc, argv);
+
+	for (int i = 0; i < 3; i++) {
+		elf_firmware_t fw;
+		if (elf_read_firmware(firmware[i], &fw))
+			fail("Failed to read ELF firmware %s", firmware[i]);
+
+		avr_t *ref = make(&fw, 0);
+		ref->run_one = avr_run_one;
+		run(ref);
+
+		avr_t *avr = make(&fw, 0);
+		if (i != 1 && avr->run_one == avr_run_one)
+			fail("%s didn't get a specialized decoder", avr->mmcu);
+		run(avr);
+		compare(ref, avr, "specialized");
+		avr_terminate(avr);
+
+		avr = make(&fw, AVR_FLAG_SUPERINSN);
+		if (!avr->superinsn)
+			fail("%s has no superinstructions", avr->mmcu);
+		run(avr);
+		compare(ref, avr, "superinstructions");
+		avr_terminate(avr);
+		avr_terminate(ref);
+	}
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "tests.h"
+#include "sim_elf_cache.h"
+
+#define FIRMWARE	"atmega88_example.axf"
+#define PATCH		64	// bytes of flash looked for in the image
+
+static void check_same(elf_firmware_t *a, elf_firmware_t *b, const char *what) {
+	if (strcmp(a->mmcu, b->mmcu) || a->frequency != b->frequency ||
+			a->flashsize != b->flashsize || a->flashbase != b->flashbase ||
+			a->eesize != b->eesize ||
+			memcmp(a->flash, b->flash, a->flashsize))
+		fail("%s firmware differs from the ELF one", what);
+}
+
+/*
+ * The first read parses the ELF file and stores its image; the next ones
+ * have to map that image, and not parse the ELF again: a byte changed in
+ * the image shows in what they read.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	char dir[64], path[128];
+	snprintf(dir, sizeof(dir), "elf_cache_test.%d", (int)getpid());
+
+	elf_firmware_t ref, fw;
+	if (elf_read_firmware(FIRMWARE, &ref))
+		fail("Failed to read ELF firmware");
+	if (ref.flashsize < PATCH)
+		fail("Firmware is too small for this test");
+	if (elf_read_firmware_cached(dir, FIRMWARE, &fw))
+		fail("Failed to read ELF firmware through the cache");
+	check_same(&ref, &fw, "Parsed");
+
+	uint64_t hash;
+	if (elf_cache_hash(FIRMWARE, 0, &hash))
+		fail("Can't hash %s", FIRMWARE);
+	snprintf(path, sizeof(path), "%s/%016llx.fw", dir, (unsigned long long)hash);
+	int fd = open(path, O_RDWR);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st))
+		fail("No image stored in %s", path);
+	uint8_t *image = malloc(st.st_size);
+	if (read(fd, image, st.st_size) != st.st_size)
+		fail("Can't read %s", path);
+
+	if (elf_read_firmware_cached(dir, FIRMWARE, &fw))
+		fail("Failed to load the cached image");
+	check_same(&ref, &fw, "Cached");
+
+	// mark the flash in the image, the next read has to see it
+	uint8_t *flash = NULL;
+	for (off_t o = 0; o + PATCH <= st.st_size && !flash; o += 4)
+		if (!memcmp(image + o, ref.flash, PATCH))
+			flash = image + o;
+	if (!flash)
+		fail("Flash not found in %s", path);
+	uint8_t mark = ref.flash[0] ^ 0xff;
+	if (pwrite(fd, &mark, 1, flash - image) != 1)
+		fail("Can't write %s", path);
+	close(fd);
+	if (elf_read_firmware_cached(dir, FIRMWARE, &fw))
+		fail("Failed to load the changed image");
+	if (fw.flash[0] != mark)
+		fail("The ELF file was parsed again, the image wasn't used");
+
+	unlink(path);
+	rmdir(dir);
+	free(image);
+	tests_success();
+	return 0;
+}
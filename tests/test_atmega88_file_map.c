@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_file_map.h"
+
+#define FLASH_FILE	"atmega88_file_map_flash.bin"
+#define EEPROM_FILE	"atmega88_file_map_eeprom.bin"
+#define EEPROM_SIZE	512
+
+// what's in the file, read through another descriptor
+static void check_file(const char *path, uint32_t offset, const void *expected,
+		       int size) {
+	uint8_t b[16];
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || pread(fd, b, size, offset) != size)
+		fail("Can't read %d bytes at %04x in %s", size, offset, path);
+	close(fd);
+	if (memcmp(b, expected, size))
+		fail("%s doesn't have the expected bytes at %04x", path, offset);
+}
+
+static int dirty(avr_file_map_t *m) {
+	return m->dirty_end > m->dirty_start;
+}
+
+/*
+ * The flash and the eeprom are files mapped MAP_SHARED: what is loaded or
+ * changed is in them at once. A change waits for its msync() timer, that
+ * avr_reset() cancels and avr_file_map_reset() has to put back.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_file_map.axf", &fw))
+		fail("Failed to read ELF firmware");
+
+	// the eeprom was used before, the flash is blank
+	uint8_t old[EEPROM_SIZE];
+	memset(old, 0xaa, sizeof(old));
+	unlink(FLASH_FILE);
+	int fd = open(EEPROM_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, old, sizeof(old)) != sizeof(old))
+		fail("Can't write %s", EEPROM_FILE);
+	close(fd);
+
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flash_file = FLASH_FILE;
+	avr->eeprom_file = EEPROM_FILE;
+	avr->file_sync_usec = 1000;
+	avr_init(avr);
+	if (!avr->flash_map)
+		fail("Flash file not mapped");
+	avr_load_firmware(avr, &fw);
+
+	check_file(FLASH_FILE, 0, fw.flash, 16);
+	static const uint8_t erased[4] = { 0xff, 0xff, 0xff, 0xff };
+	check_file(FLASH_FILE, avr->flashend - 3, erased, 4);
+	// the .eeprom section replaces the start of the eeprom file only
+	static const uint8_t image[4] = { 1, 2, 3, 4 };
+	check_file(EEPROM_FILE, 0, image, 4);
+	check_file(EEPROM_FILE, 4, old + 4, 4);
+
+	// as if the host had changed the flash, then reset the core
+	avr->flash[avr->flashend] = 0x5a;
+	avr_file_map_dirty(avr->flash_map, avr->flashend, 1);
+	check_file(FLASH_FILE, avr->flashend, "\x5a", 1);
+	avr_reset(avr);
+	if (!dirty(avr->flash_map))
+		fail("Flash change not pending a sync after reset");
+
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d", state);
+	if (dirty(avr->flash_map))
+		fail("Flash change not synced, the timer wasn't set again at reset");
+	check_file(EEPROM_FILE, 0x10, "file", 4);
+
+	avr_terminate(avr);
+	check_file(FLASH_FILE, avr->flashend, "\x5a", 1);
+	unlink(FLASH_FILE);
+	unlink(EEPROM_FILE);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_hle.h"
+#include "avr_uart.h"
+
+static void no_sleep(avr_t *avr, avr_cycle_count_t howLong) {
+}
+
+static void uart_output_cb(struct avr_irq_t *irq, uint32_t value, void *param) {
+	char *buf = param;
+	size_t len = strlen(buf);
+	if (len < 127) {
+		buf[len] = value;
+		buf[len + 1] = 0;
+	}
+}
+
+/*
+ * Runs the firmware to the end, with the libc routines in C if 'hle'
+ */
+static avr_t *run(elf_firmware_t *fw, int hle, char *output) {
+	avr_t *avr = avr_make_mcu_by_name(fw->mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr_init(avr);
+	avr_load_firmware(avr, fw);
+	avr->sleep = no_sleep;
+	if (hle && avr_hle_init(avr, fw) <= 0)
+		fail("No routine to emulate in the firmware");
+	output[0] = 0;
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+				uart_output_cb, output);
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < 100000000);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count, state, avr->cycle);
+	return avr;
+}
+
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_hle.axf", &fw))
+		fail("Failed to read ELF firmware");
+
+	char expected[128], output[128];
+	avr_t *ref = run(&fw, 0, expected);
+	avr_t *avr = run(&fw, 1, output);
+	if (strncmp(expected, "sum ", 4))
+		fail("Unexpected UART output \"%s\"", expected);
+	if (strcmp(expected, output))
+		fail("UART outputs differ: expected \"%s\", got \"%s\"", expected, output);
+
+	avr_hle_t *hle = avr->hle;
+	uint32_t calls = 0;
+	for (int i = 0; i < hle->count; i++) {
+		if (hle->fn[i].state == AVR_HLE_OFF)
+			fail("An emulated routine didn't match the firmware's");
+		calls += hle->fn[i].calls;
+	}
+	if (!calls)
+		fail("No routine was run in C");
+	// the arithmetic routines are charged their average time
+	tests_cycle_count = avr->cycle;
+	tests_assert_cycles_between(ref->cycle - ref->cycle / 50, ref->cycle + ref->cycle / 50);
+
+	avr_terminate(ref);
+	avr_terminate(avr);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_time.h"
+
+#define GPIOR0	0x3e
+
+static avr_t *avr;
+static avr_cycle_count_t woken_cycle;
+
+static void *poster(void *param) {
+	usleep(50000);
+	avr_wake(avr);
+	return NULL;
+}
+
+// on the simulator thread, hands over what the firmware waits for
+static void wake_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	woken_cycle = avr->cycle;
+	avr->data[GPIOR0] = 1;
+}
+
+/*
+ * The firmware polls a register with no timer due; the idle loop skipping
+ * has to wait for the other thread, like a sleep, rather than run the
+ * cycle count away until the limit.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_idle_wake.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flags |= AVR_FLAG_IDLE_LOOPS;
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr_irq_register_notify(avr_wake_getirq(avr), wake_hook, NULL);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, poster, NULL);
+	avr_cycle_count_t limit = avr_usec_to_cycles(avr, 2000000);
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < limit);
+	pthread_join(thread, NULL);
+
+	if (!woken_cycle)
+		fail("The wake IRQ wasn't raised; state=%d, cycles=%" PRI_avr_cycle_count,
+		     state, avr->cycle);
+	if (state != cpu_Done || avr->cycle - woken_cycle > 100)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count ", woken at %" PRI_avr_cycle_count,
+		     state, avr->cycle, woken_cycle);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+
+#define GPIOR0	0x3e
+#define WRITERS	6
+
+typedef struct writer_t {
+	int count;
+	uint8_t last;
+} writer_t;
+
+static writer_t gpior[WRITERS], console[WRITERS];
+static int changes;
+
+static void write_cb(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+	writer_t *w = param;
+	w->count++;
+	w->last = v;
+	// the writers have to set the register themselves, the first one does
+	if (w == &gpior[0] || w == &console[0])
+		avr->data[addr] = v;
+}
+
+static void change_cb(struct avr_irq_t *irq, uint32_t value, void *param) {
+	changes++;
+}
+
+static void check(const char *what, writer_t *w, int count, uint8_t last) {
+	for (int i = 0; i < WRITERS; i++)
+		if (w[i].count != count || w[i].last != last)
+			fail("%s writer %d saw %d writes, last %02x; expected %d, %02x",
+			     what, i, w[i].count, w[i].last, count, last);
+}
+
+/*
+ * More writers than the old shared register table held, on an IO register
+ * and on the console register, that is in SRAM, past the IO space
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_io_hooks.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr_init(avr);
+	uint16_t ioend = avr->ioend;
+	avr_load_firmware(avr, &fw);
+
+	uint16_t addr = fw.console_register_addr;
+	if (addr <= ioend || avr->ioend != addr)
+		fail("Console register at %04x, IO space was up to %04x and is up to %04x",
+		     addr, ioend, avr->ioend);
+	for (int i = 0; i < WRITERS; i++) {
+		avr_register_io_write(avr, GPIOR0, write_cb, &gpior[i]);
+		avr_register_io_write(avr, addr, write_cb, &console[i]);
+	}
+	// the same one again isn't called twice
+	avr_register_io_write(avr, GPIOR0, write_cb, &gpior[1]);
+	avr_irq_register_notify(avr_iomem_getirq(avr, addr, NULL, AVR_IOMEM_IRQ_ALL),
+				change_cb, NULL);
+	// past ramend, refused, without stopping everything
+	avr_register_io_write(avr, avr->ramend + 1, write_cb, &gpior[0]);
+	if (avr->ioend != addr)
+		fail("IO space moved to %04x", avr->ioend);
+
+	enum tests_finish_reason reason = tests_run_test(avr, 100000);
+	if (reason != LJR_SPECIAL_DEINIT)
+		fail("Test failed to finish properly; reason=%d, cycles=%"
+		     PRI_avr_cycle_count, reason, tests_cycle_count);
+	check("GPIOR0", gpior, 3, 3);
+	check("Console", console, 6, '\r');
+	if (avr->data[GPIOR0] != 3 || avr->data[addr] != '\r')
+		fail("Registers are %02x and %02x", avr->data[GPIOR0], avr->data[addr]);
+	if (changes != 6)
+		fail("The console register IRQ was raised %d times", changes);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests.h"
+#include "sim_io.h"
+#include "avr_ioport.h"
+
+#define COUNT	500		// more than an arena block
+
+static int notified;
+
+static void notify(struct avr_irq_t *irq, uint32_t value, void *param) {
+	notified++;
+}
+
+/*
+ * The IRQs, their hooks and names all come from the pool arena: hooks
+ * released are reused before the arena grows, and freeing the pool, or
+ * terminating the core, releases it all at once and leaves it reusable.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr_irq_pool_t pool = { 0 };
+	avr_irq_t *irq[COUNT];
+	for (int i = 0; i < COUNT; i++) {
+		char name[32];
+		const char *names[] = { name };
+		sprintf(name, "8>test.irq%d", i);
+		irq[i] = avr_alloc_irq(&pool, i, 1, names);
+	}
+	if (pool.count != COUNT || !pool.arena)
+		fail("Pool has %d IRQs", pool.count);
+	if (avr_find_irq(&pool, "test.irq321") != irq[321])
+		fail("IRQ not found by it's name");
+
+	for (int i = 0; i < COUNT; i++) {
+		avr_irq_register_notify(irq[i], notify, NULL);
+		avr_irq_register_notify(irq[i], notify, NULL);	// not twice
+		if (i)
+			avr_connect_irq(irq[i - 1], irq[i]);
+	}
+	if (avr_irq_hook_count(irq[0]) != 2 || avr_irq_hook_count(irq[COUNT - 1]) != 1)
+		fail("Hook counts are %d and %d", avr_irq_hook_count(irq[0]),
+		     avr_irq_hook_count(irq[COUNT - 1]));
+	avr_raise_irq(irq[0], 1);
+	if (notified != COUNT)
+		fail("%d IRQs notified along the chain", notified);
+
+	for (int i = 0; i < COUNT; i++) {
+		avr_irq_unregister_notify(irq[i], notify, NULL);
+		if (i)
+			avr_unconnect_irq(irq[i - 1], irq[i]);
+	}
+	for (int i = 0; i < COUNT; i++)
+		if (avr_irq_hook_count(irq[i]))
+			fail("IRQ %d still has %d hooks", i, avr_irq_hook_count(irq[i]));
+	if (!pool.free_hook)
+		fail("Released hooks not kept for reuse");
+	// as many hooks as were released, they all come from the free list
+	for (int i = 0; i < COUNT; i++) {
+		avr_irq_register_notify(irq[i], notify, NULL);
+		if (i)
+			avr_connect_irq(irq[i - 1], irq[i]);
+	}
+	if (pool.free_hook)
+		fail("New hooks taken from the arena, not the released ones");
+
+	avr_free_irq(irq[321], 1);
+	if (avr_find_irq(&pool, "test.irq321"))
+		fail("Freed IRQ still in the pool");
+	uint8_t *big = avr_irq_pool_alloc(&pool, 40000);
+	for (int i = 0; i < 40000; i++)
+		if (big[i])
+			fail("Pool memory isn't zeroed");
+
+	avr_free_irq_pool(&pool);
+	if (pool.arena || pool.irq || pool.count || pool.free_hook)
+		fail("Pool not cleared when freed");
+	// and it can be used again
+	const char *names[] = { "test.again" };
+	avr_irq_t *again = avr_alloc_irq(&pool, 0, 1, names);
+	if (avr_find_irq(&pool, "test.irq0") || avr_find_irq(&pool, "test.again") != again)
+		fail("Pool not usable after being freed");
+	avr_free_irq_pool(&pool);
+
+	// a core, with hooks from the host as well as it's own
+	avr_t *avr = tests_init_avr("atmega88_example.axf");
+	avr_irq_t *pin = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 0);
+	avr_irq_register_notify(pin, notify, NULL);
+	avr_connect_irq(pin, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 0));
+	if (avr_irq_hook_count(pin) < 2)
+		fail("Pin has %d hooks", avr_irq_hook_count(pin));
+	avr_terminate(avr);
+	if (avr->irq_pool.arena || avr->irq_pool.irq || avr->irq_pool.count)
+		fail("Core IRQ pool not released by avr_terminate()");
+
+	tests_success();
+	return 0;
+}
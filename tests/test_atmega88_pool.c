@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_pool.h"
+#include "sim_io.h"
+#include "avr_eeprom.h"
+
+#define EEDR	0x40
+
+static avr_irq_t *eedr;
+static int writes, setups, timer_called;
+
+static void eedr_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	writes++;
+}
+
+// the board of every new instance; recycled ones keep it
+static void setup(avr_t *avr, void *param) {
+	setups++;
+	eedr = avr_iomem_getirq(avr, EEDR, NULL, AVR_IOMEM_IRQ_ALL);
+	avr_irq_register_notify(eedr, eedr_hook, NULL);
+}
+
+static avr_cycle_count_t job_timer(avr_t *avr, avr_cycle_count_t when,
+				   void *param) {
+	timer_called++;
+	return 0;
+}
+
+static void run(avr_t *avr) {
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d", state);
+}
+
+static void check_eeprom(avr_t *avr, uint16_t offset, const uint8_t *expected) {
+	uint8_t ee[4];
+	avr_eeprom_desc_t d = { .ee = ee, .offset = offset, .size = sizeof(ee) };
+	if (avr_ioctl(avr, AVR_IOCTL_EEPROM_GET, &d))
+		fail("Can't read the eeprom");
+	if (memcmp(d.ee, expected, sizeof(ee)))
+		fail("Eeprom at %04x is %02x%02x%02x%02x", offset,
+		     d.ee[0], d.ee[1], d.ee[2], d.ee[3]);
+}
+
+/*
+ * An instance put back in the pool, after a job that changed everything
+ * it could, has to come back as a new one would, with the hooks from the
+ * setup there once, and nothing the job left behind.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_file_map.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_pool_t *pool = avr_pool_new(fw.mmcu, &fw, setup, NULL);
+	if (!pool)
+		fail("Creating the pool failed.");
+
+	avr_t *avr = avr_pool_get(pool);
+	run(avr);
+	int first = writes;
+	if (!first)
+		fail("The firmware didn't write the eeprom");
+	check_eeprom(avr, 0x10, (const uint8_t *)"file");
+	// and what a job may leave
+	avr->flash[avr->flashend] = 0x00;
+	avr->data[avr->ramend - 0x10] = 0x55;
+	avr->frequency = 1;
+	avr_cycle_timer_register(avr, 1000000, job_timer, NULL);
+	avr_pool_put(pool, avr);
+
+	avr_t *again = avr_pool_get(pool);
+	if (again != avr)
+		fail("The instance wasn't recycled");
+	if (setups != 1)
+		fail("Setup called %d times", setups);
+	if (avr->state != cpu_Running || avr->cycle || avr->pc)
+		fail("Recycled with state=%d, cycle=%" PRI_avr_cycle_count ", pc=%04x",
+		     avr->state, avr->cycle, avr->pc);
+	if (avr->flash[avr->flashend] != 0xff || avr->data[avr->ramend - 0x10] ||
+			avr->frequency != pool->frequency)
+		fail("The flash, SRAM or settings weren't rewound");
+	static const uint8_t image[4] = { 1, 2, 3, 4 }, erased[4] = {
+		0xff, 0xff, 0xff, 0xff };
+	check_eeprom(avr, 0, image);
+	check_eeprom(avr, 0x10, erased);
+	if (avr_cycle_timer_status(avr, job_timer, NULL))
+		fail("The job's cycle timer is still there");
+	if (avr_irq_hook_count(eedr) != 1)
+		fail("The setup hook is there %d times", avr_irq_hook_count(eedr));
+
+	run(avr);
+	if (writes != 2 * first || timer_called)
+		fail("Second run saw %d eeprom writes, the first %d; timer called %d",
+		     writes - first, first, timer_called);
+	check_eeprom(avr, 0x10, (const uint8_t *)"file");
+	avr_pool_put(pool, avr);
+	avr_pool_free(pool);
+	tests_success();
+	return 0;
+}
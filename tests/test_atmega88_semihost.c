@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <string.h>
+#include "tests.h"
+
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	static const char *expected =
+		"hello from the firmware\n"
+		"read back\n"
+		"no time\n";
+	remove("atmega88_semihost.out");
+	if (tests_init_and_run_test("atmega88_semihost.axf", 100000) != LJR_SPECIAL_DEINIT)
+		fail("Firmware didn't finish");
+
+	char buf[128] = "";
+	FILE *f = fopen("atmega88_semihost.out", "r");
+	if (!f)
+		fail("No file written by the firmware");
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = 0;
+	fclose(f);
+	remove("atmega88_semihost.out");
+	if (strcmp(buf, expected))
+		fail("File differs: expected \"%s\", got \"%s\"", expected, buf);
+	tests_success();
+	return 0;
+}
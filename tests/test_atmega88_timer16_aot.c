@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_aot.h"
+#include "sim_shadow.h"
+
+static void no_sleep(avr_t *avr, avr_cycle_count_t howLong) {
+}
+
+/*
+ * Same firmware as test_atmega88_timer16, translated to C, built with the
+ * host compiler ($CC, or cc) and checked against the reference decoder
+ * after every step
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+#ifdef __MINGW32__
+	// no avr_aot_load() there
+	tests_success();
+#else
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_timer16.axf", &fw))
+		fail("Failed to read ELF firmware");
+
+	char dir[] = "/tmp/simavr_aot.XXXXXX";
+	if (!mkdtemp(dir))
+		fail("Can't create a temporary directory");
+	char c[64], so[64], cmd[256];
+	snprintf(c, sizeof(c), "%s/timer16.c", dir);
+	snprintf(so, sizeof(so), "%s/timer16.so", dir);
+	if (avr_aot_generate(&fw, c))
+		fail("Failed to translate the firmware");
+	const char *cc = getenv("CC") ? getenv("CC") : "cc";
+	snprintf(cmd, sizeof(cmd), "%s -O1 -shared -fPIC -I../simavr/sim -o %s %s",
+			cc, so, c);
+	if (system(cmd))
+		fail("Failed to build the translation: %s", cmd);
+
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->sleep = no_sleep;
+	int res = avr_aot_load(avr, so);
+	unlink(c);
+	unlink(so);
+	rmdir(dir);
+	if (res || avr->run_one != avr->aot->run)
+		fail("Failed to load the translation");
+
+	avr_shadow_t shadow;
+	avr_t *ref = avr_shadow_make(avr, &fw);
+	if (!ref)
+		fail("Creating the reference AVR failed.");
+	avr_shadow_init(&shadow, avr, ref);
+
+	int state;
+	do {
+		state = avr_shadow_run(&shadow);
+	} while (state != -1 && state != cpu_Done && state != cpu_Crashed &&
+			avr->cycle < 13000000);
+	if (state == -1)
+		fail("Diverged from the reference decoder after %llu instructions",
+		     (unsigned long long)shadow.insns);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count, state, avr->cycle);
+	tests_cycle_count = avr->cycle;
+	tests_assert_cycles_between(12500000, 12500300);
+	avr_shadow_free(&shadow);
+	tests_success();
+#endif
+	return 0;
+}
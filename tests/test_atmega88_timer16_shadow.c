@@ -0,0 +1,48 @@
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_shadow.h"
+
+static void no_sleep(avr_t *avr, avr_cycle_count_t howLong) {
+}
+
+/*
+ * Same firmware as test_atmega88_timer16, run with the superinstructions
+ * and checked against the reference decoder after every step
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_timer16.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flags |= AVR_FLAG_SUPERINSN;
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->sleep = no_sleep;
+
+	avr_shadow_t shadow;
+	avr_t *ref = avr_shadow_make(avr, &fw);
+	if (!ref)
+		fail("Creating the reference AVR failed.");
+	avr_shadow_init(&shadow, avr, ref);
+
+	int state;
+	do {
+		state = avr_shadow_run(&shadow);
+	} while (state != -1 && state != cpu_Done && state != cpu_Crashed &&
+			avr->cycle < 13000000);
+	if (state == -1)
+		fail("Diverged from the reference decoder after %llu instructions",
+		     (unsigned long long)shadow.insns);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count, state, avr->cycle);
+	tests_cycle_count = avr->cycle;
+	tests_assert_cycles_between(12500000, 12500300);
+	avr_shadow_free(&shadow);
+	tests_success();
+	return 0;
+}
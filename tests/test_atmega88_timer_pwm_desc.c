@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include "tests.h"
+#include "avr_timer.h"
+
+static int changes;
+
+static void pwm_cb(struct avr_irq_t *irq, uint32_t value, void *param) {
+	changes++;
+}
+
+/*
+ * Same firmware as test_atmega88_timer_pwm, the OC1A waveform comes
+ * from the timer settings, without looking at its edges
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr_t *avr = tests_init_avr("atmega88_timer_pwm.axf");
+	avr_irq_t *irq = avr_io_getirq(avr, AVR_IOCTL_TIMER_GETIRQ('1'),
+				       TIMER_IRQ_OUT_PWM + AVR_TIMER_COMPA);
+	avr_irq_register_notify(irq, pwm_cb, NULL);
+
+	enum tests_finish_reason reason = tests_run_test(avr, 1000000);
+	if (reason != LJR_SPECIAL_DEINIT)
+		fail("Test failed to finish properly; reason=%d, cycles=%"
+		     PRI_avr_cycle_count, reason, tests_cycle_count);
+	tests_assert_cycles_between(99 * 2000, 99 * 2000 + 1000);
+
+	// high from 250 on the way down to 250 on the way up
+	avr_timer_pwm_t pwm = { .comp = AVR_TIMER_COMPA };
+	if (avr_ioctl(avr, AVR_IOCTL_TIMER_GETPWM('1'), &pwm))
+		fail("No PWM descriptor for OC1A");
+	if (pwm.period != 2000 || pwm.duty != 500 || pwm.inverted)
+		fail("OC1A period %u duty %u inverted %d, expected 2000/500/0",
+		     pwm.period, pwm.duty, pwm.inverted);
+	if (irq->value != 0x4000)
+		fail("OC1A IRQ value %x, expected 0x4000", irq->value);
+	if (changes != 1)
+		fail("OC1A waveform changed %d times, expected once", changes);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include "tests.h"
+#include "sim_elf.h"
+#include "sim_core.h"
+
+static avr_t *make(elf_firmware_t *fw) {
+	avr_t *avr = avr_make_mcu_by_name(fw->mmcu);
+	if (!avr)
+		fail("Creating AVR failed.");
+	avr->flags |= AVR_FLAG_SUPERINSN;
+	avr_init(avr);
+	avr_load_firmware(avr, fw);
+	return avr;
+}
+
+static int run(avr_t *avr, int count) {
+	int state = avr->state;
+	while (count-- && state != cpu_Done && state != cpu_Crashed)
+		state = avr_run(avr);
+	return state;
+}
+
+/*
+ * Tracing is turned on for a few instructions in the middle of the run,
+ * then off again: the traced decoder is only used in between, and the run
+ * ends on the same cycle, with the same SRAM, as one that wasn't traced.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	elf_firmware_t fw;
+	if (elf_read_firmware("atmega88_decoders.axf", &fw))
+		fail("Failed to read ELF firmware");
+	avr_t *ref = make(&fw);
+	if (run(ref, -1) != cpu_Done)
+		fail("Reference run failed to finish properly");
+
+	avr_t *avr = make(&fw);
+	avr_run_one_p decoder = avr->run_one;
+	run(avr, 10000);
+	avr_set_trace(avr, 1);
+	if (avr->run_one != avr_run_one_trace || !avr->trace)
+		fail("Tracing didn't switch to the traced decoder");
+	run(avr, 50);
+	avr_set_trace(avr, 0);
+	if (avr->run_one != decoder || avr->trace)
+		fail("Tracing off didn't switch back to the core's decoder");
+	int state = run(avr, -1);
+
+	if (state != cpu_Done || avr->cycle != ref->cycle)
+		fail("Traced run ended with state=%d on cycle %" PRI_avr_cycle_count
+		     ", the other on cycle %" PRI_avr_cycle_count,
+		     state, avr->cycle, ref->cycle);
+	for (int i = 0; i <= ref->ramend; i++)
+		if (avr->data[i] != ref->data[i])
+			fail("Traced run left %02x at %04x, the other %02x",
+			     avr->data[i], i, ref->data[i]);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include "tests.h"
+#include "avr_uart.h"
+
+static uint8_t sent[80];
+static avr_cycle_count_t sent_cycles[80];
+static uint32_t count;
+
+static uint8_t batch[16];
+static avr_cycle_count_t batch_cycles[16];
+
+static void flush_cb(avr_uart_drain_t *d, uint32_t len) {
+	if (count + len > 80)
+		fail("Too many bytes sent (%u)", count + len);
+	for (uint32_t i = 0; i < len; i++, count++) {
+		sent[count] = d->buf[i];
+		sent_cycles[count] = d->cycles[i];
+	}
+}
+
+/*
+ * At 1Mbps the frames are only 80 cycles; the second byte waits in UDR
+ * while the first one is shifted out, so they all follow each other
+ * without a gap.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr_t *avr = tests_init_avr("atmega88_uart_baud.axf");
+	avr_uart_drain_t d = {
+		.buf = batch, .cycles = batch_cycles, .size = sizeof(batch),
+		.flush = flush_cb };
+	if (avr_ioctl(avr, AVR_IOCTL_UART_DRAIN('0'), &d))
+		fail("Can't install the drain");
+
+	enum tests_finish_reason reason = tests_run_test(avr, 100000);
+	if (reason != LJR_SPECIAL_DEINIT)
+		fail("Test failed to finish properly; reason=%d, cycles=%"
+		     PRI_avr_cycle_count, reason, tests_cycle_count);
+
+	if (count != 80)
+		fail("%u bytes sent, expected 80", count);
+	for (int i = 0; i < 80; i++)
+		if (sent[i] != i)
+			fail("Byte %d is %d", i, sent[i]);
+	for (int i = 1; i < 80; i++) {
+		avr_cycle_count_t gap = sent_cycles[i] - sent_cycles[i - 1];
+		// the 8E2 frames start after the firmware waited for TXC
+		if (i == 64)
+			continue;
+		if (gap != (i < 64 ? 80 : 96))
+			fail("Byte %d sent %" PRI_avr_cycle_count
+			     " cycles after the previous one", i, gap);
+	}
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tests.h"
+#include "avr_uart.h"
+
+static uint8_t sent[2][256];
+static int done;
+
+static void done_cb(avr_uart_buffer_t *b) {
+	if (b->pos != b->size)
+		fail("Buffer %d given back after %u bytes", done, b->pos);
+	done++;
+}
+
+static uint8_t echo[512 + 1];
+static avr_cycle_count_t echo_cycles[512 + 1];
+static uint32_t echoed;
+static int flushes;
+
+static uint8_t batch[64];
+static avr_cycle_count_t batch_cycles[64];
+
+static void flush_cb(avr_uart_drain_t *d, uint32_t len) {
+	if (echoed + len > 512)
+		fail("Too many bytes sent back (%u)", echoed + len);
+	memcpy(echo + echoed, d->buf, len);
+	memcpy(echo_cycles + echoed, d->cycles, len * sizeof(d->cycles[0]));
+	echoed += len;
+	flushes++;
+}
+
+/*
+ * The firmware sends back whatever it receives; it all goes in as two
+ * buffers and comes out in batches of up to 64 bytes.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr_t *avr = tests_init_avr("atmega88_uart_bulk.axf");
+
+	avr_uart_buffer_t b[2];
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 256; j++)
+			sent[i][j] = j * 7 + i;
+		b[i] = (avr_uart_buffer_t) {
+			.data = sent[i], .size = 256, .done = done_cb };
+		if (avr_ioctl(avr, AVR_IOCTL_UART_QUEUE('0'), &b[i]))
+			fail("Can't queue buffer %d", i);
+	}
+	avr_uart_drain_t d = {
+		.buf = batch, .cycles = batch_cycles, .size = sizeof(batch),
+		.flush = flush_cb };
+	if (avr_ioctl(avr, AVR_IOCTL_UART_DRAIN('0'), &d))
+		fail("Can't install the drain");
+
+	enum tests_finish_reason reason = tests_run_test(avr, 500000);
+	if (reason != LJR_SPECIAL_DEINIT)
+		fail("Test failed to finish properly; reason=%d, cycles=%"
+		     PRI_avr_cycle_count, reason, tests_cycle_count);
+
+	if (done != 2)
+		fail("%d buffers done, expected 2", done);
+	if (echoed != 512 || memcmp(echo, sent, 512))
+		fail("Got %u bytes back, not the ones sent", echoed);
+	// no latency, only full batches
+	if (flushes != 8)
+		fail("%d flushes for 512 bytes", flushes);
+	// bytes can't come back faster than they are received
+	for (int i = 1; i < 512; i++)
+		if (echo_cycles[i] - echo_cycles[i - 1] < 1000)
+			fail("Byte %d sent back %" PRI_avr_cycle_count
+			     " cycles after the previous one", i,
+			     echo_cycles[i] - echo_cycles[i - 1]);
+	tests_success();
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tests.h"
+#include "avr_uart.h"
+#include "sim_time.h"
+#include "sim_mailbox.h"
+
+static avr_t *avr;
+static avr_irq_t *input;
+static avr_cycle_count_t when, received_cycle;
+static volatile int ready, done;
+static int posted = -1, sent = -1;
+
+static void *poster(void *param) {
+	while (!ready)
+		usleep(100);
+	posted = avr_mailbox_post(avr, input, 'm', when);
+	__sync_synchronize();
+	done = 1;
+	return NULL;
+}
+
+// holds the core, a little after the start, until the other thread posted
+static avr_cycle_count_t post_now(avr_t *avr, avr_cycle_count_t cycle,
+				  void *param) {
+	ready = 1;
+	while (!done)
+		usleep(100);
+	return 0;
+}
+
+static void input_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	received_cycle = avr->cycle;
+}
+
+static void output_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	sent = value;
+}
+
+/*
+ * The byte is posted from another thread 5ms in, to be received 20ms in;
+ * the firmware is sleeping then (see atmega88_uart_wake.c), the mailbox
+ * has to hold it until its cycle. The core waits for the post, so how
+ * far it ran by then doesn't depend on the host.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr = tests_init_avr("atmega88_uart_wake.axf");
+	input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(input, input_hook, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+					      UART_IRQ_OUTPUT), output_hook, NULL);
+	when = avr_usec_to_cycles(avr, 20000);
+	avr_cycle_timer_register_usec(avr, 5000, post_now, NULL);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, poster, NULL);
+	avr_cycle_count_t limit = avr_usec_to_cycles(avr, 2000000);
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < limit);
+	pthread_join(thread, NULL);
+
+	if (posted)
+		fail("Posting failed");
+	if (sent != 'm')
+		fail("Byte sent back is %d", sent);
+	// the timers go off at the end of the instruction, or sleep
+	if (received_cycle < when || received_cycle > when + 4)
+		fail("Received at cycle %" PRI_avr_cycle_count ", expected %"
+		     PRI_avr_cycle_count, received_cycle, when);
+	tests_success();
+	return 0;
+}
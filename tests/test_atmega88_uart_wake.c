@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tests.h"
+#include "avr_uart.h"
+#include "sim_time.h"
+
+static avr_t *avr;
+static avr_cycle_count_t woken_cycle, sent_cycle;
+static avr_cycle_count_t sleep_start, sleep_end, cut_end;
+static int sent = -1;
+
+static void *poster(void *param) {
+	usleep(50000);
+	avr_wake(avr);
+	return NULL;
+}
+
+// the run loop adds the sleep after this, and takes back what was cut
+static void sleep_hook(avr_t *avr, avr_cycle_count_t howLong) {
+	sleep_start = avr->cycle;
+	sleep_end = avr->cycle + 1 + howLong;
+	avr_callback_sleep_raw(avr, howLong);
+}
+
+// on the simulator thread, right after the sleep it cut short
+static void wake_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	if (woken_cycle)
+		return;
+	woken_cycle = avr->cycle;
+	cut_end = sleep_end;
+	if (woken_cycle < sleep_start)
+		fail("Woken at cycle %" PRI_avr_cycle_count ", before the sleep at %"
+		     PRI_avr_cycle_count, woken_cycle, sleep_start);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+				    UART_IRQ_INPUT), 'w');
+}
+
+static void output_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+	sent = value;
+	sent_cycle = avr->cycle;
+}
+
+/*
+ * The firmware sleeps 32ms at a time, and is woken from another thread;
+ * when that happens depends on the host, so everything is checked against
+ * the cycle the wake was seen at: the core mustn't have counted the rest
+ * of the sleep it was in, and the byte handed over then has to be taken
+ * at once rather than at the next timer overflow.
+ */
+int main(int argc, char **argv) {
+	tests_init(argc, argv);
+
+	avr = tests_init_avr("atmega88_uart_wake.axf");
+	avr->sleep = sleep_hook;
+	avr_irq_register_notify(avr_wake_getirq(avr), wake_hook, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+					      UART_IRQ_OUTPUT), output_hook, NULL);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, poster, NULL);
+	avr_cycle_count_t limit = avr_usec_to_cycles(avr, 2000000);
+	int state;
+	do {
+		state = avr_run(avr);
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < limit);
+	pthread_join(thread, NULL);
+
+	if (!woken_cycle)
+		fail("The wake IRQ wasn't raised");
+	if (woken_cycle >= cut_end)
+		fail("Woken at cycle %" PRI_avr_cycle_count ", the sleep ended at %"
+		     PRI_avr_cycle_count, woken_cycle, cut_end);
+	if (sent != 'w')
+		fail("Byte sent back is %d", sent);
+	// the RX interrupt, then 10 bits at 16 cycles each, are well under that
+	if (sent_cycle - woken_cycle > 1000)
+		fail("Sent back at cycle %" PRI_avr_cycle_count ", woken at %"
+		     PRI_avr_cycle_count, sent_cycle, woken_cycle);
+	if (state != cpu_Done)
+		fail("Test failed to finish properly; state=%d, cycles=%"
+		     PRI_avr_cycle_count, state, avr->cycle);
+	tests_success();
+	return 0;
+}